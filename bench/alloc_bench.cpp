@@ -0,0 +1,79 @@
+/*
+  Compares the heap allocations made per message when building with the default allocator and
+  when building into a caller supplied arena.
+*/
+
+#include <cstddef>
+#include <memory_resource>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "attachment/attachment.hpp"
+#include "bench.hpp"
+#include "email/email.hpp"
+#include "mime/mime.hpp"
+
+namespace {
+
+constexpr std::size_t kAttachmentSize = 64 * 1024;
+
+smtp::Attachment makeAttachment(std::size_t size) {
+  smtp::Attachment attachment;
+  attachment.setContents(std::vector<uint8_t>(size, 0x5a));
+  attachment.setFilePath("/path/report.bin");
+  return attachment;
+}
+
+} // namespace
+
+namespace bench {
+
+void runAllocBenchmarks(Runner &runner) {
+  NullBuffer null_buffer;
+  std::ostream null_stream{&null_buffer};
+
+  const smtp::EmailParams params{
+      "user",                             // smtp username
+      "password",                         // smtp password
+      "smtps://localhost:465",            // smtp server
+      "bigboss@gmail.com",                // to
+      "tully@gmail.com",                  // from
+      "All the bosses at PWC",            // cc
+      "Quarterly report",                 // subject
+      "Please find the report attached.", // body
+  };
+  const smtp::Attachment &attachment = makeAttachment(kAttachmentSize);
+  const std::string &contents_b64 = attachment.getContentsAsB64();
+
+  // A single buffer is reused for every message, releasing the arena frees everything at once
+  std::vector<std::byte> buffer(1024 * 1024);
+
+  runner.run("mime_build_heap", kAttachmentSize, [&]() {
+    smtp::Mime mime;
+    mime.addMessage("Please find the report attached.");
+    mime.addAttachment(attachment.getFilePath(), contents_b64);
+  });
+
+  runner.run("mime_build_arena", kAttachmentSize, [&]() {
+    std::pmr::monotonic_buffer_resource arena{buffer.data(), buffer.size()};
+    smtp::Mime mime{smtp::Mime::kDefaultUserAgent, &arena};
+    mime.addMessage("Please find the report attached.");
+    mime.addAttachment(attachment.getFilePath(), contents_b64);
+  });
+
+  runner.run("email_render_heap", kAttachmentSize, [&]() {
+    smtp::Email email{params};
+    email.addAttachment(attachment);
+    null_stream << email;
+  });
+
+  runner.run("email_render_arena", kAttachmentSize, [&]() {
+    std::pmr::monotonic_buffer_resource arena{buffer.data(), buffer.size()};
+    smtp::Email email{params, &arena};
+    email.addAttachment(attachment);
+    null_stream << email;
+  });
+}
+
+} // namespace bench
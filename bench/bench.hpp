@@ -0,0 +1,94 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "perf_counters.hpp"
+
+namespace bench {
+
+// CSV with a header row, or one JSON object per line
+enum class Format { kCsv, kJsonLines };
+
+struct Options {
+  // Only the benchmarks whose name contains the filter are run
+  std::string filter;
+  // Payload sizes go up by a factor of 10 from 1 KB to this many bytes
+  std::size_t max_size = 100 * 1024 * 1024;
+  // Each benchmark is repeated until it has run for at least this long
+  std::chrono::milliseconds min_time{200};
+  Format format = Format::kCsv;
+};
+
+// Heap allocations made so far by the whole process, counted by the replaced operator new
+std::size_t allocationCount();
+std::size_t allocatedBytes();
+
+struct Result {
+  std::string name;
+  // Payload bytes handled by each operation, 0 for operations that are not sized by a payload
+  std::size_t size = 0;
+  std::size_t iterations = 0;
+  double ns_per_op = 0.0;
+  double allocations_per_op = 0.0;
+  double bytes_allocated_per_op = 0.0;
+  // Only there when the hardware counters could be opened with perf_event_open
+  std::optional<double> cycles_per_op;
+  std::optional<double> instructions_per_op;
+
+  // Payload throughput in MB/s, 0 when there is no payload
+  double megabytesPerSecond() const;
+};
+
+// Times operations and prints a row for each of them as soon as it has finished, so partial
+// results are not lost if a large payload runs out of memory.
+class Runner {
+public:
+  explicit Runner(const Options &options);
+
+  const Options &options() const { return m_options; }
+
+  // 1 KB, 10 KB ... up to the maximum size
+  std::vector<std::size_t> payloadSizes() const;
+
+  // Runs op once to warm up, then repeatedly until the minimum time has passed. size is the
+  // number of payload bytes each call handles.
+  void run(std::string_view name, std::size_t size, const std::function<void()> &op);
+
+private:
+  void print(const Result &result);
+
+  Options m_options;
+  PerfCounters m_counters;
+  std::size_t m_printed = 0;
+};
+
+// A number of bytes with an optional K or M suffix e.g 64K
+bool parseSize(std::string_view text, std::size_t &size);
+
+// Bytes that are not all the same, so that a branch on the input cannot be predicted perfectly
+std::vector<uint8_t> makePayload(std::size_t size);
+
+// Stops the result of an operation from being optimised away
+template <typename T> void keep(const T &value) { asm volatile("" : : "g"(&value) : "memory"); }
+
+// Discards everything that is written to it, for timing operator<< without the cost of a sink
+class NullBuffer : public std::streambuf {
+protected:
+  int overflow(int c) override { return c; }
+  std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+};
+
+// Each group registers its benchmarks with the runner
+void runEncodeBenchmarks(Runner &runner);
+void runMimeBenchmarks(Runner &runner);
+void runAllocBenchmarks(Runner &runner);
+
+} // namespace bench
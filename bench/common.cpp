@@ -0,0 +1,38 @@
+/*
+  Helpers shared by the benchmark executables.
+*/
+
+#include <cstdlib>
+#include <string>
+
+#include "bench.hpp"
+
+namespace bench {
+
+std::vector<uint8_t> makePayload(std::size_t size) {
+  std::vector<uint8_t> payload(size);
+  uint32_t state = 0x12345678;
+  for (uint8_t &byte : payload) {
+    state = state * 1664525 + 1013904223;
+    byte = static_cast<uint8_t>(state >> 24);
+  }
+  return payload;
+}
+
+bool parseSize(std::string_view text, std::size_t &size) {
+  std::size_t multiplier = 1;
+  if (!text.empty() && (text.back() == 'K' || text.back() == 'M')) {
+    multiplier = text.back() == 'K' ? 1024 : 1024 * 1024;
+    text.remove_suffix(1);
+  }
+  char *end = nullptr;
+  const std::string number{text};
+  const unsigned long long value = std::strtoull(number.c_str(), &end, 10);
+  if (number.empty() || *end != '\0') {
+    return false;
+  }
+  size = static_cast<std::size_t>(value) * multiplier;
+  return true;
+}
+
+} // namespace bench
@@ -0,0 +1,25 @@
+/*
+  Throughput of the base64 encoders and decoder over payloads of increasing size.
+*/
+
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "utils/base64/base64.hpp"
+
+namespace bench {
+
+void runEncodeBenchmarks(Runner &runner) {
+  for (const std::size_t size : runner.payloadSizes()) {
+    const std::vector<uint8_t> &payload = makePayload(size);
+    const std::string &encoded = smtp::Base64::Base64Encode(payload);
+
+    runner.run("base64_encode", size, [&]() { keep(smtp::Base64::Base64Encode(payload)); });
+    runner.run("base64_decode", size, [&]() { keep(smtp::Base64::Base64Decode(encoded)); });
+    runner.run("base64url_encode", size,
+               [&]() { keep(smtp::Base64::Base64UrlEncode(payload)); });
+  }
+}
+
+} // namespace bench
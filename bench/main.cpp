@@ -0,0 +1,40 @@
+/*
+  Runs every benchmark and prints one row per benchmark and payload size.
+
+  Usage: smtp_bench [--filter=<text>] [--max-size=<bytes>[K|M]] [--min-time=<ms>] [--json]
+*/
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include "bench.hpp"
+
+int main(int argc, char **argv) {
+  bench::Options options;
+  for (int i = 1; i < argc; i++) {
+    const std::string_view arg = argv[i];
+    std::size_t value = 0;
+    if (arg.rfind("--filter=", 0) == 0) {
+      options.filter = arg.substr(9);
+    } else if (arg.rfind("--max-size=", 0) == 0 && bench::parseSize(arg.substr(11), value)) {
+      options.max_size = value;
+    } else if (arg.rfind("--min-time=", 0) == 0 && bench::parseSize(arg.substr(11), value)) {
+      options.min_time = std::chrono::milliseconds{value};
+    } else if (arg == "--json") {
+      options.format = bench::Format::kJsonLines;
+    } else {
+      std::fprintf(stderr, "[!] Unknown argument: %s\n", argv[i]);
+      std::fprintf(stderr, "Usage: %s [--filter=<text>] [--max-size=<bytes>[K|M]] "
+                           "[--min-time=<ms>] [--json]\n",
+                   argv[0]);
+      return 1;
+    }
+  }
+
+  bench::Runner runner{options};
+  bench::runEncodeBenchmarks(runner);
+  bench::runMimeBenchmarks(runner);
+  bench::runAllocBenchmarks(runner);
+  return 0;
+}
@@ -0,0 +1,85 @@
+/*
+  Building MIME documents and emails with one attachment of increasing size, then writing the
+  email out. A batch of new emails is also rendered by a BatchRenderer with one thread per core.
+*/
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "attachment/attachment.hpp"
+#include "bench.hpp"
+#include "email/batch_renderer.hpp"
+#include "email/email.hpp"
+#include "mime/mime.hpp"
+
+namespace bench {
+
+void runMimeBenchmarks(Runner &runner) {
+  NullBuffer null_buffer;
+  std::ostream null_stream{&null_buffer};
+
+  const smtp::EmailParams params{
+      "user",                             // smtp username
+      "password",                         // smtp password
+      "smtps://localhost:465",            // smtp server
+      "bigboss@gmail.com",                // to
+      "tully@gmail.com",                  // from
+      "All the bosses at PWC",            // cc
+      "Quarterly report",                 // subject
+      "Please find the report attached.", // body
+  };
+
+  // Emails rendered by each call of the batch benchmark, each of them encodes its attachment
+  static constexpr std::size_t kBatchSize = 16;
+  smtp::BatchRenderer renderer;
+  std::vector<smtp::RenderedEmail> batch_rendered;
+
+  for (const std::size_t size : runner.payloadSizes()) {
+    smtp::Attachment attachment;
+    attachment.setContents(makePayload(size));
+    attachment.setFilePath("/path/report.bin");
+    const std::string &contents_b64 = attachment.getContentsAsB64();
+
+    runner.run("mime_add_attachment", size, [&]() {
+      smtp::Mime mime;
+      mime.addAttachment(attachment.getFilePath(), contents_b64);
+      keep(mime);
+    });
+
+    // A new email has nothing cached, so this includes encoding the attachment
+    runner.run("email_build", size, [&]() {
+      smtp::Email email{params};
+      email.addAttachment(attachment);
+      smtp::RenderedEmail rendered;
+      email.render(rendered);
+      keep(rendered);
+    });
+
+    runner.run("email_batch_build", size * kBatchSize, [&]() {
+      std::vector<std::unique_ptr<smtp::Email>> emails;
+      std::vector<const smtp::Email *> batch;
+      for (std::size_t i = 0; i < kBatchSize; i++) {
+        emails.push_back(std::make_unique<smtp::Email>(params));
+        emails.back()->addAttachment(attachment);
+        batch.push_back(emails.back().get());
+      }
+      renderer.render(batch, batch_rendered);
+      keep(batch_rendered);
+    });
+
+    // Rendering the same email again only refreshes the parts that changed i.e the date
+    smtp::Email email{params};
+    email.addAttachment(attachment);
+    runner.run("email_build_cached", size, [&]() {
+      smtp::RenderedEmail rendered;
+      email.render(rendered);
+      keep(rendered);
+    });
+
+    runner.run("email_stream", size, [&]() { null_stream << email; });
+  }
+}
+
+} // namespace bench
@@ -0,0 +1,570 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <list>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#include "mock_smtp_server.hpp"
+#include "utils/base64/base64.hpp"
+
+namespace bench {
+
+static constexpr std::string_view kHostname = "mock.example.com";
+// A client that sends a longer line than this is disconnected
+static constexpr std::size_t kMaxLineLength = 1024 * 1024;
+static constexpr std::size_t kReadSize = 64 * 1024;
+
+struct SslCtxDeleter {
+  void operator()(SSL_CTX *ctx) const { SSL_CTX_free(ctx); }
+};
+
+// A key and certificate made up on the spot, valid for a day for localhost and 127.0.0.1
+static std::unique_ptr<SSL_CTX, SslCtxDeleter> makeTlsContext(std::string &certificate_pem) {
+  std::unique_ptr<SSL_CTX, SslCtxDeleter> ctx{SSL_CTX_new(TLS_server_method())};
+  EVP_PKEY *key = EVP_EC_gen("P-256");
+  X509 *certificate = X509_new();
+  bool ok = ctx && key && certificate;
+
+  if (ok) {
+    X509_set_version(certificate, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+    X509_gmtime_adj(X509_getm_notBefore(certificate), -60);
+    X509_gmtime_adj(X509_getm_notAfter(certificate), 24 * 60 * 60);
+    X509_set_pubkey(certificate, key);
+
+    X509_NAME *name = X509_get_subject_name(certificate);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                               reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(certificate, name);
+
+    X509V3_CTX ext_ctx;
+    X509V3_set_ctx_nodb(&ext_ctx);
+    X509V3_set_ctx(&ext_ctx, certificate, certificate, nullptr, nullptr, 0);
+    X509_EXTENSION *alt_names = X509V3_EXT_conf_nid(nullptr, &ext_ctx, NID_subject_alt_name,
+                                                    "DNS:localhost,IP:127.0.0.1");
+    ok = alt_names && X509_add_ext(certificate, alt_names, -1) == 1 &&
+         X509_sign(certificate, key, EVP_sha256()) > 0 &&
+         SSL_CTX_use_certificate(ctx.get(), certificate) == 1 &&
+         SSL_CTX_use_PrivateKey(ctx.get(), key) == 1;
+    X509_EXTENSION_free(alt_names);
+  }
+
+  if (ok) {
+    BIO *bio = BIO_new(BIO_s_mem());
+    PEM_write_bio_X509(bio, certificate);
+    char *data = nullptr;
+    const long size = BIO_get_mem_data(bio, &data);
+    certificate_pem.assign(data, static_cast<std::size_t>(size));
+    BIO_free(bio);
+  }
+
+  X509_free(certificate);
+  EVP_PKEY_free(key);
+  if (!ok) {
+    throw MockServerException("[!] Could not make a self-signed certificate");
+  }
+  return ctx;
+}
+
+// OpenSSL writes to the socket without MSG_NOSIGNAL, so a client that hangs up would kill the
+// whole process with SIGPIPE. The server's threads block it instead, workers inherit the mask of
+// the acceptor that starts them.
+static void blockSigpipe() {
+  sigset_t pipe_set;
+  sigemptyset(&pipe_set);
+  sigaddset(&pipe_set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe_set, nullptr);
+}
+
+// A client socket, read and written through TLS once the handshake is done
+class Connection {
+public:
+  Connection(int socket, SSL_CTX *tls) : m_socket{socket} {
+    if (tls) {
+      m_ssl = SSL_new(tls);
+      SSL_set_fd(m_ssl, socket);
+      m_ok = SSL_accept(m_ssl) == 1;
+    }
+  }
+
+  ~Connection() {
+    if (m_ssl) {
+      SSL_shutdown(m_ssl);
+      SSL_free(m_ssl);
+    }
+  }
+
+  bool ok() const { return m_ok; }
+
+  long read(char *buffer, std::size_t size) {
+    if (m_ssl) {
+      return SSL_read(m_ssl, buffer, static_cast<int>(size));
+    }
+    return ::read(m_socket, buffer, size);
+  }
+
+  bool write(std::string_view text) {
+    while (!text.empty()) {
+      const long written =
+          m_ssl ? SSL_write(m_ssl, text.data(), static_cast<int>(text.size()))
+                : ::send(m_socket, text.data(), text.size(), MSG_NOSIGNAL);
+      if (written <= 0) {
+        return false;
+      }
+      text.remove_prefix(static_cast<std::size_t>(written));
+    }
+    return true;
+  }
+
+private:
+  int m_socket;
+  SSL *m_ssl = nullptr;
+  bool m_ok = true;
+};
+
+// Splits what the client sends into lines without copying them
+class LineReader {
+public:
+  explicit LineReader(Connection &connection) : m_connection{connection} {}
+
+  // The line is returned without its line break and is valid until the next call
+  bool next(std::string_view &line) {
+    while (true) {
+      const std::size_t end = m_buffer.find('\n', m_scanned);
+      if (end != std::string::npos) {
+        line = std::string_view{m_buffer}.substr(m_start, end - m_start);
+        if (!line.empty() && line.back() == '\r') {
+          line.remove_suffix(1);
+        }
+        m_start = end + 1;
+        m_scanned = m_start;
+        return true;
+      }
+
+      m_buffer.erase(0, m_start);
+      m_start = 0;
+      m_scanned = m_buffer.size();
+      if (m_buffer.size() > kMaxLineLength) {
+        return false;
+      }
+      m_buffer.resize(m_scanned + kReadSize);
+      const long size = m_connection.read(m_buffer.data() + m_scanned, kReadSize);
+      m_buffer.resize(m_scanned + static_cast<std::size_t>(std::max(size, 0L)));
+      if (size <= 0) {
+        return false;
+      }
+    }
+  }
+
+private:
+  Connection &m_connection;
+  std::string m_buffer;
+  std::size_t m_start = 0;
+  std::size_t m_scanned = 0;
+};
+
+struct Worker {
+  std::thread thread;
+  int socket = -1;
+  std::atomic<bool> done{false};
+};
+
+struct MockSmtpServer::Impl {
+  MockServerOptions m_options;
+  std::string m_url;
+  std::string m_certificate;
+  std::unique_ptr<SSL_CTX, SslCtxDeleter> m_tls;
+  int m_socket = -1;
+  std::thread m_acceptor;
+
+  mutable std::mutex m_mutex;
+  std::list<Worker> m_workers;
+  MockServerStats m_stats;
+  std::vector<std::string> m_messages;
+  // Events at the fault stage so far, which decides the ones that get a fault
+  std::size_t m_fault_events = 0;
+
+  void acceptLoop();
+  void serve(int socket);
+  bool injectFault(FaultStage stage);
+  bool reply(Connection &connection, std::string_view text) const;
+  // Replies and returns false, for the steps that fail
+  bool refuse(Connection &connection, std::string_view text) const;
+  // Reads the data of a message and replies to it, returns false if the connection is lost
+  bool receive(Connection &connection, LineReader &reader, std::size_t recipients);
+  bool authenticate(Connection &connection, LineReader &reader, std::string_view arguments);
+};
+
+bool MockSmtpServer::Impl::injectFault(FaultStage stage) {
+  if (stage != m_options.fault_stage) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock{m_mutex};
+  const double event = static_cast<double>(m_fault_events++);
+  const bool fault = std::floor((event + 1.0) * m_options.fault_rate) >
+                     std::floor(event * m_options.fault_rate);
+  m_stats.faults += fault ? 1 : 0;
+  return fault;
+}
+
+bool MockSmtpServer::Impl::reply(Connection &connection, std::string_view text) const {
+  if (m_options.reply_delay.count() > 0) {
+    std::this_thread::sleep_for(m_options.reply_delay);
+  }
+  return connection.write(std::string{text} + "\r\n");
+}
+
+bool MockSmtpServer::Impl::refuse(Connection &connection, std::string_view text) const {
+  reply(connection, text);
+  return false;
+}
+
+static std::string faultReply(int code) {
+  return std::to_string(code) + (code >= 500 ? " 5.0.0" : " 4.0.0") + " Injected fault";
+}
+
+static std::string decodeBase64(std::string_view text) {
+  const std::vector<uint8_t> &decoded = smtp::Base64::Base64Decode(std::string{text});
+  return std::string{decoded.begin(), decoded.end()};
+}
+
+bool MockSmtpServer::Impl::authenticate(Connection &connection, LineReader &reader,
+                                        std::string_view arguments) {
+  const std::size_t space = arguments.find(' ');
+  std::string mechanism{arguments.substr(0, space)};
+  std::transform(mechanism.begin(), mechanism.end(), mechanism.begin(),
+                 [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+  std::string_view initial =
+      space == std::string_view::npos ? std::string_view{} : arguments.substr(space + 1);
+
+  // Each step either takes the initial response or asks the client for the next one
+  std::string_view line;
+  const auto &challenge = [&](std::string_view prompt, std::string &response) {
+    if (!initial.empty()) {
+      response = decodeBase64(initial);
+      initial = {};
+      return true;
+    }
+    if (!reply(connection, "334 " + std::string{prompt}) || !reader.next(line) || line == "*") {
+      return false;
+    }
+    response = decodeBase64(line);
+    return true;
+  };
+
+  std::string user;
+  std::string password;
+  if (mechanism == "PLAIN") {
+    // authzid NUL authcid NUL passwd, RFC 4616
+    std::string response;
+    if (!challenge("", response)) {
+      return refuse(connection, "501 5.7.0 Authentication cancelled");
+    }
+    const std::size_t first = response.find('\0');
+    const std::size_t second = response.find('\0', first + 1);
+    if (first != std::string::npos && second != std::string::npos) {
+      user = response.substr(first + 1, second - first - 1);
+      password = response.substr(second + 1);
+    }
+  } else if (mechanism == "LOGIN") {
+    if (!challenge("VXNlcm5hbWU6", user) || !challenge("UGFzc3dvcmQ6", password)) {
+      return refuse(connection, "501 5.7.0 Authentication cancelled");
+    }
+  } else {
+    return refuse(connection, "504 5.5.4 Unrecognized authentication type");
+  }
+
+  if (user != m_options.user || password != m_options.password) {
+    return refuse(connection, "535 5.7.8 Authentication credentials invalid");
+  }
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_stats.logins++;
+  }
+  return reply(connection, "235 2.7.0 Authentication successful");
+}
+
+static std::string_view commandOf(std::string_view line, std::string &upper) {
+  const std::size_t end = std::min(line.find_first_of(" :"), line.size());
+  upper.assign(line.substr(0, end));
+  std::transform(upper.begin(), upper.end(), upper.begin(),
+                 [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+  return end < line.size() ? line.substr(end + 1) : std::string_view{};
+}
+
+// The value of a parameter of MAIL FROM e.g SIZE=1024, empty if it is not there
+static std::string_view parameterOf(std::string_view arguments, std::string_view name) {
+  const std::size_t pos = arguments.find(name);
+  if (pos == std::string_view::npos) {
+    return {};
+  }
+  const std::string_view value = arguments.substr(pos + name.size());
+  return value.substr(0, std::min(value.find(' '), value.size()));
+}
+
+bool MockSmtpServer::Impl::receive(Connection &connection, LineReader &reader,
+                                   std::size_t recipients) {
+  if (!reply(connection, "354 End data with <CR><LF>.<CR><LF>")) {
+    return false;
+  }
+
+  // Lines that start with a dot have had another one put in front of them, RFC 5321
+  // section 4.5.2
+  std::string_view line;
+  std::string message;
+  std::size_t size = 0;
+  bool terminated = false;
+  while (reader.next(line)) {
+    if (line == ".") {
+      terminated = true;
+      break;
+    }
+    if (!line.empty() && line.front() == '.') {
+      line.remove_prefix(1);
+    }
+    size += line.size() + 2;
+    if (m_options.record) {
+      message.append(line);
+      message.append("\r\n");
+    }
+  }
+  if (!terminated) {
+    return false;
+  }
+
+  if (m_options.data_delay.count() > 0) {
+    std::this_thread::sleep_for(m_options.data_delay);
+  }
+  if (m_options.max_message_size > 0 && size > m_options.max_message_size) {
+    return reply(connection, "552 5.3.4 Message size exceeds fixed limit");
+  }
+  if (injectFault(FaultStage::kData)) {
+    return reply(connection, faultReply(m_options.fault_code));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_stats.messages++;
+    m_stats.bytes += size;
+    m_stats.recipients += recipients;
+    if (m_options.record) {
+      m_messages.push_back(std::move(message));
+    }
+  }
+  return reply(connection, "250 2.0.0 Ok: queued");
+}
+
+void MockSmtpServer::Impl::serve(int socket) {
+  Connection connection{socket, m_tls.get()};
+  if (!connection.ok()) {
+    return;
+  }
+  LineReader reader{connection};
+
+  if (m_options.greeting_delay.count() > 0) {
+    std::this_thread::sleep_for(m_options.greeting_delay);
+  }
+  if (injectFault(FaultStage::kGreeting)) {
+    connection.write(faultReply(m_options.fault_code) + "\r\n");
+    return;
+  }
+  if (!connection.write("220 " + std::string{kHostname} + " ESMTP\r\n")) {
+    return;
+  }
+
+  bool authenticated = m_options.user.empty();
+  bool in_transaction = false;
+  std::size_t recipients = 0;
+  std::string command;
+  std::string_view line;
+  while (reader.next(line)) {
+    const std::string_view arguments = commandOf(line, command);
+    bool ok = true;
+
+    if (command == "EHLO") {
+      std::string capabilities = "250-" + std::string{kHostname} + "\r\n250-SIZE";
+      if (m_options.max_message_size > 0) {
+        capabilities += " " + std::to_string(m_options.max_message_size);
+      }
+      if (!m_options.user.empty()) {
+        capabilities += "\r\n250-AUTH " + m_options.auth_mechanisms;
+      }
+      ok = reply(connection, capabilities + "\r\n250 8BITMIME");
+    } else if (command == "HELO") {
+      ok = reply(connection, "250 " + std::string{kHostname});
+    } else if (command == "AUTH") {
+      if (m_options.user.empty() || authenticated) {
+        ok = reply(connection, "503 5.5.1 AUTH not available");
+      } else {
+        authenticated = authenticate(connection, reader, arguments);
+      }
+    } else if (command == "MAIL") {
+      const std::string size{parameterOf(arguments, "SIZE=")};
+      const unsigned long long declared = std::strtoull(size.c_str(), nullptr, 10);
+      if (!authenticated) {
+        ok = reply(connection, "530 5.7.0 Authentication required");
+      } else if (m_options.max_message_size > 0 && declared > m_options.max_message_size) {
+        ok = reply(connection, "552 5.3.4 Message size exceeds fixed limit");
+      } else if (injectFault(FaultStage::kMailFrom)) {
+        ok = reply(connection, faultReply(m_options.fault_code));
+      } else {
+        in_transaction = true;
+        recipients = 0;
+        ok = reply(connection, "250 2.1.0 Ok");
+      }
+    } else if (command == "RCPT") {
+      if (!in_transaction) {
+        ok = reply(connection, "503 5.5.1 Need MAIL first");
+      } else if (injectFault(FaultStage::kRcptTo)) {
+        ok = reply(connection, faultReply(m_options.fault_code));
+      } else {
+        recipients++;
+        ok = reply(connection, "250 2.1.5 Ok");
+      }
+    } else if (command == "DATA") {
+      ok = recipients == 0 ? reply(connection, "503 5.5.1 Need RCPT first")
+                           : receive(connection, reader, recipients);
+      in_transaction = false;
+      recipients = 0;
+    } else if (command == "RSET") {
+      in_transaction = false;
+      recipients = 0;
+      ok = reply(connection, "250 2.0.0 Ok");
+    } else if (command == "NOOP") {
+      ok = reply(connection, "250 2.0.0 Ok");
+    } else if (command == "QUIT") {
+      if (m_options.quit_delay.count() > 0) {
+        std::this_thread::sleep_for(m_options.quit_delay);
+      }
+      reply(connection, "221 2.0.0 Bye");
+      return;
+    } else {
+      ok = reply(connection, "502 5.5.2 Command not recognized");
+    }
+
+    if (!ok) {
+      return;
+    }
+  }
+}
+
+void MockSmtpServer::Impl::acceptLoop() {
+  while (true) {
+    const int client = accept(m_socket, nullptr, nullptr);
+    if (client < 0) {
+      return; // the listening socket was shut down
+    }
+
+    // Replies are small and each one is waited for, so they are sent straight away
+    const int no_delay = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_stats.connections++;
+
+    // Threads of the connections that have closed are joined as new ones come in
+    for (auto it = m_workers.begin(); it != m_workers.end();) {
+      if (it->done.load()) {
+        it->thread.join();
+        it = m_workers.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    Worker &worker = m_workers.emplace_back();
+    worker.socket = client;
+    worker.thread = std::thread{[this, &worker]() {
+      serve(worker.socket);
+      std::lock_guard<std::mutex> worker_lock{m_mutex};
+      close(worker.socket);
+      worker.socket = -1;
+      worker.done.store(true);
+    }};
+  }
+}
+
+MockSmtpServer::MockSmtpServer(const MockServerOptions &options)
+    : m_impl{std::make_unique<Impl>()} {
+  m_impl->m_options = options;
+  if (options.tls) {
+    m_impl->m_tls = makeTlsContext(m_impl->m_certificate);
+  }
+
+  m_impl->m_socket = socket(AF_INET, SOCK_STREAM, 0);
+  const int reuse = 1;
+  setsockopt(m_impl->m_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(options.port);
+  socklen_t size = sizeof(address);
+  if (m_impl->m_socket < 0 ||
+      bind(m_impl->m_socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+      listen(m_impl->m_socket, SOMAXCONN) != 0 ||
+      getsockname(m_impl->m_socket, reinterpret_cast<sockaddr *>(&address), &size) != 0) {
+    if (m_impl->m_socket >= 0) {
+      close(m_impl->m_socket);
+    }
+    throw MockServerException("[!] Could not listen on port " + std::to_string(options.port));
+  }
+
+  m_impl->m_url = std::string{options.tls ? "smtps" : "smtp"} + "://127.0.0.1:" +
+                  std::to_string(ntohs(address.sin_port));
+  m_impl->m_acceptor = std::thread{[this]() {
+    blockSigpipe();
+    m_impl->acceptLoop();
+  }};
+}
+
+MockSmtpServer::~MockSmtpServer() {
+  shutdown(m_impl->m_socket, SHUT_RDWR);
+  m_impl->m_acceptor.join();
+  close(m_impl->m_socket);
+
+  // Connections that are still open are woken up from their reads
+  {
+    std::lock_guard<std::mutex> lock{m_impl->m_mutex};
+    for (Worker &worker : m_impl->m_workers) {
+      if (worker.socket >= 0) {
+        shutdown(worker.socket, SHUT_RDWR);
+      }
+    }
+  }
+  for (Worker &worker : m_impl->m_workers) {
+    worker.thread.join();
+  }
+}
+
+const std::string &MockSmtpServer::url() const { return m_impl->m_url; }
+
+const std::string &MockSmtpServer::certificate() const { return m_impl->m_certificate; }
+
+MockServerStats MockSmtpServer::stats() const {
+  std::lock_guard<std::mutex> lock{m_impl->m_mutex};
+  return m_impl->m_stats;
+}
+
+std::vector<std::string> MockSmtpServer::messages() const {
+  std::lock_guard<std::mutex> lock{m_impl->m_mutex};
+  return m_impl->m_messages;
+}
+
+} // namespace bench
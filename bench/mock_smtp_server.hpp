@@ -0,0 +1,97 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+class MockServerException : public std::runtime_error {
+public:
+  using runtime_error::runtime_error;
+};
+
+// Where in the transaction an injected fault is replied to
+enum class FaultStage {
+  kNone,
+  // The connection is greeted with the fault code and closed
+  kGreeting,
+  kMailFrom,
+  kRcptTo,
+  // The whole message is read and then refused
+  kData,
+};
+
+struct MockServerOptions {
+  // Implicit TLS with a self-signed certificate, the url starts with smtps:// rather than smtp://
+  bool tls = false;
+  // Port 0 picks a free port, the server only ever listens on loopback
+  unsigned short port = 0;
+
+  // AUTH is only advertised when there is a user. Clients that log in with anything else are
+  // refused with 535.
+  std::string user;
+  std::string password;
+  // Mechanisms advertised after AUTH, a client picks the one it prefers out of them
+  std::string auth_mechanisms = "PLAIN LOGIN";
+
+  // Advertised with SIZE, larger messages are refused with 552. 0 means no limit.
+  std::size_t max_message_size = 0;
+
+  // Added before the greeting, before every other reply, before the reply to the end of the data
+  // and before the reply to QUIT respectively, to stand in for a relay that is far away or busy
+  std::chrono::milliseconds greeting_delay{0};
+  std::chrono::milliseconds reply_delay{0};
+  std::chrono::milliseconds data_delay{0};
+  std::chrono::milliseconds quit_delay{0};
+
+  // A share of the transactions, between 0 and 1, get fault_code at fault_stage. The faults are
+  // spread evenly rather than at random, so a run can be repeated exactly.
+  FaultStage fault_stage = FaultStage::kNone;
+  double fault_rate = 0.0;
+  int fault_code = 451;
+
+  // Keep the data of every accepted message, otherwise it is only counted
+  bool record = false;
+};
+
+struct MockServerStats {
+  std::size_t connections = 0;
+  std::size_t messages = 0;
+  // Bytes of data of the accepted messages, without the terminating dot
+  std::size_t bytes = 0;
+  std::size_t recipients = 0;
+  std::size_t logins = 0;
+  std::size_t faults = 0;
+};
+
+// An SMTP server on a loopback port for benchmarks and tests, so that the send path can be
+// driven end to end without a real relay. Each connection is served by its own thread. It
+// speaks just enough ESMTP for libcurl: EHLO, AUTH PLAIN and LOGIN, MAIL, RCPT, DATA, RSET, NOOP
+// and QUIT.
+class MockSmtpServer {
+public:
+  explicit MockSmtpServer(const MockServerOptions &options = {});
+  ~MockSmtpServer();
+
+  MockSmtpServer(const MockSmtpServer &) = delete;
+  MockSmtpServer &operator=(const MockSmtpServer &) = delete;
+
+  // e.g smtps://127.0.0.1:40123
+  const std::string &url() const;
+  // The self-signed certificate in PEM, empty without TLS
+  const std::string &certificate() const;
+
+  MockServerStats stats() const;
+  // The data of the accepted messages in the order they finished, when they are recorded
+  std::vector<std::string> messages() const;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace bench
@@ -0,0 +1,71 @@
+#include <initializer_list>
+
+#include "perf_counters.hpp"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench {
+
+#if defined(__linux__)
+static int openCounter(uint64_t config) {
+  perf_event_attr attr{};
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // pid 0 and cpu -1 follow the calling thread on whichever CPU it runs
+  return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+static uint64_t readCounter(int fd) {
+  uint64_t value = 0;
+  return read(fd, &value, sizeof(value)) == sizeof(value) ? value : 0;
+}
+
+PerfCounters::PerfCounters()
+    : m_cycles{openCounter(PERF_COUNT_HW_CPU_CYCLES)},
+      m_instructions{openCounter(PERF_COUNT_HW_INSTRUCTIONS)} {}
+
+PerfCounters::~PerfCounters() {
+  if (m_cycles >= 0) {
+    close(m_cycles);
+  }
+  if (m_instructions >= 0) {
+    close(m_instructions);
+  }
+}
+
+void PerfCounters::start() {
+  if (!available()) {
+    return;
+  }
+  for (const int fd : {m_cycles, m_instructions}) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+CounterValues PerfCounters::stop() {
+  if (!available()) {
+    return {};
+  }
+  for (const int fd : {m_cycles, m_instructions}) {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  }
+  return {readCounter(m_cycles), readCounter(m_instructions)};
+}
+#else
+PerfCounters::PerfCounters() = default;
+PerfCounters::~PerfCounters() = default;
+void PerfCounters::start() {}
+CounterValues PerfCounters::stop() { return {}; }
+#endif
+
+} // namespace bench
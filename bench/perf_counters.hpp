@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+namespace bench {
+
+struct CounterValues {
+  uint64_t cycles = 0;
+  uint64_t instructions = 0;
+};
+
+// CPU cycles and retired instructions of the calling thread in user space, read through
+// perf_event_open. The counters are not available outside of Linux, in most containers, or when
+// kernel.perf_event_paranoid is above 2, in which case available() is false and nothing is
+// counted.
+class PerfCounters {
+public:
+  PerfCounters();
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  bool available() const { return m_cycles >= 0 && m_instructions >= 0; }
+
+  void start();
+  // Returns the counts since start()
+  CounterValues stop();
+
+private:
+  int m_cycles = -1;
+  int m_instructions = -1;
+};
+
+} // namespace bench
@@ -0,0 +1,132 @@
+/*
+  Times each operation and counts the heap allocations it makes. operator new is replaced for the
+  whole process, so the allocations made inside of the library are counted as well.
+*/
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "bench.hpp"
+
+static std::atomic<std::size_t> g_allocations{0};
+static std::atomic<std::size_t> g_allocated_bytes{0};
+
+void *operator new(std::size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+// std::pmr::new_delete_resource() allocates through the aligned overloads
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  const std::size_t align = static_cast<std::size_t>(alignment);
+  if (void *ptr = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+
+namespace bench {
+
+std::size_t allocationCount() { return g_allocations.load(std::memory_order_relaxed); }
+std::size_t allocatedBytes() { return g_allocated_bytes.load(std::memory_order_relaxed); }
+
+double Result::megabytesPerSecond() const {
+  return ns_per_op > 0.0 ? static_cast<double>(size) * 1000.0 / ns_per_op : 0.0;
+}
+
+Runner::Runner(const Options &options) : m_options{options} {}
+
+std::vector<std::size_t> Runner::payloadSizes() const {
+  std::vector<std::size_t> sizes;
+  for (std::size_t size = 1024; size <= m_options.max_size; size *= 10) {
+    sizes.push_back(size);
+  }
+  return sizes;
+}
+
+void Runner::run(std::string_view name, std::size_t size, const std::function<void()> &op) {
+  if (name.find(m_options.filter) == std::string_view::npos) {
+    return;
+  }
+
+  op(); // warm up any lazily initialised statics and the caches
+
+  const std::size_t allocations = allocationCount();
+  const std::size_t bytes = allocatedBytes();
+  const auto start = std::chrono::steady_clock::now();
+  auto elapsed = std::chrono::steady_clock::duration::zero();
+  std::size_t iterations = 0;
+
+  m_counters.start();
+  while (iterations == 0 || elapsed < m_options.min_time) {
+    op();
+    iterations++;
+    elapsed = std::chrono::steady_clock::now() - start;
+  }
+  const CounterValues &counters = m_counters.stop();
+
+  const double count = static_cast<double>(iterations);
+  Result result;
+  result.name = name;
+  result.size = size;
+  result.iterations = iterations;
+  result.ns_per_op =
+      static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) /
+      count;
+  result.allocations_per_op = static_cast<double>(allocationCount() - allocations) / count;
+  result.bytes_allocated_per_op = static_cast<double>(allocatedBytes() - bytes) / count;
+  if (m_counters.available()) {
+    result.cycles_per_op = static_cast<double>(counters.cycles) / count;
+    result.instructions_per_op = static_cast<double>(counters.instructions) / count;
+  }
+  print(result);
+}
+
+void Runner::print(const Result &result) {
+  // Counters that are not available are left empty in CSV and null in JSON
+  const char *missing = m_options.format == Format::kCsv ? "" : "null";
+  char cycles[32];
+  char instructions[32];
+  if (result.cycles_per_op) {
+    std::snprintf(cycles, sizeof(cycles), "%.0f", *result.cycles_per_op);
+    std::snprintf(instructions, sizeof(instructions), "%.0f", *result.instructions_per_op);
+  } else {
+    std::snprintf(cycles, sizeof(cycles), "%s", missing);
+    std::snprintf(instructions, sizeof(instructions), "%s", missing);
+  }
+
+  if (m_options.format == Format::kCsv) {
+    if (m_printed == 0) {
+      std::printf("benchmark,size,iterations,ns_per_op,mb_per_s,allocations_per_op,"
+                  "bytes_allocated_per_op,cycles_per_op,instructions_per_op\n");
+    }
+    std::printf("%s,%zu,%zu,%.0f,%.2f,%.2f,%.0f,%s,%s\n", result.name.c_str(), result.size,
+                result.iterations, result.ns_per_op, result.megabytesPerSecond(),
+                result.allocations_per_op, result.bytes_allocated_per_op, cycles, instructions);
+  } else {
+    std::printf("{\"benchmark\":\"%s\",\"version\":\"%s\",\"size\":%zu,\"iterations\":%zu,"
+                "\"ns_per_op\":%.0f,\"mb_per_s\":%.2f,\"allocations_per_op\":%.2f,"
+                "\"bytes_allocated_per_op\":%.0f,\"cycles_per_op\":%s,"
+                "\"instructions_per_op\":%s}\n",
+                result.name.c_str(), SMTP_BENCH_VERSION, result.size, result.iterations,
+                result.ns_per_op, result.megabytesPerSecond(), result.allocations_per_op,
+                result.bytes_allocated_per_op, cycles, instructions);
+  }
+  std::fflush(stdout);
+  m_printed++;
+}
+
+} // namespace bench
@@ -0,0 +1,242 @@
+/*
+  Sends emails through Email::send() to a mock server on loopback, for each attachment size and
+  number of concurrent senders, and prints the throughput and send latency of each run.
+
+  With --spool each email is written to a spool file once and sent with sendSpool(), which
+  uploads the file with sendfile() instead of copying it through libcurl.
+
+  Usage: smtp_send_bench [--sizes=1K,100K,1M,10M] [--concurrency=1,4,16] [--min-time=<ms>]
+                         [--plain] [--spool] [--reply-delay=<ms>] [--json] [--verbose]
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "attachment/attachment.hpp"
+#include "bench.hpp"
+#include "email/email.hpp"
+#include "mock_smtp_server.hpp"
+#include "transport/spool.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct SendOptions {
+  std::vector<std::size_t> sizes{1024, 100 * 1024, 1024 * 1024, 10 * 1024 * 1024};
+  std::vector<std::size_t> concurrency{1, 4, 16};
+  std::chrono::milliseconds min_time{1000};
+  bool tls = true;
+  bool spool = false;
+  std::chrono::milliseconds reply_delay{0};
+  bench::Format format = bench::Format::kCsv;
+  bool verbose = false;
+};
+
+struct SendResult {
+  std::size_t size = 0;
+  std::size_t concurrency = 0;
+  std::size_t messages = 0;
+  std::size_t failures = 0;
+  std::size_t message_size = 0;
+  double seconds = 0.0;
+  // Send latencies in microseconds, sorted
+  std::vector<double> latencies;
+
+  double percentile(double p) const {
+    if (latencies.empty()) {
+      return 0.0;
+    }
+    const std::size_t rank = static_cast<std::size_t>(p * static_cast<double>(latencies.size()));
+    return latencies[std::min(rank, latencies.size() - 1)];
+  }
+};
+
+bool parseList(std::string_view text, std::vector<std::size_t> &values) {
+  values.clear();
+  while (!text.empty()) {
+    const std::size_t comma = std::min(text.find(','), text.size());
+    std::size_t value = 0;
+    if (!bench::parseSize(text.substr(0, comma), value) || value == 0) {
+      return false;
+    }
+    values.push_back(value);
+    text.remove_prefix(std::min(comma + 1, text.size()));
+  }
+  return !values.empty();
+}
+
+// Each sender keeps on sending the same email until the time is up, so every run sends about
+// the same amount of data whatever the concurrency
+SendResult runSends(const std::function<smtp::TransportResult()> &send, std::size_t concurrency,
+                    std::chrono::milliseconds min_time) {
+  std::vector<std::vector<double>> latencies(concurrency);
+  std::vector<std::size_t> failures(concurrency, 0);
+  const Clock::time_point start = Clock::now();
+
+  std::vector<std::thread> senders;
+  for (std::size_t i = 0; i < concurrency; i++) {
+    senders.emplace_back([&, i]() {
+      while (Clock::now() - start < min_time || latencies[i].empty()) {
+        const Clock::time_point sent = Clock::now();
+        const smtp::TransportResult &result = send();
+        const auto elapsed = std::chrono::duration<double, std::micro>(Clock::now() - sent);
+        latencies[i].push_back(elapsed.count());
+        failures[i] += result.sent() ? 0 : 1;
+      }
+    });
+  }
+  for (std::thread &sender : senders) {
+    sender.join();
+  }
+
+  SendResult result;
+  result.concurrency = concurrency;
+  result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  for (std::size_t i = 0; i < concurrency; i++) {
+    result.latencies.insert(result.latencies.end(), latencies[i].begin(), latencies[i].end());
+    result.failures += failures[i];
+  }
+  std::sort(result.latencies.begin(), result.latencies.end());
+  result.messages = result.latencies.size() - result.failures;
+  return result;
+}
+
+void print(const SendOptions &options, const SendResult &result, bool first) {
+  const double messages_per_second = static_cast<double>(result.messages) / result.seconds;
+  const double megabytes_per_second =
+      messages_per_second * static_cast<double>(result.message_size) / 1e6;
+  const char *tls = options.spool ? (options.tls ? "smtps+spool" : "smtp+spool")
+                                  : (options.tls ? "smtps" : "smtp");
+
+  if (options.format == bench::Format::kCsv) {
+    if (first) {
+      std::printf("benchmark,protocol,size,concurrency,messages,failures,msgs_per_s,mb_per_s,"
+                  "p50_us,p99_us\n");
+    }
+    std::printf("email_send,%s,%zu,%zu,%zu,%zu,%.1f,%.2f,%.0f,%.0f\n", tls, result.size,
+                result.concurrency, result.messages, result.failures, messages_per_second,
+                megabytes_per_second, result.percentile(0.5), result.percentile(0.99));
+  } else {
+    std::printf("{\"benchmark\":\"email_send\",\"version\":\"%s\",\"protocol\":\"%s\","
+                "\"size\":%zu,\"concurrency\":%zu,\"messages\":%zu,\"failures\":%zu,"
+                "\"msgs_per_s\":%.1f,\"mb_per_s\":%.2f,\"p50_us\":%.0f,\"p99_us\":%.0f}\n",
+                SMTP_BENCH_VERSION, tls, result.size, result.concurrency, result.messages,
+                result.failures, messages_per_second, megabytes_per_second,
+                result.percentile(0.5), result.percentile(0.99));
+  }
+  std::fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  SendOptions options;
+  for (int i = 1; i < argc; i++) {
+    const std::string_view arg = argv[i];
+    std::size_t value = 0;
+    bool ok = true;
+    if (arg.rfind("--sizes=", 0) == 0) {
+      ok = parseList(arg.substr(8), options.sizes);
+    } else if (arg.rfind("--concurrency=", 0) == 0) {
+      ok = parseList(arg.substr(14), options.concurrency);
+    } else if (arg.rfind("--min-time=", 0) == 0 && bench::parseSize(arg.substr(11), value)) {
+      options.min_time = std::chrono::milliseconds{value};
+    } else if (arg.rfind("--reply-delay=", 0) == 0 && bench::parseSize(arg.substr(14), value)) {
+      options.reply_delay = std::chrono::milliseconds{value};
+    } else if (arg == "--plain") {
+      options.tls = false;
+    } else if (arg == "--spool") {
+      options.spool = true;
+    } else if (arg == "--json") {
+      options.format = bench::Format::kJsonLines;
+    } else if (arg == "--verbose") {
+      options.verbose = true;
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      std::fprintf(stderr, "[!] Invalid argument: %s\n", argv[i]);
+      std::fprintf(stderr, "Usage: %s [--sizes=1K,100K,1M,10M] [--concurrency=1,4,16] "
+                           "[--min-time=<ms>] [--plain] [--spool] [--reply-delay=<ms>] [--json] "
+                           "[--verbose]\n",
+                   argv[0]);
+      return 1;
+    }
+  }
+
+  // The transport has libcurl log every command to stderr, which would swamp the results
+  if (!options.verbose && !std::freopen("/dev/null", "w", stderr)) {
+    return 1;
+  }
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+
+  bench::MockServerOptions server_options;
+  server_options.tls = options.tls;
+  server_options.user = "user";
+  server_options.password = "password";
+  server_options.reply_delay = options.reply_delay;
+  const bench::MockSmtpServer server{server_options};
+
+  const smtp::EmailParams params{
+      "user",                             // smtp username
+      "password",                         // smtp password
+      server.url(),                       // smtp server
+      "bigboss@example.com",              // to
+      "tully@example.com",                // from
+      "",                                 // cc
+      "Quarterly report",                 // subject
+      "Please find the report attached.", // body
+  };
+
+  bool first = true;
+  for (const std::size_t size : options.sizes) {
+    smtp::Email email{params};
+    smtp::Attachment attachment;
+    attachment.setContents(bench::makePayload(size));
+    attachment.setFilePath("/path/report.bin");
+    email.addAttachment(attachment);
+
+    // The spool file is written once, every send reads it from the page cache
+    std::FILE *spool = options.spool ? std::tmpfile() : nullptr;
+    if (options.spool && !spool) {
+      std::fprintf(stdout, "[!] Could not create a spool file\n");
+      return 1;
+    }
+    smtp::SpoolInfo spool_info;
+    if (spool) {
+      smtp::RenderedEmail rendered;
+      email.render(rendered);
+      spool_info = smtp::writeSpool(rendered.view(), fileno(spool));
+    }
+    const smtp::TransportParams spool_params{
+        params.user, params.password, params.hostname, params.from, {params.to}};
+    const std::function<smtp::TransportResult()> &send = [&]() {
+      return spool ? smtp::sendSpool(spool_params, fileno(spool), spool_info) : email.send();
+    };
+
+    for (const std::size_t concurrency : options.concurrency) {
+      SendResult result = runSends(send, concurrency, options.min_time);
+      result.size = size;
+      result.message_size = email.serializedSize();
+      print(options, result, first);
+      first = false;
+    }
+    if (spool) {
+      std::fclose(spool);
+    }
+  }
+
+  curl_global_cleanup();
+  return 0;
+}
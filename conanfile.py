@@ -10,6 +10,8 @@ class VerySimpleSMTPSConan(ConanFile):
     required_packages = [
         "libcurl/8.0.1",
         "doctest/2.4.11",
+        "zlib/1.3.1",
+        "openssl/3.2.1",
     ]
 
     def requirements(self):
@@ -0,0 +1,443 @@
+/*
+  Sends a message to a list of recipients at a target rate, or as fast as it can, to find out how
+  many messages a mailer node can get through and to replay production load against new versions
+  of this library.
+
+  The message file has From, Subject and optionally To and Cc headers, a blank line, then the
+  body. Any of them may use {{placeholders}}. The recipient file is a header row naming the
+  columns, then one recipient per line, e.g
+
+    to,name
+    jane@example.com,Jane
+    bob@example.com,Bob
+
+  To defaults to {{to}}. Columns are split on commas, so values cannot contain one.
+
+  Usage: load_generator --message=<file> --recipients=<file> (--relay=<url>... | --mock)
+                        [--user=<user>] [--password=<password>] [--attachments=<a,b>...]
+                        [--rate=<messages per second>] [--concurrency=<n>]
+                        [--count=<n> | --duration=<seconds>] [--prewarm=<n>] [--verbose]
+
+  --prewarm opens that many connections to each relay before the clock starts, so the first
+  messages are not held up connecting and logging in.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "attachment/attachment.hpp"
+#include "email/email_template.hpp"
+#include "mock_smtp_server.hpp"
+#include "transport/library.hpp"
+#include "transport/relay_pool.hpp"
+
+using namespace smtp;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct LoadOptions {
+  std::string message_file;
+  std::string recipients_file;
+  std::vector<std::string> relays;
+  bool mock = false;
+  std::string user;
+  std::string password;
+  // Each set is sent with an equal share of the messages
+  std::vector<std::vector<std::string>> attachment_sets;
+  // Messages per second over every sender, 0 sends as fast as possible
+  double rate = 0.0;
+  std::size_t concurrency = 4;
+  // One message per recipient unless a count or duration is given, recipients are reused in
+  // turn when there are fewer of them than messages
+  std::size_t count = 0;
+  std::chrono::seconds duration{0};
+  // Connections opened to each relay before the run
+  std::size_t prewarm = 0;
+  bool verbose = false;
+};
+
+struct Message {
+  std::string to = "{{to}}";
+  std::string from;
+  std::string cc;
+  std::string subject;
+  std::string body;
+};
+
+struct Recipients {
+  std::vector<std::string> columns;
+  std::vector<std::vector<std::string>> rows;
+};
+
+// Sends that have finished, shared by every sender and read by the reporter
+class Stats {
+public:
+  void record(const TransportResult &result, Clock::duration latency, std::size_t bytes) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_latencies.push_back(std::chrono::duration<double, std::milli>(latency).count());
+    if (result.sent()) {
+      m_sent++;
+      m_bytes += bytes;
+    } else {
+      m_errors[describe(result)]++;
+    }
+  }
+
+  void recordError(const std::string &error) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_errors[error]++;
+  }
+
+  // Prints the totals since the previous call
+  void printProgress(Clock::duration elapsed) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    const double interval = seconds - m_last_report;
+    const std::size_t failed = m_latencies.size() - m_sent;
+    std::printf("[%7.1fs] sent %zu failed %zu | %.1f msgs/s %.2f MB/s\n", seconds, m_sent, failed,
+                static_cast<double>(m_sent - m_last_sent) / interval,
+                static_cast<double>(m_bytes - m_last_bytes) / interval / 1e6);
+    std::fflush(stdout);
+    m_last_report = seconds;
+    m_last_sent = m_sent;
+    m_last_bytes = m_bytes;
+  }
+
+  void printSummary(Clock::duration elapsed) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    std::sort(m_latencies.begin(), m_latencies.end());
+    const auto percentile = [this](double p) {
+      if (m_latencies.empty()) {
+        return 0.0;
+      }
+      const auto rank = static_cast<std::size_t>(p * static_cast<double>(m_latencies.size()));
+      return m_latencies[std::min(rank, m_latencies.size() - 1)];
+    };
+
+    std::printf("\nsent %zu of %zu in %.1fs, %.1f msgs/s, %.2f MB/s\n", m_sent,
+                m_latencies.size(), seconds, static_cast<double>(m_sent) / seconds,
+                static_cast<double>(m_bytes) / seconds / 1e6);
+    std::printf("latency ms: p50 %.1f p90 %.1f p99 %.1f max %.1f\n", percentile(0.5),
+                percentile(0.9), percentile(0.99), m_latencies.empty() ? 0.0 : m_latencies.back());
+    for (const auto &[error, count] : m_errors) {
+      std::printf("error: %s x %zu\n", error.c_str(), count);
+    }
+  }
+
+private:
+  static std::string describe(const TransportResult &result) {
+    static const char *const kStatuses[] = {"sent",      "connect_failed", "transient_failure",
+                                            "permanent_failure", "timed_out", "cancelled"};
+    std::string text = kStatuses[static_cast<std::size_t>(result.status)];
+    if (result.response_code != 0) {
+      text += " " + std::to_string(result.response_code);
+    }
+    return text;
+  }
+
+  std::mutex m_mutex;
+  std::vector<double> m_latencies;
+  std::size_t m_sent = 0;
+  std::size_t m_bytes = 0;
+  std::map<std::string, std::size_t> m_errors;
+  double m_last_report = 0.0;
+  std::size_t m_last_sent = 0;
+  std::size_t m_last_bytes = 0;
+};
+
+std::vector<std::string> split(std::string_view text, char separator) {
+  std::vector<std::string> fields;
+  while (true) {
+    const std::size_t end = std::min(text.find(separator), text.size());
+    fields.emplace_back(text.substr(0, end));
+    if (end == text.size()) {
+      return fields;
+    }
+    text.remove_prefix(end + 1);
+  }
+}
+
+std::string readFile(const std::string &path) {
+  std::ifstream file{path, std::ios::binary};
+  if (!file) {
+    throw std::runtime_error("[!] Could not open " + path);
+  }
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+Message readMessage(const std::string &path) {
+  std::istringstream file{readFile(path)};
+  Message message;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty()) {
+      break;
+    }
+    const std::size_t colon = line.find(':');
+    const std::string name = line.substr(0, colon);
+    const std::size_t start = line.find_first_not_of(' ', colon + 1);
+    const std::string value = start == std::string::npos ? "" : line.substr(start);
+    if (name == "To") {
+      message.to = value;
+    } else if (name == "From") {
+      message.from = value;
+    } else if (name == "Cc") {
+      message.cc = value;
+    } else if (name == "Subject") {
+      message.subject = value;
+    } else {
+      throw std::runtime_error("[!] Unknown header in message file: " + line);
+    }
+  }
+  std::ostringstream body;
+  body << file.rdbuf();
+  message.body = body.str();
+  return message;
+}
+
+Recipients readRecipients(const std::string &path) {
+  std::istringstream file{readFile(path)};
+  Recipients recipients;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty() || line.front() == '#') {
+      continue;
+    }
+    if (recipients.columns.empty()) {
+      recipients.columns = split(line, ',');
+    } else {
+      recipients.rows.push_back(split(line, ','));
+    }
+  }
+  if (recipients.rows.empty()) {
+    throw std::runtime_error("[!] No recipients in " + path);
+  }
+  return recipients;
+}
+
+bool parseOptions(int argc, char **argv, LoadOptions &options) {
+  for (int i = 1; i < argc; i++) {
+    const std::string_view arg = argv[i];
+    const std::size_t equals = arg.find('=');
+    const std::string_view name = arg.substr(0, equals);
+    const std::string value{equals == std::string_view::npos ? "" : arg.substr(equals + 1)};
+    if (name == "--message") {
+      options.message_file = value;
+    } else if (name == "--recipients") {
+      options.recipients_file = value;
+    } else if (name == "--relay") {
+      options.relays.push_back(value);
+    } else if (name == "--mock") {
+      options.mock = true;
+    } else if (name == "--user") {
+      options.user = value;
+    } else if (name == "--password") {
+      options.password = value;
+    } else if (name == "--attachments") {
+      // An empty list is a set without attachments
+      std::vector<std::string> set = split(value, ',');
+      set.erase(std::remove(set.begin(), set.end(), ""), set.end());
+      options.attachment_sets.push_back(std::move(set));
+    } else if (name == "--rate") {
+      options.rate = std::atof(value.c_str());
+    } else if (name == "--concurrency") {
+      options.concurrency = std::max<std::size_t>(1, std::strtoul(value.c_str(), nullptr, 10));
+    } else if (name == "--count") {
+      options.count = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (name == "--duration") {
+      options.duration = std::chrono::seconds{std::strtoul(value.c_str(), nullptr, 10)};
+    } else if (name == "--prewarm") {
+      options.prewarm = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (name == "--verbose") {
+      options.verbose = true;
+    } else {
+      std::fprintf(stderr, "[!] Unknown argument: %s\n", argv[i]);
+      return false;
+    }
+  }
+
+  if (options.message_file.empty() || options.recipients_file.empty() ||
+      (options.relays.empty() && !options.mock)) {
+    std::fprintf(stderr, "Usage: %s --message=<file> --recipients=<file> "
+                         "(--relay=<url>... | --mock) [--user=<user>] [--password=<password>] "
+                         "[--attachments=<a,b>...] [--rate=<messages per second>] "
+                         "[--concurrency=<n>] [--count=<n> | --duration=<seconds>] [--prewarm=<n>] "
+                         "[--verbose]\n",
+                 argv[0]);
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  LoadOptions options;
+  if (!parseOptions(argc, argv, options)) {
+    return 1;
+  }
+
+  try {
+    const Message message = readMessage(options.message_file);
+    const Recipients recipients = readRecipients(options.recipients_file);
+
+    // Stands in for the relay, it accepts whatever it is sent
+    std::unique_ptr<bench::MockSmtpServer> mock;
+    if (options.mock) {
+      bench::MockServerOptions mock_options;
+      mock_options.tls = true;
+      mock_options.user = options.user;
+      mock_options.password = options.password;
+      mock = std::make_unique<bench::MockSmtpServer>(mock_options);
+      options.relays = {mock->url()};
+    }
+
+    // The transport has libcurl log every command to stderr, which would bury the progress
+    if (!options.verbose && !std::freopen("/dev/null", "w", stderr)) {
+      return 1;
+    }
+    // Every sender reuses the connections the others leave open
+    LibraryOptions library_options;
+    library_options.max_idle_connections =
+        std::max(options.concurrency, library_options.max_idle_connections);
+    const LibraryGuard library{library_options};
+
+    const std::vector<std::string_view> relay_urls(options.relays.begin(), options.relays.end());
+    RelayPool relays{relay_urls};
+
+    EmailParams params{
+        options.user,        // smtp username
+        options.password,    // smtp password
+        relay_urls.front(),  // smtp server
+        message.to,          // to
+        message.from,        // from
+        message.cc,          // cc
+        message.subject,     // subject
+        message.body,        // body
+    };
+    params.relays = relay_urls.size() > 1 ? &relays : nullptr;
+
+    // One template per attachment set, each compiled once and shared by every sender
+    if (options.attachment_sets.empty()) {
+      options.attachment_sets.emplace_back();
+    }
+    std::vector<std::unique_ptr<EmailTemplate>> templates;
+    for (const std::vector<std::string> &set : options.attachment_sets) {
+      std::vector<Attachment> attachments;
+      for (const std::string &path : set) {
+        attachments.emplace_back(path);
+      }
+      templates.push_back(std::make_unique<EmailTemplate>(params, attachments));
+    }
+
+    // Placeholders that have no column in the recipient file are left empty
+    std::vector<std::size_t> columns;
+    for (const std::string &slot : templates.front()->slots()) {
+      const auto &it = std::find(recipients.columns.begin(), recipients.columns.end(), slot);
+      columns.push_back(static_cast<std::size_t>(it - recipients.columns.begin()));
+    }
+
+    for (const std::string &relay : options.relays) {
+      const std::size_t opened =
+          prewarm(Credentials{options.user, options.password, relay}, options.prewarm);
+      if (opened < std::min(options.prewarm, library_options.max_idle_connections)) {
+        std::printf("[!] Only %zu of %zu connections to %s could be opened\n", opened,
+                    options.prewarm, relay.c_str());
+      }
+    }
+
+    const std::size_t count =
+        options.count > 0 || options.duration.count() > 0 ? options.count : recipients.rows.size();
+    const Clock::time_point start = Clock::now();
+    const Clock::duration interval =
+        options.rate > 0.0 ? std::chrono::duration_cast<Clock::duration>(
+                                 std::chrono::duration<double>(1.0 / options.rate))
+                           : Clock::duration::zero();
+
+    Stats stats;
+    std::atomic<std::size_t> next{0};
+    std::atomic<bool> done{false};
+
+    const auto &sender = [&]() {
+      MergedEmail merged;
+      std::vector<std::string_view> values(columns.size());
+      while (true) {
+        const std::size_t index = next++;
+        if (count > 0 && index >= count) {
+          return;
+        }
+        // Each message has its own slot in the schedule, so senders that fall behind catch up
+        if (options.rate > 0.0) {
+          std::this_thread::sleep_until(start + interval * static_cast<long>(index));
+        }
+        if (options.duration.count() > 0 && Clock::now() - start >= options.duration) {
+          return;
+        }
+
+        const std::vector<std::string> &row = recipients.rows[index % recipients.rows.size()];
+        for (std::size_t i = 0; i < columns.size(); i++) {
+          values[i] = columns[i] < row.size() ? std::string_view{row[columns[i]]} : "";
+        }
+        const EmailTemplate &email = *templates[index % templates.size()];
+        try {
+          email.render(values, merged);
+          const Clock::time_point sent = Clock::now();
+          const TransportResult &result = email.send(merged);
+          stats.record(result, Clock::now() - sent, merged.size());
+        } catch (const std::exception &e) {
+          stats.recordError(e.what());
+        }
+      }
+    };
+
+    // Wakes up often so it is not left waiting once the senders are done
+    std::thread reporter{[&]() {
+      Clock::time_point report = start + std::chrono::seconds{1};
+      while (!done.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        if (Clock::now() >= report) {
+          stats.printProgress(Clock::now() - start);
+          report += std::chrono::seconds{1};
+        }
+      }
+    }};
+    std::vector<std::thread> senders;
+    for (std::size_t i = 0; i < options.concurrency; i++) {
+      senders.emplace_back(sender);
+    }
+    for (std::thread &thread : senders) {
+      thread.join();
+    }
+    const Clock::duration elapsed = Clock::now() - start;
+    done = true;
+    reporter.join();
+
+    stats.printSummary(elapsed);
+  } catch (const std::exception &e) {
+    std::printf("%s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
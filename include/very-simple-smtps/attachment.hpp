@@ -3,10 +3,13 @@
 #include <cstdint>
 #include <exception>
 #include <iostream>
+#include <memory_resource>
 #include <string>
 #include <string_view>
 #include <vector>
 
+#include "compression.hpp"
+
 namespace smtp {
 
 class AttachmentException : public std::runtime_error {
@@ -20,17 +23,39 @@ public:
   // This constructor will open the file at file_path in read only mode and will then
   // read the whole file into m_contents
   explicit Attachment(const std::string &file_path);
+  // Same as above but the file is compressed as it is read according to options, so only the
+  // compressed contents are held in memory. See compress().
+  Attachment(const std::string &file_path, const CompressionOptions &options);
 
-  std::string getFilePath() const { return m_file_path; }
+  const std::string &getFilePath() const { return m_file_path; }
   void setFilePath(std::string_view file_path) { m_file_path = file_path; }
 
+  // The MIME type the attachment is sent with
+  const std::string &getContentType() const { return m_content_type; }
+  void setContentType(std::string_view content_type) { m_content_type = content_type; }
+
+  // Replaces the contents with a gzip file or a zip archive holding them, unless the contents are
+  // smaller than options.min_size or do not compress well enough. The file path and content type
+  // are updated to match e.g report.csv becomes report.csv.gz. Returns true if the contents were
+  // compressed.
+  bool compress(const CompressionOptions &options);
+
   // Returns the base64 encoded contents
   std::string getContentsAsB64() const;
+  std::pmr::string getContentsAsB64(std::pmr::memory_resource *resource) const;
   void setContents(const std::vector<uint8_t> &contents);
+  const std::vector<uint8_t> &getContents() const { return m_contents; }
+
+  // Returns the size of the raw contents, before they are base64 encoded
+  std::size_t getContentsSize() const { return m_contents.size(); }
 
 private:
   std::vector<uint8_t> m_contents;
   std::string m_file_path;
+  std::string m_content_type = "application/octet-stream";
+
+  bool useCompressed(std::vector<uint8_t> &&compressed, const CompressionOptions &options,
+                     std::size_t original_size);
 };
 
 } // namespace smtp
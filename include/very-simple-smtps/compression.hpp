@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace smtp {
+
+class CompressionException : public std::runtime_error {
+public:
+  using runtime_error::runtime_error;
+};
+
+enum class CompressionFormat { kNone, kGzip, kZip };
+
+struct CompressionOptions {
+  CompressionFormat format = CompressionFormat::kNone;
+  // zlib compression level, from 1 for the fastest to 9 for the smallest output
+  int level = 6;
+  // Attachments smaller than this many bytes are sent as they are
+  std::size_t min_size = 16 * 1024;
+  // The compressed attachment is only sent if it is at most this percentage of the original size,
+  // otherwise the original is sent so already compressed files are not made larger.
+  std::size_t max_ratio_percent = 90;
+};
+
+// Compresses data that is written to it in chunks into either a gzip file or a zip archive
+// containing a single entry. Only the compressed output is ever held in memory.
+class Compressor {
+public:
+  // entry_name is the name stored inside the gzip header or the zip archive
+  Compressor(CompressionFormat format, int level, std::string_view entry_name);
+  ~Compressor();
+
+  Compressor(const Compressor &) = delete;
+  Compressor &operator=(const Compressor &) = delete;
+
+  void write(const uint8_t *data, std::size_t size);
+  // Completes the file and returns it, nothing can be written afterwards
+  std::vector<uint8_t> finish();
+
+  // Number of bytes written so far, before they were compressed
+  std::size_t inputSize() const;
+
+  // Returns the name of filename once it has been compressed with format e.g report.csv.gz
+  static std::string compressedFilename(std::string_view filename, CompressionFormat format);
+  static std::string_view contentType(CompressionFormat format);
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace smtp
@@ -1,55 +1,188 @@
 #pragma once
 
+#include <cstddef>
+#include <functional>
 #include <memory>
+#include <memory_resource>
+#include <ostream>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <vector>
 
 #include "attachment.hpp"
+#include "credentials.hpp"
 #include "date_time.hpp"
+#include "message_view.hpp"
+#include "recipient_list.hpp"
+#include "transport.hpp"
 
 namespace smtp {
 
+class EmailException : public std::runtime_error {
+public:
+  using runtime_error::runtime_error;
+};
+
+class DkimSigner;
+class RelayPool;
+
 struct EmailParams {
   std::string_view user;
   std::string_view password;
   std::string_view hostname;
 
+  // To, Cc and Bcc take a single address or a comma separated list of them, which may include
+  // display names e.g "Jane <jane@example.com>, bob@example.com"
   std::string_view to;
   std::string_view from;
   std::string_view cc;
   std::string_view subject;
   std::string_view body;
   const DateTime *datetime = nullptr;
+
+  // Messages larger than this many bytes are rejected before anything is uploaded. The size is
+  // also advertised to the server through the SIZE parameter of MAIL FROM. 0 means no limit.
+  std::size_t max_message_size = 0;
+
+  // Signs the email with DKIM when set. The signer holds the parsed private key, so a single
+  // signer can be shared by every email sent for a domain. It must outlive the email.
+  const DkimSigner *dkim = nullptr;
+
+  // Recipients that are sent the email without being listed in its headers
+  std::string_view bcc = {};
+
+  // Largest number of recipients the relay accepts for one message. Every recipient is sent the
+  // same rendered email, in as few transactions as this allows. 0 means no limit.
+  std::size_t max_recipients_per_message = 100;
+
+  // send() refuses an email with a recipient whose address is not valid RFC 5321 syntax, before
+  // connecting to the server. When set the invalid recipients are left out of the envelope
+  // instead, they are still listed by Email::invalidRecipients().
+  bool skip_invalid_recipients = false;
+
+  // Sends the email through a pool of relays with failover instead of the single hostname above.
+  // A pool is shared by every email sent through the same relays and must outlive them.
+  RelayPool *relays = nullptr;
+
+  // Timeouts and the minimum transfer speed of each send
+  SendLimits limits{};
+
+  // Counts what each send allocates from the email's memory resource, including the parts it
+  // renders, and reports it in TransportResult::allocations. Every allocation then costs a few
+  // atomic operations. Sends of the same email from several threads share one peak.
+  bool track_allocations = false;
+
+  // Used instead of user, password and hostname when set. The emails that share them all point at
+  // the same locked copy of the password instead of each holding their own.
+  std::shared_ptr<const Credentials> credentials = nullptr;
 };
 
+class RenderedEmail;
+
 class Email {
 public:
-  explicit Email(const EmailParams &params);
+  // Everything the email owns, including its cached rendered parts, is allocated from resource.
+  // A caller supplied arena can be used to release all of it in one step. Temporaries made by a
+  // build are always allocated from a per build arena which sits on top of resource.
+  explicit Email(const EmailParams &params,
+                 std::pmr::memory_resource *resource = std::pmr::get_default_resource());
 
   ~Email();
 
   void addAttachment(const Attachment &attachment);
   void removeAttachment(std::string_view file_path);
 
+  // Replace the addresses of one kind of recipient. An address is only kept once across To, Cc
+  // and Bcc, so one that is already a recipient of another kind stays where it is.
+  void setTo(std::string_view to);
+  void setFrom(std::string_view from);
+  void setCc(std::string_view cc);
+  void setBcc(std::string_view bcc);
+
+  // Adds to the addresses of one kind of recipient. Returns the number of addresses that were
+  // not recipients of the email already.
+  std::size_t addRecipients(RecipientType type, std::string_view addresses);
+  std::size_t recipientCount() const;
+  // Recipients, as they were given, whose address is not valid. The addresses are checked as they
+  // are added, so this does not validate anything again.
+  std::vector<std::string> invalidRecipients() const;
+  void setSubject(std::string_view subject);
+  void setBody(std::string_view body);
+
   void clear();
-  void send() const;
+  // Sends the email, stop can be used to cancel the send from another thread. Returns how the
+  // send went, including which limit was reached if it timed out.
+  TransportResult send(const StopToken *stop = nullptr) const;
+
+  // Returns the exact number of bytes that will be uploaded for this email. The size is computed
+  // from the lengths of the headers, body and attachments without rendering or encoding anything.
+  std::size_t serializedSize() const;
+
+  // The MIME boundary of this email. It is chosen at random when the email is created and is
+  // replaced if the body is changed to something that contains it.
+  std::string boundary() const;
+
+  // Renders the email into rendered, reusing its buffers. The view of a rendered email points
+  // straight at the cached parts of this email, so it can be written out with writev() or
+  // uploaded without copying the payload.
+  void render(RenderedEmail &rendered) const;
+
+  // The rendered email is made up of immutable parts which are shared with the email's cache.
+  // Only the parts affected by a change are rendered again by the next build, so the parts can
+  // be safely held onto, or built from several threads, while the email is being sent.
+  using Part = std::shared_ptr<const std::pmr::string>;
+  using RenderedParts = std::pmr::vector<Part>;
 
 private:
   struct Impl;
   std::unique_ptr<Impl> m_impl;
 
-  std::vector<std::string> build() const;
+  // Layout of the parts returned by build(), attachments follow the message and the last part
+  // closes the document. The signature part is empty unless the email is signed with DKIM.
+  enum RenderedPart : std::size_t {
+    kSignaturePart,
+    kHeadersPart,
+    kDatePart,
+    kMimeHeaderPart,
+    kMessagePart
+  };
+
+  // Calls body once for every index below count, possibly from several threads at once, and
+  // returns when every call has returned
+  using ForEach =
+      std::function<void(std::size_t count, const std::function<void(std::size_t)> &body)>;
+
+  // arena is used for temporaries, the returned list of parts must not outlive it. When
+  // for_each is set the attachments that have to be encoded are handed to it.
+  RenderedParts build(std::pmr::memory_resource *arena,
+                      const ForEach *for_each = nullptr) const;
+  void renderWith(RenderedEmail &rendered, const ForEach *for_each) const;
   std::string getDatetime() const;
 
-  friend std::ostream &operator<<(std::ostream &out, const Email &email) {
-    const std::vector<std::string> &email_contents = email.build();
-    std::string result;
-    for (const auto &line : email_contents) {
-      result += line;
-    }
-    return out << result;
-  }
+  friend class BatchRenderer;
+  friend class EmailTemplate;
+
+  friend std::ostream &operator<<(std::ostream &out, const Email &email);
+};
+
+// Holds onto the parts of a rendered email for as long as its view is in use
+class RenderedEmail {
+public:
+  RenderedEmail() = default;
+  RenderedEmail(const RenderedEmail &) = delete;
+  RenderedEmail &operator=(const RenderedEmail &) = delete;
+  // The view points into the parts, which stay where they are when the list of them is moved
+  RenderedEmail(RenderedEmail &&) noexcept = default;
+  RenderedEmail &operator=(RenderedEmail &&) noexcept = default;
+
+  const MessageView &view() const { return m_view; }
+
+private:
+  std::vector<Email::Part> m_parts;
+  MessageView m_view;
+
+  friend class Email;
 };
 
 } // namespace smtp
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "attachment.hpp"
+#include "email.hpp"
+
+namespace smtp {
+
+class EmailTemplateException : public std::runtime_error {
+public:
+  using runtime_error::runtime_error;
+};
+
+// An email that has been personalised for a single recipient by EmailTemplate::render(). The
+// segments reference the template, the values it was rendered with and storage inside this
+// object, so all three need to outlive it. Reusing the same MergedEmail for each recipient avoids
+// allocating once its buffers have grown large enough.
+class MergedEmail {
+public:
+  MergedEmail() = default;
+  MergedEmail(const MergedEmail &) = delete;
+  MergedEmail &operator=(const MergedEmail &) = delete;
+
+  // The rendered message as a scatter-gather list, in the order it is sent
+  const MessageView &view() const { return m_view; }
+  std::size_t size() const { return m_view.size(); }
+  // Bytes held by this object rather than by the template, which is all a send of it adds
+  std::size_t personalisedSize() const;
+
+  std::string_view to() const { return m_to; }
+  std::string_view from() const { return m_from; }
+  std::string_view cc() const { return m_cc; }
+
+private:
+  MessageView m_view;
+  std::string m_to;
+  std::string m_from;
+  std::string m_cc;
+  std::string m_date;
+  // Only used when the values stop the message from being sent as 7bit, in which case it is
+  // rendered again for this recipient.
+  std::string m_body;
+  std::pmr::string m_message;
+
+  friend class EmailTemplate;
+};
+
+// Compiles an email into static byte segments and placeholder slots once, so that it can be sent
+// to many recipients without rebuilding the MIME structure or encoding the attachments again.
+// Placeholders are written as {{name}} and may be used in the to, from, cc, subject and body
+// fields. A compiled template is immutable and can be rendered from several threads at once.
+class EmailTemplate {
+public:
+  explicit EmailTemplate(const EmailParams &params,
+                         const std::vector<Attachment> &attachments = {});
+
+  ~EmailTemplate();
+
+  // Names of the placeholders, values must be passed to render() in this order
+  const std::vector<std::string> &slots() const;
+  std::size_t slotIndex(std::string_view name) const;
+
+  // The MIME boundary shared by every email rendered from this template
+  const std::string &boundary() const;
+
+  // Fills in the placeholders for one recipient. Only the personalised fields are copied, every
+  // other segment points into the compiled template. Throws if a value contains the boundary,
+  // since it cannot be changed without compiling the template again, or if a value used in a
+  // header has a CR or LF in it.
+  void render(const std::vector<std::string_view> &values, MergedEmail &merged) const;
+  // Sends to the merged To and Cc lists, which are checked for invalid addresses just like the
+  // recipients of an Email
+  TransportResult send(const MergedEmail &merged, const StopToken *stop = nullptr) const;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace smtp
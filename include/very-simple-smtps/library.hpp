@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+
+#include "credentials.hpp"
+#include "memory_budget.hpp"
+#include "transport.hpp"
+
+namespace smtp {
+
+class LibraryException : public std::runtime_error {
+public:
+  using runtime_error::runtime_error;
+};
+
+struct LibraryOptions {
+  // Connections kept open for each relay and login once their send is over, so that the next
+  // send can skip connecting, the TLS handshake and logging in
+  std::size_t max_idle_connections = 8;
+  // Idle connections are closed rather than reused after this long, relays drop idle clients
+  // after a few minutes. RFC 5321 section 4.5.3.2.7 has servers wait at least five.
+  std::chrono::seconds max_idle_time{60};
+
+  // Bytes of messages that may be queued or in the middle of being sent at once, across every
+  // email, template and send queue. A message counts with the size it renders to, while it sits
+  // in a SendQueue and until its send returns. 0 means no limit.
+  std::size_t memory_budget = 0;
+  // Once the budget is used up a send, or SendQueue::submit(), waits for others to finish. When
+  // set it throws a MemoryBudgetException straight away instead.
+  bool reject_over_budget = false;
+};
+
+// Sets up libcurl, which is not thread safe, along with a DNS cache and a TLS session cache
+// shared by every send and a cache of connections that stay open between sends. Call it before
+// any other thread uses the library, typically at the start of main(). Without it libcurl sets
+// itself up on the first send and every send opens a connection of its own.
+//
+// Calls nest, shutdown() has to be called once for every call to initialize(). The options of
+// the first call apply until the last shutdown().
+void initialize(const LibraryOptions &options = {});
+// Closes the cached connections and releases libcurl. No send may be in progress, or queued.
+void shutdown();
+bool initialized();
+// The budget set by LibraryOptions::memory_budget, null when there is none
+const MemoryBudget *memoryBudget();
+
+// Sets up the library for the lifetime of a scope
+class LibraryGuard {
+public:
+  explicit LibraryGuard(const LibraryOptions &options = {}) { initialize(options); }
+  ~LibraryGuard() { shutdown(); }
+
+  LibraryGuard(const LibraryGuard &) = delete;
+  LibraryGuard &operator=(const LibraryGuard &) = delete;
+};
+
+// Resolves the relay of credentials, then opens up to connections connections to it and logs
+// in on each of them, in parallel. The connections are left in the connection cache for the
+// sends that follow, so a newly started process serves its first emails at the same latency as
+// the rest. No more than LibraryOptions::max_idle_connections are kept. Returns the number of
+// connections that were opened. Throws if the library is not initialized.
+std::size_t prewarm(const Credentials &credentials, std::size_t connections,
+                    const SendLimits &limits = {});
+
+} // namespace smtp
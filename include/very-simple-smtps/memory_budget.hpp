@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+
+namespace smtp {
+
+class MemoryBudgetException : public std::runtime_error {
+public:
+  using runtime_error::runtime_error;
+};
+
+struct MemoryBudgetStats {
+  std::size_t capacity = 0;
+  // Bytes held by reservations that have not been released
+  std::size_t in_use = 0;
+  std::size_t peak = 0;
+  // Callers waiting for memory to be released right now
+  std::size_t waiting = 0;
+  std::size_t admitted = 0;
+  // Reservations that were refused, or that gave up waiting
+  std::size_t rejected = 0;
+};
+
+class MemoryBudget;
+
+// Bytes taken from a budget, they are given back when the reservation is destroyed
+class MemoryReservation {
+public:
+  MemoryReservation() = default;
+  ~MemoryReservation() { release(); }
+
+  MemoryReservation(MemoryReservation &&other) noexcept;
+  MemoryReservation &operator=(MemoryReservation &&other) noexcept;
+  MemoryReservation(const MemoryReservation &) = delete;
+  MemoryReservation &operator=(const MemoryReservation &) = delete;
+
+  std::size_t bytes() const { return m_bytes; }
+  void release();
+
+private:
+  MemoryBudget *m_budget = nullptr;
+  std::size_t m_bytes = 0;
+
+  friend class MemoryBudget;
+};
+
+// Caps the memory of the work admitted at once, e.g the messages that are queued or being sent.
+// Work is admitted with a reservation of its estimated size, and once the budget is used up the
+// next reservation waits for memory to be released or is refused. Callers are admitted in the
+// order they arrive, so a large reservation is not starved by a stream of small ones. The budget
+// can be used from several threads at once.
+class MemoryBudget {
+public:
+  explicit MemoryBudget(std::size_t capacity);
+  // Every reservation must have been released
+  ~MemoryBudget() = default;
+
+  MemoryBudget(const MemoryBudget &) = delete;
+  MemoryBudget &operator=(const MemoryBudget &) = delete;
+
+  // Waits until bytes fit in the budget. Returns nothing if max_wait passes first, or if stop
+  // returns true, it is checked at least every 100ms. A max_wait of 0 waits for as long as it
+  // takes. Throws if bytes is larger than the whole budget, since it would never fit.
+  std::optional<MemoryReservation> acquire(std::size_t bytes,
+                                           std::chrono::milliseconds max_wait = {},
+                                           const std::function<bool()> &stop = {});
+  // Takes bytes only if they fit straight away and nobody is waiting before us
+  std::optional<MemoryReservation> tryAcquire(std::size_t bytes);
+
+  std::size_t capacity() const { return m_capacity; }
+  MemoryBudgetStats stats() const;
+
+private:
+  void release(std::size_t bytes) noexcept;
+  MemoryReservation reserve(std::size_t bytes);
+
+  const std::size_t m_capacity;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_released;
+  std::size_t m_in_use = 0;
+  std::size_t m_peak = 0;
+  std::size_t m_admitted = 0;
+  std::size_t m_rejected = 0;
+  // Bytes wanted by each caller that is waiting, only the first of them may be admitted
+  std::list<std::size_t> m_waiting;
+
+  friend class MemoryReservation;
+};
+
+} // namespace smtp
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include <sys/uio.h>
+
+namespace smtp {
+
+// A non-owning scatter-gather list of the buffers that make up a rendered message. The segments
+// point straight at the headers, boundaries and encoded attachments of whatever rendered the
+// message, so that owner needs to outlive the view. The segments are stored as iovecs so the
+// whole message can be handed to writev() without copying the payload.
+class MessageView {
+public:
+  void append(std::string_view segment);
+  void clear();
+  void reserve(std::size_t num_segments) { m_segments.reserve(num_segments); }
+
+  const std::vector<iovec> &segments() const { return m_segments; }
+  std::string_view segment(std::size_t index) const;
+  std::size_t count() const { return m_segments.size(); }
+
+  // Total number of bytes in the message
+  std::size_t size() const { return m_size; }
+
+  // Writes the whole message to a blocking file descriptor such as a file or a socket using
+  // writev(), partial writes are retried. Throws std::system_error if the write fails.
+  std::size_t writeTo(int fd) const;
+
+private:
+  std::vector<iovec> m_segments;
+  std::size_t m_size = 0;
+};
+
+// Reads a message out of a MessageView sequentially into fixed sized buffers, e.g for libcurl's
+// upload callback. This is the only place bytes are copied and only into the caller's buffer.
+class MessageReader {
+public:
+  explicit MessageReader(const MessageView &view) : m_view{view} {}
+
+  // Returns the number of bytes copied into buffer, 0 once the whole message has been read
+  std::size_t read(char *buffer, std::size_t size);
+
+private:
+  const MessageView &m_view;
+  std::size_t m_segment_index = 0;
+  std::size_t m_segment_offset = 0;
+};
+
+} // namespace smtp
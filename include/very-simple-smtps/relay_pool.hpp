@@ -0,0 +1,89 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "message_view.hpp"
+#include "transport.hpp"
+
+namespace smtp {
+
+class RelayPoolException : public std::runtime_error {
+public:
+  using runtime_error::runtime_error;
+};
+
+struct RelayOptions {
+  // Weight of the newest sample in the moving average of each relay's latency
+  double latency_weight = 0.3;
+  // Consecutive failures that open the circuit of a relay, taking it out of rotation
+  std::size_t failure_threshold = 3;
+  // How long an open circuit stays open before a single trial send is let through
+  std::chrono::milliseconds open_duration{30000};
+};
+
+enum class CircuitState {
+  kClosed,
+  kOpen,
+  // The open period is over and one trial send decides whether the relay is back
+  kHalfOpen,
+};
+
+struct RelayStats {
+  std::string url;
+  CircuitState state = CircuitState::kClosed;
+  // Moving average of the time taken by the sends that went through, 0 until there has been one
+  std::chrono::microseconds latency{0};
+  std::size_t in_flight = 0;
+  std::size_t sent = 0;
+  std::size_t failures = 0;
+  std::size_t consecutive_failures = 0;
+};
+
+// A set of relays that are used interchangeably. Each send goes to the healthy relay with the
+// lowest latency, weighed by the number of sends it already has in flight, and moves on to the
+// next relay if it cannot connect or gets a transient error. A relay that keeps on failing has
+// its circuit opened and is skipped until its open period is over.
+//
+// A pool is meant to be shared by every email sent through the same set of relays, it can be
+// used from several threads at once.
+class RelayPool {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Each relay is a URL just like EmailParams::hostname e.g
+  // "smtps://email-smtp.us-east-1.amazonaws.com:465"
+  explicit RelayPool(const std::vector<std::string_view> &urls, const RelayOptions &options = {});
+  ~RelayPool();
+
+  // Sends the message through the fastest healthy relay, failing over to the others in turn. The
+  // hostname of params is ignored. Batches of recipients that one relay accepted are not sent
+  // again by the next.
+  TransportResult send(TransportParams params, const MessageView &message);
+
+  std::size_t size() const;
+  std::vector<RelayStats> stats() const;
+
+  // The steps of send(), for a caller that talks to the relays itself. acquire() returns the
+  // relay to use next that is not in the excluded bit mask, or nothing if every relay is
+  // excluded or has its circuit open. Each acquired relay must be released with the outcome.
+  std::optional<std::size_t> acquire(uint64_t excluded = 0, Clock::time_point now = Clock::now());
+  void release(std::size_t relay, TransportStatus status, Clock::duration latency,
+               Clock::time_point now = Clock::now());
+  const std::string &url(std::size_t relay) const;
+
+  static constexpr std::size_t kMaxRelays = 64;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace smtp
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "counting_resource.hpp"
+#include "message_view.hpp"
+
+namespace smtp {
+
+// Bounds on how long a send may take, a zero duration means no limit. The defaults follow the
+// longest of the timeouts recommended by RFC 5321 section 4.5.3.2, so a relay that stops
+// responding cannot hold a thread for longer than that.
+struct SendLimits {
+  std::chrono::milliseconds connect_timeout{std::chrono::seconds{30}};
+  // Covers the whole send, every batch of recipients and every relay it is tried on
+  std::chrono::milliseconds timeout{0};
+  // Longest wait for the relay to reply to a command, including the reply to the end of the data
+  std::chrono::seconds response_timeout{std::chrono::minutes{10}};
+  // The send is abandoned if fewer than min_bytes_per_second of the message are uploaded on
+  // average over min_speed_period, which catches a relay that stops reading it
+  std::size_t min_bytes_per_second = 1;
+  std::chrono::seconds min_speed_period{std::chrono::minutes{3}};
+};
+
+// Lets another thread cancel sends that are in progress. A send checks it while the message is
+// being uploaded and whenever libcurl reports progress, which it does at least once a second.
+class StopToken {
+public:
+  void requestStop() { m_stop.store(true, std::memory_order_relaxed); }
+  bool stopRequested() const { return m_stop.load(std::memory_order_relaxed); }
+  void reset() { m_stop.store(false, std::memory_order_relaxed); }
+
+private:
+  std::atomic<bool> m_stop{false};
+};
+
+struct TransportParams {
+  std::string_view user;
+  std::string_view password;
+  std::string_view hostname;
+
+  // Envelope sender and recipients i.e MAIL FROM and RCPT TO
+  std::string_view from;
+  std::vector<std::string_view> recipients;
+
+  // Most relays limit the number of RCPT commands in a transaction, RFC 5321 section 4.5.3.1.8
+  // only guarantees 100. Longer lists of recipients are split into batches of at most this many,
+  // each of which is sent in its own transaction over the same connection. 0 means no limit.
+  std::size_t max_recipients = 0;
+
+  SendLimits limits{};
+  // When the send has to be over by, set from limits.timeout when the send starts if it is not
+  // set already
+  std::optional<std::chrono::steady_clock::time_point> deadline{};
+  const StopToken *stop = nullptr;
+};
+
+enum class TransportStatus {
+  kSent,
+  // The server could not be reached, nothing was sent
+  kConnectFailed,
+  // A 4xx reply or a connection that dropped part way, the message can be sent again
+  kTransientFailure,
+  // A 5xx reply or a problem with the request itself, sending it again will not help
+  kPermanentFailure,
+  // One of the send limits was reached, the reason is in TransportResult::timeout
+  kTimedOut,
+  // Stopped through the stop token
+  kCancelled,
+};
+
+enum class TimeoutReason {
+  kNone,
+  // The relay could not be reached or never greeted us
+  kConnect,
+  // The deadline of the whole send passed
+  kDeadline,
+  // The relay stopped replying to commands or reading the message
+  kStalled,
+};
+
+// How the payload of a message got from the caller to the socket
+enum class PayloadPath {
+  // Copied into user space buffers and encrypted by libcurl or OpenSSL
+  kCopied,
+  // Passed to sendfile() on a socket whose TLS records are encrypted by the kernel
+  kKernelTls,
+  // Passed to sendfile() on a connection without TLS
+  kSendfile,
+};
+
+struct TransportResult {
+  TransportStatus status = TransportStatus::kSent;
+  // Last reply code of the server, 0 if it never replied
+  long response_code = 0;
+  // Number of recipients at the front of the list that do not need to be sent to again, because
+  // their batch was either accepted or refused for good
+  std::size_t recipients_done = 0;
+  TimeoutReason timeout = TimeoutReason::kNone;
+  std::string error;
+  // What the send allocated from the email's memory resource, only filled in when
+  // EmailParams::track_allocations is set. The peak includes what the email held beforehand.
+  AllocationStats allocations{};
+  // Only sendSpool() avoids copying the payload, sendMessage() always copies it
+  PayloadPath payload = PayloadPath::kCopied;
+
+  bool sent() const { return status == TransportStatus::kSent; }
+  // The message may go through if it is sent again, possibly to another relay
+  bool retryable() const {
+    return status == TransportStatus::kConnectFailed ||
+           status == TransportStatus::kTransientFailure ||
+           (status == TransportStatus::kTimedOut && timeout != TimeoutReason::kDeadline);
+  }
+};
+
+// Uploads a rendered message to the smtp server. The segments of the message are streamed to the
+// server in order without being joined together first. A batch of recipients that is refused for
+// good does not stop the batches after it, but the first connect or transient failure does.
+TransportResult sendMessage(const TransportParams &params, const MessageView &message);
+
+} // namespace smtp
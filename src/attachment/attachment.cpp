@@ -8,6 +8,9 @@
 
 namespace smtp {
 
+// Files are read and compressed this many bytes at a time
+static constexpr std::size_t kReadChunkSize = 64 * 1024;
+
 Attachment::Attachment(const std::string &file_path) : m_file_path{file_path} {
   std::ifstream ifs(file_path, std::ifstream::binary);
   // TODO: Find a better method since this is really slow!
@@ -23,8 +26,69 @@ Attachment::Attachment(const std::string &file_path) : m_file_path{file_path} {
   m_contents = std::vector<uint8_t>(file_contents.begin(), file_contents.end());
 }
 
+Attachment::Attachment(const std::string &file_path, const CompressionOptions &options)
+    : m_file_path{file_path} {
+  std::ifstream ifs(file_path, std::ifstream::binary | std::ifstream::ate);
+  if (!ifs) {
+    throw AttachmentException("[!] Failed to open file: " + file_path);
+  }
+  const auto file_size = static_cast<std::size_t>(ifs.tellg());
+  ifs.seekg(0);
+
+  if (options.format == CompressionFormat::kNone || file_size < options.min_size) {
+    *this = Attachment{file_path};
+    return;
+  }
+
+  Compressor compressor{options.format, options.level, file_path};
+  std::vector<uint8_t> chunk(kReadChunkSize);
+  while (ifs) {
+    ifs.read(reinterpret_cast<char *>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+    compressor.write(chunk.data(), static_cast<std::size_t>(ifs.gcount()));
+  }
+  if (ifs.bad()) {
+    throw AttachmentException("[!] Failed to read file: " + file_path);
+  }
+
+  // The file did not compress well, so it is read again and sent as it is
+  if (!useCompressed(compressor.finish(), options, compressor.inputSize())) {
+    *this = Attachment{file_path};
+  }
+}
+
 std::string Attachment::getContentsAsB64() const { return Base64::Base64Encode(m_contents); }
 
+std::pmr::string Attachment::getContentsAsB64(std::pmr::memory_resource *resource) const {
+  return Base64::Base64Encode(m_contents, resource);
+}
+
 void Attachment::setContents(const std::vector<uint8_t> &contents) { m_contents = contents; }
 
+bool Attachment::compress(const CompressionOptions &options) {
+  if (options.format == CompressionFormat::kNone || m_contents.size() < options.min_size) {
+    return false;
+  }
+
+  // The contents are fed to the compressor in chunks, like a file being read would be
+  Compressor compressor{options.format, options.level, m_file_path};
+  for (std::size_t offset = 0; offset < m_contents.size(); offset += kReadChunkSize) {
+    compressor.write(m_contents.data() + offset,
+                     std::min(kReadChunkSize, m_contents.size() - offset));
+  }
+
+  return useCompressed(compressor.finish(), options, m_contents.size());
+}
+
+bool Attachment::useCompressed(std::vector<uint8_t> &&compressed,
+                               const CompressionOptions &options, std::size_t original_size) {
+  if (compressed.size() * 100 > original_size * options.max_ratio_percent) {
+    return false;
+  }
+
+  m_contents = std::move(compressed);
+  m_file_path = Compressor::compressedFilename(m_file_path, options.format);
+  m_content_type = Compressor::contentType(options.format);
+  return true;
+}
+
 } // namespace smtp
@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <climits>
+#include <ctime>
+
+#include "attachment/compression.hpp"
+
+#include "zlib.h"
+
+namespace smtp {
+
+// Output grows by at least this much at a time
+static constexpr std::size_t kOutputChunk = 64 * 1024;
+
+// zlib window size, negated for a raw deflate stream and offset by 16 for a gzip wrapper
+static constexpr int kWindowBits = 15;
+static constexpr int kGzipWindowBits = kWindowBits + 16;
+static constexpr int kMemoryLevel = 8;
+
+// Sizes of the records of a zip archive, see section 4.3 of the PKWARE APPNOTE
+static constexpr std::size_t kZipLocalHeaderSize = 30;
+static constexpr std::size_t kZipCentralHeaderSize = 46;
+static constexpr std::size_t kZipEndOfCentralSize = 22;
+static constexpr uint32_t kZipLocalSignature = 0x04034b50;
+static constexpr uint32_t kZipCentralSignature = 0x02014b50;
+static constexpr uint32_t kZipEndOfCentralSignature = 0x06054b50;
+static constexpr uint16_t kZipVersion = 20;
+// The entry name is UTF-8
+static constexpr uint16_t kZipFlags = 0x0800;
+static constexpr uint16_t kZipDeflate = 8;
+static constexpr uint32_t kZipMaxSize = 0xffffffff;
+
+static std::string_view filenameOf(std::string_view path) {
+  const std::size_t slash = path.rfind('/');
+  return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+static void putLE(std::vector<uint8_t> &out, std::size_t offset, uint64_t value,
+                  std::size_t size) {
+  for (std::size_t i = 0; i < size; i++) {
+    out[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+static void appendLE(std::vector<uint8_t> &out, uint64_t value, std::size_t size) {
+  out.resize(out.size() + size);
+  putLE(out, out.size() - size, value, size);
+}
+
+// Zip archives store the modification time in MS-DOS format
+static void dosDateTime(uint16_t &dos_time, uint16_t &dos_date) {
+  const std::time_t now = std::time(nullptr);
+  std::tm local{};
+  localtime_r(&now, &local);
+  dos_time =
+      static_cast<uint16_t>((local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2));
+  dos_date = static_cast<uint16_t>((std::max(local.tm_year - 80, 0) << 9) |
+                                   ((local.tm_mon + 1) << 5) | local.tm_mday);
+}
+
+struct Compressor::Impl {
+  CompressionFormat m_format;
+  std::string m_entry_name;
+  z_stream m_stream{};
+  gz_header m_gzip_header{};
+  std::vector<uint8_t> m_output;
+  // Where the compressed data starts inside of m_output, a zip archive starts with its header
+  std::size_t m_data_offset = 0;
+  std::size_t m_input_size = 0;
+  uLong m_crc = crc32(0, Z_NULL, 0);
+  bool m_finished = false;
+
+  void deflateInto(int flush);
+};
+
+Compressor::Compressor(CompressionFormat format, int level, std::string_view entry_name)
+    : m_impl{std::make_unique<Impl>()} {
+  if (format == CompressionFormat::kNone) {
+    throw CompressionException("[!] No compression format was given");
+  }
+
+  m_impl->m_format = format;
+  m_impl->m_entry_name = filenameOf(entry_name);
+
+  const int window_bits = format == CompressionFormat::kGzip ? kGzipWindowBits : -kWindowBits;
+  if (deflateInit2(&m_impl->m_stream, std::clamp(level, 1, 9), Z_DEFLATED, window_bits,
+                   kMemoryLevel, Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw CompressionException("[!] Failed to initialise zlib");
+  }
+
+  if (format == CompressionFormat::kGzip) {
+    // Lets gunzip -N restore the original name
+    m_impl->m_gzip_header.name = reinterpret_cast<Bytef *>(m_impl->m_entry_name.data());
+    m_impl->m_gzip_header.time = static_cast<uLong>(std::time(nullptr));
+    deflateSetHeader(&m_impl->m_stream, &m_impl->m_gzip_header);
+  } else {
+    // The local header is filled in once the sizes and checksum are known
+    m_impl->m_data_offset = kZipLocalHeaderSize + m_impl->m_entry_name.size();
+    m_impl->m_output.resize(m_impl->m_data_offset);
+  }
+}
+
+Compressor::~Compressor() {
+  if (!m_impl->m_finished) {
+    deflateEnd(&m_impl->m_stream);
+  }
+}
+
+void Compressor::Impl::deflateInto(int flush) {
+  int result = Z_OK;
+  do {
+    const std::size_t used = m_data_offset + m_stream.total_out;
+    if (m_output.size() - used < kOutputChunk) {
+      m_output.resize(used + kOutputChunk);
+    }
+    m_stream.next_out = m_output.data() + used;
+    m_stream.avail_out = static_cast<uInt>(m_output.size() - used);
+
+    result = deflate(&m_stream, flush);
+    if (result == Z_STREAM_ERROR) {
+      throw CompressionException("[!] Failed to compress attachment");
+    }
+  } while (m_stream.avail_out == 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+}
+
+void Compressor::write(const uint8_t *data, std::size_t size) {
+  if (m_impl->m_finished) {
+    throw CompressionException("[!] Compressor has already finished");
+  }
+
+  m_impl->m_input_size += size;
+  while (size > 0) {
+    const auto chunk = static_cast<uInt>(std::min<std::size_t>(size, UINT_MAX));
+    m_impl->m_crc = crc32(m_impl->m_crc, data, chunk);
+
+    m_impl->m_stream.next_in = const_cast<Bytef *>(data);
+    m_impl->m_stream.avail_in = chunk;
+    m_impl->deflateInto(Z_NO_FLUSH);
+
+    data += chunk;
+    size -= chunk;
+  }
+}
+
+std::vector<uint8_t> Compressor::finish() {
+  if (m_impl->m_finished) {
+    throw CompressionException("[!] Compressor has already finished");
+  }
+
+  m_impl->m_stream.next_in = nullptr;
+  m_impl->m_stream.avail_in = 0;
+  m_impl->deflateInto(Z_FINISH);
+  m_impl->m_finished = true;
+
+  const std::size_t compressed_size = m_impl->m_stream.total_out;
+  deflateEnd(&m_impl->m_stream);
+
+  std::vector<uint8_t> &out = m_impl->m_output;
+  out.resize(m_impl->m_data_offset + compressed_size);
+  if (m_impl->m_format == CompressionFormat::kGzip) {
+    return std::move(out);
+  }
+
+  if (m_impl->m_input_size > kZipMaxSize || compressed_size > kZipMaxSize) {
+    throw CompressionException("[!] Attachment is too large for a zip archive, use gzip");
+  }
+
+  const std::string &name = m_impl->m_entry_name;
+  uint16_t dos_time = 0;
+  uint16_t dos_date = 0;
+  dosDateTime(dos_time, dos_date);
+
+  // Fields shared by the local header and the central directory header
+  const auto &appendEntry = [&](std::vector<uint8_t> &record) {
+    appendLE(record, kZipVersion, 2);
+    appendLE(record, kZipFlags, 2);
+    appendLE(record, kZipDeflate, 2);
+    appendLE(record, dos_time, 2);
+    appendLE(record, dos_date, 2);
+    appendLE(record, m_impl->m_crc, 4);
+    appendLE(record, compressed_size, 4);
+    appendLE(record, m_impl->m_input_size, 4);
+    appendLE(record, name.size(), 2);
+    appendLE(record, 0, 2); // extra field length
+  };
+
+  std::vector<uint8_t> header;
+  header.reserve(kZipLocalHeaderSize);
+  appendLE(header, kZipLocalSignature, 4);
+  appendEntry(header);
+  std::copy(header.begin(), header.end(), out.begin());
+  std::copy(name.begin(), name.end(), out.begin() + kZipLocalHeaderSize);
+
+  const std::size_t central_offset = out.size();
+  appendLE(out, kZipCentralSignature, 4);
+  appendLE(out, kZipVersion, 2); // version made by
+  appendEntry(out);
+  appendLE(out, 0, 2); // comment length
+  appendLE(out, 0, 2); // disk number
+  appendLE(out, 0, 2); // internal attributes
+  appendLE(out, 0, 4); // external attributes
+  appendLE(out, 0, 4); // offset of the local header
+  out.insert(out.end(), name.begin(), name.end());
+
+  appendLE(out, kZipEndOfCentralSignature, 4);
+  appendLE(out, 0, 2); // disk number
+  appendLE(out, 0, 2); // disk with the central directory
+  appendLE(out, 1, 2); // entries on this disk
+  appendLE(out, 1, 2); // total entries
+  appendLE(out, kZipCentralHeaderSize + name.size(), 4);
+  appendLE(out, central_offset, 4);
+  appendLE(out, 0, 2); // comment length
+
+  return std::move(out);
+}
+
+std::size_t Compressor::inputSize() const { return m_impl->m_input_size; }
+
+std::string Compressor::compressedFilename(std::string_view filename, CompressionFormat format) {
+  switch (format) {
+  case CompressionFormat::kGzip:
+    return std::string{filename} + ".gz";
+  case CompressionFormat::kZip:
+    return std::string{filename} + ".zip";
+  case CompressionFormat::kNone:
+    break;
+  }
+  return std::string{filename};
+}
+
+std::string_view Compressor::contentType(CompressionFormat format) {
+  switch (format) {
+  case CompressionFormat::kGzip:
+    return "application/gzip";
+  case CompressionFormat::kZip:
+    return "application/zip";
+  case CompressionFormat::kNone:
+    break;
+  }
+  return "application/octet-stream";
+}
+
+} // namespace smtp
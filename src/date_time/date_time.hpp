@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
 
 namespace smtp {
@@ -8,6 +9,10 @@ class DateTime {
 public:
   virtual ~DateTime() = default;
   virtual std::string getTimestamp() const = 0;
+
+  // Length of the string returned by getTimestamp(). Implementations with a fixed format should
+  // override this so the size of an email can be computed without formatting a timestamp.
+  virtual std::size_t getTimestampLength() const { return getTimestamp().size(); }
 };
 
 } // namespace smtp
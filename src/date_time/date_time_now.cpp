@@ -6,6 +6,9 @@
 
 namespace smtp {
 
+// e.g 25/07/2023 07:21:05 +1100
+static constexpr std::size_t kTimestampLength = 25;
+
 std::string DateTimeNow::getTimestamp() const {
   auto cur_time = std::chrono::system_clock::now();
   const std::time_t &time_t_obj = std::chrono::system_clock::to_time_t(cur_time);
@@ -16,4 +19,6 @@ std::string DateTimeNow::getTimestamp() const {
   return ss.str();
 }
 
+std::size_t DateTimeNow::getTimestampLength() const { return kTimestampLength; }
+
 } // namespace smtp
@@ -7,6 +7,7 @@ namespace smtp {
 class DateTimeNow : public DateTime {
 public:
   std::string getTimestamp() const override;
+  std::size_t getTimestampLength() const override;
 };
 
 } // namespace smtp
@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <cctype>
+#include <climits>
+
+#include "dkim/dkim.hpp"
+#include "utils/base64/base64.hpp"
+
+#include "openssl/evp.h"
+#include "openssl/pem.h"
+
+namespace smtp {
+
+static constexpr std::string_view kSignatureField = "DKIM-Signature";
+static constexpr std::string_view kCRLF = "\r\n";
+// Continuation of a folded header line
+static constexpr std::string_view kFold = "\r\n\t";
+
+// The signature is folded into lines of this many characters
+static constexpr std::size_t kSignatureLineLength = 72;
+
+// Canonicalized output is collected here before it is hashed, so the digest is not updated once
+// for every word of the body.
+static constexpr std::size_t kHashBufferSize = 4096;
+
+using DigestContext = std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)>;
+using PrivateKey = std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>;
+
+static bool isWsp(char c) { return c == ' ' || c == '\t'; }
+
+// Number of characters std::to_string() gives for value
+static std::size_t decimalLength(std::time_t value) {
+  std::size_t length = value < 0 ? 2 : 1;
+  for (; value / 10 != 0; value /= 10) {
+    length++;
+  }
+  return length;
+}
+
+static std::string base64Of(const uint8_t *data, std::size_t size) {
+  return Base64::Base64Encode(std::vector<uint8_t>(data, data + size));
+}
+
+static bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return std::tolower(static_cast<unsigned char>(x)) ==
+                  std::tolower(static_cast<unsigned char>(y));
+         });
+}
+
+struct HeaderField {
+  std::string_view name;
+  // Everything after the colon, including any folded lines but not the final CRLF
+  std::string_view value;
+};
+
+static void parseFields(std::string_view block, std::vector<HeaderField> &fields) {
+  const std::size_t first_field = fields.size();
+  std::size_t pos = 0;
+  while (pos < block.size()) {
+    std::size_t end = block.find(kCRLF, pos);
+    if (end == std::string_view::npos) {
+      end = block.size();
+    }
+
+    const std::string_view line = block.substr(pos, end - pos);
+    if (!line.empty() && isWsp(line.front()) && fields.size() > first_field) {
+      HeaderField &field = fields.back();
+      field.value = {field.value.data(),
+                     static_cast<std::size_t>(block.data() + end - field.value.data())};
+    } else if (const std::size_t colon = line.find(':'); colon != std::string_view::npos) {
+      fields.push_back({line.substr(0, colon), line.substr(colon + 1)});
+    }
+
+    pos = end + kCRLF.size();
+  }
+}
+
+// Relaxed header canonicalization, RFC 6376 section 3.4.2. The name is lowercased, the value is
+// unfolded and every run of whitespace becomes a single space, leading and trailing whitespace
+// is removed. No CRLF is appended.
+static void appendRelaxedField(const HeaderField &field, std::string &out) {
+  std::string_view name = field.name;
+  while (!name.empty() && isWsp(name.back())) {
+    name.remove_suffix(1);
+  }
+  for (const char c : name) {
+    out.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+  }
+  out.push_back(':');
+
+  bool whitespace = false;
+  bool started = false;
+  for (const char c : field.value) {
+    if (c == '\r' || c == '\n') {
+      continue;
+    }
+    if (isWsp(c)) {
+      whitespace = true;
+      continue;
+    }
+    if (whitespace && started) {
+      out.push_back(' ');
+    }
+    whitespace = false;
+    started = true;
+    out.push_back(c);
+  }
+}
+
+struct DkimBodyHasher::Impl {
+  DigestContext m_context{EVP_MD_CTX_new(), &EVP_MD_CTX_free};
+  std::array<char, kHashBufferSize> m_buffer;
+  std::size_t m_used = 0;
+
+  // Empty lines are only written once something follows them, since the empty lines at the end
+  // of the body are ignored. Whitespace is likewise held back until the line continues.
+  std::size_t m_pending_lines = 0;
+  bool m_pending_whitespace = false;
+  bool m_pending_cr = false;
+  bool m_has_content = false;
+  bool m_finished = false;
+
+  void put(char c) {
+    if (m_used == m_buffer.size()) {
+      flush();
+    }
+    m_buffer[m_used++] = c;
+  }
+
+  void flush() {
+    if (m_used > 0 && EVP_DigestUpdate(m_context.get(), m_buffer.data(), m_used) != 1) {
+      throw DkimException("[!] Failed to hash the message body");
+    }
+    m_used = 0;
+  }
+
+  void content(char c) {
+    for (; m_pending_lines > 0; m_pending_lines--) {
+      put('\r');
+      put('\n');
+    }
+    if (m_pending_whitespace) {
+      put(' ');
+      m_pending_whitespace = false;
+    }
+    put(c);
+    m_has_content = true;
+  }
+
+  void endLine() {
+    // Whitespace at the end of a line is dropped
+    m_pending_whitespace = false;
+    m_pending_lines++;
+  }
+};
+
+DkimBodyHasher::DkimBodyHasher() : m_impl{std::make_unique<Impl>()} {
+  if (!m_impl->m_context ||
+      EVP_DigestInit_ex(m_impl->m_context.get(), EVP_sha256(), nullptr) != 1) {
+    throw DkimException("[!] Failed to start hashing the message body");
+  }
+}
+
+DkimBodyHasher::~DkimBodyHasher() = default;
+
+void DkimBodyHasher::update(std::string_view chunk) {
+  if (m_impl->m_finished) {
+    throw DkimException("[!] Body hash has already been finished");
+  }
+
+  Impl &impl = *m_impl;
+  for (const char c : chunk) {
+    // Only a CR followed by a LF ends a line, the CR may be at the end of the previous chunk
+    if (impl.m_pending_cr) {
+      impl.m_pending_cr = false;
+      if (c == '\n') {
+        impl.endLine();
+        continue;
+      }
+      impl.content('\r');
+    }
+
+    if (c == '\r') {
+      impl.m_pending_cr = true;
+    } else if (isWsp(c)) {
+      impl.m_pending_whitespace = true;
+    } else {
+      impl.content(c);
+    }
+  }
+}
+
+DkimBodyHash DkimBodyHasher::finish() {
+  if (m_impl->m_finished) {
+    throw DkimException("[!] Body hash has already been finished");
+  }
+  m_impl->m_finished = true;
+
+  Impl &impl = *m_impl;
+  if (impl.m_pending_cr) {
+    impl.content('\r');
+  }
+  // A body that is not empty always ends with exactly one CRLF
+  if (impl.m_has_content) {
+    impl.put('\r');
+    impl.put('\n');
+  }
+  impl.flush();
+
+  DkimBodyHash hash;
+  unsigned int size = 0;
+  if (EVP_DigestFinal_ex(impl.m_context.get(), hash.data(), &size) != 1 || size != hash.size()) {
+    throw DkimException("[!] Failed to hash the message body");
+  }
+  return hash;
+}
+
+struct DkimSigner::Impl {
+  std::string m_domain;
+  std::string m_selector;
+  std::vector<std::string> m_headers;
+  // Value of the h= tag
+  std::string m_header_list;
+  PrivateKey m_key{nullptr, &EVP_PKEY_free};
+  DkimAlgorithm m_algorithm = DkimAlgorithm::kRsaSha256;
+  // Size of a signature in bytes, before it is base64 encoded
+  std::size_t m_signature_size = 0;
+
+  std::string_view algorithmTag() const;
+  // The header field up to and including "b=", where the folded signature goes
+  std::string unsignedField(std::string_view body_hash, std::time_t timestamp) const;
+  // Size of unsignedField() for a body hash of hash_size characters, without building it
+  std::size_t unsignedFieldSize(std::size_t hash_size, std::time_t timestamp) const;
+  std::string signData(std::string_view data) const;
+};
+
+DkimSigner::DkimSigner(const DkimParams &params) : m_impl{std::make_unique<Impl>()} {
+  if (params.domain.empty() || params.selector.empty()) {
+    throw DkimException("[!] DKIM signing needs both a domain and a selector");
+  }
+  // RFC 6376 section 5.4 requires From to be signed
+  if (std::none_of(params.headers.begin(), params.headers.end(),
+                   [](const std::string &name) { return equalsIgnoreCase(name, "From"); })) {
+    throw DkimException("[!] DKIM signed headers must include From");
+  }
+  if (params.private_key.size() > INT_MAX) {
+    throw DkimException("[!] DKIM private key is too large");
+  }
+
+  m_impl->m_domain = params.domain;
+  m_impl->m_selector = params.selector;
+  m_impl->m_headers = params.headers;
+  for (const auto &name : params.headers) {
+    if (!m_impl->m_header_list.empty()) {
+      m_impl->m_header_list.push_back(':');
+    }
+    m_impl->m_header_list.append(name);
+  }
+
+  // Parsing the key is by far the slowest part of signing, so it is only done once. Encrypted
+  // keys are rejected rather than prompting for a passphrase.
+  const std::unique_ptr<BIO, decltype(&BIO_free)> bio{
+      BIO_new_mem_buf(params.private_key.data(), static_cast<int>(params.private_key.size())),
+      &BIO_free};
+  const auto &no_passphrase = [](char *, int, int, void *) { return 0; };
+  m_impl->m_key.reset(
+      bio ? PEM_read_bio_PrivateKey(bio.get(), nullptr, no_passphrase, nullptr) : nullptr);
+  if (!m_impl->m_key) {
+    throw DkimException("[!] Failed to parse the DKIM private key");
+  }
+
+  switch (EVP_PKEY_get_base_id(m_impl->m_key.get())) {
+  case EVP_PKEY_RSA:
+    m_impl->m_algorithm = DkimAlgorithm::kRsaSha256;
+    break;
+  case EVP_PKEY_ED25519:
+    m_impl->m_algorithm = DkimAlgorithm::kEd25519Sha256;
+    break;
+  default:
+    throw DkimException("[!] DKIM private key must be an RSA or Ed25519 key");
+  }
+  m_impl->m_signature_size = static_cast<std::size_t>(EVP_PKEY_get_size(m_impl->m_key.get()));
+}
+
+DkimSigner::~DkimSigner() = default;
+
+DkimAlgorithm DkimSigner::algorithm() const { return m_impl->m_algorithm; }
+
+std::string_view DkimSigner::Impl::algorithmTag() const {
+  return m_algorithm == DkimAlgorithm::kRsaSha256 ? "rsa-sha256" : "ed25519-sha256";
+}
+
+std::string DkimSigner::Impl::unsignedField(std::string_view body_hash,
+                                            std::time_t timestamp) const {
+  std::string field;
+  field.append(kSignatureField).append(": v=1; a=").append(algorithmTag());
+  field.append("; c=relaxed/relaxed; d=").append(m_domain);
+  field.append("; s=").append(m_selector).append(";").append(kFold);
+  field.append("t=").append(std::to_string(timestamp));
+  field.append("; h=").append(m_header_list).append(";").append(kFold);
+  field.append("bh=").append(body_hash).append(";").append(kFold);
+  field.append("b=");
+  return field;
+}
+
+std::size_t DkimSigner::Impl::unsignedFieldSize(std::size_t hash_size,
+                                                std::time_t timestamp) const {
+  // The fixed text of every tag in unsignedField(), in the same order
+  constexpr std::string_view tags[] = {": v=1; a=", "; c=relaxed/relaxed; d=", "; s=", ";",
+                                       "t=",        "; h=",                    ";",    "bh=",
+                                       ";",         "b="};
+  std::size_t size = kSignatureField.size() + 3 * kFold.size();
+  for (const std::string_view tag : tags) {
+    size += tag.size();
+  }
+  return size + algorithmTag().size() + m_domain.size() + m_selector.size() +
+         decimalLength(timestamp) + m_header_list.size() + hash_size;
+}
+
+std::string DkimSigner::Impl::signData(std::string_view data) const {
+  const DigestContext context{EVP_MD_CTX_new(), &EVP_MD_CTX_free};
+  if (!context) {
+    throw DkimException("[!] Failed to create the DKIM signing context");
+  }
+
+  // ed25519-sha256 signs the SHA-256 hash of the headers rather than the headers themselves,
+  // see RFC 8463 section 3.
+  std::array<uint8_t, EVP_MAX_MD_SIZE> digest;
+  unsigned int digest_size = 0;
+  const EVP_MD *md = EVP_sha256();
+  const auto *input = reinterpret_cast<const uint8_t *>(data.data());
+  std::size_t input_size = data.size();
+  if (m_algorithm == DkimAlgorithm::kEd25519Sha256) {
+    if (EVP_Digest(data.data(), data.size(), digest.data(), &digest_size, md, nullptr) != 1) {
+      throw DkimException("[!] Failed to hash the DKIM signed headers");
+    }
+    input = digest.data();
+    input_size = digest_size;
+    md = nullptr;
+  }
+
+  std::string signature(m_signature_size, '\0');
+  std::size_t signature_size = signature.size();
+  if (EVP_DigestSignInit(context.get(), nullptr, md, nullptr, m_key.get()) != 1 ||
+      EVP_DigestSign(context.get(), reinterpret_cast<uint8_t *>(signature.data()),
+                     &signature_size, input, input_size) != 1) {
+    throw DkimException("[!] Failed to sign the message with DKIM");
+  }
+  signature.resize(signature_size);
+  return signature;
+}
+
+std::string DkimSigner::sign(const std::vector<std::string_view> &header_blocks,
+                             const DkimBodyHash &body_hash, std::time_t timestamp) const {
+  std::vector<HeaderField> fields;
+  for (const std::string_view block : header_blocks) {
+    parseFields(block, fields);
+  }
+
+  // Each listed name takes the last instance of the field that has not been used yet, RFC 6376
+  // section 5.4.2. Names without a remaining instance contribute nothing.
+  std::string data;
+  std::vector<bool> used(fields.size());
+  for (const auto &name : m_impl->m_headers) {
+    for (std::size_t i = fields.size(); i-- > 0;) {
+      if (!used[i] && equalsIgnoreCase(fields[i].name, name)) {
+        used[i] = true;
+        appendRelaxedField(fields[i], data);
+        data.append(kCRLF);
+        break;
+      }
+    }
+  }
+
+  // The signature field itself is signed last, with an empty b= tag and no trailing CRLF
+  const std::string &encoded_hash = base64Of(body_hash.data(), body_hash.size());
+  std::string field = m_impl->unsignedField(encoded_hash, timestamp);
+  const std::string_view name = kSignatureField;
+  appendRelaxedField({name, std::string_view{field}.substr(name.size() + 1)}, data);
+
+  const std::string &signature = m_impl->signData(data);
+  const std::string &encoded =
+      base64Of(reinterpret_cast<const uint8_t *>(signature.data()), signature.size());
+  for (std::size_t pos = 0; pos < encoded.size(); pos += kSignatureLineLength) {
+    if (pos > 0) {
+      field.append(kFold);
+    }
+    field.append(encoded, pos, kSignatureLineLength);
+  }
+  field.append(kCRLF);
+  return field;
+}
+
+std::size_t DkimSigner::signatureSize(std::time_t timestamp) const {
+  const std::size_t hash_size = Base64::EncodedSize(std::tuple_size_v<DkimBodyHash>);
+  const std::size_t signature_size = Base64::EncodedSize(m_impl->m_signature_size);
+  const std::size_t folds = (signature_size + kSignatureLineLength - 1) / kSignatureLineLength;
+
+  return m_impl->unsignedFieldSize(hash_size, timestamp) + signature_size +
+         (folds > 0 ? folds - 1 : 0) * kFold.size() + kCRLF.size();
+}
+
+} // namespace smtp
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace smtp {
+
+class DkimException : public std::runtime_error {
+public:
+  using runtime_error::runtime_error;
+};
+
+enum class DkimAlgorithm { kRsaSha256, kEd25519Sha256 };
+
+using DkimBodyHash = std::array<uint8_t, 32>;
+
+// Hashes a message body with SHA-256 after applying the relaxed body canonicalization of
+// RFC 6376 section 3.4.4. The body is fed in as consecutive chunks of any size, so it can be
+// hashed part by part as the message is rendered without ever being joined together.
+class DkimBodyHasher {
+public:
+  DkimBodyHasher();
+  ~DkimBodyHasher();
+
+  DkimBodyHasher(const DkimBodyHasher &) = delete;
+  DkimBodyHasher &operator=(const DkimBodyHasher &) = delete;
+
+  void update(std::string_view chunk);
+  // Completes the hash, nothing can be fed in afterwards
+  DkimBodyHash finish();
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_impl;
+};
+
+struct DkimParams {
+  // Signing domain and selector, the public key is published at <selector>._domainkey.<domain>
+  std::string_view domain;
+  std::string_view selector;
+  // PEM encoded RSA or Ed25519 private key, the algorithm is chosen from the type of the key
+  std::string_view private_key;
+  // Header fields covered by the signature. Fields missing from a message are still listed so
+  // that they cannot be added to it later without breaking the signature.
+  std::vector<std::string> headers = {"From",    "To",           "Cc",
+                                      "Subject", "MIME-Version", "Content-Type"};
+};
+
+// Signs messages with DKIM (RFC 6376) using relaxed/relaxed canonicalization and either
+// rsa-sha256 or ed25519-sha256 (RFC 8463). The private key is parsed once when the signer is
+// created, so a single signer should be shared by every email sent for the domain. Signing does
+// not modify the signer and can be done from several threads at once.
+class DkimSigner {
+public:
+  explicit DkimSigner(const DkimParams &params);
+  ~DkimSigner();
+
+  DkimSigner(const DkimSigner &) = delete;
+  DkimSigner &operator=(const DkimSigner &) = delete;
+
+  DkimAlgorithm algorithm() const;
+
+  // Returns the DKIM-Signature header field, ending in a CRLF, to be put in front of a message.
+  // header_blocks hold the header fields of the message in order, every block made of complete
+  // CRLF terminated fields, and body_hash comes from a DkimBodyHasher fed the message body.
+  std::string sign(const std::vector<std::string_view> &header_blocks,
+                   const DkimBodyHash &body_hash,
+                   std::time_t timestamp = std::time(nullptr)) const;
+
+  // Exact size of the header field returned by sign(), which does not depend on the message
+  std::size_t signatureSize(std::time_t timestamp = std::time(nullptr)) const;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace smtp
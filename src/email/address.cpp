@@ -0,0 +1,305 @@
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#include "email/address.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace smtp {
+
+// Character classes of RFC 5321 section 4.1.2, the scalar path and the tails of the SIMD path
+// look characters up here
+enum CharClass : uint8_t {
+  kAtext = 1 << 0,
+  kLetDig = 1 << 1,
+  kHyphen = 1 << 2,
+  kDot = 1 << 3,
+  kDtext = 1 << 4,
+  kQtext = 1 << 5,
+};
+
+static constexpr std::string_view kAtextSymbols = "!#$%&'*+-/=?^_`{|}~";
+
+// Printable characters that are not atext, apart from the dot which separates atoms
+static constexpr std::string_view kSpecials = "\"(),:;<>@[\\]";
+
+static constexpr std::array<uint8_t, 256> makeCharClasses() {
+  std::array<uint8_t, 256> classes{};
+  for (int c = 0; c < 256; c++) {
+    const bool letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    const bool digit = c >= '0' && c <= '9';
+    uint8_t value = 0;
+    if (letter || digit) {
+      value |= kAtext | kLetDig;
+    }
+    if (kAtextSymbols.find(static_cast<char>(c)) != std::string_view::npos) {
+      value |= kAtext;
+    }
+    if (c == '-') {
+      value |= kHyphen;
+    }
+    if (c == '.') {
+      value |= kDot;
+    }
+    if ((c >= 33 && c <= 90) || (c >= 94 && c <= 126)) {
+      value |= kDtext;
+    }
+    if (c == 32 || c == 33 || (c >= 35 && c <= 91) || (c >= 93 && c <= 126)) {
+      value |= kQtext;
+    }
+    classes[static_cast<std::size_t>(c)] = value;
+  }
+  return classes;
+}
+
+static constexpr std::array<uint8_t, 256> kCharClasses = makeCharClasses();
+
+static bool hasClass(char c, uint8_t classes) {
+  return (kCharClasses[static_cast<unsigned char>(c)] & classes) != 0;
+}
+
+static bool allOfClass(std::string_view text, std::size_t pos, uint8_t classes) {
+  for (; pos < text.size(); pos++) {
+    if (!hasClass(text[pos], classes)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#if defined(__SSE2__)
+// Bytes between low and high inclusive. Bytes of 0x80 and above compare as negative, so they are
+// never inside of a printable range.
+static __m128i inRange(__m128i block, char low, char high) {
+  return _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8(static_cast<char>(low - 1))),
+                       _mm_cmplt_epi8(block, _mm_set1_epi8(static_cast<char>(high + 1))));
+}
+
+static const __m128i *blockAt(std::string_view text, std::size_t pos) {
+  return reinterpret_cast<const __m128i *>(text.data() + pos);
+}
+#endif
+
+// Every character is atext or a dot
+static bool isDotAtomText(std::string_view text) {
+  std::size_t pos = 0;
+#if defined(__SSE2__)
+  for (; pos + 16 <= text.size(); pos += 16) {
+    const __m128i block = _mm_loadu_si128(blockAt(text, pos));
+    __m128i specials = _mm_setzero_si128();
+    for (const char special : kSpecials) {
+      specials = _mm_or_si128(specials, _mm_cmpeq_epi8(block, _mm_set1_epi8(special)));
+    }
+    const __m128i valid = _mm_andnot_si128(specials, inRange(block, '!', '~'));
+    if (_mm_movemask_epi8(valid) != 0xffff) {
+      return false;
+    }
+  }
+#endif
+  return allOfClass(text, pos, kAtext | kDot);
+}
+
+// Every character is a letter, digit, hyphen or dot
+static bool isDomainText(std::string_view text) {
+  std::size_t pos = 0;
+#if defined(__SSE2__)
+  for (; pos + 16 <= text.size(); pos += 16) {
+    const __m128i block = _mm_loadu_si128(blockAt(text, pos));
+    // Setting the 0x20 bit folds the upper case letters onto the lower case ones
+    const __m128i letters = inRange(_mm_or_si128(block, _mm_set1_epi8(0x20)), 'a', 'z');
+    const __m128i digits = inRange(block, '0', '9');
+    const __m128i separators = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('-')),
+                                            _mm_cmpeq_epi8(block, _mm_set1_epi8('.')));
+    const __m128i valid = _mm_or_si128(_mm_or_si128(letters, digits), separators);
+    if (_mm_movemask_epi8(valid) != 0xffff) {
+      return false;
+    }
+  }
+#endif
+  return allOfClass(text, pos, kLetDig | kHyphen | kDot);
+}
+
+static void copyLowercase(std::string_view text, char *out) {
+  std::size_t pos = 0;
+#if defined(__SSE2__)
+  for (; pos + 16 <= text.size(); pos += 16) {
+    const __m128i block = _mm_loadu_si128(blockAt(text, pos));
+    const __m128i upper = inRange(block, 'A', 'Z');
+    const __m128i lower = _mm_add_epi8(block, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + pos), lower);
+  }
+#endif
+  for (; pos < text.size(); pos++) {
+    const char c = text[pos];
+    out[pos] = c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+  }
+}
+
+static bool isWsp(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+static std::string_view trim(std::string_view text) {
+  while (!text.empty() && isWsp(text.front())) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && isWsp(text.back())) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+static AddressError validateDomain(std::string_view domain) {
+  if (domain.empty()) {
+    return AddressError::kInvalidDomain;
+  }
+
+  // Address literal e.g [192.0.2.1] or [IPv6:2001:db8::1], only its characters are checked
+  if (domain.front() == '[') {
+    const bool valid = domain.size() > 2 && domain.back() == ']' &&
+                       allOfClass(domain.substr(1, domain.size() - 2), 0, kDtext);
+    return valid ? AddressError::kNone : AddressError::kInvalidDomain;
+  }
+
+  if (!isDomainText(domain)) {
+    return AddressError::kInvalidDomain;
+  }
+
+  // Labels are not empty and neither start nor end with a hyphen
+  std::size_t start = 0;
+  while (true) {
+    const std::size_t dot = domain.find('.', start);
+    const std::size_t end = dot == std::string_view::npos ? domain.size() : dot;
+    const std::size_t length = end - start;
+    if (length == 0 || domain[start] == '-' || domain[end - 1] == '-') {
+      return AddressError::kInvalidDomain;
+    }
+    if (length > kMaxLabelLength) {
+      return AddressError::kLabelTooLong;
+    }
+    if (dot == std::string_view::npos) {
+      return AddressError::kNone;
+    }
+    start = dot + 1;
+  }
+}
+
+// Returns the position of the '@' that follows a quoted local part, or npos if it is not valid
+static std::size_t quotedLocalPartEnd(std::string_view address) {
+  for (std::size_t pos = 1; pos < address.size(); pos++) {
+    const char c = address[pos];
+    if (c == '"') {
+      return pos + 1;
+    }
+    if (c == '\\') {
+      // quoted-pairSMTP is a backslash followed by any printable character or a space
+      if (++pos == address.size() || address[pos] < ' ' || address[pos] > '~') {
+        return std::string_view::npos;
+      }
+    } else if (!hasClass(c, kQtext)) {
+      return std::string_view::npos;
+    }
+  }
+  return std::string_view::npos;
+}
+
+std::string_view describeAddressError(AddressError error) {
+  switch (error) {
+  case AddressError::kNone:
+    return "valid";
+  case AddressError::kEmpty:
+    return "empty address";
+  case AddressError::kTooLong:
+    return "address is longer than 254 characters";
+  case AddressError::kUnbalancedBrackets:
+    return "unbalanced angle brackets";
+  case AddressError::kMissingAt:
+    return "missing @";
+  case AddressError::kInvalidLocalPart:
+    return "invalid local part";
+  case AddressError::kLocalPartTooLong:
+    return "local part is longer than 64 characters";
+  case AddressError::kInvalidDomain:
+    return "invalid domain";
+  case AddressError::kLabelTooLong:
+    return "domain label is longer than 63 characters";
+  }
+  return "unknown error";
+}
+
+AddressError validateAddress(std::string_view address) {
+  if (address.empty()) {
+    return AddressError::kEmpty;
+  }
+  if (address.size() > kMaxAddressLength) {
+    return AddressError::kTooLong;
+  }
+
+  std::size_t at = 0;
+  if (address.front() == '"') {
+    at = quotedLocalPartEnd(address);
+    if (at == std::string_view::npos) {
+      return AddressError::kInvalidLocalPart;
+    }
+    if (at == address.size() || address[at] != '@') {
+      return AddressError::kMissingAt;
+    }
+  } else {
+    // An unquoted local part cannot contain an '@', so the last one starts the domain
+    at = address.rfind('@');
+    if (at == std::string_view::npos) {
+      return AddressError::kMissingAt;
+    }
+    const std::string_view local_part = address.substr(0, at);
+    if (local_part.empty() || local_part.front() == '.' || local_part.back() == '.' ||
+        local_part.find("..") != std::string_view::npos || !isDotAtomText(local_part)) {
+      return AddressError::kInvalidLocalPart;
+    }
+  }
+
+  if (at > kMaxLocalPartLength) {
+    return AddressError::kLocalPartTooLong;
+  }
+  return validateDomain(address.substr(at + 1));
+}
+
+NormalizedAddress normalizeAddress(std::string_view entry, char *out) {
+  entry = trim(entry);
+  if (entry.empty()) {
+    return {{}, AddressError::kEmpty};
+  }
+
+  // An address in angle brackets may have a display name in front of it
+  std::string_view address = entry;
+  if (entry.back() == '>') {
+    const std::size_t open = entry.rfind('<');
+    if (open == std::string_view::npos) {
+      std::memcpy(out, entry.data(), entry.size());
+      return {{out, entry.size()}, AddressError::kUnbalancedBrackets};
+    }
+    address = trim(entry.substr(open + 1, entry.size() - open - 2));
+  }
+
+  // The local part may be case sensitive, only the domain is lowercased
+  const std::size_t at = address.rfind('@');
+  const std::size_t domain_start = at == std::string_view::npos ? address.size() : at + 1;
+  std::memcpy(out, address.data(), domain_start);
+  copyLowercase(address.substr(domain_start), out + domain_start);
+
+  const std::string_view normalized{out, address.size()};
+  return {normalized, validateAddress(normalized)};
+}
+
+std::size_t validateAddresses(const std::vector<std::string_view> &addresses,
+                              std::vector<AddressError> &errors) {
+  errors.resize(addresses.size());
+  std::size_t valid = 0;
+  for (std::size_t i = 0; i < addresses.size(); i++) {
+    errors[i] = validateAddress(addresses[i]);
+    valid += errors[i] == AddressError::kNone ? 1 : 0;
+  }
+  return valid;
+}
+
+} // namespace smtp
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace smtp {
+
+// Longest address a relay has to accept, a 256 octet path less its angle brackets. RFC 5321
+// section 4.5.3.1
+inline constexpr std::size_t kMaxAddressLength = 254;
+inline constexpr std::size_t kMaxLocalPartLength = 64;
+inline constexpr std::size_t kMaxLabelLength = 63;
+
+enum class AddressError {
+  kNone,
+  kEmpty,
+  kTooLong,
+  kUnbalancedBrackets,
+  kMissingAt,
+  kInvalidLocalPart,
+  kLocalPartTooLong,
+  kInvalidDomain,
+  kLabelTooLong,
+};
+
+// Short description of an error e.g for an exception message
+std::string_view describeAddressError(AddressError error);
+
+struct NormalizedAddress {
+  std::string_view address;
+  AddressError error = AddressError::kNone;
+
+  bool valid() const { return error == AddressError::kNone; }
+};
+
+// Checks a bare address against the Mailbox syntax of RFC 5321 section 4.1.2: a dot-atom or
+// quoted local part, then a domain made of letter, digit and hyphen labels or an address
+// literal. On x86 the characters are classified 16 at a time. Nothing is allocated.
+AddressError validateAddress(std::string_view address);
+
+// Takes the address out of an entry such as "Jane <Jane@Example.COM>" or " jane@example.com ",
+// writes it to out with its domain lowercased and validates it. out must have room for
+// entry.size() characters and the returned address points into it. An entry that is not valid
+// is still written out as well as it could be normalized.
+NormalizedAddress normalizeAddress(std::string_view entry, char *out);
+
+// Validates a whole batch of bare addresses, errors is resized to hold the result for each of
+// them so it can be reused between batches without allocating. Returns the number of valid
+// addresses.
+std::size_t validateAddresses(const std::vector<std::string_view> &addresses,
+                              std::vector<AddressError> &errors);
+
+} // namespace smtp
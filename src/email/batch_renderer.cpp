@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "email/batch_renderer.hpp"
+
+namespace smtp {
+
+// A loop shared by the threads that run it, each takes the next index until there are none left.
+// A helper can start after the loop is over, the shared pointer keeps the state alive for it and
+// it finds no index left to take.
+struct Loop {
+  const std::function<void(std::size_t)> *body = nullptr;
+  std::size_t count = 0;
+  std::atomic<std::size_t> next{0};
+
+  std::mutex mutex;
+  std::condition_variable finished;
+  // Helpers that are taking indices, the caller waits for them once it has run out
+  std::size_t active = 0;
+  std::exception_ptr error;
+
+  void run() {
+    for (;;) {
+      const std::size_t index = next.fetch_add(1);
+      if (index >= count) {
+        return;
+      }
+      try {
+        (*body)(index);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (!error) {
+          error = std::current_exception();
+        }
+        next.store(count);
+      }
+    }
+  }
+};
+
+struct BatchRenderer::Impl {
+  BatchRenderOptions m_options;
+
+  std::mutex m_mutex;
+  std::condition_variable m_ready;
+  std::deque<std::function<void()>> m_tasks;
+  // Workers waiting for a task, a loop never asks for more helpers than this
+  std::size_t m_idle = 0;
+  bool m_stopping = false;
+
+  std::vector<std::thread> m_workers;
+
+  void work();
+  void forEach(std::size_t count, const std::function<void(std::size_t)> &body);
+};
+
+void BatchRenderer::Impl::work() {
+  std::unique_lock<std::mutex> lock{m_mutex};
+  for (;;) {
+    m_idle++;
+    m_ready.wait(lock, [this]() { return !m_tasks.empty() || m_stopping; });
+    m_idle--;
+    if (m_tasks.empty()) {
+      return;
+    }
+
+    const std::function<void()> task = std::move(m_tasks.front());
+    m_tasks.pop_front();
+    lock.unlock();
+    task();
+    lock.lock();
+  }
+}
+
+void BatchRenderer::Impl::forEach(std::size_t count,
+                                  const std::function<void(std::size_t)> &body) {
+  if (count == 0) {
+    return;
+  }
+  const auto &loop = std::make_shared<Loop>();
+  loop->body = &body;
+  loop->count = count;
+
+  // Only idle workers are asked to help. When every worker is busy, e.g rendering other emails
+  // of the batch, the caller runs the whole loop itself instead of queueing helpers that would
+  // find nothing left to do by the time they start.
+  std::size_t helpers = 0;
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    helpers = std::min(count - 1, m_idle);
+    for (std::size_t i = 0; i < helpers; i++) {
+      m_tasks.emplace_back([loop]() {
+        {
+          std::lock_guard<std::mutex> loop_lock{loop->mutex};
+          loop->active++;
+        }
+        loop->run();
+        std::lock_guard<std::mutex> loop_lock{loop->mutex};
+        if (--loop->active == 0) {
+          loop->finished.notify_all();
+        }
+      });
+    }
+  }
+  for (std::size_t i = 0; i < helpers; i++) {
+    m_ready.notify_one();
+  }
+
+  // Every index has been taken once the caller runs out, a helper that starts after that never
+  // calls body
+  loop->run();
+  std::unique_lock<std::mutex> lock{loop->mutex};
+  loop->finished.wait(lock, [&loop]() { return loop->active == 0; });
+  if (loop->error) {
+    std::rethrow_exception(loop->error);
+  }
+}
+
+BatchRenderer::BatchRenderer(const BatchRenderOptions &options)
+    : m_impl{std::make_unique<Impl>()} {
+  m_impl->m_options = options;
+  if (m_impl->m_options.threads == 0) {
+    m_impl->m_options.threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // The thread that calls render() does its share, so it is not counted among the workers
+  m_impl->m_workers.reserve(m_impl->m_options.threads - 1);
+  for (std::size_t i = 1; i < m_impl->m_options.threads; i++) {
+    m_impl->m_workers.emplace_back([this]() { m_impl->work(); });
+  }
+}
+
+BatchRenderer::~BatchRenderer() {
+  {
+    std::lock_guard<std::mutex> lock{m_impl->m_mutex};
+    m_impl->m_stopping = true;
+  }
+  m_impl->m_ready.notify_all();
+  for (std::thread &worker : m_impl->m_workers) {
+    worker.join();
+  }
+}
+
+void BatchRenderer::render(const std::vector<const Email *> &emails,
+                           std::vector<RenderedEmail> &rendered) {
+  rendered.resize(emails.size());
+
+  const Email::ForEach &split = [this](std::size_t count,
+                                       const std::function<void(std::size_t)> &body) {
+    m_impl->forEach(count, body);
+  };
+  const Email::ForEach *for_each = m_impl->m_options.split_attachments ? &split : nullptr;
+
+  // Emails are taken one at a time, they vary too much in size for fixed shares to even out
+  m_impl->forEach(emails.size(), [&](std::size_t index) {
+    emails[index]->renderWith(rendered[index], for_each);
+  });
+}
+
+std::size_t BatchRenderer::threads() const { return m_impl->m_options.threads; }
+
+} // namespace smtp
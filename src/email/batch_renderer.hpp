@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "email/email.hpp"
+
+namespace smtp {
+
+struct BatchRenderOptions {
+  // Threads that render, including the one that calls render(). 0 uses one for every core.
+  std::size_t threads = 0;
+  // Threads that have nothing else to do encode the attachments of an email in parallel, so a
+  // batch of a few large emails is not left to one core each. The memory resource of an email
+  // is then used from several threads at once and has to be thread safe, as it already has to
+  // be for an email that is sent from several threads. The default resource is.
+  bool split_attachments = true;
+};
+
+// Renders many emails at once on a pool of threads, e.g every email of a campaign. Each rendered
+// email is left in the cache of its email as well, so a send() that follows only renders the
+// date again.
+//
+// The renderer can be used from several threads at once, the batches then share its threads.
+class BatchRenderer {
+public:
+  explicit BatchRenderer(const BatchRenderOptions &options = {});
+  ~BatchRenderer();
+
+  BatchRenderer(const BatchRenderer &) = delete;
+  BatchRenderer &operator=(const BatchRenderer &) = delete;
+
+  // Renders emails[i] into rendered[i], reusing the buffers of the rendered emails it already
+  // holds, and returns once all of them are done. If an email throws the rest of the batch is
+  // abandoned and the first exception is rethrown once every thread has stopped.
+  void render(const std::vector<const Email *> &emails, std::vector<RenderedEmail> &rendered);
+
+  std::size_t threads() const;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace smtp
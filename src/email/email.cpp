@@ -1,56 +1,155 @@
 #include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
 
 #include "date_time/date_time_now.hpp"
+#include "dkim/dkim.hpp"
 #include "email/email.hpp"
 #include "mime/mime.hpp"
-#include "utils/secure_strings.hpp"
-
-#include "curl/curl.h"
+#include "mime/transfer_encoding.hpp"
+#include "utils/quoted_printable/quoted_printable.hpp"
+#include "transport/admission.hpp"
+#include "transport/relay_pool.hpp"
+#include "transport/transport.hpp"
+#include "utils/memory/counting_resource.hpp"
 
 namespace smtp {
 
-struct UploadStatus {
-  uint64_t lines_read;
-  std::vector<std::string> email_contents;
+static constexpr std::string_view kToPrefix = "To: ";
+static constexpr std::string_view kFromPrefix = "From: ";
+static constexpr std::string_view kCcPrefix = "Cc: ";
+static constexpr std::string_view kSubjectPrefix = "Subject: ";
+static constexpr std::string_view kEndOfData = "\r\n.\r\n";
+static constexpr std::size_t kCRLFSize = 2;
+
+// Size of the stack buffer that backs the arena used for each build, most emails fit inside of it
+// so the temporaries of a build do not touch the heap at all.
+static constexpr std::size_t kArenaSize = 2048;
+
+static const DateTimeNow kDateTimeNow;
+
+// Stands in for the signature of an email that is not signed, it adds nothing to the message
+static const Email::Part kUnsignedPart = std::make_shared<const std::pmr::string>();
+
+// Rendered sections of an email are cached so that retries, or an email that is logged and then
+// sent, do not render and encode everything again. A null entry means that section is dirty.
+struct RenderCache {
+  explicit RenderCache(std::pmr::memory_resource *resource) : attachments{resource} {}
+
+  Email::Part headers;
+  Email::Part mime_header;
+  Email::Part message;
+  std::pmr::vector<Email::Part> attachments;
+  Email::Part trailer;
+  // DKIM hash of everything after the header section. It only depends on the parts above, so it
+  // is kept until one of them changes.
+  std::optional<DkimBodyHash> body_hash;
 };
 
+static std::string_view contentsOf(const Attachment &attachment) {
+  const std::vector<uint8_t> &contents = attachment.getContents();
+  return {reinterpret_cast<const char *>(contents.data()), contents.size()};
+}
+
+// Where the body starts inside of the rendered MIME header, after the empty line that ends the
+// header section.
+static std::size_t bodyOffset(std::string_view mime_header) {
+  static constexpr std::string_view kHeaderEnd = "\r\n\r\n";
+  return mime_header.find(kHeaderEnd) + kHeaderEnd.size();
+}
+
+static Email::Part makePart(std::pmr::string &&contents, std::pmr::memory_resource *resource) {
+  const std::pmr::polymorphic_allocator<std::byte> allocator{resource};
+  return std::allocate_shared<std::pmr::string>(allocator, std::move(contents));
+}
+
 struct Email::Impl {
-  // smtp information
-  smtp::secure_string m_smtp_user;
-  smtp::secure_string m_smtp_password;
-  smtp::secure_string m_smtp_host;
+  Impl(std::pmr::memory_resource *resource, bool track_allocations)
+      : m_counter{track_allocations ? std::make_unique<CountingResource>(resource) : nullptr},
+        m_recipients{counted(resource)}, m_from{counted(resource)}, m_subject{counted(resource)},
+        m_body{counted(resource)}, m_boundary{smtp::Mime::generateBoundary(), counted(resource)},
+        m_resource{counted(resource)}, m_cache{counted(resource)} {}
+
+  // Only set when allocations are tracked, it then sits in front of the caller's resource
+  std::unique_ptr<CountingResource> m_counter;
+
+  std::pmr::memory_resource *counted(std::pmr::memory_resource *resource) const {
+    return m_counter ? m_counter.get() : resource;
+  }
+
+  // smtp information, which may be shared with other emails
+  std::shared_ptr<const Credentials> m_credentials;
 
   // email data
-  std::string m_to;
-  std::string m_from;
-  std::string m_cc;
-  std::string m_subject;
-  std::string m_body;
+  RecipientList m_recipients;
+  std::pmr::string m_from;
+  std::pmr::string m_subject;
+  std::pmr::string m_body;
+  // Chosen whenever the body changes so the size of the email is known without encoding it
+  EncodingChoice m_body_encoding;
 
   const DateTime *m_date = nullptr;
+  const DkimSigner *m_dkim = nullptr;
+  RelayPool *m_relays = nullptr;
+  SendLimits m_limits;
   std::vector<Attachment> m_attachments;
-};
+  std::vector<EncodingChoice> m_attachment_encodings;
 
-static size_t payloadCallback(void *ptr, size_t size, size_t nmemb, void *userp);
+  // Every part that contains a delimiter is rendered with this boundary, so changing it
+  // invalidates all of the cached parts.
+  std::pmr::string m_boundary;
+
+  std::size_t m_max_message_size = 0;
+  std::size_t m_max_recipients = 0;
+  bool m_skip_invalid_recipients = false;
+
+  // Everything the email owns, including the cached parts, is allocated from here
+  std::pmr::memory_resource *m_resource;
+
+  // Guards m_cache so that the same email can be built from several threads at once. The cached
+  // parts are immutable and shared, so a build that is in progress is unaffected when another
+  // thread invalidates the cache.
+  mutable std::mutex m_cache_mutex;
+  mutable RenderCache m_cache;
+};
 
-Email::Email(const EmailParams &params) : m_impl{std::make_unique<Impl>()} {
-  m_impl->m_smtp_user = params.user;
-  m_impl->m_smtp_password = params.password;
-  m_impl->m_smtp_host = params.hostname;
-  m_impl->m_to = params.to;
+Email::Email(const EmailParams &params, std::pmr::memory_resource *resource)
+    : m_impl{std::make_unique<Impl>(resource, params.track_allocations)} {
+  m_impl->m_credentials = params.credentials
+                              ? params.credentials
+                              : Credentials::make(params.user, params.password, params.hostname);
+  m_impl->m_recipients.add(RecipientType::kTo, params.to);
+  m_impl->m_recipients.add(RecipientType::kCc, params.cc);
+  m_impl->m_recipients.add(RecipientType::kBcc, params.bcc);
   m_impl->m_from = params.from;
-  m_impl->m_cc = params.cc;
   m_impl->m_subject = params.subject;
   m_impl->m_body = params.body;
+  m_impl->m_body_encoding = chooseTextEncoding(params.body);
   m_impl->m_date = params.datetime;
+  m_impl->m_dkim = params.dkim;
+  m_impl->m_relays = params.relays;
+  m_impl->m_limits = params.limits;
+  m_impl->m_max_message_size = params.max_message_size;
+  m_impl->m_max_recipients = params.max_recipients_per_message;
+  m_impl->m_skip_invalid_recipients = params.skip_invalid_recipients;
 }
 
 Email::~Email() = default;
 
 void Email::addAttachment(const Attachment &attachment) {
+  // Scanning the contents to pick an encoding is done before taking the lock
+  const EncodingChoice &encoding = chooseAttachmentEncoding(contentsOf(attachment));
+
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
   m_impl->m_attachments.push_back(attachment);
+  m_impl->m_attachment_encodings.push_back(encoding);
+  m_impl->m_cache.attachments.push_back(nullptr);
+  m_impl->m_cache.body_hash.reset();
 }
 
 void Email::removeAttachment(std::string_view file_path) {
@@ -58,167 +157,359 @@ void Email::removeAttachment(std::string_view file_path) {
     return attachment.getFilePath() == file_path;
   };
 
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
   if (const auto &it =
           std::find_if(m_impl->m_attachments.begin(), m_impl->m_attachments.end(), checkFilePath);
       it != m_impl->m_attachments.end()) {
+    const auto index = std::distance(m_impl->m_attachments.begin(), it);
+    m_impl->m_cache.attachments.erase(m_impl->m_cache.attachments.begin() + index);
+    m_impl->m_attachment_encodings.erase(m_impl->m_attachment_encodings.begin() + index);
     m_impl->m_attachments.erase(it);
+    m_impl->m_cache.body_hash.reset();
   }
 }
 
-std::vector<std::string> Email::build() const {
-  std::vector<std::string> result;
+void Email::setTo(std::string_view to) {
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
+  m_impl->m_recipients.clear(RecipientType::kTo);
+  m_impl->m_recipients.add(RecipientType::kTo, to);
+  m_impl->m_cache.headers.reset();
+}
+
+void Email::setFrom(std::string_view from) {
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
+  m_impl->m_from = from;
+  m_impl->m_cache.headers.reset();
+}
 
-  result.push_back("To: " + m_impl->m_to + "\r\n");
-  result.push_back("From: " + m_impl->m_from + "\r\n");
-  result.push_back("Cc: " + m_impl->m_cc + "\r\n");
-  result.push_back("Subject: " + m_impl->m_subject + "\r\n");
-  result.push_back(this->getDatetime() + "\r\n");
+void Email::setCc(std::string_view cc) {
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
+  m_impl->m_recipients.clear(RecipientType::kCc);
+  m_impl->m_recipients.add(RecipientType::kCc, cc);
+  m_impl->m_cache.headers.reset();
+}
 
-  smtp::Mime m_mime;
-  m_mime.addMessage(m_impl->m_body);
+void Email::setBcc(std::string_view bcc) {
+  // Bcc recipients are not part of the headers, so nothing has to be rendered again
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
+  m_impl->m_recipients.clear(RecipientType::kBcc);
+  m_impl->m_recipients.add(RecipientType::kBcc, bcc);
+}
 
-  for (const auto &attachment : m_impl->m_attachments) {
-    m_mime.addAttachment(attachment.getFilePath(), attachment.getContentsAsB64());
+std::size_t Email::addRecipients(RecipientType type, std::string_view addresses) {
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
+  const std::size_t added = m_impl->m_recipients.add(type, addresses);
+  if (added > 0 && type != RecipientType::kBcc) {
+    m_impl->m_cache.headers.reset();
   }
+  return added;
+}
 
-  const std::vector<std::string> &mime_lines = m_mime.build();
-  for (const auto &line : mime_lines) {
-    result.push_back(line);
-  }
+std::size_t Email::recipientCount() const {
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
+  return m_impl->m_recipients.size();
+}
 
-  result.push_back(smtp::Mime::kLastBoundary);
-  result.emplace_back("\r\n.\r\n");
+std::vector<std::string> Email::invalidRecipients() const {
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
+  const std::vector<std::string_view> &invalid = m_impl->m_recipients.invalid();
+  return {invalid.begin(), invalid.end()};
+}
 
-  return result;
+void Email::setSubject(std::string_view subject) {
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
+  m_impl->m_subject = subject;
+  m_impl->m_cache.headers.reset();
+}
+
+void Email::setBody(std::string_view body) {
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
+  m_impl->m_body = body;
+  m_impl->m_body_encoding = chooseTextEncoding(body);
+  m_impl->m_cache.message.reset();
+  m_impl->m_cache.body_hash.reset();
 }
 
-void Email::send() const {
-  CURL *curl = nullptr;
-  CURLcode res = CURLE_OK;
-  struct curl_slist *recipients = nullptr;
-  UploadStatus upload_ctx;
-
-  upload_ctx.email_contents = this->build();
-  upload_ctx.lines_read = 0;
-
-  curl = curl_easy_init();
-
-  if (curl) {
-    curl_easy_setopt(curl, CURLOPT_USERNAME, m_impl->m_smtp_user.c_str());
-    curl_easy_setopt(curl, CURLOPT_PASSWORD, m_impl->m_smtp_password.c_str());
-
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER,
-                     0); // allows emails to be sent
-    curl_easy_setopt(curl, CURLOPT_URL, m_impl->m_smtp_host.c_str());
-
-    /* If you want to connect to a site who isn't using a certificate that is
-     * signed by one of the certs in the CA bundle you have, you can skip the
-     * verification of the server's certificate. This makes the connection
-     * A LOT LESS SECURE.
-     *
-     * If you have a CA cert for the server stored someplace else than in the
-     * default bundle, then the CURLOPT_CAPATH option might come handy for
-     * you. */
-#ifdef SKIP_PEER_VERIFICATION
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-#endif
-
-    /* If the site you're connecting to uses a different host name that what
-     * they have mentioned in their server certificate's commonName (or
-     * subjectAltName) fields, libcurl will refuse to connect. You can skip
-     * this check, but this will make the connection less secure. */
-#ifdef SKIP_HOSTNAME_VERIFICATION
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-#endif
-
-    /* Note that this option isn't strictly required, omitting it will result
-     * in libcurl sending the MAIL FROM command with empty sender data. All
-     * autoresponses should have an empty reverse-path, and should be directed
-     * to the address in the reverse-path which triggered them. Otherwise,
-     * they could cause an endless loop. See RFC 5321 Section 4.5.5 for more
-     * details.
-     */
-    curl_easy_setopt(curl, CURLOPT_MAIL_FROM, m_impl->m_from.c_str());
-
-    /* Add two recipients, in this particular case they correspond to the
-     * To: and Cc: addressees in the header, but they could be any kind of
-     * recipient. */
-    recipients = curl_slist_append(recipients, m_impl->m_to.c_str());
-    if (m_impl->m_cc.length() > 0) {
-      recipients = curl_slist_append(recipients, m_impl->m_cc.c_str());
+Email::RenderedParts Email::build(std::pmr::memory_resource *arena,
+                                  const ForEach *for_each) const {
+  std::pmr::memory_resource *resource = m_impl->m_resource;
+
+  // The timestamp changes between builds so it is the only part that is never cached
+  std::pmr::string date{resource};
+  date.append(this->getDatetime()).append("\r\n");
+  const Email::Part &date_part = makePart(std::move(date), resource);
+
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
+  RenderCache &cache = m_impl->m_cache;
+  std::pmr::string &boundary = m_impl->m_boundary;
+
+  // Base64 never contains the boundary, but the body and quoted-printable attachments copy its
+  // characters through unchanged. They are checked when they change, against their contents,
+  // since the escapes and soft line breaks added by encoding all start with '=' which the
+  // boundary never contains. A new boundary has to avoid all of them.
+  const auto &collides = [&](std::string_view candidate, bool changed_only) {
+    if ((!changed_only || !cache.message) &&
+        smtp::Mime::collidesWithBoundary(m_impl->m_body, candidate)) {
+      return true;
+    }
+    for (std::size_t i = 0; i < m_impl->m_attachments.size(); i++) {
+      if ((!changed_only || !cache.attachments[i]) &&
+          m_impl->m_attachment_encodings[i].encoding == TransferEncoding::kQuotedPrintable &&
+          smtp::Mime::collidesWithBoundary(contentsOf(m_impl->m_attachments[i]), candidate)) {
+        return true;
+      }
     }
+    return false;
+  };
+  if (collides(boundary, true)) {
+    do {
+      boundary = smtp::Mime::generateBoundary();
+    } while (collides(boundary, false));
+    cache = RenderCache{resource};
+    cache.attachments.resize(m_impl->m_attachments.size());
+  }
 
-    curl_easy_setopt(curl, CURLOPT_MAIL_RCPT, recipients);
+  if (!cache.headers) {
+    std::pmr::string headers{resource};
+    const RecipientList &recipients = m_impl->m_recipients;
+    headers.append(kToPrefix);
+    recipients.appendHeader(RecipientType::kTo, kToPrefix.size(), headers);
+    headers.append("\r\n");
+    headers.append(kFromPrefix).append(m_impl->m_from).append("\r\n");
+    headers.append(kCcPrefix);
+    recipients.appendHeader(RecipientType::kCc, kCcPrefix.size(), headers);
+    headers.append("\r\n");
+    headers.append(kSubjectPrefix).append(m_impl->m_subject).append("\r\n");
+    cache.headers = makePart(std::move(headers), resource);
+  }
 
-    /* We're using a callback function to specify the payload (the headers and
-     * body of the message). You could just use the CURLOPT_READDATA option to
-     * specify a FILE pointer to read from. */
-    curl_easy_setopt(curl, CURLOPT_READFUNCTION, payloadCallback);
-    curl_easy_setopt(curl, CURLOPT_READDATA, &upload_ctx);
-    curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+  if (!cache.mime_header) {
+    cache.mime_header = makePart(
+        smtp::Mime::renderHeader(smtp::Mime::kDefaultUserAgent, boundary, resource), resource);
+  }
 
-    /* Since the traffic will be encrypted, it is very useful to turn on debug
-     * information within libcurl to see what is happening during the
-     * transfer */
-    curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+  if (!cache.message) {
+    cache.message = makePart(smtp::Mime::renderMessage(m_impl->m_body, m_impl->m_body_encoding,
+                                                       boundary, resource),
+                             resource);
+  }
 
-    /* Send the message */
-    res = curl_easy_perform(curl);
+  const auto &renderAttachment = [&](std::size_t i, std::pmr::memory_resource *temporaries) {
+    // Only the rendered part is kept, the intermediate encoded string lives in temporaries
+    const Attachment &attachment = m_impl->m_attachments[i];
+    const TransferEncoding encoding = m_impl->m_attachment_encodings[i].encoding;
+    const std::pmr::string &encoded =
+        encoding == TransferEncoding::kBase64
+            ? attachment.getContentsAsB64(temporaries)
+            : QuotedPrintable::Encode(contentsOf(attachment), QuotedPrintable::Mode::kBinary,
+                                      temporaries);
+    cache.attachments[i] = makePart(
+        smtp::Mime::renderAttachment(attachment.getFilePath(), attachment.getContentType(),
+                                     encoded, encoding, boundary, resource),
+        resource);
+  };
 
-    /* Check for errors */
-    if (res != CURLE_OK) {
-      fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+  std::pmr::vector<std::size_t> dirty{arena};
+  for (std::size_t i = 0; i < m_impl->m_attachments.size(); i++) {
+    if (!cache.attachments[i]) {
+      dirty.push_back(i);
     }
+  }
+  if (for_each && dirty.size() > 1) {
+    // Each attachment writes its own entry of the cache, the lock is held until all of them are
+    // done. The arena is not thread safe so every attachment gets one of its own.
+    (*for_each)(dirty.size(), [&](std::size_t index) {
+      std::array<std::byte, kArenaSize> buffer;
+      std::pmr::monotonic_buffer_resource temporaries{buffer.data(), buffer.size(), resource};
+      renderAttachment(dirty[index], &temporaries);
+    });
+  } else {
+    for (const std::size_t i : dirty) {
+      renderAttachment(i, arena);
+    }
+  }
+
+  if (!cache.trailer) {
+    std::pmr::string trailer = smtp::Mime::renderLastBoundary(boundary, resource);
+    trailer.append(kEndOfData);
+    cache.trailer = makePart(std::move(trailer), resource);
+  }
 
-    /* Free the list of recipients */
-    curl_slist_free_all(recipients);
+  // The body is hashed once after any of its parts have changed. Every part is hashed straight
+  // from the cache, the body is never joined into a single string.
+  const std::size_t body_offset = bodyOffset(*cache.mime_header);
+  if (m_impl->m_dkim && !cache.body_hash) {
+    DkimBodyHasher hasher;
+    hasher.update(std::string_view{*cache.mime_header}.substr(body_offset));
+    hasher.update(*cache.message);
+    for (const auto &attachment : cache.attachments) {
+      hasher.update(*attachment);
+    }
+    hasher.update(*cache.trailer);
+    cache.body_hash = hasher.finish();
+  }
 
-    /* Always cleanup */
-    curl_easy_cleanup(curl);
+  // The signature has the time it was made in its t= tag, so like the date it is made again for
+  // every build. Only the cached headers and the MIME fields are signed, never the date.
+  Email::Part signature_part = kUnsignedPart;
+  if (m_impl->m_dkim) {
+    const std::string_view mime_fields = std::string_view{*cache.mime_header}.substr(
+        0, body_offset - kCRLFSize);
+    const std::string &signature =
+        m_impl->m_dkim->sign({*cache.headers, mime_fields}, *cache.body_hash);
+    signature_part = makePart(std::pmr::string{signature, resource}, resource);
   }
+
+  RenderedParts result{arena};
+  result.reserve(cache.attachments.size() + 6);
+  result.push_back(signature_part);
+  result.push_back(cache.headers);
+  result.push_back(date_part);
+  result.push_back(cache.mime_header);
+  result.push_back(cache.message);
+  result.insert(result.end(), cache.attachments.begin(), cache.attachments.end());
+  result.push_back(cache.trailer);
+
+  return result;
 }
 
-static size_t payloadCallback(void *ptr, size_t size, size_t nmemb, void *userp) {
-  auto *upload_ctx = static_cast<UploadStatus *>(userp);
-  const char *data = nullptr;
+std::size_t Email::serializedSize() const {
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
+  const std::pmr::string &boundary = m_impl->m_boundary;
+  const DateTime &date = m_impl->m_date ? *m_impl->m_date : kDateTimeNow;
+
+  const RecipientList &recipients = m_impl->m_recipients;
+  std::size_t size = kToPrefix.size() + kCRLFSize;
+  size += recipients.headerSize(RecipientType::kTo, kToPrefix.size());
+  size += kFromPrefix.size() + m_impl->m_from.size() + kCRLFSize;
+  size += kCcPrefix.size() + kCRLFSize;
+  size += recipients.headerSize(RecipientType::kCc, kCcPrefix.size());
+  size += kSubjectPrefix.size() + m_impl->m_subject.size() + kCRLFSize;
+  size += date.getTimestampLength() + kCRLFSize;
+
+  size += smtp::Mime::headerSize(smtp::Mime::kDefaultUserAgent, boundary);
+  size += smtp::Mime::messageSize(m_impl->m_body_encoding, boundary);
+  for (std::size_t i = 0; i < m_impl->m_attachments.size(); i++) {
+    const Attachment &attachment = m_impl->m_attachments[i];
+    size += smtp::Mime::attachmentSize(attachment.getFilePath(), attachment.getContentType(),
+                                       m_impl->m_attachment_encodings[i], boundary);
+  }
 
-  // No more data to send
-  if ((size == 0) || (nmemb == 0) || ((size * nmemb) < 1)) {
-    return 0;
+  if (m_impl->m_dkim) {
+    size += m_impl->m_dkim->signatureSize();
   }
 
-  if (upload_ctx->lines_read < upload_ctx->email_contents.size()) {
-    data = upload_ctx->email_contents[upload_ctx->lines_read].c_str();
+  return size + smtp::Mime::lastBoundarySize(boundary) + kEndOfData.size();
+}
 
-    if (data) {
-      size_t len = strlen(data);
-      memcpy(ptr, data, len);
-      upload_ctx->lines_read++;
+std::string Email::boundary() const {
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
+  return std::string{m_impl->m_boundary};
+}
+
+TransportResult Email::send(const StopToken *stop) const {
+  // Reject oversized messages before doing any of the work to render or upload them
+  const std::size_t message_size = this->serializedSize();
+  if (m_impl->m_max_message_size > 0 && message_size > m_impl->m_max_message_size) {
+    throw EmailException("[!] Message size of " + std::to_string(message_size) +
+                         " bytes exceeds the limit of " +
+                         std::to_string(m_impl->m_max_message_size) + " bytes");
+  }
+
+  // The rendered message counts against the library's memory budget until the send is over
+  const std::optional<MemoryReservation> &reservation =
+      admitSend(message_size, m_impl->m_limits, stop);
+  if (!reservation) {
+    return notAdmitted(stop);
+  }
 
-      return len;
+  // Held for the whole send so that clear() cannot free the credentials while they are in use
+  std::shared_ptr<const Credentials> credentials;
+  TransportParams transport_params;
+  {
+    std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
+    credentials = m_impl->m_credentials;
+    transport_params.user = credentials->user();
+    transport_params.password = credentials->password();
+    transport_params.hostname = credentials->hostname();
+    transport_params.from = m_impl->m_from;
+
+    // Invalid addresses would each cost a round trip only to be refused by the server
+    const RecipientList &recipients = m_impl->m_recipients;
+    const std::vector<std::string_view> &invalid = recipients.invalid();
+    if (!invalid.empty() && !m_impl->m_skip_invalid_recipients) {
+      throw EmailException("[!] Invalid recipient address: " + std::string(invalid.front()) +
+                           (invalid.size() > 1
+                                ? " and " + std::to_string(invalid.size() - 1) + " more"
+                                : ""));
     }
+    transport_params.recipients = recipients.envelope(true);
+  }
+  transport_params.max_recipients = m_impl->m_max_recipients;
+  transport_params.limits = m_impl->m_limits;
+  transport_params.stop = stop;
+
+  CountingResource *counter = m_impl->m_counter.get();
+  const AllocationStats &start = counter ? counter->startWindow() : AllocationStats{};
+
+  // The email is rendered once however many recipients it has, every batch of RCPTs is sent the
+  // same view
+  RenderedEmail rendered;
+  this->render(rendered);
+
+  TransportResult result = m_impl->m_relays
+                               ? m_impl->m_relays->send(transport_params, rendered.view())
+                               : sendMessage(transport_params, rendered.view());
+  if (counter) {
+    result.allocations = counter->windowStats(start);
   }
+  return result;
+}
 
-  return 0;
+void Email::render(RenderedEmail &rendered) const { this->renderWith(rendered, nullptr); }
+
+void Email::renderWith(RenderedEmail &rendered, const ForEach *for_each) const {
+  // Every temporary made while rendering is released in one step once the parts are built
+  std::array<std::byte, kArenaSize> buffer;
+  std::pmr::monotonic_buffer_resource arena{buffer.data(), buffer.size(), m_impl->m_resource};
+  const RenderedParts &parts = this->build(&arena, for_each);
+
+  rendered.m_view.clear();
+  rendered.m_parts.assign(parts.begin(), parts.end());
+  rendered.m_view.reserve(rendered.m_parts.size());
+  for (const auto &part : rendered.m_parts) {
+    rendered.m_view.append(*part);
+  }
 }
 
 std::string Email::getDatetime() const {
-  const auto &datetimenow = std::make_unique<DateTimeNow>();
-  return m_impl->m_date ? m_impl->m_date->getTimestamp() : datetimenow->getTimestamp();
+  return m_impl->m_date ? m_impl->m_date->getTimestamp() : kDateTimeNow.getTimestamp();
 }
 
 void Email::clear() {
-  m_impl->m_smtp_user.clear();
-  m_impl->m_smtp_password.clear();
-  m_impl->m_smtp_host.clear();
+  std::lock_guard<std::mutex> lock{m_impl->m_cache_mutex};
+  m_impl->m_credentials = Credentials::make({}, {}, {});
 
-  m_impl->m_to.clear();
+  m_impl->m_recipients.clear();
   m_impl->m_from.clear();
-  m_impl->m_cc.clear();
   m_impl->m_subject.clear();
   m_impl->m_body.clear();
+  m_impl->m_body_encoding = {};
 
   m_impl->m_attachments.clear();
+  m_impl->m_attachment_encodings.clear();
+  m_impl->m_cache = RenderCache{m_impl->m_resource};
+}
+
+std::ostream &operator<<(std::ostream &out, const Email &email) {
+  RenderedEmail rendered;
+  email.render(rendered);
+
+  const MessageView &view = rendered.view();
+  for (std::size_t i = 0; i < view.count(); i++) {
+    out << view.segment(i);
+  }
+  return out;
 }
 
 } // namespace smtp
@@ -0,0 +1,365 @@
+#include <algorithm>
+#include <optional>
+#include <string>
+
+#include "date_time/date_time_now.hpp"
+#include "email/email_template.hpp"
+#include "email/recipient_list.hpp"
+#include "mime/mime.hpp"
+#include "mime/text_normalizer.hpp"
+#include "mime/transfer_encoding.hpp"
+#include "transport/admission.hpp"
+#include "transport/relay_pool.hpp"
+#include "transport/transport.hpp"
+
+namespace smtp {
+
+static constexpr std::string_view kSlotOpen = "{{";
+static constexpr std::string_view kSlotClose = "}}";
+
+static constexpr std::size_t kStaticPiece = static_cast<std::size_t>(-1);
+static constexpr std::size_t kDatePiece = static_cast<std::size_t>(-2);
+static constexpr std::size_t kMessagePiece = static_cast<std::size_t>(-3);
+
+static const DateTimeNow kDateTimeNow;
+
+// A piece is either a run of static text inside Impl::m_text or a slot to be filled in
+struct Piece {
+  std::size_t offset;
+  std::size_t length;
+  std::size_t slot;
+};
+
+using Pieces = std::vector<Piece>;
+
+struct EmailTemplate::Impl {
+  // smtp information, which may be shared with other templates and emails
+  std::shared_ptr<const Credentials> m_credentials;
+
+  const DateTime *m_date = nullptr;
+  RelayPool *m_relays = nullptr;
+  SendLimits m_limits;
+  std::size_t m_max_message_size = 0;
+  std::size_t m_max_recipients = 0;
+  bool m_skip_invalid_recipients = false;
+
+  // All of the static text of the template, pieces refer to ranges inside of it
+  std::string m_text;
+  std::vector<std::string> m_slots;
+  // Slots that are used in a header, where a line break would start a header of its own
+  std::vector<bool> m_header_slots;
+  std::string m_boundary;
+
+  Pieces m_document;
+  // The rendered message part, which is only used when it can be sent as 7bit
+  Pieces m_message;
+  // The body before it is encoded, for everything else
+  Pieces m_body;
+  bool m_plain_body = false;
+  Pieces m_to;
+  Pieces m_from;
+  Pieces m_cc;
+
+  void appendStatic(std::string_view text, Pieces &pieces);
+  void parse(std::string_view text, Pieces &pieces);
+  void expand(const Pieces &pieces, const std::vector<std::string_view> &values,
+              std::string &out) const;
+  void append(const Piece &piece, const std::vector<std::string_view> &values,
+              MessageView &view) const;
+  void markHeaderSlots(const Pieces &pieces);
+  // Returns true if no line of pieces is longer than the limit once the values are filled in
+  bool fitsLineLimit(const Pieces &pieces, const std::vector<std::string_view> &values) const;
+};
+
+// Values that can be spliced into a 7bit message without changing its encoding. The lines of
+// the template they are spliced into can still grow too long, see fitsLineLimit().
+static bool isPlainValue(std::string_view value) {
+  const ContentStats &stats = scanContent(value);
+  return classifyContent(stats) == ContentClass::kSevenBit && stats.bare_line_breaks == 0;
+}
+
+EmailTemplate::EmailTemplate(const EmailParams &params, const std::vector<Attachment> &attachments)
+    : m_impl{std::make_unique<Impl>()} {
+  // The signature covers the personalised headers and body, so it cannot be made once up front
+  if (params.dkim) {
+    throw EmailTemplateException("[!] DKIM signing is not supported for templates");
+  }
+  // Each merged email is sent to the recipients in its own headers
+  if (!params.bcc.empty()) {
+    throw EmailTemplateException("[!] Bcc recipients are not supported for templates");
+  }
+
+  m_impl->m_credentials = params.credentials
+                              ? params.credentials
+                              : Credentials::make(params.user, params.password, params.hostname);
+  m_impl->m_date = params.datetime;
+  m_impl->m_relays = params.relays;
+  m_impl->m_limits = params.limits;
+  m_impl->m_max_message_size = params.max_message_size;
+  m_impl->m_max_recipients = params.max_recipients_per_message;
+  m_impl->m_skip_invalid_recipients = params.skip_invalid_recipients;
+
+  // Render the template exactly like a normal email would be, the placeholders pass through
+  // untouched and are located afterwards. It shares the credentials rather than copying them.
+  EmailParams email_params = params;
+  email_params.credentials = m_impl->m_credentials;
+  Email email{email_params};
+  for (const auto &attachment : attachments) {
+    email.addAttachment(attachment);
+  }
+  std::pmr::monotonic_buffer_resource arena;
+  const Email::RenderedParts &parts = email.build(&arena);
+  m_impl->m_boundary = email.boundary();
+
+  std::size_t total_size =
+      params.to.size() + params.from.size() + params.cc.size() + params.body.size();
+  for (const auto &part : parts) {
+    total_size += part->size();
+  }
+  m_impl->m_text.reserve(total_size);
+
+  m_impl->parse(*parts[Email::kHeadersPart], m_impl->m_document);
+  m_impl->m_document.push_back({0, 0, kDatePiece});
+  m_impl->appendStatic(*parts[Email::kMimeHeaderPart], m_impl->m_document);
+
+  // A 7bit body can have the values spliced straight into it, any other encoding has to be
+  // applied after the values have been filled in.
+  m_impl->m_document.push_back({0, 0, kMessagePiece});
+  m_impl->m_plain_body = chooseTextEncoding(params.body).encoding == TransferEncoding::k7Bit;
+  if (m_impl->m_plain_body) {
+    m_impl->parse(*parts[Email::kMessagePart], m_impl->m_message);
+  }
+  m_impl->parse(params.body, m_impl->m_body);
+
+  // Attachments and the closing boundary never contain placeholders, they are encoded once here
+  // and shared by every recipient.
+  for (std::size_t i = Email::kMessagePart + 1; i < parts.size(); i++) {
+    m_impl->appendStatic(*parts[i], m_impl->m_document);
+  }
+
+  m_impl->parse(params.to, m_impl->m_to);
+  m_impl->parse(params.from, m_impl->m_from);
+  m_impl->parse(params.cc, m_impl->m_cc);
+
+  // The document only has placeholders in its headers, the body is kept separately
+  m_impl->m_header_slots.resize(m_impl->m_slots.size());
+  m_impl->markHeaderSlots(m_impl->m_document);
+  m_impl->markHeaderSlots(m_impl->m_to);
+  m_impl->markHeaderSlots(m_impl->m_from);
+  m_impl->markHeaderSlots(m_impl->m_cc);
+}
+
+EmailTemplate::~EmailTemplate() = default;
+
+const std::vector<std::string> &EmailTemplate::slots() const { return m_impl->m_slots; }
+
+const std::string &EmailTemplate::boundary() const { return m_impl->m_boundary; }
+
+std::size_t EmailTemplate::slotIndex(std::string_view name) const {
+  const auto &slots = m_impl->m_slots;
+  if (const auto &it = std::find(slots.begin(), slots.end(), name); it != slots.end()) {
+    return static_cast<std::size_t>(std::distance(slots.begin(), it));
+  }
+
+  throw EmailTemplateException("[!] Unknown placeholder: " + std::string(name));
+}
+
+void EmailTemplate::render(const std::vector<std::string_view> &values,
+                           MergedEmail &merged) const {
+  if (values.size() != m_impl->m_slots.size()) {
+    throw EmailTemplateException("[!] Expected " + std::to_string(m_impl->m_slots.size()) +
+                                 " values but got " + std::to_string(values.size()));
+  }
+
+  bool plain_values = true;
+  for (std::size_t i = 0; i < values.size(); i++) {
+    const std::string_view value = values[i];
+    if (smtp::Mime::collidesWithBoundary(value, m_impl->m_boundary)) {
+      throw EmailTemplateException("[!] Placeholder value contains the MIME boundary");
+    }
+    if (m_impl->m_header_slots[i] && value.find_first_of("\r\n") != std::string_view::npos) {
+      throw EmailTemplateException("[!] Placeholder value used in a header has a line break: " +
+                                   m_impl->m_slots[i]);
+    }
+    plain_values = plain_values && isPlainValue(value);
+  }
+
+  m_impl->expand(m_impl->m_to, values, merged.m_to);
+  m_impl->expand(m_impl->m_from, values, merged.m_from);
+  m_impl->expand(m_impl->m_cc, values, merged.m_cc);
+
+  merged.m_date = m_impl->m_date ? m_impl->m_date->getTimestamp() : kDateTimeNow.getTimestamp();
+  merged.m_date += "\r\n";
+
+  const bool plain_message = m_impl->m_plain_body && plain_values &&
+                             m_impl->fitsLineLimit(m_impl->m_message, values);
+  if (!plain_message) {
+    m_impl->expand(m_impl->m_body, values, merged.m_body);
+    merged.m_message = Mime::renderMessage(merged.m_body, m_impl->m_boundary);
+  }
+
+  merged.m_view.clear();
+  for (const Piece &piece : m_impl->m_document) {
+    if (piece.slot == kMessagePiece) {
+      if (plain_message) {
+        for (const Piece &message_piece : m_impl->m_message) {
+          m_impl->append(message_piece, values, merged.m_view);
+        }
+      } else {
+        merged.m_view.append(merged.m_message);
+      }
+    } else if (piece.slot == kDatePiece) {
+      merged.m_view.append(merged.m_date);
+    } else {
+      m_impl->append(piece, values, merged.m_view);
+    }
+  }
+}
+
+std::size_t MergedEmail::personalisedSize() const {
+  return m_to.size() + m_from.size() + m_cc.size() + m_date.size() + m_body.size() +
+         m_message.size();
+}
+
+TransportResult EmailTemplate::send(const MergedEmail &merged, const StopToken *stop) const {
+  const std::size_t message_size = merged.size();
+  if (m_impl->m_max_message_size > 0 && message_size > m_impl->m_max_message_size) {
+    throw EmailException("[!] Message size of " + std::to_string(message_size) +
+                         " bytes exceeds the limit of " +
+                         std::to_string(m_impl->m_max_message_size) + " bytes");
+  }
+
+  // Only what was rendered for this recipient counts against the memory budget, the rest of the
+  // message is shared with the template
+  const std::optional<MemoryReservation> &reservation =
+      admitSend(merged.personalisedSize(), m_impl->m_limits, stop);
+  if (!reservation) {
+    return notAdmitted(stop);
+  }
+
+  // The merged To and Cc are lists just like the ones of an email, and are checked the same way
+  RecipientList recipients;
+  recipients.add(RecipientType::kTo, merged.to());
+  recipients.add(RecipientType::kCc, merged.cc());
+  const std::vector<std::string_view> &invalid = recipients.invalid();
+  if (!invalid.empty() && !m_impl->m_skip_invalid_recipients) {
+    throw EmailException("[!] Invalid recipient address: " + std::string(invalid.front()) +
+                         (invalid.size() > 1
+                              ? " and " + std::to_string(invalid.size() - 1) + " more"
+                              : ""));
+  }
+
+  const Credentials &credentials = *m_impl->m_credentials;
+  TransportParams transport_params{credentials.user(), credentials.password(),
+                                   credentials.hostname(), merged.from(),
+                                   recipients.envelope(true)};
+  transport_params.max_recipients = m_impl->m_max_recipients;
+  transport_params.limits = m_impl->m_limits;
+  transport_params.stop = stop;
+  if (m_impl->m_relays) {
+    return m_impl->m_relays->send(transport_params, merged.view());
+  }
+  return sendMessage(transport_params, merged.view());
+}
+
+void EmailTemplate::Impl::appendStatic(std::string_view text, Pieces &pieces) {
+  if (text.empty()) {
+    return;
+  }
+
+  // Merge with the previous piece when the two are next to each other in m_text, so the
+  // rendered message is made of as few segments as possible.
+  const std::size_t offset = m_text.size();
+  m_text.append(text);
+  if (!pieces.empty() && pieces.back().slot == kStaticPiece &&
+      pieces.back().offset + pieces.back().length == offset) {
+    pieces.back().length += text.size();
+  } else {
+    pieces.push_back({offset, text.size(), kStaticPiece});
+  }
+}
+
+void EmailTemplate::Impl::parse(std::string_view text, Pieces &pieces) {
+  std::size_t pos = 0;
+  while (pos < text.size()) {
+    const std::size_t open = text.find(kSlotOpen, pos);
+    if (open == std::string_view::npos) {
+      break;
+    }
+
+    const std::size_t close = text.find(kSlotClose, open + kSlotOpen.size());
+    if (close == std::string_view::npos) {
+      throw EmailTemplateException("[!] Unterminated placeholder in template");
+    }
+
+    appendStatic(text.substr(pos, open - pos), pieces);
+
+    const std::string_view name =
+        text.substr(open + kSlotOpen.size(), close - open - kSlotOpen.size());
+    const auto &it = std::find(m_slots.begin(), m_slots.end(), name);
+    const std::size_t slot = static_cast<std::size_t>(std::distance(m_slots.begin(), it));
+    if (it == m_slots.end()) {
+      m_slots.emplace_back(name);
+    }
+    pieces.push_back({0, 0, slot});
+
+    pos = close + kSlotClose.size();
+  }
+
+  appendStatic(text.substr(pos), pieces);
+}
+
+void EmailTemplate::Impl::markHeaderSlots(const Pieces &pieces) {
+  for (const Piece &piece : pieces) {
+    if (piece.slot < m_header_slots.size()) {
+      m_header_slots[piece.slot] = true;
+    }
+  }
+}
+
+bool EmailTemplate::Impl::fitsLineLimit(const Pieces &pieces,
+                                        const std::vector<std::string_view> &values) const {
+  // Plain text only has CRLF line breaks, so a line starts after a LF and ends before a CR. The
+  // lines inside of a piece are already short enough, only the ones pieces are joined on grow.
+  std::size_t line_length = 0;
+  for (const Piece &piece : pieces) {
+    const std::string_view text = piece.slot == kStaticPiece
+                                      ? std::string_view{m_text}.substr(piece.offset, piece.length)
+                                      : values[piece.slot];
+    const std::size_t first_break = text.find('\r');
+    if (first_break == std::string_view::npos) {
+      line_length += text.size();
+    } else if (line_length + first_break > TextNormalizer::kMaxLineLength) {
+      return false;
+    } else {
+      line_length = text.size() - text.rfind('\n') - 1;
+    }
+    if (line_length > TextNormalizer::kMaxLineLength) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void EmailTemplate::Impl::append(const Piece &piece, const std::vector<std::string_view> &values,
+                                 MessageView &view) const {
+  if (piece.slot == kStaticPiece) {
+    view.append({m_text.data() + piece.offset, piece.length});
+  } else {
+    view.append(values[piece.slot]);
+  }
+}
+
+void EmailTemplate::Impl::expand(const Pieces &pieces, const std::vector<std::string_view> &values,
+                                 std::string &out) const {
+  out.clear();
+  for (const Piece &piece : pieces) {
+    if (piece.slot == kStaticPiece) {
+      out.append(m_text, piece.offset, piece.length);
+    } else {
+      out.append(values[piece.slot]);
+    }
+  }
+}
+
+} // namespace smtp
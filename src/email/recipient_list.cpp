@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include "email/address.hpp"
+#include "email/recipient_list.hpp"
+
+namespace smtp {
+
+// Header lines are folded to stay within the line length recommended by RFC 5322 section 2.1.1
+static constexpr std::size_t kMaxHeaderLine = 78;
+static constexpr std::string_view kSeparator = ",";
+static constexpr std::string_view kSpace = " ";
+static constexpr std::string_view kFold = "\r\n ";
+
+static constexpr std::size_t kMinSlots = 16;
+
+struct SizeWriter {
+  std::size_t size = 0;
+  void append(std::string_view text) { size += text.size(); }
+};
+
+struct StringWriter {
+  std::pmr::string &out;
+  void append(std::string_view text) { out.append(text); }
+};
+
+static bool isWsp(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+static std::string_view trim(std::string_view text) {
+  while (!text.empty() && isWsp(text.front())) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && isWsp(text.back())) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+RecipientList::RecipientList(std::pmr::memory_resource *resource)
+    : m_text{resource}, m_entries{resource}, m_slots{resource} {}
+
+std::size_t RecipientList::add(RecipientType type, std::string_view entries) {
+  // Commas inside of a quoted display name or angle brackets do not separate entries
+  std::size_t added = 0;
+  std::size_t start = 0;
+  bool quoted = false;
+  bool bracketed = false;
+  for (std::size_t i = 0; i <= entries.size(); i++) {
+    if (i == entries.size() || (entries[i] == ',' && !quoted && !bracketed)) {
+      added += addEntry(type, entries.substr(start, i - start)) ? 1 : 0;
+      start = i + 1;
+    } else if (entries[i] == '"') {
+      quoted = !quoted;
+    } else if (entries[i] == '<' && !quoted) {
+      bracketed = true;
+    } else if (entries[i] == '>' && !quoted) {
+      bracketed = false;
+    }
+  }
+  return added;
+}
+
+bool RecipientList::addEntry(RecipientType type, std::string_view entry) {
+  // The normalized address is written straight into the buffer and taken off again if it is
+  // empty or turns out to be a duplicate
+  const std::size_t address_offset = m_text.size();
+  m_text.resize(address_offset + entry.size());
+  const NormalizedAddress &normalized = normalizeAddress(entry, m_text.data() + address_offset);
+  m_text.resize(address_offset + normalized.address.size());
+  if (normalized.error == AddressError::kEmpty) {
+    return false;
+  }
+
+  const std::size_t hash = std::hash<std::string_view>{}(normalized.address);
+  if (m_slots.empty() || m_entries.size() * 2 >= m_slots.size()) {
+    rehash(std::max(kMinSlots, m_slots.size() * 2));
+  }
+
+  const std::size_t slot = findSlot(normalized.address, hash);
+  if (m_slots[slot] != 0) {
+    m_text.resize(address_offset);
+    return false;
+  }
+
+  // The display text is only stored when it differs from the normalized address
+  entry = trim(entry);
+  std::size_t display_offset = address_offset;
+  if (entry != normalized.address) {
+    display_offset = m_text.size();
+    m_text.append(entry);
+  }
+
+  m_entries.push_back({display_offset, entry.size(), address_offset, normalized.address.size(),
+                       hash, type, normalized.error});
+  m_slots[slot] = static_cast<uint32_t>(m_entries.size());
+  return true;
+}
+
+std::size_t RecipientList::findSlot(std::string_view address, std::size_t hash) const {
+  const std::size_t mask = m_slots.size() - 1;
+  for (std::size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+    const uint32_t index = m_slots[slot];
+    if (index == 0) {
+      return slot;
+    }
+    const Entry &entry = m_entries[index - 1];
+    if (entry.hash == hash && this->address(entry) == address) {
+      return slot;
+    }
+  }
+}
+
+void RecipientList::rehash(std::size_t slot_count) {
+  m_slots.assign(slot_count, 0);
+  const std::size_t mask = slot_count - 1;
+  for (std::size_t i = 0; i < m_entries.size(); i++) {
+    std::size_t slot = m_entries[i].hash & mask;
+    while (m_slots[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    m_slots[slot] = static_cast<uint32_t>(i + 1);
+  }
+}
+
+void RecipientList::clear(RecipientType type) {
+  // The remaining entries are copied into fresh buffers so the text of the removed ones is freed
+  RecipientList remaining{m_text.get_allocator().resource()};
+  for (const Entry &entry : m_entries) {
+    if (entry.type != type) {
+      remaining.addEntry(entry.type, display(entry));
+    }
+  }
+  *this = std::move(remaining);
+}
+
+void RecipientList::clear() {
+  m_text.clear();
+  m_entries.clear();
+  m_slots.clear();
+}
+
+bool RecipientList::contains(std::string_view address) const {
+  if (m_slots.empty()) {
+    return false;
+  }
+
+  std::string buffer(address.size(), '\0');
+  const NormalizedAddress &normalized = normalizeAddress(address, buffer.data());
+  const std::size_t hash = std::hash<std::string_view>{}(normalized.address);
+  return m_slots[findSlot(normalized.address, hash)] != 0;
+}
+
+std::vector<std::string_view> RecipientList::invalid() const {
+  std::vector<std::string_view> result;
+  for (const Entry &entry : m_entries) {
+    if (entry.error != AddressError::kNone) {
+      result.push_back(display(entry));
+    }
+  }
+  return result;
+}
+
+template <typename Writer>
+void RecipientList::writeHeader(RecipientType type, std::size_t prefix_size,
+                                Writer &out) const {
+  std::size_t column = prefix_size;
+  bool first = true;
+  for (const Entry &entry : m_entries) {
+    if (entry.type != type) {
+      continue;
+    }
+
+    // Room is left on every line for the separator that may follow the entry
+    const std::string_view text = display(entry);
+    if (!first) {
+      out.append(kSeparator);
+      column += kSeparator.size();
+      if (column + kSpace.size() + text.size() + kSeparator.size() > kMaxHeaderLine) {
+        out.append(kFold);
+        column = kSpace.size();
+      } else {
+        out.append(kSpace);
+        column += kSpace.size();
+      }
+    }
+    out.append(text);
+    column += text.size();
+    first = false;
+  }
+}
+
+void RecipientList::appendHeader(RecipientType type, std::size_t prefix_size,
+                                 std::pmr::string &out) const {
+  StringWriter writer{out};
+  writeHeader(type, prefix_size, writer);
+}
+
+std::size_t RecipientList::headerSize(RecipientType type, std::size_t prefix_size) const {
+  SizeWriter writer;
+  writeHeader(type, prefix_size, writer);
+  return writer.size;
+}
+
+std::vector<std::string_view> RecipientList::envelope(bool valid_only) const {
+  std::vector<std::string_view> result;
+  result.reserve(m_entries.size());
+  for (const Entry &entry : m_entries) {
+    if (!valid_only || entry.error == AddressError::kNone) {
+      result.push_back(address(entry));
+    }
+  }
+  return result;
+}
+
+} // namespace smtp
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "email/address.hpp"
+
+namespace smtp {
+
+enum class RecipientType { kTo, kCc, kBcc };
+
+// The To, Cc and Bcc recipients of an email. Every address is kept once, however many times and
+// in however many of the lists it is added, in the list it was first added to.
+//
+// Addresses are compared once they have been normalized with normalizeAddress(): the whitespace
+// around them and any display name and angle brackets are removed, and the domain is lowercased.
+// The entries are kept as they were given for the headers, along with whether their address is
+// valid. All of the text lives in one buffer and duplicates are
+// found with an open addressing hash table, so adding an address does not allocate once the
+// buffers have grown large enough.
+class RecipientList {
+public:
+  explicit RecipientList(std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+  // Adds every entry of a comma separated list such as a header value, e.g
+  // "Jane <jane@example.com>, bob@example.com". Returns the number of addresses that were not
+  // recipients already.
+  std::size_t add(RecipientType type, std::string_view entries);
+  void clear(RecipientType type);
+  void clear();
+
+  std::size_t size() const { return m_entries.size(); }
+  bool contains(std::string_view address) const;
+
+  // Entries, as they were given, whose address is not valid RFC 5321 syntax
+  std::vector<std::string_view> invalid() const;
+
+  // Appends the value of the To or Cc header, folded so that lines are at most 78 characters
+  // long. prefix_size is the length of what comes before the value on the first line, e.g 4 for
+  // "To: ".
+  void appendHeader(RecipientType type, std::size_t prefix_size, std::pmr::string &out) const;
+  std::size_t headerSize(RecipientType type, std::size_t prefix_size) const;
+
+  // Normalized address of every recipient, Bcc included, in the order they were added. Entries
+  // that are not valid are left out when valid_only is set.
+  std::vector<std::string_view> envelope(bool valid_only = false) const;
+
+private:
+  struct Entry {
+    std::size_t display_offset;
+    std::size_t display_size;
+    std::size_t address_offset;
+    std::size_t address_size;
+    std::size_t hash;
+    RecipientType type;
+    AddressError error;
+  };
+
+  std::pmr::string m_text;
+  std::pmr::vector<Entry> m_entries;
+  // Index + 1 of the entry in each slot, 0 for an empty slot. The size is a power of two.
+  std::pmr::vector<uint32_t> m_slots;
+
+  std::string_view address(const Entry &entry) const {
+    return std::string_view{m_text}.substr(entry.address_offset, entry.address_size);
+  }
+  std::string_view display(const Entry &entry) const {
+    return std::string_view{m_text}.substr(entry.display_offset, entry.display_size);
+  }
+
+  bool addEntry(RecipientType type, std::string_view entry);
+  // Returns the slot that holds address, or the empty slot where it belongs
+  std::size_t findSlot(std::string_view address, std::size_t hash) const;
+  void rehash(std::size_t slot_count);
+
+  template <typename Writer>
+  void writeHeader(RecipientType type, std::size_t prefix_size, Writer &out) const;
+};
+
+} // namespace smtp
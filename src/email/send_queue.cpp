@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "email/send_queue.hpp"
+#include "transport/admission.hpp"
+
+namespace smtp {
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr std::size_t kLanes = 3;
+
+struct Job {
+  SendQueue::Send send;
+  std::promise<TransportResult> promise;
+  Clock::time_point queued;
+  // The job's share of the library's memory budget, from when it is queued until it is sent
+  MemoryReservation reservation;
+  // Whether the job went through admission as it was queued
+  bool admitted = false;
+};
+
+struct Lane {
+  std::deque<Job> jobs;
+  LaneStats stats;
+};
+
+struct SendQueue::Impl {
+  SendQueueOptions m_options;
+
+  mutable std::mutex m_mutex;
+  // Reserved workers wait on their own condition so that mail they cannot take does not wake them
+  std::condition_variable m_shared_ready;
+  std::condition_variable m_reserved_ready;
+  std::condition_variable m_idle;
+  std::array<Lane, kLanes> m_lanes;
+  // Position in the cycle of normal_weight + bulk_weight turns shared by the two lower lanes
+  std::size_t m_turn = 0;
+  bool m_stopping = false;
+
+  std::vector<std::thread> m_workers;
+
+  Lane &lane(Priority priority) { return m_lanes[static_cast<std::size_t>(priority)]; }
+
+  std::optional<Priority> nextLane(bool reserved);
+  void work(bool reserved);
+};
+
+std::optional<Priority> SendQueue::Impl::nextLane(bool reserved) {
+  if (!lane(Priority::kInteractive).jobs.empty()) {
+    return Priority::kInteractive;
+  }
+  if (reserved) {
+    return std::nullopt;
+  }
+
+  const bool normal = !lane(Priority::kNormal).jobs.empty();
+  const bool bulk = !lane(Priority::kBulk).jobs.empty();
+  if (normal && bulk) {
+    const std::size_t cycle = m_options.normal_weight + m_options.bulk_weight;
+    const bool normal_turn = m_turn < m_options.normal_weight;
+    m_turn = (m_turn + 1) % cycle;
+    return normal_turn ? Priority::kNormal : Priority::kBulk;
+  }
+  if (normal) {
+    return Priority::kNormal;
+  }
+  if (bulk) {
+    return Priority::kBulk;
+  }
+  return std::nullopt;
+}
+
+void SendQueue::Impl::work(bool reserved) {
+  std::condition_variable &ready = reserved ? m_reserved_ready : m_shared_ready;
+  std::unique_lock<std::mutex> lock{m_mutex};
+  for (;;) {
+    std::optional<Priority> priority;
+    ready.wait(lock, [&]() {
+      priority = nextLane(reserved);
+      return priority || m_stopping;
+    });
+    if (!priority) {
+      return;
+    }
+
+    Lane &current = lane(*priority);
+    Job job = std::move(current.jobs.front());
+    current.jobs.pop_front();
+    current.stats.queued--;
+    current.stats.in_flight++;
+    const auto &wait = std::chrono::duration_cast<std::chrono::microseconds>(
+        Clock::now() - job.queued);
+    current.stats.longest_wait = std::max(current.stats.longest_wait, wait);
+    lock.unlock();
+
+    bool sent = false;
+    try {
+      // The send was admitted when it was queued, so it does not wait for the budget again
+      std::optional<AdmittedScope> admitted;
+      if (job.admitted) {
+        admitted.emplace();
+      }
+      TransportResult result = job.send();
+      sent = result.sent();
+      job.promise.set_value(std::move(result));
+    } catch (...) {
+      job.promise.set_exception(std::current_exception());
+    }
+    job.reservation.release();
+
+    lock.lock();
+    current.stats.in_flight--;
+    (sent ? current.stats.sent : current.stats.failed)++;
+    m_idle.notify_all();
+  }
+}
+
+SendQueue::SendQueue(const SendQueueOptions &options) : m_impl{std::make_unique<Impl>()} {
+  if (options.workers == 0 || options.reserved_interactive >= options.workers) {
+    throw SendQueueException("[!] A send queue needs more workers than it reserves for "
+                             "interactive mail");
+  }
+  if (options.normal_weight == 0 || options.bulk_weight == 0) {
+    throw SendQueueException("[!] The normal and bulk weights must be at least 1");
+  }
+
+  m_impl->m_options = options;
+  m_impl->m_workers.reserve(options.workers);
+  for (std::size_t i = 0; i < options.workers; i++) {
+    const bool reserved = i < options.reserved_interactive;
+    m_impl->m_workers.emplace_back([this, reserved]() { m_impl->work(reserved); });
+  }
+}
+
+SendQueue::~SendQueue() {
+  {
+    std::lock_guard<std::mutex> lock{m_impl->m_mutex};
+    m_impl->m_stopping = true;
+  }
+  m_impl->m_shared_ready.notify_all();
+  m_impl->m_reserved_ready.notify_all();
+  for (std::thread &worker : m_impl->m_workers) {
+    worker.join();
+  }
+}
+
+std::future<TransportResult> SendQueue::submit(const Email &email, Priority priority,
+                                               const StopToken *stop) {
+  return this->submit([&email, stop]() { return email.send(stop); }, priority,
+                      email.serializedSize());
+}
+
+std::future<TransportResult> SendQueue::submit(const EmailTemplate &email_template,
+                                               const MergedEmail &merged, Priority priority,
+                                               const StopToken *stop) {
+  return this->submit(
+      [&email_template, &merged, stop]() { return email_template.send(merged, stop); },
+      priority, merged.personalisedSize());
+}
+
+std::future<TransportResult> SendQueue::submit(Send send, Priority priority,
+                                               std::size_t bytes) {
+  // Waits for memory before taking the lock, so the workers carry on and release it meanwhile.
+  // Interactive mail never waits behind a blast, it is let through over budget instead.
+  const bool admitted = bytes > 0;
+  MemoryReservation reservation =
+      admitted ? admitQueued(bytes, priority != Priority::kInteractive) : MemoryReservation{};
+  Job job{std::move(send), {}, Clock::now(), std::move(reservation), admitted};
+  std::future<TransportResult> future = job.promise.get_future();
+  {
+    std::lock_guard<std::mutex> lock{m_impl->m_mutex};
+    Lane &lane = m_impl->lane(priority);
+    lane.jobs.push_back(std::move(job));
+    lane.stats.queued++;
+  }
+
+  // A reserved worker is woken as well, whichever of them is free first takes the send
+  if (priority == Priority::kInteractive) {
+    m_impl->m_reserved_ready.notify_one();
+  }
+  m_impl->m_shared_ready.notify_one();
+  return future;
+}
+
+LaneStats SendQueue::stats(Priority priority) const {
+  std::lock_guard<std::mutex> lock{m_impl->m_mutex};
+  return m_impl->lane(priority).stats;
+}
+
+void SendQueue::drain() {
+  std::unique_lock<std::mutex> lock{m_impl->m_mutex};
+  m_impl->m_idle.wait(lock, [this]() {
+    for (const Lane &lane : m_impl->m_lanes) {
+      if (lane.stats.queued > 0 || lane.stats.in_flight > 0) {
+        return false;
+      }
+    }
+    return true;
+  });
+}
+
+} // namespace smtp
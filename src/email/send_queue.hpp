@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+
+#include "email/email.hpp"
+#include "email/email_template.hpp"
+#include "transport/transport.hpp"
+
+namespace smtp {
+
+class SendQueueException : public std::runtime_error {
+public:
+  using runtime_error::runtime_error;
+};
+
+// Lanes of the send queue, from the most urgent to the least
+enum class Priority : std::size_t {
+  // Password resets, one time codes and anything else someone is waiting for
+  kInteractive,
+  kNormal,
+  // Newsletters and other mail sent in bulk
+  kBulk,
+};
+
+struct SendQueueOptions {
+  // Threads that send the queued mail, each of them holds at most one connection at a time
+  std::size_t workers = 8;
+  // Workers that only ever send interactive mail, so it gets a connection straight away however
+  // much other mail is queued. Must be fewer than workers.
+  std::size_t reserved_interactive = 1;
+  // While both lanes have mail queued, the other workers take this many normal sends for every
+  // bulk_weight bulk sends. Interactive mail always goes before either of them.
+  std::size_t normal_weight = 4;
+  std::size_t bulk_weight = 1;
+};
+
+struct LaneStats {
+  std::size_t queued = 0;
+  std::size_t in_flight = 0;
+  std::size_t sent = 0;
+  // Sends that did not return TransportStatus::kSent or that threw
+  std::size_t failed = 0;
+  // Longest time a send of this lane waited for a worker
+  std::chrono::microseconds longest_wait{0};
+};
+
+// Sends mail from a pool of worker threads, taking it from one queue per priority. Interactive
+// mail is always taken first and has workers reserved for it, the normal and bulk lanes share the
+// other workers by weight, so a large blast can run at full speed without delaying urgent mail.
+// A send that has started is never interrupted, it could already have been delivered to some of
+// its recipients.
+//
+// The queue can be used from several threads at once. It waits for every queued send to finish
+// before it is destroyed.
+class SendQueue {
+public:
+  using Send = std::function<TransportResult()>;
+
+  explicit SendQueue(const SendQueueOptions &options = {});
+  ~SendQueue();
+
+  SendQueue(const SendQueue &) = delete;
+  SendQueue &operator=(const SendQueue &) = delete;
+
+  // The email, and the stop token if there is one, must outlive the send. The future holds the
+  // result, or the exception that send() threw.
+  //
+  // When the library has a memory budget the message takes its share of it from now until its
+  // send is over. submit() waits for the share if the budget is used up, or throws a
+  // MemoryBudgetException if the library rejects work over budget. Interactive mail is never held
+  // up by the budget, it is sent without a share when there is no room for it.
+  std::future<TransportResult> submit(const Email &email, Priority priority = Priority::kNormal,
+                                      const StopToken *stop = nullptr);
+  // The template and the merged email must outlive the send
+  std::future<TransportResult> submit(const EmailTemplate &email_template,
+                                      const MergedEmail &merged,
+                                      Priority priority = Priority::kNormal,
+                                      const StopToken *stop = nullptr);
+  // bytes is what the send counts against the memory budget, 0 leaves it to the send itself
+  std::future<TransportResult> submit(Send send, Priority priority = Priority::kNormal,
+                                      std::size_t bytes = 0);
+
+  LaneStats stats(Priority priority) const;
+
+  // Blocks until nothing is queued or in flight
+  void drain();
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace smtp
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cctype>
+
+#include "mime/delivery_status.hpp"
+
+namespace smtp {
+
+// message/global-delivery-status is the same thing with UTF-8 allowed, RFC 6533
+static constexpr std::string_view kDeliveryStatusType = "message/delivery-status";
+static constexpr std::string_view kGlobalDeliveryStatusType = "message/global-delivery-status";
+
+static bool isWsp(char c) { return c == ' ' || c == '\t'; }
+
+static bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return std::tolower(static_cast<unsigned char>(x)) ==
+                  std::tolower(static_cast<unsigned char>(y));
+         });
+}
+
+static std::string_view trim(std::string_view text) {
+  while (!text.empty() && isWsp(text.front())) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && isWsp(text.back())) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+// Removes the type from a value such as "rfc822; <user@example.com>"
+static std::string addressOf(std::string_view value) {
+  if (const std::size_t semicolon = value.find(';'); semicolon != std::string_view::npos) {
+    value = trim(value.substr(semicolon + 1));
+  }
+  if (value.size() >= 2 && value.front() == '<' && value.back() == '>') {
+    value = value.substr(1, value.size() - 2);
+  }
+  return std::string{value};
+}
+
+static std::string lowercase(std::string_view text) {
+  std::string result{text};
+  for (char &c : result) {
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+  return result;
+}
+
+bool RecipientStatus::isPermanentFailure() const {
+  return status.empty() ? action == "failed" : status.front() == '5';
+}
+
+bool DeliveryStatusHandler::onHeadersEnd(const MimeEntity &entity) {
+  if (m_found || m_collecting) {
+    return false;
+  }
+  if (entity.isMultipart()) {
+    return true;
+  }
+  if (entity.content_type == kDeliveryStatusType ||
+      entity.content_type == kGlobalDeliveryStatusType) {
+    m_collecting = true;
+    m_depth = entity.depth;
+    m_text.clear();
+    return true;
+  }
+  return false;
+}
+
+void DeliveryStatusHandler::onBody(std::string_view data) {
+  if (m_collecting) {
+    m_text.append(data);
+  }
+}
+
+void DeliveryStatusHandler::onEntityEnd(std::size_t depth) {
+  if (m_collecting && depth == m_depth) {
+    m_collecting = false;
+    m_found = true;
+    parseFields(m_text, m_status);
+  }
+}
+
+void DeliveryStatusHandler::parseFields(std::string_view text, DeliveryStatus &status) {
+  // The first group of fields is about the message, every group after it about one recipient
+  std::size_t group = 0;
+  bool group_started = false;
+  std::string_view field;
+  std::string scratch;
+
+  const auto &apply = [&]() {
+    const std::size_t colon = field.find(':');
+    if (field.empty() || colon == std::string_view::npos) {
+      return;
+    }
+    const std::string_view name = trim(field.substr(0, colon));
+    const std::string_view value = MimeParser::unfold(field.substr(colon + 1), scratch);
+
+    if (group == 0) {
+      if (equalsIgnoreCase(name, "Reporting-MTA")) {
+        status.reporting_mta = addressOf(value);
+      } else if (equalsIgnoreCase(name, "Original-Envelope-Id")) {
+        status.original_envelope_id = value;
+      }
+      return;
+    }
+
+    RecipientStatus &recipient = status.recipients.back();
+    if (equalsIgnoreCase(name, "Final-Recipient")) {
+      recipient.final_recipient = addressOf(value);
+    } else if (equalsIgnoreCase(name, "Original-Recipient")) {
+      recipient.original_recipient = addressOf(value);
+    } else if (equalsIgnoreCase(name, "Action")) {
+      recipient.action = lowercase(value);
+    } else if (equalsIgnoreCase(name, "Status")) {
+      // The code may be followed by a comment e.g "5.1.1 (bad destination mailbox)"
+      recipient.status = value.substr(0, value.find_first_of(" \t("));
+    } else if (equalsIgnoreCase(name, "Remote-MTA")) {
+      recipient.remote_mta = addressOf(value);
+    } else if (equalsIgnoreCase(name, "Diagnostic-Code")) {
+      recipient.diagnostic_code = value;
+    }
+  };
+
+  std::size_t pos = 0;
+  while (pos < text.size()) {
+    std::size_t end = text.find('\n', pos);
+    end = end == std::string_view::npos ? text.size() : end;
+    std::string_view line = text.substr(pos, end - pos);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    pos = end + 1;
+
+    if (trim(line).empty()) {
+      apply();
+      field = {};
+      if (group_started) {
+        group++;
+        group_started = false;
+      }
+    } else if (isWsp(line.front()) && !field.empty()) {
+      field = {field.data(), static_cast<std::size_t>(line.data() + line.size() - field.data())};
+    } else {
+      apply();
+      if (!group_started && group > 0) {
+        status.recipients.emplace_back();
+      }
+      group_started = true;
+      field = line;
+    }
+  }
+  apply();
+}
+
+bool parseDeliveryStatus(std::string_view message, DeliveryStatus &status) {
+  DeliveryStatusHandler handler;
+  MimeParser parser{handler};
+  parser.feed(message);
+  parser.finish();
+
+  if (handler.found()) {
+    status = handler.status();
+  }
+  return handler.found();
+}
+
+} // namespace smtp
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mime/mime_parser.hpp"
+
+namespace smtp {
+
+// Per recipient fields of a delivery status notification, RFC 3464 section 2.3
+struct RecipientStatus {
+  // Addresses have their type, e.g "rfc822;", removed
+  std::string final_recipient;
+  std::string original_recipient;
+  // Lowercased, one of failed, delayed, delivered, relayed or expanded
+  std::string action;
+  // Enhanced status code e.g 5.1.1
+  std::string status;
+  std::string remote_mta;
+  std::string diagnostic_code;
+
+  // The address will keep on failing however many times it is retried, which is what a
+  // suppression list is made of
+  bool isPermanentFailure() const;
+};
+
+struct DeliveryStatus {
+  std::string reporting_mta;
+  std::string original_envelope_id;
+  std::vector<RecipientStatus> recipients;
+};
+
+// Picks the message/delivery-status part out of a bounce while it is being parsed. Every other
+// part is skipped without being decoded, and only the status part itself is copied.
+class DeliveryStatusHandler : public MimeHandler {
+public:
+  bool onHeadersEnd(const MimeEntity &entity) override;
+  void onBody(std::string_view data) override;
+  void onEntityEnd(std::size_t depth) override;
+
+  // True once a delivery status part has been read, only the first one is used
+  bool found() const { return m_found; }
+  const DeliveryStatus &status() const { return m_status; }
+
+  // Parses the groups of fields that make up a delivery status part into status
+  static void parseFields(std::string_view text, DeliveryStatus &status);
+
+private:
+  DeliveryStatus m_status;
+  std::string m_text;
+  std::size_t m_depth = 0;
+  bool m_collecting = false;
+  bool m_found = false;
+};
+
+// Reads the delivery status of a bounce that is already in memory. Returns false if the message
+// does not contain one.
+bool parseDeliveryStatus(std::string_view message, DeliveryStatus &status);
+
+} // namespace smtp
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include "mime/message_view.hpp"
+
+namespace smtp {
+
+// Linux refuses writev() calls with more than UIO_MAXIOV (1024) segments
+static constexpr std::size_t kMaxSegmentsPerWrite = 1024;
+
+void MessageView::append(std::string_view segment) {
+  if (segment.empty()) {
+    return;
+  }
+
+  // writev() never writes to the buffers so casting away const is safe
+  m_segments.push_back({const_cast<char *>(segment.data()), segment.size()});
+  m_size += segment.size();
+}
+
+void MessageView::clear() {
+  m_segments.clear();
+  m_size = 0;
+}
+
+std::string_view MessageView::segment(std::size_t index) const {
+  const iovec &segment = m_segments[index];
+  return {static_cast<const char *>(segment.iov_base), segment.iov_len};
+}
+
+std::size_t MessageView::writeTo(int fd) const {
+  std::array<iovec, kMaxSegmentsPerWrite> batch;
+  std::size_t index = 0;
+  std::size_t offset = 0;
+  std::size_t total_written = 0;
+
+  while (index < m_segments.size()) {
+    const std::size_t count = std::min(batch.size(), m_segments.size() - index);
+    std::copy_n(m_segments.begin() + index, count, batch.begin());
+
+    // Skip over the part of the first segment that was written by a previous partial write
+    batch[0].iov_base = static_cast<char *>(batch[0].iov_base) + offset;
+    batch[0].iov_len -= offset;
+
+    const ssize_t written = ::writev(fd, batch.data(), static_cast<int>(count));
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::system_error(errno, std::generic_category(), "[!] Failed to write message");
+    }
+
+    total_written += static_cast<std::size_t>(written);
+
+    auto remaining = static_cast<std::size_t>(written);
+    while (remaining > 0) {
+      const std::size_t left_in_segment = m_segments[index].iov_len - offset;
+      if (remaining < left_in_segment) {
+        offset += remaining;
+        break;
+      }
+
+      remaining -= left_in_segment;
+      index++;
+      offset = 0;
+    }
+  }
+
+  return total_written;
+}
+
+std::size_t MessageReader::read(char *buffer, std::size_t size) {
+  const std::vector<iovec> &segments = m_view.segments();
+  std::size_t bytes_read = 0;
+
+  // Segments may be larger than the buffer so we keep track of how far into the current segment
+  // we are.
+  while (bytes_read < size && m_segment_index < segments.size()) {
+    const iovec &segment = segments[m_segment_index];
+    const std::size_t len = std::min(segment.iov_len - m_segment_offset, size - bytes_read);
+
+    std::memcpy(buffer + bytes_read, static_cast<const char *>(segment.iov_base) + m_segment_offset,
+                len);
+    bytes_read += len;
+    m_segment_offset += len;
+
+    if (m_segment_offset == segment.iov_len) {
+      m_segment_index++;
+      m_segment_offset = 0;
+    }
+  }
+
+  return bytes_read;
+}
+
+} // namespace smtp
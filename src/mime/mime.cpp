@@ -1,62 +1,306 @@
 #include <algorithm>
-#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <random>
 #include <sstream>
 
 #include "mime/mime.hpp"
+#include "mime/text_normalizer.hpp"
 #include "utils/base64/base64.hpp"
+#include "utils/quoted_printable/quoted_printable.hpp"
+#include "utils/simd/substring.hpp"
 
 namespace smtp {
 
-const std::string Mime::kBoundaryDeclare = "----------030203080101020302070708";
-const std::string Mime::kBoundary = "--" + kBoundaryDeclare;
-const std::string Mime::kLastBoundary = kBoundary + "--";
+const std::string Mime::kDefaultUserAgent = "Very-Simple-SMTPS";
 const std::string Mime::kCRLF = "\r\n";
 
-const int kTransferRate = 512;
+const std::size_t kTransferRate = 512;
 
-Mime::Mime(const std::string &user_agent) : m_user_agent{user_agent} { buildHeader(); }
+// Fixed pieces of the document. These are shared by the builders and the size calculations so
+// that the two can never disagree.
+static constexpr std::string_view kUserAgentPrefix = "User-Agent: ";
+static constexpr std::string_view kMimeVersion = "MIME-Version: 1.0\r\n";
+static constexpr std::string_view kMultipartType = "Content-Type: multipart/mixed;\r\n";
+static constexpr std::string_view kBoundaryPrefix = " boundary=\"";
+static constexpr std::string_view kBoundarySuffix = "\"\r\n";
+static constexpr std::string_view kPreamble =
+    "\r\nThis is a multi-part message in MIME format.\r\n";
 
-void Mime::buildHeader() {
-  m_document.push_back("User-Agent: " + m_user_agent + "\r\n");
-  m_document.emplace_back("MIME-Version: 1.0\r\n");
-  m_document.emplace_back("Content-Type: multipart/mixed;\r\n");
-  m_document.emplace_back(" boundary=\"----------030203080101020302070708\"\r\n");
-  m_document.emplace_back("\r\nThis is a multi-part message in MIME format.\r\n");
-  m_document.push_back(Mime::kBoundary);
-  m_document.emplace_back("\r\n");
+static constexpr std::string_view kTextType =
+    "Content-Type: text/plain; charset=utf-8; format=flowed\r\n";
+static constexpr std::string_view kEncodingPrefix = "Content-Transfer-Encoding: ";
+
+static constexpr std::string_view kContentTypePrefix = "Content-Type: ";
+static constexpr std::string_view kDefaultAttachmentType = "application/octet-stream";
+static constexpr std::string_view kAttachmentDisposition = "Content-Disposition: attachment;\r\n";
+static constexpr std::string_view kFilenamePrefix = " filename=";
+
+static constexpr std::size_t kCRLFSize = 2;
+
+// A boundary is a run of dashes followed by random alphanumeric characters
+static constexpr std::string_view kBoundaryDashes = "----------";
+static constexpr std::string_view kBoundaryAlphabet =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+// Delimiter lines inside of the document are the boundary prefixed by two more dashes
+static constexpr std::string_view kDelimiterPrefix = "--";
+static constexpr std::string_view kLastBoundarySuffix = "--";
+
+static std::size_t encodingHeaderSize(TransferEncoding encoding) {
+  return kEncodingPrefix.size() + transferEncodingName(encoding).size() + kCRLFSize;
+}
+
+static void appendEncodingHeader(TransferEncoding encoding, std::pmr::string &out) {
+  out.append(kEncodingPrefix).append(transferEncodingName(encoding)).append(Mime::kCRLF);
+}
+
+// Base64 encoded content is split into lines of kTransferRate bytes, each ending with a CRLF
+static std::size_t base64LinesSize(std::size_t encoded_size) {
+  const std::size_t num_lines = (encoded_size + kTransferRate - 1) / kTransferRate;
+  return encoded_size + num_lines * kCRLFSize;
+}
+
+static void appendBase64Lines(std::string_view contents_b64, std::pmr::string &out) {
+  for (std::size_t bytes_read = 0; bytes_read < contents_b64.size();
+       bytes_read += kTransferRate) {
+    out.append(contents_b64.substr(bytes_read, kTransferRate)).append(Mime::kCRLF);
+  }
+}
+
+// Equivalent to std::filesystem::path(path).filename() for POSIX paths but does not allocate.
+static std::string_view filenameOf(std::string_view path) {
+  const std::size_t slash = path.rfind('/');
+  return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+Mime::Mime(const std::string &user_agent, std::pmr::memory_resource *resource)
+    : m_document{resource}, m_user_agent{user_agent, resource},
+      m_boundary{generateBoundary(), resource} {
+  if (collidesWithBoundary(m_user_agent, m_boundary)) {
+    replaceBoundary(m_user_agent);
+  }
+  m_document.push_back(renderHeader(m_user_agent, m_boundary, resource));
 }
 
 void Mime::addMessage(const std::string &message) {
-  m_document.emplace_back("Content-Type: text/plain; charset=utf-8; format=flowed\r\n");
-  m_document.emplace_back("Content-Transfer-Encoding: 7bit\r\n");
-  m_document.emplace_back("\r\n");
-  m_document.push_back(message + "\r\n");
-  m_document.push_back(Mime::kBoundary + "\r\n");
+  if (collidesWithBoundary(message, m_boundary)) {
+    replaceBoundary(message);
+  }
+  m_document.push_back(renderMessage(message, m_boundary, m_document.get_allocator().resource()));
 }
 
 void Mime::addAttachment(const std::string &attachment_path, const std::string &contents_b64) {
-  const std::string &filename = std::filesystem::path(attachment_path).filename().string();
+  m_document.push_back(renderAttachment(attachment_path, contents_b64, m_boundary,
+                                        m_document.get_allocator().resource()));
+}
+
+void Mime::replaceBoundary(std::string_view message) {
+  const auto &collides = [this, &message](std::string_view boundary) {
+    return collidesWithBoundary(message, boundary) ||
+           std::any_of(m_document.begin(), m_document.end(),
+                       [&boundary](std::string_view section) {
+                         return collidesWithBoundary(section, boundary);
+                       });
+  };
+
+  std::string boundary = generateBoundary();
+  while (collides(boundary)) {
+    boundary = generateBoundary();
+  }
+
+  // Every boundary has the same length so the sections can be rewritten without moving anything.
+  // None of the text sections contain the old boundary, otherwise it would have been replaced
+  // when they were added, so every occurrence of it is a delimiter.
+  for (auto &section : m_document) {
+    for (std::size_t pos = section.find(m_boundary); pos != std::string::npos;
+         pos = section.find(m_boundary, pos + boundary.size())) {
+      section.replace(pos, boundary.size(), boundary);
+    }
+  }
+  m_boundary = boundary;
+}
+
+std::string Mime::generateBoundary() {
+  thread_local std::mt19937_64 generator{std::random_device{}()};
+  std::uniform_int_distribution<std::size_t> distribution{0, kBoundaryAlphabet.size() - 1};
+
+  std::string boundary{kBoundaryDashes};
+  boundary.reserve(kBoundaryLength);
+  while (boundary.size() < kBoundaryLength) {
+    boundary.push_back(kBoundaryAlphabet[distribution(generator)]);
+  }
+  return boundary;
+}
+
+bool Mime::collidesWithBoundary(std::string_view text, std::string_view boundary) {
+  // Searching for the bare boundary rather than the delimiter also catches the boundary="..."
+  // parameter and costs nothing extra, a collision only means a new boundary is picked.
+  return containsSubstring(text, boundary);
+}
+
+std::vector<std::string> Mime::build() const {
+  return std::vector<std::string>(m_document.begin(), m_document.end());
+}
+
+MessageView Mime::view() const {
+  MessageView view;
+  view.reserve(m_document.size());
+  for (const auto &section : m_document) {
+    view.append(section);
+  }
+  return view;
+}
 
-  m_document.emplace_back("Content-Type: application/octet-stream\r\n");
-  m_document.emplace_back("Content-Transfer-Encoding: base64\r\n");
-  m_document.emplace_back("Content-Disposition: attachment;\r\n");
-  m_document.push_back(" filename=" + filename + "\r\n");
-  m_document.emplace_back("\r\n");
+std::pmr::string Mime::renderHeader(std::string_view user_agent, std::string_view boundary,
+                                    std::pmr::memory_resource *resource) {
+  std::pmr::string result{resource};
+  result.reserve(headerSize(user_agent, boundary));
 
-  // Split the base64 encoded contents into chunks of 512 bytes
-  uint32_t bytes_read = 0;
-  while (bytes_read < contents_b64.size()) {
-    const std::string &data = contents_b64.substr(bytes_read, kTransferRate);
-    bytes_read += data.size();
+  result.append(kUserAgentPrefix).append(user_agent).append(kCRLF);
+  result.append(kMimeVersion);
+  result.append(kMultipartType);
+  result.append(kBoundaryPrefix).append(boundary).append(kBoundarySuffix);
+  result.append(kPreamble);
+  result.append(kDelimiterPrefix).append(boundary).append(kCRLF);
 
-    m_document.push_back(data + "\r\n");
+  return result;
+}
+
+std::pmr::string Mime::renderMessage(std::string_view message, std::string_view boundary,
+                                     std::pmr::memory_resource *resource) {
+  return renderMessage(message, chooseTextEncoding(message), boundary, resource);
+}
+
+std::pmr::string Mime::renderMessage(std::string_view message, const EncodingChoice &encoding,
+                                     std::string_view boundary,
+                                     std::pmr::memory_resource *resource) {
+  std::pmr::string result{resource};
+  result.reserve(messageSize(encoding, boundary));
+
+  result.append(kTextType);
+  appendEncodingHeader(encoding.encoding, result);
+  result.append(kCRLF);
+
+  // Line breaks are converted to CRLF while the message is copied or encoded into the part, so
+  // the body is only copied once unless it has to be base64 encoded.
+  switch (encoding.encoding) {
+  case TransferEncoding::k7Bit:
+    TextNormalizer::append(message, result);
+    break;
+  case TransferEncoding::kQuotedPrintable:
+    QuotedPrintable::EncodeTo(message, QuotedPrintable::Mode::kText, result);
+    break;
+  case TransferEncoding::kBase64: {
+    std::pmr::string normalized{resource};
+    normalized.reserve(message.size());
+    TextNormalizer::append(message, normalized);
+    appendBase64Lines(Base64::Base64Encode(normalized, resource), result);
+    break;
+  }
+  }
+
+  result.append(kCRLF);
+  result.append(kDelimiterPrefix).append(boundary).append(kCRLF);
+
+  return result;
+}
+
+std::pmr::string Mime::renderAttachment(std::string_view attachment_path,
+                                        std::string_view contents_b64,
+                                        std::string_view boundary,
+                                        std::pmr::memory_resource *resource) {
+  return renderAttachment(attachment_path, kDefaultAttachmentType, contents_b64,
+                          TransferEncoding::kBase64, boundary, resource);
+}
+
+std::pmr::string Mime::renderAttachment(std::string_view attachment_path,
+                                        std::string_view content_type,
+                                        std::string_view encoded_contents,
+                                        TransferEncoding encoding, std::string_view boundary,
+                                        std::pmr::memory_resource *resource) {
+  const std::string_view filename = filenameOf(attachment_path);
+
+  std::pmr::string result{resource};
+  result.reserve(attachmentSize(attachment_path, content_type,
+                                {encoding, encoded_contents.size()}, boundary));
+
+  result.append(kContentTypePrefix).append(content_type).append(kCRLF);
+  appendEncodingHeader(encoding, result);
+  result.append(kAttachmentDisposition);
+  result.append(kFilenamePrefix).append(filename).append(kCRLF);
+  result.append(kCRLF);
+
+  if (encoding == TransferEncoding::kBase64) {
+    // Split the base64 encoded contents into lines of 512 bytes, blank lines are ignored when
+    // base64 is decoded so the extra line break before the delimiter is harmless
+    appendBase64Lines(encoded_contents, result);
+    result.append(kCRLF);
+  } else {
+    // The line break before the delimiter belongs to the delimiter, so the contents decode to
+    // exactly what was encoded
+    result.append(encoded_contents).append(kCRLF);
   }
 
-  m_document.emplace_back("\r\n");
-  m_document.push_back(Mime::kBoundary);
-  m_document.emplace_back("\r\n");
+  result.append(kDelimiterPrefix).append(boundary).append(kCRLF);
+
+  return result;
+}
+
+std::pmr::string Mime::renderLastBoundary(std::string_view boundary,
+                                          std::pmr::memory_resource *resource) {
+  std::pmr::string result{resource};
+  result.reserve(lastBoundarySize(boundary));
+  result.append(kDelimiterPrefix).append(boundary).append(kLastBoundarySuffix);
+  return result;
+}
+
+std::size_t Mime::serializedSize() const {
+  std::size_t size = 0;
+  for (const auto &section : m_document) {
+    size += section.size();
+  }
+  return size;
+}
+
+std::size_t Mime::headerSize(std::string_view user_agent, std::string_view boundary) {
+  return kUserAgentPrefix.size() + user_agent.size() + kCRLFSize + kMimeVersion.size() +
+         kMultipartType.size() + kBoundaryPrefix.size() + boundary.size() +
+         kBoundarySuffix.size() + kPreamble.size() + kDelimiterPrefix.size() + boundary.size() +
+         kCRLFSize;
+}
+
+std::size_t Mime::messageSize(const EncodingChoice &encoding, std::string_view boundary) {
+  const std::size_t body_size = encoding.encoding == TransferEncoding::kBase64
+                                    ? base64LinesSize(encoding.size)
+                                    : encoding.size;
+  return kTextType.size() + encodingHeaderSize(encoding.encoding) + kCRLFSize + body_size +
+         kCRLFSize + kDelimiterPrefix.size() + boundary.size() + kCRLFSize;
+}
+
+std::size_t Mime::lastBoundarySize(std::string_view boundary) {
+  return kDelimiterPrefix.size() + boundary.size() + kLastBoundarySuffix.size();
+}
+
+std::size_t Mime::base64Size(std::size_t raw_size) { return Base64::EncodedSize(raw_size); }
+
+std::size_t Mime::attachmentSize(std::string_view attachment_path, std::size_t raw_size,
+                                 std::string_view boundary) {
+  return attachmentSize(attachment_path, kDefaultAttachmentType,
+                        {TransferEncoding::kBase64, base64Size(raw_size)}, boundary);
+}
+
+std::size_t Mime::attachmentSize(std::string_view attachment_path, std::string_view content_type,
+                                 const EncodingChoice &encoding, std::string_view boundary) {
+  // Base64 contents are followed by a blank line, see renderAttachment()
+  const std::size_t contents_size = encoding.encoding == TransferEncoding::kBase64
+                                        ? base64LinesSize(encoding.size) + kCRLFSize
+                                        : encoding.size + kCRLFSize;
+
+  return kContentTypePrefix.size() + content_type.size() + kCRLFSize +
+         encodingHeaderSize(encoding.encoding) +
+         kAttachmentDisposition.size() + kFilenamePrefix.size() +
+         filenameOf(attachment_path).size() + kCRLFSize + kCRLFSize + contents_size +
+         kDelimiterPrefix.size() + boundary.size() + kCRLFSize;
 }
 
 } // namespace smtp
@@ -1,37 +1,111 @@
 #pragma once
 
+#include <cstddef>
 #include <iostream>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "mime/message_view.hpp"
+#include "mime/transfer_encoding.hpp"
+
 namespace smtp {
 
 class Mime {
 public:
-  explicit Mime(const std::string &user_agent = "Very-Simple-SMTPS");
+  // Every section of the document is allocated from resource. Passing an arena such as
+  // std::pmr::monotonic_buffer_resource lets the whole document be released in one step.
+  explicit Mime(const std::string &user_agent = kDefaultUserAgent,
+                std::pmr::memory_resource *resource = std::pmr::get_default_resource());
 
   void addAttachment(const std::string &attachment_path, const std::string &contents_b64);
   void addMessage(const std::string &message);
 
-  std::vector<std::string> build() const { return m_document; }
+  std::vector<std::string> build() const;
+  const std::pmr::vector<std::pmr::string> &document() const { return m_document; }
+
+  // Returns segments that reference the document without copying it. The view is invalidated by
+  // adding to or destroying this Mime.
+  MessageView view() const;
+
+  // The boundary that separates the parts of this document. A new one is generated for every
+  // Mime, and again if a message added to it happens to contain it.
+  std::string_view boundary() const { return m_boundary; }
+
+  // Returns a random boundary of kBoundaryLength characters. It starts with dashes, which are not
+  // part of the base64 alphabet, so base64 encoded parts never need to be checked against it. It
+  // has no '=', so quoted-printable text only contains it if the text it encodes does.
+  static std::string generateBoundary();
+  // Returns true if text contains the delimiter for boundary, meaning it cannot be placed in a
+  // part that is separated by it.
+  static bool collidesWithBoundary(std::string_view text, std::string_view boundary);
+
+  // Each section of the document can also be rendered on its own. This lets callers such as
+  // Email cache the sections that have not changed between builds.
+  static std::pmr::string
+  renderHeader(std::string_view user_agent, std::string_view boundary,
+               std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+  // The message is sent as 7bit, quoted-printable or base64, whichever is smallest. Callers that
+  // have already chosen the encoding with chooseTextEncoding() can pass it in.
+  static std::pmr::string
+  renderMessage(std::string_view message, std::string_view boundary,
+                std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+  static std::pmr::string
+  renderMessage(std::string_view message, const EncodingChoice &encoding,
+                std::string_view boundary,
+                std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+  static std::pmr::string
+  renderAttachment(std::string_view attachment_path, std::string_view contents_b64,
+                   std::string_view boundary,
+                   std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+  // Same as above for contents of the given MIME type that have already been encoded with
+  // encoding
+  static std::pmr::string
+  renderAttachment(std::string_view attachment_path, std::string_view content_type,
+                   std::string_view encoded_contents, TransferEncoding encoding,
+                   std::string_view boundary,
+                   std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+  // The delimiter that closes the document, "--" + boundary + "--".
+  static std::pmr::string
+  renderLastBoundary(std::string_view boundary,
+                     std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+  // Returns the number of bytes build() would produce. This walks the existing lines and does
+  // not allocate.
+  std::size_t serializedSize() const;
+
+  // The helpers below compute the exact size of each section of the document arithmetically,
+  // so the size of a message can be known before any of it is rendered or encoded.
+  static std::size_t headerSize(std::string_view user_agent, std::string_view boundary);
+  static std::size_t messageSize(const EncodingChoice &encoding, std::string_view boundary);
+  // raw_size is the size of the attachment before it has been base64 encoded.
+  static std::size_t attachmentSize(std::string_view attachment_path, std::size_t raw_size,
+                                    std::string_view boundary);
+  static std::size_t attachmentSize(std::string_view attachment_path,
+                                    std::string_view content_type,
+                                    const EncodingChoice &encoding, std::string_view boundary);
+  static std::size_t lastBoundarySize(std::string_view boundary);
+  static std::size_t base64Size(std::size_t raw_size);
 
-  static const std::string kBoundaryDeclare;
-  static const std::string kBoundary;
-  static const std::string kLastBoundary;
+  static const std::string kDefaultUserAgent;
   static const std::string kCRLF;
+  static constexpr std::size_t kBoundaryLength = 34;
 
 private:
-  std::vector<std::string> m_document;
-  std::string m_user_agent;
+  std::pmr::vector<std::pmr::string> m_document;
+  std::pmr::string m_user_agent;
+  std::pmr::string m_boundary;
 
-  void buildHeader();
+  // Swaps m_boundary for one that none of the text sections contain, rewriting the delimiters
+  // that have already been rendered in place.
+  void replaceBoundary(std::string_view message);
 
   std::ostream &output(std::ostream &out) const {
-    std::string contents;
-    for (const std::string &line : build()) {
-      contents += line;
+    for (const auto &section : m_document) {
+      out << section;
     }
-    return out << contents;
+    return out;
   }
 
   friend std::ostream &operator<<(std::ostream &p_out, const Mime &p_mime) {
@@ -0,0 +1,568 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <vector>
+
+#include "mime/mime_parser.hpp"
+#include "utils/base64/base64.hpp"
+#include "utils/quoted_printable/quoted_printable.hpp"
+
+namespace smtp {
+
+static constexpr std::string_view kCRLF = "\r\n";
+static constexpr std::string_view kCR = "\r";
+static constexpr std::string_view kDashes = "--";
+// Only a line that starts like this can be a delimiter
+static constexpr std::string_view kDelimiterStart = "\n--";
+static constexpr std::string_view kDefaultContentType = "text/plain";
+static constexpr std::string_view kMultipartPrefix = "multipart/";
+
+// Base64 text is decoded in batches of at least this many characters, or at the end of a chunk
+static constexpr std::size_t kBase64Batch = 64 * 1024;
+
+static bool isWsp(char c) { return c == ' ' || c == '\t'; }
+
+static bool startsWith(std::string_view text, std::string_view prefix) {
+  return text.substr(0, prefix.size()) == prefix;
+}
+
+static std::string_view trim(std::string_view text) {
+  while (!text.empty() && isWsp(text.front())) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && isWsp(text.back())) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+static std::string_view stripCR(std::string_view line) {
+  return !line.empty() && line.back() == '\r' ? line.substr(0, line.size() - 1) : line;
+}
+
+static std::string lowercase(std::string_view text) {
+  std::string result{text};
+  for (char &c : result) {
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+  return result;
+}
+
+static bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return std::tolower(static_cast<unsigned char>(x)) ==
+                  std::tolower(static_cast<unsigned char>(y));
+         });
+}
+
+static bool isBase64Char(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) || c == '+' || c == '/' || c == '=';
+}
+
+// Whether a decoded quoted-printable line ends with a soft line break
+static bool isSoftBreak(std::string_view line) {
+  while (!line.empty() && isWsp(line.back())) {
+    line.remove_suffix(1);
+  }
+  return !line.empty() && line.back() == '=';
+}
+
+// Returns the value of the parameter called name in a Content-Type value, without its quotes
+static std::string_view parameter(std::string_view value, std::string_view name) {
+  std::size_t pos = value.find(';');
+  while (pos != std::string_view::npos) {
+    const std::size_t equals = value.find('=', pos + 1);
+    if (equals == std::string_view::npos) {
+      break;
+    }
+    const std::string_view key = trim(value.substr(pos + 1, equals - pos - 1));
+
+    std::size_t start = equals + 1;
+    while (start < value.size() && isWsp(value[start])) {
+      start++;
+    }
+
+    // A quoted value can contain a ';' so the next parameter is looked for after the quotes
+    std::string_view result;
+    if (start < value.size() && value[start] == '"') {
+      const std::size_t quote = value.find('"', start + 1);
+      result = value.substr(start + 1, quote == std::string_view::npos ? quote : quote - start - 1);
+      pos = quote == std::string_view::npos ? quote : value.find(';', quote);
+    } else {
+      pos = value.find(';', start);
+      result = trim(value.substr(start, pos == std::string_view::npos ? pos : pos - start));
+    }
+
+    if (equalsIgnoreCase(key, name)) {
+      return result;
+    }
+  }
+  return {};
+}
+
+enum class State {
+  kHeaders,
+  // Body of an entity that is not multipart
+  kBody,
+  // Lines of a multipart outside of its parts i.e its preamble and epilogue, which are ignored
+  kBetweenParts,
+};
+
+struct Entity {
+  std::string content_type;
+  // Set while the entity is a multipart whose closing delimiter has not been seen
+  std::string boundary;
+  TransferEncoding encoding = TransferEncoding::k7Bit;
+  // Whether the handler wants the body
+  bool wanted = true;
+};
+
+struct MimeParser::Impl {
+  explicit Impl(MimeHandler &handler) : m_handler{handler} {}
+
+  MimeHandler &m_handler;
+  // The entity being read and every multipart that it is inside of
+  std::vector<Entity> m_entities;
+  State m_state = State::kHeaders;
+  bool m_started = false;
+  bool m_finished = false;
+
+  // Start of a line that was cut off at the end of the previous chunk
+  std::string m_carry;
+  // The start of the current line has already been read and the rest of it is body
+  bool m_mid_line = false;
+  // The body passed on so far ended with a CR, which may turn out to be part of a CRLF
+  bool m_pending_cr = false;
+  // A line break is owed to the handler before the next line of the body. It is dropped when the
+  // next line is a delimiter, since the line break before a delimiter belongs to the delimiter.
+  bool m_pending_break = false;
+
+  // Header field being read, either a view into the chunk or into m_field_copy
+  std::string_view m_field;
+  bool m_field_copied = false;
+  std::string m_field_copy;
+  std::string m_scratch;
+
+  std::string m_base64;
+  std::string m_decoded;
+
+  void begin();
+  void beginEntity();
+  void endEntity(bool by_delimiter);
+  bool emitting() const {
+    return m_state == State::kBody && m_entities.back().wanted;
+  }
+
+  void line(std::string_view text, bool in_chunk, bool has_break = true);
+  void partial(std::string_view text);
+  void bodyLines(std::string_view text, bool has_break = true);
+  void bodyPiece(std::string_view text, bool line_complete);
+  bool delimiter(std::string_view text);
+
+  void headerLine(std::string_view text, bool in_chunk);
+  void copyField();
+  void flushField();
+  void applyHeader(std::string_view name, std::string_view value);
+  void endHeaders();
+
+  void emit(std::string_view data) {
+    if (!data.empty()) {
+      m_handler.onBody(data);
+    }
+  }
+  void emitPendingBreak() {
+    if (m_pending_break) {
+      m_pending_break = false;
+      m_handler.onBody(kCRLF);
+    }
+  }
+  void appendBase64(std::string_view text);
+  void flushBase64(bool final);
+};
+
+MimeParser::MimeParser(MimeHandler &handler) : m_impl{std::make_unique<Impl>(handler)} {}
+
+MimeParser::~MimeParser() = default;
+
+void MimeParser::feed(std::string_view chunk) {
+  Impl &impl = *m_impl;
+  impl.begin();
+
+  std::size_t pos = 0;
+  if (impl.m_mid_line) {
+    const std::size_t line_break = chunk.find('\n');
+    impl.bodyPiece(chunk.substr(0, line_break), line_break != std::string_view::npos);
+    pos = line_break == std::string_view::npos ? chunk.size() : line_break + 1;
+  } else if (!impl.m_carry.empty()) {
+    const std::size_t line_break = chunk.find('\n');
+    impl.m_carry.append(chunk.substr(0, line_break));
+    if (line_break == std::string_view::npos) {
+      if (impl.m_carry.size() > kMaxLineLength) {
+        throw MimeParserException("[!] Line is too long");
+      }
+      return;
+    }
+
+    impl.line(impl.m_carry, false);
+    impl.m_carry.clear();
+    pos = line_break + 1;
+  }
+
+  while (pos < chunk.size()) {
+    // Lines up to the next one that starts with "--" cannot be delimiters, so inside of a body
+    // they are all handled in one go.
+    if (impl.m_state != State::kHeaders && !startsWith(chunk.substr(pos), kDashes)) {
+      std::size_t end = chunk.find(kDelimiterStart, pos);
+      if (end == std::string_view::npos) {
+        end = chunk.rfind('\n');
+      }
+      if (end == std::string_view::npos || end < pos) {
+        impl.partial(chunk.substr(pos));
+        break;
+      }
+      impl.bodyLines(stripCR(chunk.substr(pos, end - pos)));
+      pos = end + 1;
+      continue;
+    }
+
+    const std::size_t line_break = chunk.find('\n', pos);
+    if (line_break == std::string_view::npos) {
+      impl.partial(chunk.substr(pos));
+      break;
+    }
+    impl.line(chunk.substr(pos, line_break - pos), true);
+    pos = line_break + 1;
+  }
+
+  // Nothing may point into the chunk once it has been fed in
+  if (impl.m_state == State::kHeaders && !impl.m_field.empty()) {
+    impl.copyField();
+  }
+  if (impl.emitting() && impl.m_entities.back().encoding == TransferEncoding::kBase64) {
+    impl.flushBase64(false);
+  }
+}
+
+void MimeParser::finish() {
+  Impl &impl = *m_impl;
+  impl.begin();
+
+  // The last line of the message has no line break
+  if (!impl.m_carry.empty()) {
+    const std::string last_line = std::move(impl.m_carry);
+    impl.m_carry.clear();
+    impl.line(last_line, false, false);
+  } else if (impl.m_mid_line) {
+    if (impl.m_pending_cr && impl.emitting() &&
+        impl.m_entities.back().encoding != TransferEncoding::kBase64) {
+      impl.emit(kCR);
+    }
+    impl.m_pending_cr = false;
+    impl.m_mid_line = false;
+  }
+
+  while (!impl.m_entities.empty()) {
+    impl.endEntity(false);
+  }
+  impl.m_finished = true;
+}
+
+std::string_view MimeParser::unfold(std::string_view value, std::string &scratch) {
+  if (value.find_first_of("\r\n") == std::string_view::npos) {
+    return trim(value);
+  }
+
+  // Unfolding only removes the line breaks, the whitespace that follows them is kept
+  scratch.clear();
+  for (const char c : value) {
+    if (c != '\r' && c != '\n') {
+      scratch.push_back(c);
+    }
+  }
+  return trim(scratch);
+}
+
+void MimeParser::Impl::begin() {
+  if (m_finished) {
+    throw MimeParserException("[!] Message has already been finished");
+  }
+  if (!m_started) {
+    m_started = true;
+    beginEntity();
+  }
+}
+
+void MimeParser::Impl::beginEntity() {
+  if (m_entities.size() >= kMaxDepth) {
+    throw MimeParserException("[!] Multiparts are nested too deeply");
+  }
+  m_entities.emplace_back();
+  m_state = State::kHeaders;
+  m_handler.onEntityBegin(m_entities.size() - 1);
+}
+
+void MimeParser::Impl::endEntity(bool by_delimiter) {
+  // Every entity has its header ended, even one that was cut off in the middle of it
+  if (m_state == State::kHeaders) {
+    flushField();
+    endHeaders();
+  }
+
+  if (emitting()) {
+    if (m_entities.back().encoding == TransferEncoding::kBase64) {
+      flushBase64(true);
+    } else if (!by_delimiter) {
+      emitPendingBreak();
+    }
+  }
+  m_pending_break = false;
+  m_pending_cr = false;
+  m_mid_line = false;
+  m_base64.clear();
+
+  const std::size_t depth = m_entities.size() - 1;
+  m_entities.pop_back();
+  m_state = State::kBetweenParts;
+  m_handler.onEntityEnd(depth);
+}
+
+void MimeParser::Impl::line(std::string_view text, bool in_chunk, bool has_break) {
+  text = stripCR(text);
+  if (m_state == State::kHeaders) {
+    headerLine(text, in_chunk);
+  } else if (!startsWith(text, kDashes) || !delimiter(text)) {
+    bodyLines(text, has_break);
+  }
+}
+
+void MimeParser::Impl::partial(std::string_view text) {
+  // Only the first two characters decide whether the line can be a delimiter, quoted-printable
+  // needs the whole line to find a soft line break.
+  const bool may_be_delimiter = text.size() < kDashes.size() ? text.front() == '-'
+                                                             : startsWith(text, kDashes);
+  if (m_state == State::kHeaders || may_be_delimiter ||
+      (emitting() && m_entities.back().encoding == TransferEncoding::kQuotedPrintable)) {
+    if (text.size() > kMaxLineLength) {
+      throw MimeParserException("[!] Line is too long");
+    }
+    m_carry.assign(text);
+    return;
+  }
+
+  m_mid_line = true;
+  emitPendingBreak();
+  bodyPiece(text, false);
+}
+
+void MimeParser::Impl::bodyLines(std::string_view text, bool has_break) {
+  if (!emitting()) {
+    return;
+  }
+
+  switch (m_entities.back().encoding) {
+  case TransferEncoding::kBase64:
+    appendBase64(text);
+    break;
+  case TransferEncoding::kQuotedPrintable:
+    emitPendingBreak();
+    m_decoded.clear();
+    QuotedPrintable::DecodeTo(text, m_decoded);
+    emit(m_decoded);
+    m_pending_break = has_break && !isSoftBreak(text);
+    break;
+  case TransferEncoding::k7Bit:
+    emitPendingBreak();
+    emit(text);
+    m_pending_break = has_break;
+    break;
+  }
+}
+
+void MimeParser::Impl::bodyPiece(std::string_view text, bool line_complete) {
+  if (line_complete) {
+    m_mid_line = false;
+  }
+  if (!emitting()) {
+    return;
+  }
+
+  const bool base64 = m_entities.back().encoding == TransferEncoding::kBase64;
+  if (m_pending_cr) {
+    m_pending_cr = false;
+    // The CR was only content if it was not followed by the LF of the line break
+    if (!(line_complete && text.empty()) && !base64) {
+      emit(kCR);
+    }
+  }
+
+  if (line_complete) {
+    text = stripCR(text);
+  } else if (!text.empty() && text.back() == '\r') {
+    text.remove_suffix(1);
+    m_pending_cr = true;
+  }
+
+  if (base64) {
+    appendBase64(text);
+  } else {
+    emit(text);
+    m_pending_break = line_complete;
+  }
+}
+
+bool MimeParser::Impl::delimiter(std::string_view text) {
+  // The innermost multipart is checked first, a delimiter of an outer one also ends every part
+  // that was left open inside of it.
+  for (std::size_t i = m_entities.size(); i-- > 0;) {
+    const std::string &boundary = m_entities[i].boundary;
+    if (boundary.empty() || text.size() < kDashes.size() + boundary.size() ||
+        text.compare(kDashes.size(), boundary.size(), boundary) != 0) {
+      continue;
+    }
+
+    std::string_view rest = text.substr(kDashes.size() + boundary.size());
+    const bool close = startsWith(rest, kDashes);
+    if (close) {
+      rest.remove_prefix(kDashes.size());
+    }
+    if (!trim(rest).empty()) {
+      continue;
+    }
+
+    while (m_entities.size() > i + 1) {
+      endEntity(true);
+    }
+    if (close) {
+      m_entities[i].boundary.clear();
+      m_state = State::kBetweenParts;
+    } else {
+      beginEntity();
+    }
+    return true;
+  }
+  return false;
+}
+
+void MimeParser::Impl::headerLine(std::string_view text, bool in_chunk) {
+  if (text.empty()) {
+    flushField();
+    endHeaders();
+    return;
+  }
+
+  if (isWsp(text.front()) && !m_field.empty()) {
+    // A folded line is appended to its field, which is still a view when both are in the chunk
+    if (!m_field_copied && in_chunk) {
+      m_field = {m_field.data(), static_cast<std::size_t>(text.data() + text.size() -
+                                                          m_field.data())};
+    } else {
+      copyField();
+      m_field_copy.append(kCRLF).append(text);
+      m_field = m_field_copy;
+    }
+  } else {
+    flushField();
+    m_field = text;
+    if (!in_chunk) {
+      copyField();
+    }
+  }
+
+  if (m_field.size() > kMaxLineLength) {
+    throw MimeParserException("[!] Header field is too long");
+  }
+}
+
+void MimeParser::Impl::copyField() {
+  if (!m_field_copied) {
+    m_field_copy.assign(m_field);
+    m_field = m_field_copy;
+    m_field_copied = true;
+  }
+}
+
+void MimeParser::Impl::flushField() {
+  if (m_field.empty()) {
+    return;
+  }
+
+  const std::string_view field = m_field;
+  if (const std::size_t colon = field.find(':'); colon != std::string_view::npos) {
+    const std::string_view name = trim(field.substr(0, colon));
+    const std::string_view value = unfold(field.substr(colon + 1), m_scratch);
+    applyHeader(name, value);
+    m_handler.onHeader(name, value);
+  }
+
+  m_field = {};
+  m_field_copied = false;
+}
+
+void MimeParser::Impl::applyHeader(std::string_view name, std::string_view value) {
+  Entity &entity = m_entities.back();
+  if (equalsIgnoreCase(name, "Content-Type")) {
+    entity.content_type = lowercase(trim(value.substr(0, value.find(';'))));
+    entity.boundary = parameter(value, "boundary");
+  } else if (equalsIgnoreCase(name, "Content-Transfer-Encoding")) {
+    const std::string &encoding = lowercase(value);
+    if (encoding == transferEncodingName(TransferEncoding::kBase64)) {
+      entity.encoding = TransferEncoding::kBase64;
+    } else if (encoding == transferEncodingName(TransferEncoding::kQuotedPrintable)) {
+      entity.encoding = TransferEncoding::kQuotedPrintable;
+    } else {
+      entity.encoding = TransferEncoding::k7Bit;
+    }
+  }
+}
+
+void MimeParser::Impl::endHeaders() {
+  Entity &entity = m_entities.back();
+  if (entity.content_type.empty()) {
+    entity.content_type = kDefaultContentType;
+  }
+
+  const bool multipart =
+      startsWith(entity.content_type, kMultipartPrefix) && !entity.boundary.empty();
+  if (!multipart) {
+    entity.boundary.clear();
+  }
+
+  const MimeEntity info{entity.content_type, entity.boundary, entity.encoding,
+                        m_entities.size() - 1};
+  entity.wanted = m_handler.onHeadersEnd(info);
+
+  // A skipped multipart is read like any other skipped body, its delimiters are never looked at
+  if (multipart && entity.wanted) {
+    m_state = State::kBetweenParts;
+  } else {
+    entity.boundary.clear();
+    m_state = State::kBody;
+  }
+}
+
+void MimeParser::Impl::appendBase64(std::string_view text) {
+  for (const char c : text) {
+    if (isBase64Char(c)) {
+      m_base64.push_back(c);
+    }
+  }
+  if (m_base64.size() >= kBase64Batch) {
+    flushBase64(false);
+  }
+}
+
+void MimeParser::Impl::flushBase64(bool final) {
+  // Only whole groups of 4 characters are decoded until the end of the body
+  const std::size_t size = final ? m_base64.size() : m_base64.size() / 4 * 4;
+  if (size == 0) {
+    return;
+  }
+
+  std::string rest = m_base64.substr(size);
+  m_base64.resize(size);
+  const std::vector<uint8_t> &decoded = Base64::Base64Decode(m_base64);
+  m_base64 = std::move(rest);
+  emit({reinterpret_cast<const char *>(decoded.data()), decoded.size()});
+}
+
+} // namespace smtp
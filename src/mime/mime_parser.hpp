@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "mime/transfer_encoding.hpp"
+
+namespace smtp {
+
+class MimeParserException : public std::runtime_error {
+public:
+  using runtime_error::runtime_error;
+};
+
+// What is known about an entity once its header has been read
+struct MimeEntity {
+  // Media type without its parameters and lowercased e.g "multipart/report", text/plain when the
+  // entity has no Content-Type
+  std::string_view content_type;
+  // Only set for a multipart entity
+  std::string_view boundary;
+  // k7Bit stands for every encoding that is not decoded i.e 7bit, 8bit and binary
+  TransferEncoding encoding = TransferEncoding::k7Bit;
+  // 0 for the message itself, 1 for its parts and so on
+  std::size_t depth = 0;
+
+  bool isMultipart() const { return !boundary.empty(); }
+};
+
+// Receives the structure and contents of a message from a MimeParser. Every string_view passed
+// to a handler is only valid for the duration of the call.
+class MimeHandler {
+public:
+  virtual ~MimeHandler() = default;
+
+  virtual void onEntityBegin(std::size_t /*depth*/) {}
+  // The value is unfolded and has the whitespace around it removed
+  virtual void onHeader(std::string_view /*name*/, std::string_view /*value*/) {}
+  // Returning false skips the body of the entity, and every part inside of it, without decoding
+  // any of it.
+  virtual bool onHeadersEnd(const MimeEntity & /*entity*/) { return true; }
+  // Decoded contents of an entity that is not multipart, in as many pieces as it takes
+  virtual void onBody(std::string_view /*data*/) {}
+  virtual void onEntityEnd(std::size_t /*depth*/) {}
+};
+
+// Incremental MIME parser (RFC 2045 and 2046) for reading bounces and delivery status
+// notifications. The message is fed in as consecutive chunks of any size and the handler is
+// called as soon as each piece has been read. Header values and bodies that are sent as they
+// are point straight into the chunk. Only a line that is split between two chunks, or a folded
+// header field, is copied.
+//
+// Nested multiparts are followed by boundary, and base64 and quoted-printable bodies are decoded.
+// Bodies that the handler skips are only scanned for the next boundary.
+class MimeParser {
+public:
+  explicit MimeParser(MimeHandler &handler);
+  ~MimeParser();
+
+  MimeParser(const MimeParser &) = delete;
+  MimeParser &operator=(const MimeParser &) = delete;
+
+  void feed(std::string_view chunk);
+  // Ends the message, any entities that are still open are closed
+  void finish();
+
+  // Unfolds a header value by removing its line breaks and trims the whitespace around it. value
+  // is returned as it is when it was not folded, otherwise the result is written to scratch.
+  static std::string_view unfold(std::string_view value, std::string &scratch);
+
+  // Multiparts nested deeper than this are rejected
+  static constexpr std::size_t kMaxDepth = 32;
+  // Longest line, or header field including its folded lines, that is accepted
+  static constexpr std::size_t kMaxLineLength = 64 * 1024;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace smtp
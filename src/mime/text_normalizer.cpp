@@ -0,0 +1,16 @@
+#include "mime/text_normalizer.hpp"
+
+namespace smtp {
+
+TextNormalizer::Stats TextNormalizer::measure(std::string_view text, bool dot_stuff) {
+  TextNormalizer normalizer{dot_stuff};
+  normalizer.process(text, [](std::string_view) {});
+  return normalizer.stats();
+}
+
+void TextNormalizer::append(std::string_view text, std::pmr::string &out, bool dot_stuff) {
+  TextNormalizer normalizer{dot_stuff};
+  normalizer.process(text, [&out](std::string_view piece) { out.append(piece); });
+}
+
+} // namespace smtp
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+#include "utils/simd/line_break.hpp"
+
+namespace smtp {
+
+// Normalizes the text parts of a message for SMTP in a single pass: bare CR and bare LF become
+// CRLF, lines that start with a period are dot-stuffed (RFC 5321 section 4.5.2) and lines longer
+// than the limit of 998 octets are counted.
+//
+// Text is fed in as consecutive chunks of any size, so a body can be normalized while it is being
+// streamed. The output is passed to a sink as string_views, runs of text that need no changes
+// point straight back into the chunk so nothing is copied until the sink copies it.
+class TextNormalizer {
+public:
+  // Longest line allowed by RFC 5321 section 4.5.3.1.6, not counting the CRLF
+  static constexpr std::size_t kMaxLineLength = 998;
+
+  struct Stats {
+    // Number of bytes written to the sink
+    std::size_t size = 0;
+    // Number of lines longer than kMaxLineLength
+    std::size_t long_lines = 0;
+  };
+
+  // libcurl already dot-stuffs everything it uploads, so dot-stuffing is only wanted when the
+  // output is written to the server some other way.
+  explicit TextNormalizer(bool dot_stuff = false) : m_dot_stuff{dot_stuff} {}
+
+  // Normalizes chunk, sink is called with every piece of the output in order
+  template <typename Sink> void process(std::string_view chunk, Sink &&sink);
+
+  const Stats &stats() const { return m_stats; }
+
+  // Returns the stats of normalizing text without producing any output
+  static Stats measure(std::string_view text, bool dot_stuff = false);
+
+  // Appends the normalized text to out
+  static void append(std::string_view text, std::pmr::string &out, bool dot_stuff = false);
+
+private:
+  bool m_dot_stuff;
+  bool m_at_line_start = true;
+  // The previous chunk ended with a CR which has already been written as a CRLF, so a LF at the
+  // start of this chunk belongs to it.
+  bool m_skip_lf = false;
+  std::size_t m_line_length = 0;
+  Stats m_stats;
+
+  void addToLine(std::size_t length) {
+    if (m_line_length <= kMaxLineLength && m_line_length + length > kMaxLineLength) {
+      m_stats.long_lines++;
+    }
+    m_line_length += length;
+  }
+};
+
+template <typename Sink> void TextNormalizer::process(std::string_view chunk, Sink &&sink) {
+  static constexpr std::string_view kCRLF = "\r\n";
+  static constexpr std::string_view kDot = ".";
+
+  std::size_t pos = 0;
+  while (pos < chunk.size()) {
+    if (m_skip_lf) {
+      m_skip_lf = false;
+      if (chunk[pos] == '\n') {
+        pos++;
+        continue;
+      }
+    }
+
+    if (m_at_line_start) {
+      m_at_line_start = false;
+      if (m_dot_stuff && chunk[pos] == '.') {
+        sink(kDot);
+        m_stats.size += kDot.size();
+        addToLine(kDot.size());
+      }
+    }
+
+    const std::size_t line_break = findLineBreak(chunk, pos);
+    const std::size_t end = line_break == std::string_view::npos ? chunk.size() : line_break;
+    if (end > pos) {
+      sink(chunk.substr(pos, end - pos));
+      m_stats.size += end - pos;
+      addToLine(end - pos);
+    }
+
+    if (line_break == std::string_view::npos) {
+      break;
+    }
+
+    // Every line break is written as a CRLF, the LF of an existing CRLF is skipped
+    sink(kCRLF);
+    m_stats.size += kCRLF.size();
+    m_line_length = 0;
+    m_at_line_start = true;
+    m_skip_lf = chunk[line_break] == '\r';
+    pos = line_break + 1;
+  }
+}
+
+} // namespace smtp
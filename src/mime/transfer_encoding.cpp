@@ -0,0 +1,176 @@
+#include <algorithm>
+
+#include "mime/text_normalizer.hpp"
+#include "mime/transfer_encoding.hpp"
+#include "utils/base64/base64.hpp"
+#include "utils/quoted_printable/quoted_printable.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace smtp {
+
+// Quoted-printable triples every escaped byte while base64 grows everything by a third, past this
+// percentage of escaped bytes quoted-printable can not win.
+static constexpr std::size_t kMaxEscapedPercent = 17;
+
+// Base64 content is split into lines of this many characters, see Mime
+static constexpr std::size_t kBase64LineLength = 512;
+static constexpr std::size_t kCRLFSize = 2;
+
+std::string_view transferEncodingName(TransferEncoding encoding) {
+  switch (encoding) {
+  case TransferEncoding::k7Bit:
+    return "7bit";
+  case TransferEncoding::kQuotedPrintable:
+    return "quoted-printable";
+  case TransferEncoding::kBase64:
+    return "base64";
+  }
+  return "base64";
+}
+
+ContentStats scanContent(std::string_view content) {
+  ContentStats stats;
+  stats.size = content.size();
+
+  std::size_t line_length = 0;
+  bool previous_cr = false;
+
+  const auto &scanByte = [&](unsigned char c) {
+    if (c == '\n') {
+      stats.bare_line_breaks += previous_cr ? 0 : 1;
+      stats.longest_line = std::max(stats.longest_line, line_length);
+      line_length = 0;
+      previous_cr = false;
+      return;
+    }
+
+    if (previous_cr) {
+      // The previous CR was not followed by a LF
+      stats.bare_line_breaks++;
+    }
+    previous_cr = c == '\r';
+    if (previous_cr) {
+      stats.longest_line = std::max(stats.longest_line, line_length);
+      line_length = 0;
+      return;
+    }
+
+    line_length++;
+    if (c >= 0x80) {
+      stats.eight_bit++;
+    } else if ((c < ' ' && c != '\t') || c == 0x7f) {
+      stats.controls++;
+      stats.nuls += c == 0 ? 1 : 0;
+    } else if (c == '=') {
+      stats.equals++;
+    }
+  };
+
+  std::size_t pos = 0;
+
+#if defined(__SSE2__)
+  // Blocks of plain ASCII only add to the length of the current line, so only blocks with
+  // something of interest in them are looked at byte by byte.
+  const char *data = content.data();
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i del = _mm_set1_epi8(0x7f);
+  const __m128i equals = _mm_set1_epi8('=');
+
+  for (; pos + 16 <= content.size(); pos += 16) {
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+    // Compared as signed bytes so anything >= 0x80 is negative and also below a space
+    const __m128i special =
+        _mm_or_si128(_mm_cmplt_epi8(block, space),
+                     _mm_or_si128(_mm_cmpeq_epi8(block, del), _mm_cmpeq_epi8(block, equals)));
+
+    if (_mm_movemask_epi8(special) == 0 && !previous_cr) {
+      line_length += 16;
+      continue;
+    }
+
+    for (std::size_t i = 0; i < 16; i++) {
+      scanByte(static_cast<unsigned char>(data[pos + i]));
+    }
+  }
+#endif
+
+  for (; pos < content.size(); pos++) {
+    scanByte(static_cast<unsigned char>(content[pos]));
+  }
+
+  if (previous_cr) {
+    stats.bare_line_breaks++;
+  }
+  stats.longest_line = std::max(stats.longest_line, line_length);
+
+  return stats;
+}
+
+ContentClass classifyContent(const ContentStats &stats) {
+  if (stats.nuls > 0) {
+    return ContentClass::kBinary;
+  }
+
+  if (stats.eight_bit == 0 && stats.controls == 0 &&
+      stats.longest_line <= TextNormalizer::kMaxLineLength) {
+    return ContentClass::kSevenBit;
+  }
+
+  const std::size_t escaped = stats.eight_bit + stats.controls + stats.equals;
+  if (escaped * 100 > stats.size * kMaxEscapedPercent) {
+    return stats.controls > stats.eight_bit ? ContentClass::kBinary : ContentClass::kEightBit;
+  }
+
+  return ContentClass::kMostlyAscii;
+}
+
+// Number of bytes base64 content takes up once it has been split into lines
+static std::size_t base64WireSize(std::size_t encoded_size) {
+  return encoded_size + (encoded_size + kBase64LineLength - 1) / kBase64LineLength * kCRLFSize;
+}
+
+EncodingChoice chooseTextEncoding(std::string_view text) {
+  const ContentStats &stats = scanContent(text);
+  // Every bare CR or LF is written as a CRLF
+  const std::size_t normalized_size = stats.size + stats.bare_line_breaks;
+
+  switch (classifyContent(stats)) {
+  case ContentClass::kSevenBit:
+    return {TransferEncoding::k7Bit, normalized_size};
+  case ContentClass::kMostlyAscii: {
+    const std::size_t qp_size =
+        QuotedPrintable::EncodedSize(text, QuotedPrintable::Mode::kText);
+    const std::size_t base64_size = Base64::EncodedSize(normalized_size);
+    if (qp_size <= base64WireSize(base64_size)) {
+      return {TransferEncoding::kQuotedPrintable, qp_size};
+    }
+    return {TransferEncoding::kBase64, base64_size};
+  }
+  default:
+    return {TransferEncoding::kBase64, Base64::EncodedSize(normalized_size)};
+  }
+}
+
+EncodingChoice chooseAttachmentEncoding(std::string_view contents) {
+  const ContentStats &stats = scanContent(contents);
+  const std::size_t base64_size = Base64::EncodedSize(stats.size);
+
+  switch (classifyContent(stats)) {
+  case ContentClass::kSevenBit:
+  case ContentClass::kMostlyAscii: {
+    const std::size_t qp_size =
+        QuotedPrintable::EncodedSize(contents, QuotedPrintable::Mode::kBinary);
+    if (qp_size <= base64WireSize(base64_size)) {
+      return {TransferEncoding::kQuotedPrintable, qp_size};
+    }
+    return {TransferEncoding::kBase64, base64_size};
+  }
+  default:
+    return {TransferEncoding::kBase64, base64_size};
+  }
+}
+
+} // namespace smtp
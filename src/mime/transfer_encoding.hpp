@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+namespace smtp {
+
+enum class TransferEncoding { k7Bit, kQuotedPrintable, kBase64 };
+
+// Value of the Content-Transfer-Encoding header for encoding
+std::string_view transferEncodingName(TransferEncoding encoding);
+
+enum class ContentClass {
+  // Printable ASCII with lines short enough to be sent as they are
+  kSevenBit,
+  // Few enough bytes need escaping that quoted-printable is likely to beat base64
+  kMostlyAscii,
+  // Text with many bytes outside of ASCII, e.g UTF-8 in a non-latin script
+  kEightBit,
+  // Contains NULs or other control characters
+  kBinary,
+};
+
+// Everything that is learnt about some content from a single scan over it
+struct ContentStats {
+  std::size_t size = 0;
+  // Bytes >= 0x80
+  std::size_t eight_bit = 0;
+  // Control characters other than tab, CR and LF, including NUL
+  std::size_t controls = 0;
+  std::size_t nuls = 0;
+  // '=' characters, which quoted-printable has to escape
+  std::size_t equals = 0;
+  // A CR or LF that is not part of a CRLF
+  std::size_t bare_line_breaks = 0;
+  // Longest line when CR, LF and CRLF all count as line breaks
+  std::size_t longest_line = 0;
+};
+
+ContentStats scanContent(std::string_view content);
+ContentClass classifyContent(const ContentStats &stats);
+
+// The encoding chosen for some content together with the exact size of the encoded content
+struct EncodingChoice {
+  TransferEncoding encoding = TransferEncoding::k7Bit;
+  // For base64 this does not include the line breaks that the encoded content is split with
+  std::size_t size = 0;
+};
+
+// Text is sent with its line breaks normalized to CRLF, so it is either sent as is or
+// quoted-printable encoded as text. Any other content must decode to exactly the same bytes so it
+// is either quoted-printable encoded in binary mode or base64 encoded. Whichever encoding puts
+// the fewest bytes on the wire is chosen.
+EncodingChoice chooseTextEncoding(std::string_view text);
+EncodingChoice chooseAttachmentEncoding(std::string_view contents);
+
+} // namespace smtp
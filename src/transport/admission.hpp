@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+
+#include "transport/transport.hpp"
+#include "utils/memory/memory_budget.hpp"
+
+namespace smtp {
+
+// Reserves room for a message of bytes in the library's memory budget until the reservation is
+// released. The reservation is empty when there is no budget, or when the calling thread is
+// sending work that was admitted as it was queued. Waits for memory for no longer than the
+// timeout in limits, returns nothing if that passes or stop is requested first. Throws a
+// MemoryBudgetException if the library rejects work over budget, or if the message is larger than
+// the whole budget.
+std::optional<MemoryReservation> admitSend(std::size_t bytes, const SendLimits &limits,
+                                           const StopToken *stop);
+// Same as above for work that is about to be queued, which waits for as long as it takes. Work
+// that must not wait, e.g interactive mail, is let through without a reservation when it does not
+// fit.
+MemoryReservation admitQueued(std::size_t bytes, bool may_wait);
+
+// What a send returns when it gives up waiting for its share of the memory budget
+TransportResult notAdmitted(const StopToken *stop);
+
+// Marks the calling thread as sending work that was admitted when it was queued, for the lifetime
+// of the scope
+class AdmittedScope {
+public:
+  AdmittedScope();
+  ~AdmittedScope();
+
+  AdmittedScope(const AdmittedScope &) = delete;
+  AdmittedScope &operator=(const AdmittedScope &) = delete;
+};
+
+} // namespace smtp
@@ -0,0 +1,46 @@
+#include <new>
+
+#include "transport/credentials.hpp"
+#include "utils/memory/secure_pool.hpp"
+#include "utils/secure_strings.hpp"
+
+namespace smtp {
+
+struct Credentials::Impl {
+  smtp::secure_string m_user;
+  smtp::secure_string m_password;
+  smtp::secure_string m_hostname;
+};
+
+Credentials::Credentials(std::string_view user, std::string_view password,
+                         std::string_view hostname)
+    : m_impl{new (SecurePool::instance().allocate(sizeof(Impl))) Impl} {
+  try {
+    m_impl->m_user = user;
+    m_impl->m_password = password;
+    m_impl->m_hostname = hostname;
+  } catch (...) {
+    m_impl->~Impl();
+    SecurePool::instance().deallocate(m_impl, sizeof(Impl));
+    throw;
+  }
+}
+
+Credentials::~Credentials() {
+  m_impl->~Impl();
+  SecurePool::instance().deallocate(m_impl, sizeof(Impl));
+}
+
+std::shared_ptr<const Credentials> Credentials::make(std::string_view user,
+                                                     std::string_view password,
+                                                     std::string_view hostname) {
+  return std::make_shared<const Credentials>(user, password, hostname);
+}
+
+std::string_view Credentials::user() const { return m_impl->m_user; }
+
+std::string_view Credentials::password() const { return m_impl->m_password; }
+
+std::string_view Credentials::hostname() const { return m_impl->m_hostname; }
+
+} // namespace smtp
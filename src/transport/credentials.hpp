@@ -0,0 +1,32 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+
+namespace smtp {
+
+// The login and relay of an SMTP server. The password is held in memory that is locked into RAM
+// and wiped when it is freed. Credentials are immutable, so one instance can be shared by any
+// number of emails and templates, from any thread, without copying the secrets.
+class Credentials {
+public:
+  Credentials(std::string_view user, std::string_view password, std::string_view hostname);
+  ~Credentials();
+
+  Credentials(const Credentials &) = delete;
+  Credentials &operator=(const Credentials &) = delete;
+
+  static std::shared_ptr<const Credentials> make(std::string_view user, std::string_view password,
+                                                 std::string_view hostname);
+
+  std::string_view user() const;
+  std::string_view password() const;
+  std::string_view hostname() const;
+
+private:
+  struct Impl;
+  // Allocated from SecurePool, short strings are kept inside of the string objects themselves
+  Impl *m_impl;
+};
+
+} // namespace smtp
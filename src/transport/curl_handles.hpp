@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string_view>
+
+#include "curl/curl.h"
+
+namespace smtp {
+
+// Takes an easy handle for sends to hostname as user out of the connection cache. The handle is
+// reset but keeps its connection, if it still has one. A new handle is made when none is idle,
+// or when the library is not initialized.
+CURL *acquireHandle(std::string_view hostname, std::string_view user);
+
+// Gives the handle back once the send is over. A handle whose connection may be in an unknown
+// state, or that is not wanted by the cache, is cleaned up. Returns whether it was kept.
+bool releaseHandle(std::string_view hostname, std::string_view user, CURL *curl, bool reusable);
+
+} // namespace smtp
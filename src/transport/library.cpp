@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "transport/admission.hpp"
+#include "transport/curl_handles.hpp"
+#include "transport/library.hpp"
+#include "utils/secure_strings.hpp"
+
+namespace smtp {
+
+using Clock = std::chrono::steady_clock;
+
+struct IdleHandle {
+  CURL *curl;
+  Clock::time_point since;
+};
+
+// Everything initialize() sets up, it only exists while the library is initialized
+struct Library {
+  LibraryOptions options;
+  CURLSH *share = nullptr;
+  // libcurl locks each kind of data it shares through these
+  std::array<std::mutex, CURL_LOCK_DATA_LAST> locks;
+
+  std::mutex idle_mutex;
+  // Handles with an open connection, by relay and login, the most recently used is last
+  std::unordered_map<std::string, std::vector<IdleHandle>> idle;
+
+  std::unique_ptr<MemoryBudget> budget;
+};
+
+// Guards initialize() and shutdown(), sends only ever read the current library
+static std::mutex library_mutex;
+static std::size_t library_users = 0;
+static std::atomic<Library *> current_library{nullptr};
+
+// Nesting depth of AdmittedScopes on this thread
+static thread_local std::size_t admitted_scopes = 0;
+
+static void lockShared(CURL * /*curl*/, curl_lock_data data, curl_lock_access /*access*/,
+                       void *userp) {
+  static_cast<Library *>(userp)->locks[data].lock();
+}
+
+static void unlockShared(CURL * /*curl*/, curl_lock_data data, void *userp) {
+  static_cast<Library *>(userp)->locks[data].unlock();
+}
+
+static std::string handleKey(std::string_view hostname, std::string_view user) {
+  std::string key{hostname};
+  key.push_back('\n');
+  key.append(user);
+  return key;
+}
+
+void initialize(const LibraryOptions &options) {
+  std::lock_guard<std::mutex> lock{library_mutex};
+  if (library_users > 0) {
+    library_users++;
+    return;
+  }
+
+  if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+    throw LibraryException("[!] curl_global_init() failed");
+  }
+  auto library = std::make_unique<Library>();
+  library->options = options;
+  if (options.memory_budget > 0) {
+    library->budget = std::make_unique<MemoryBudget>(options.memory_budget);
+  }
+  library->share = curl_share_init();
+  if (!library->share) {
+    curl_global_cleanup();
+    throw LibraryException("[!] curl_share_init() failed");
+  }
+
+  // Connections are not shared, libcurl does not support using a shared connection from several
+  // threads at once. Each cached handle keeps its own instead.
+  curl_share_setopt(library->share, CURLSHOPT_LOCKFUNC, lockShared);
+  curl_share_setopt(library->share, CURLSHOPT_UNLOCKFUNC, unlockShared);
+  curl_share_setopt(library->share, CURLSHOPT_USERDATA, library.get());
+  curl_share_setopt(library->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(library->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+  current_library.store(library.release());
+  library_users = 1;
+}
+
+void shutdown() {
+  std::lock_guard<std::mutex> lock{library_mutex};
+  if (library_users == 0 || --library_users > 0) {
+    return;
+  }
+
+  const std::unique_ptr<Library> library{current_library.exchange(nullptr)};
+  for (const auto &[key, handles] : library->idle) {
+    for (const IdleHandle &handle : handles) {
+      curl_easy_cleanup(handle.curl);
+    }
+  }
+  curl_share_cleanup(library->share);
+  curl_global_cleanup();
+}
+
+bool initialized() { return current_library.load() != nullptr; }
+
+const MemoryBudget *memoryBudget() {
+  const Library *library = current_library.load();
+  return library ? library->budget.get() : nullptr;
+}
+
+static MemoryBudgetException usedUp(const MemoryBudget &budget) {
+  return MemoryBudgetException("[!] The memory budget of " + std::to_string(budget.capacity()) +
+                               " bytes is used up");
+}
+
+std::optional<MemoryReservation> admitSend(std::size_t bytes, const SendLimits &limits,
+                                           const StopToken *stop) {
+  Library *library = current_library.load();
+  if (!library || !library->budget || admitted_scopes > 0) {
+    return MemoryReservation{};
+  }
+
+  MemoryBudget &budget = *library->budget;
+  if (library->options.reject_over_budget) {
+    std::optional<MemoryReservation> reservation = budget.tryAcquire(bytes);
+    if (!reservation) {
+      throw usedUp(budget);
+    }
+    return reservation;
+  }
+  return budget.acquire(bytes, limits.timeout, [stop]() { return stop && stop->stopRequested(); });
+}
+
+MemoryReservation admitQueued(std::size_t bytes, bool may_wait) {
+  Library *library = current_library.load();
+  if (!library || !library->budget) {
+    return {};
+  }
+
+  MemoryBudget &budget = *library->budget;
+  const bool wait = may_wait && !library->options.reject_over_budget;
+  std::optional<MemoryReservation> reservation =
+      wait ? budget.acquire(bytes) : budget.tryAcquire(bytes);
+  if (!reservation && !may_wait) {
+    return {};
+  }
+  if (!reservation) {
+    throw usedUp(budget);
+  }
+  return std::move(*reservation);
+}
+
+TransportResult notAdmitted(const StopToken *stop) {
+  TransportResult result;
+  if (stop && stop->stopRequested()) {
+    result.status = TransportStatus::kCancelled;
+    result.error = "Cancelled while waiting for the memory budget";
+  } else {
+    result.status = TransportStatus::kTimedOut;
+    result.timeout = TimeoutReason::kDeadline;
+    result.error = "Timed out waiting for the memory budget";
+  }
+  return result;
+}
+
+AdmittedScope::AdmittedScope() { admitted_scopes++; }
+
+AdmittedScope::~AdmittedScope() { admitted_scopes--; }
+
+CURL *acquireHandle(std::string_view hostname, std::string_view user) {
+  Library *library = current_library.load();
+  if (!library) {
+    return curl_easy_init();
+  }
+
+  CURL *curl = nullptr;
+  std::vector<CURL *> expired;
+  {
+    std::lock_guard<std::mutex> lock{library->idle_mutex};
+    const auto &it = library->idle.find(handleKey(hostname, user));
+    if (it != library->idle.end()) {
+      std::vector<IdleHandle> &handles = it->second;
+      const Clock::time_point now = Clock::now();
+      while (!curl && !handles.empty()) {
+        const IdleHandle handle = handles.back();
+        handles.pop_back();
+        if (now - handle.since < library->options.max_idle_time) {
+          curl = handle.curl;
+        } else {
+          expired.push_back(handle.curl);
+        }
+      }
+    }
+  }
+
+  // Closing a connection says goodbye to the relay, which is not done while holding the lock
+  for (CURL *handle : expired) {
+    curl_easy_cleanup(handle);
+  }
+
+  // A reset handle keeps its connection, DNS cache and TLS sessions
+  if (curl) {
+    curl_easy_reset(curl);
+  } else {
+    curl = curl_easy_init();
+  }
+  if (curl) {
+    curl_easy_setopt(curl, CURLOPT_SHARE, library->share);
+  }
+  return curl;
+}
+
+bool releaseHandle(std::string_view hostname, std::string_view user, CURL *curl, bool reusable) {
+  Library *library = current_library.load();
+  if (library && reusable) {
+    std::lock_guard<std::mutex> lock{library->idle_mutex};
+    std::vector<IdleHandle> &handles = library->idle[handleKey(hostname, user)];
+    if (handles.size() < library->options.max_idle_connections) {
+      handles.push_back({curl, Clock::now()});
+      return true;
+    }
+  }
+  curl_easy_cleanup(curl);
+  return false;
+}
+
+static size_t discardCallback(char * /*ptr*/, size_t size, size_t nmemb, void * /*userp*/) {
+  return size * nmemb;
+}
+
+std::size_t prewarm(const Credentials &credentials, std::size_t connections,
+                    const SendLimits &limits) {
+  Library *library = current_library.load();
+  if (!library) {
+    throw LibraryException("[!] The library has to be initialized before it can be prewarmed");
+  }
+
+  // curl needs null terminated strings
+  const smtp::secure_string user{credentials.user()};
+  const smtp::secure_string password{credentials.password()};
+  const std::string hostname{credentials.hostname()};
+
+  // The first connection fills the DNS cache and the TLS session cache, the rest reuse them
+  std::atomic<std::size_t> kept{0};
+  const auto &open = [&]() {
+    CURL *curl = curl_easy_init();
+    if (!curl) {
+      return;
+    }
+    curl_easy_setopt(curl, CURLOPT_SHARE, library->share);
+    curl_easy_setopt(curl, CURLOPT_URL, hostname.c_str());
+    curl_easy_setopt(curl, CURLOPT_USERNAME, user.c_str());
+    curl_easy_setopt(curl, CURLOPT_PASSWORD, password.c_str());
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS,
+                     static_cast<long>(limits.connect_timeout.count()));
+    curl_easy_setopt(curl, CURLOPT_SERVER_RESPONSE_TIMEOUT,
+                     static_cast<long>(limits.response_timeout.count()));
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, static_cast<long>(limits.timeout.count()));
+
+    // Without recipients or anything to upload libcurl logs in and sends this command instead
+    // of a mail transaction, then leaves the connection open
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "NOOP");
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discardCallback);
+
+    const bool opened = curl_easy_perform(curl) == CURLE_OK;
+    if (releaseHandle(hostname, user, curl, opened)) {
+      kept++;
+    }
+  };
+
+  connections = std::min(connections, library->options.max_idle_connections);
+  if (connections > 0) {
+    open();
+  }
+  std::vector<std::thread> threads;
+  for (std::size_t i = 1; i < connections; i++) {
+    threads.emplace_back(open);
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  return kept.load();
+}
+
+} // namespace smtp
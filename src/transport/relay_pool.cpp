@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <mutex>
+
+#include "transport/relay_pool.hpp"
+
+namespace smtp {
+
+struct Relay {
+  std::string url;
+  CircuitState state = CircuitState::kClosed;
+  RelayPool::Clock::time_point open_until{};
+  // Moving average in microseconds, negative until the first sample
+  double latency = -1.0;
+  std::size_t in_flight = 0;
+  std::size_t sent = 0;
+  std::size_t failures = 0;
+  std::size_t consecutive_failures = 0;
+};
+
+struct RelayPool::Impl {
+  RelayOptions m_options;
+  std::vector<Relay> m_relays;
+  mutable std::mutex m_mutex;
+};
+
+RelayPool::RelayPool(const std::vector<std::string_view> &urls, const RelayOptions &options)
+    : m_impl{std::make_unique<Impl>()} {
+  if (urls.empty() || urls.size() > kMaxRelays) {
+    throw RelayPoolException("[!] A relay pool needs between 1 and " +
+                             std::to_string(kMaxRelays) + " relays");
+  }
+  if (options.latency_weight <= 0.0 || options.latency_weight > 1.0) {
+    throw RelayPoolException("[!] Latency weight must be in (0, 1]");
+  }
+
+  m_impl->m_options = options;
+  m_impl->m_relays.resize(urls.size());
+  for (std::size_t i = 0; i < urls.size(); i++) {
+    m_impl->m_relays[i].url = urls[i];
+  }
+}
+
+RelayPool::~RelayPool() = default;
+
+std::size_t RelayPool::size() const { return m_impl->m_relays.size(); }
+
+const std::string &RelayPool::url(std::size_t relay) const {
+  return m_impl->m_relays.at(relay).url;
+}
+
+std::optional<std::size_t> RelayPool::acquire(uint64_t excluded, Clock::time_point now) {
+  std::lock_guard<std::mutex> lock{m_impl->m_mutex};
+
+  std::optional<std::size_t> best;
+  double best_score = 0.0;
+  for (std::size_t i = 0; i < m_impl->m_relays.size(); i++) {
+    Relay &relay = m_impl->m_relays[i];
+    if ((excluded >> i) & 1U) {
+      continue;
+    }
+    if (relay.state == CircuitState::kOpen && now >= relay.open_until) {
+      relay.state = CircuitState::kHalfOpen;
+    }
+    // Only one trial send at a time goes to a relay that is on probation
+    if (relay.state == CircuitState::kOpen ||
+        (relay.state == CircuitState::kHalfOpen && relay.in_flight > 0)) {
+      continue;
+    }
+
+    // A relay that has not been measured yet scores as the fastest, so every relay gets tried.
+    // Sends in flight scale the score so that concurrent sends spread over the relays.
+    const double latency = relay.latency < 0.0 ? 0.0 : relay.latency;
+    const double score = (latency + 1.0) * static_cast<double>(relay.in_flight + 1);
+    if (!best || score < best_score) {
+      best = i;
+      best_score = score;
+    }
+  }
+
+  if (best) {
+    m_impl->m_relays[*best].in_flight++;
+  }
+  return best;
+}
+
+void RelayPool::release(std::size_t relay_index, TransportStatus status, Clock::duration latency,
+                        Clock::time_point now) {
+  std::lock_guard<std::mutex> lock{m_impl->m_mutex};
+  Relay &relay = m_impl->m_relays.at(relay_index);
+  const RelayOptions &options = m_impl->m_options;
+  relay.in_flight--;
+
+  // A send that was cancelled says nothing either way, a half open relay gets another trial
+  if (status == TransportStatus::kCancelled) {
+    return;
+  }
+
+  // A message that was refused for good says nothing about the health of the relay
+  if (status == TransportStatus::kSent || status == TransportStatus::kPermanentFailure) {
+    const double sample =
+        static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+    relay.latency = relay.latency < 0.0 ? sample
+                                        : options.latency_weight * sample +
+                                              (1.0 - options.latency_weight) * relay.latency;
+    relay.sent += status == TransportStatus::kSent ? 1 : 0;
+    relay.consecutive_failures = 0;
+    relay.state = CircuitState::kClosed;
+    return;
+  }
+
+  relay.failures++;
+  relay.consecutive_failures++;
+  if (relay.state == CircuitState::kHalfOpen ||
+      relay.consecutive_failures >= options.failure_threshold) {
+    relay.state = CircuitState::kOpen;
+    relay.open_until = now + options.open_duration;
+  }
+}
+
+TransportResult RelayPool::send(TransportParams params, const MessageView &message) {
+  // The recipients that are done are counted without the empty ones, so they are removed first
+  params.recipients.erase(
+      std::remove_if(params.recipients.begin(), params.recipients.end(),
+                     [](std::string_view recipient) { return recipient.empty(); }),
+      params.recipients.end());
+
+  // The deadline is shared by every relay the message is tried on
+  if (!params.deadline && params.limits.timeout.count() > 0) {
+    params.deadline = Clock::now() + params.limits.timeout;
+  }
+
+  TransportResult result;
+  result.status = TransportStatus::kConnectFailed;
+  result.error = "[!] No healthy relay is available";
+
+  uint64_t tried = 0;
+  std::size_t recipients_done = 0;
+  while (const std::optional<std::size_t> &relay = this->acquire(tried)) {
+    tried |= uint64_t{1} << *relay;
+    params.hostname = this->url(*relay);
+
+    const Clock::time_point start = Clock::now();
+    result = sendMessage(params, message);
+    const Clock::time_point end = Clock::now();
+    this->release(*relay, result.status, end - start, end);
+
+    // Batches that went through on this relay are not sent again by the next one
+    recipients_done += result.recipients_done;
+    if (!result.retryable()) {
+      break;
+    }
+    params.recipients.erase(params.recipients.begin(),
+                            params.recipients.begin() +
+                                static_cast<std::ptrdiff_t>(result.recipients_done));
+  }
+
+  result.recipients_done = recipients_done;
+  return result;
+}
+
+std::vector<RelayStats> RelayPool::stats() const {
+  std::lock_guard<std::mutex> lock{m_impl->m_mutex};
+  std::vector<RelayStats> result;
+  result.reserve(m_impl->m_relays.size());
+  for (const Relay &relay : m_impl->m_relays) {
+    RelayStats stats;
+    stats.url = relay.url;
+    stats.state = relay.state;
+    stats.latency = std::chrono::microseconds{
+        relay.latency < 0.0 ? 0 : static_cast<std::chrono::microseconds::rep>(relay.latency)};
+    stats.in_flight = relay.in_flight;
+    stats.sent = relay.sent;
+    stats.failures = relay.failures;
+    stats.consecutive_failures = relay.consecutive_failures;
+    result.push_back(std::move(stats));
+  }
+  return result;
+}
+
+} // namespace smtp
@@ -0,0 +1,752 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "transport/spool.hpp"
+#include "utils/base64/base64.hpp"
+#include "utils/memory/secure_pool.hpp"
+
+namespace smtp {
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr std::string_view kCRLF = "\r\n";
+static constexpr std::string_view kStuffing = ".";
+
+// Largest piece of the payload that is sent in one call, the stop token and the deadline are
+// checked between pieces
+static constexpr std::size_t kChunkSize = 1024 * 1024;
+// Size of the buffer the payload is copied through when it cannot be sent with sendfile()
+static constexpr std::size_t kCopyBufferSize = 64 * 1024;
+// How often a wait on the socket wakes up to check the stop token
+static constexpr std::chrono::milliseconds kPollInterval{100};
+// How long the relay has to answer QUIT, the message has been accepted by then so there is no
+// reason to wait for as long as for any other reply
+static constexpr std::chrono::milliseconds kQuitTimeout{1000};
+
+SpoolInfo writeSpool(const MessageView &message, int fd) {
+  // The message is split wherever a line starts with a period, so that another one can be put in
+  // front of it without copying the rest
+  MessageView stuffed;
+  stuffed.reserve(message.count() + 2);
+  bool line_start = true;
+  for (std::size_t i = 0; i < message.count(); i++) {
+    std::string_view segment = message.segment(i);
+    while (!segment.empty()) {
+      if (line_start && segment.front() == '.') {
+        stuffed.append(kStuffing);
+      }
+      const std::size_t line_break = segment.find('\n');
+      const std::size_t end =
+          line_break == std::string_view::npos ? segment.size() : line_break + 1;
+      stuffed.append(segment.substr(0, end));
+      line_start = line_break != std::string_view::npos;
+      segment.remove_prefix(end);
+    }
+  }
+
+  // The data ends with a line that only holds a period
+  if (!line_start) {
+    stuffed.append(kCRLF);
+  }
+  SpoolInfo info;
+  info.message_size = message.size() + (line_start ? 0 : kCRLF.size());
+  stuffed.append(".\r\n");
+  info.file_size = stuffed.writeTo(fd);
+  return info;
+}
+
+// Ends the send, with the status and reason that it is reported with
+class SpoolFailure : public std::runtime_error {
+public:
+  SpoolFailure(TransportStatus status, const std::string &message,
+               TimeoutReason timeout = TimeoutReason::kNone)
+      : runtime_error{message}, m_status{status}, m_timeout{timeout} {}
+
+  TransportStatus status() const { return m_status; }
+  TimeoutReason timeout() const { return m_timeout; }
+
+private:
+  TransportStatus m_status;
+  TimeoutReason m_timeout;
+};
+
+struct Reply {
+  long code = 0;
+  std::string text;
+
+  bool positive() const { return code >= 200 && code < 400; }
+};
+
+// Whether sending again could help, for a reply that refused a command
+static TransportStatus classify(const Reply &reply) {
+  return reply.code >= 500 ? TransportStatus::kPermanentFailure
+                           : TransportStatus::kTransientFailure;
+}
+
+struct RelayAddress {
+  bool tls = false;
+  std::string host;
+  std::string port;
+};
+
+// e.g smtps://email-smtp.us-east-1.amazonaws.com:465 or smtp://[::1]:2525
+static RelayAddress parseRelay(std::string_view url) {
+  static constexpr std::string_view kSmtps = "smtps://";
+  static constexpr std::string_view kSmtp = "smtp://";
+
+  RelayAddress relay;
+  if (url.rfind(kSmtps, 0) == 0) {
+    relay.tls = true;
+    url.remove_prefix(kSmtps.size());
+  } else if (url.rfind(kSmtp, 0) == 0) {
+    url.remove_prefix(kSmtp.size());
+  } else {
+    throw SpoolFailure(TransportStatus::kPermanentFailure,
+                       "Unsupported relay URL: " + std::string(url));
+  }
+  url = url.substr(0, url.find('/'));
+
+  std::string_view port;
+  if (!url.empty() && url.front() == '[') {
+    const std::size_t close = std::min(url.find(']'), url.size());
+    relay.host = url.substr(1, close - 1);
+    port = url.substr(std::min(close + 1, url.size()));
+  } else {
+    const std::size_t colon = std::min(url.rfind(':'), url.size());
+    relay.host = url.substr(0, colon);
+    port = url.substr(colon);
+  }
+  relay.port = port.size() > 1 ? std::string(port.substr(1)) : relay.tls ? "465" : "25";
+  if (relay.host.empty()) {
+    throw SpoolFailure(TransportStatus::kPermanentFailure, "No host in the relay URL");
+  }
+  return relay;
+}
+
+// OpenSSL writes to the socket itself, so a relay that hangs up would raise SIGPIPE. It is
+// blocked for this thread while the send is in progress and any that is raised is discarded.
+class SigpipeGuard {
+public:
+  SigpipeGuard() {
+    sigemptyset(&m_sigpipe);
+    sigaddset(&m_sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &m_sigpipe, &m_previous);
+  }
+
+  ~SigpipeGuard() {
+    sigset_t pending;
+    sigpending(&pending);
+    if (sigismember(&pending, SIGPIPE)) {
+      const timespec no_wait{0, 0};
+      sigtimedwait(&m_sigpipe, nullptr, &no_wait);
+    }
+    pthread_sigmask(SIG_SETMASK, &m_previous, nullptr);
+  }
+
+  SigpipeGuard(const SigpipeGuard &) = delete;
+  SigpipeGuard &operator=(const SigpipeGuard &) = delete;
+
+private:
+  sigset_t m_sigpipe;
+  sigset_t m_previous;
+};
+
+// A non-blocking connection to the relay, with or without TLS. Every wait on the socket is
+// bounded by a limit of its own and by the deadline of the whole send.
+class Connection {
+public:
+  Connection(const TransportParams &params, std::optional<Clock::time_point> deadline)
+      : m_params{params}, m_deadline{deadline} {}
+  ~Connection();
+
+  Connection(const Connection &) = delete;
+  Connection &operator=(const Connection &) = delete;
+
+  void connect(const RelayAddress &relay);
+  void handshake(const RelayAddress &relay, bool kernel_tls);
+
+  void send(std::string_view data);
+  Reply reply();
+  Reply command(std::string_view line);
+  PayloadPath sendFile(int fd, std::size_t size);
+  // Says goodbye, waiting for the answer for kQuitTimeout at most
+  void quit();
+
+  long lastCode() const { return m_last_code; }
+
+private:
+  // Waits for the socket to be ready for events, until limit or the deadline
+  void wait(short events, Clock::time_point limit, TimeoutReason reason);
+  void send(std::string_view data, Clock::time_point limit);
+  Reply reply(Clock::time_point limit);
+  // Throws if the send was stopped or ran out of time
+  void checkLimits() const;
+  // How long the next reply may take. Until the relay has said anything the connect timeout
+  // applies, since it covers the greeting as well.
+  Clock::time_point replyLimit() const;
+  Clock::time_point limitAfter(std::chrono::milliseconds timeout) const;
+  // Handles an OpenSSL call that did not complete, returns once it can be tried again
+  void retrySsl(int ret, Clock::time_point limit, TimeoutReason reason, const char *what);
+
+  const TransportParams &m_params;
+  std::optional<Clock::time_point> m_deadline;
+  Clock::time_point m_connect_limit{};
+
+  int m_socket = -1;
+  SSL_CTX *m_ctx = nullptr;
+  SSL *m_ssl = nullptr;
+
+  // Bytes that have been read and are not part of a reply yet
+  std::string m_input;
+  long m_last_code = 0;
+};
+
+Connection::~Connection() {
+  if (m_ssl) {
+    SSL_free(m_ssl);
+  }
+  if (m_ctx) {
+    SSL_CTX_free(m_ctx);
+  }
+  if (m_socket >= 0) {
+    close(m_socket);
+  }
+}
+
+Clock::time_point Connection::limitAfter(std::chrono::milliseconds timeout) const {
+  return timeout.count() > 0 ? Clock::now() + timeout : Clock::time_point::max();
+}
+
+Clock::time_point Connection::replyLimit() const {
+  return m_last_code == 0 ? m_connect_limit
+                          : limitAfter(std::chrono::milliseconds{m_params.limits.response_timeout});
+}
+
+void Connection::checkLimits() const {
+  if (m_params.stop && m_params.stop->stopRequested()) {
+    throw SpoolFailure(TransportStatus::kCancelled, "The send was stopped");
+  }
+  if (m_deadline && Clock::now() >= *m_deadline) {
+    throw SpoolFailure(TransportStatus::kTimedOut, "The deadline of the send passed",
+                       TimeoutReason::kDeadline);
+  }
+}
+
+void Connection::wait(short events, Clock::time_point limit, TimeoutReason reason) {
+  for (;;) {
+    checkLimits();
+    const Clock::time_point now = Clock::now();
+    if (now >= limit) {
+      throw SpoolFailure(TransportStatus::kTimedOut, "Timed out waiting for the relay", reason);
+    }
+
+    // Wakes up regularly so that a stop request is noticed
+    Clock::duration slice = std::min<Clock::duration>(kPollInterval, limit - now);
+    if (m_deadline) {
+      slice = std::min<Clock::duration>(slice, *m_deadline - now);
+    }
+    const auto &timeout = std::chrono::ceil<std::chrono::milliseconds>(slice);
+
+    pollfd ready{m_socket, events, 0};
+    const int count = poll(&ready, 1, static_cast<int>(timeout.count()));
+    if (count > 0) {
+      return;
+    }
+    if (count < 0 && errno != EINTR) {
+      throw SpoolFailure(TransportStatus::kTransientFailure,
+                         std::string("poll() failed: ") + std::strerror(errno));
+    }
+  }
+}
+
+void Connection::connect(const RelayAddress &relay) {
+  m_connect_limit = limitAfter(m_params.limits.connect_timeout);
+
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses = nullptr;
+  if (getaddrinfo(relay.host.c_str(), relay.port.c_str(), &hints, &addresses) != 0) {
+    throw SpoolFailure(TransportStatus::kConnectFailed, "Couldn't resolve host name");
+  }
+  const std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> owner{addresses, freeaddrinfo};
+
+  for (const addrinfo *address = addresses; address; address = address->ai_next) {
+    m_socket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (m_socket < 0) {
+      continue;
+    }
+    fcntl(m_socket, F_SETFD, FD_CLOEXEC);
+    fcntl(m_socket, F_SETFL, fcntl(m_socket, F_GETFL) | O_NONBLOCK);
+
+    int error = 0;
+    if (::connect(m_socket, address->ai_addr, address->ai_addrlen) != 0) {
+      error = errno;
+      if (error == EINPROGRESS) {
+        wait(POLLOUT, m_connect_limit, TimeoutReason::kConnect);
+        socklen_t length = sizeof(error);
+        getsockopt(m_socket, SOL_SOCKET, SO_ERROR, &error, &length);
+      }
+    }
+    if (error == 0) {
+      // Commands are small and each one is waited for, so they are sent straight away
+      const int no_delay = 1;
+      setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+      return;
+    }
+    close(m_socket);
+    m_socket = -1;
+  }
+  throw SpoolFailure(TransportStatus::kConnectFailed, "Couldn't connect to server");
+}
+
+void Connection::retrySsl(int ret, Clock::time_point limit, TimeoutReason reason,
+                          const char *what) {
+  const int error = SSL_get_error(m_ssl, ret);
+  if (error == SSL_ERROR_WANT_READ) {
+    wait(POLLIN, limit, reason);
+  } else if (error == SSL_ERROR_WANT_WRITE) {
+    wait(POLLOUT, limit, reason);
+  } else {
+    std::array<char, 256> message{};
+    ERR_error_string_n(ERR_get_error(), message.data(), message.size());
+    throw SpoolFailure(m_last_code == 0 ? TransportStatus::kConnectFailed
+                                        : TransportStatus::kTransientFailure,
+                       std::string(what) + " failed: " + message.data());
+  }
+}
+
+void Connection::handshake(const RelayAddress &relay, bool kernel_tls) {
+  m_ctx = SSL_CTX_new(TLS_client_method());
+  if (!m_ctx) {
+    throw SpoolFailure(TransportStatus::kPermanentFailure, "SSL_CTX_new() failed");
+  }
+  // Like sendMessage(), the certificate of the relay is not verified
+  SSL_CTX_set_verify(m_ctx, SSL_VERIFY_NONE, nullptr);
+#if defined(SSL_OP_ENABLE_KTLS)
+  if (kernel_tls) {
+    SSL_CTX_set_options(m_ctx, SSL_OP_ENABLE_KTLS);
+  }
+#else
+  (void)kernel_tls;
+#endif
+
+  m_ssl = SSL_new(m_ctx);
+  if (!m_ssl || SSL_set_fd(m_ssl, m_socket) != 1) {
+    throw SpoolFailure(TransportStatus::kPermanentFailure, "SSL_new() failed");
+  }
+  SSL_set_tlsext_host_name(m_ssl, relay.host.c_str());
+
+  ERR_clear_error();
+  for (int ret = SSL_connect(m_ssl); ret != 1; ret = SSL_connect(m_ssl)) {
+    retrySsl(ret, m_connect_limit, TimeoutReason::kConnect, "TLS handshake");
+  }
+}
+
+void Connection::send(std::string_view data) {
+  send(data, limitAfter(std::chrono::milliseconds{m_params.limits.response_timeout}));
+}
+
+void Connection::send(std::string_view data, Clock::time_point limit) {
+  while (!data.empty()) {
+    if (m_ssl) {
+      ERR_clear_error();
+      const int sent = SSL_write(m_ssl, data.data(), static_cast<int>(data.size()));
+      if (sent > 0) {
+        data.remove_prefix(static_cast<std::size_t>(sent));
+      } else {
+        retrySsl(sent, limit, TimeoutReason::kStalled, "SSL_write()");
+      }
+      continue;
+    }
+
+    const ssize_t sent = ::send(m_socket, data.data(), data.size(), MSG_NOSIGNAL);
+    if (sent > 0) {
+      data.remove_prefix(static_cast<std::size_t>(sent));
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      wait(POLLOUT, limit, TimeoutReason::kStalled);
+    } else if (errno != EINTR) {
+      throw SpoolFailure(TransportStatus::kTransientFailure, "Failed sending data to the peer");
+    }
+  }
+}
+
+Reply Connection::reply() { return reply(replyLimit()); }
+
+Reply Connection::reply(Clock::time_point limit) {
+  const TimeoutReason reason =
+      m_last_code == 0 ? TimeoutReason::kConnect : TimeoutReason::kStalled;
+
+  // A reply is one or more lines that start with the code, every line but the last has a hyphen
+  // after the code, RFC 5321 section 4.2.1
+  Reply reply;
+  std::size_t line_start = 0;
+  for (;;) {
+    const std::size_t line_end = m_input.find(kCRLF, line_start);
+    if (line_end != std::string::npos) {
+      const std::string_view line{m_input.data() + line_start, line_end - line_start};
+      reply.text.append(line);
+      line_start = line_end + kCRLF.size();
+      if (line.size() < 4 || line[3] != '-') {
+        reply.code = std::strtol(std::string(line.substr(0, 3)).c_str(), nullptr, 10);
+        m_input.erase(0, line_start);
+        m_last_code = reply.code;
+        return reply;
+      }
+      reply.text.append("\n");
+      continue;
+    }
+
+    std::array<char, 4096> buffer;
+    ssize_t received = 0;
+    if (m_ssl) {
+      ERR_clear_error();
+      const int ret = SSL_read(m_ssl, buffer.data(), static_cast<int>(buffer.size()));
+      if (ret <= 0 && SSL_get_error(m_ssl, ret) != SSL_ERROR_ZERO_RETURN) {
+        retrySsl(ret, limit, reason, "SSL_read()");
+        continue;
+      }
+      received = ret;
+    } else {
+      received = recv(m_socket, buffer.data(), buffer.size(), 0);
+      if (received < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          wait(POLLIN, limit, reason);
+        } else if (errno != EINTR) {
+          throw SpoolFailure(TransportStatus::kTransientFailure,
+                             "Failure when receiving data from the peer");
+        }
+        continue;
+      }
+    }
+
+    if (received <= 0) {
+      throw SpoolFailure(m_last_code == 0 ? TransportStatus::kConnectFailed
+                                          : TransportStatus::kTransientFailure,
+                         "The relay closed the connection");
+    }
+    m_input.append(buffer.data(), static_cast<std::size_t>(received));
+  }
+}
+
+Reply Connection::command(std::string_view line) {
+  std::string data{line};
+  data.append(kCRLF);
+  this->send(data);
+  return this->reply();
+}
+
+void Connection::quit() {
+  const Clock::time_point limit = std::min(replyLimit(), limitAfter(kQuitTimeout));
+  std::string data{"QUIT"};
+  data.append(kCRLF);
+  this->send(data, limit);
+  this->reply(limit);
+}
+
+PayloadPath Connection::sendFile(int fd, std::size_t size) {
+  // Each wait is bounded by the minimum speed period, a relay that reads nothing for that long
+  // has stopped reading the message
+  const auto &period = std::chrono::milliseconds{m_params.limits.min_speed_period};
+  off_t offset = 0;
+  const auto &remaining = [&]() {
+    return std::min(kChunkSize, size - static_cast<std::size_t>(offset));
+  };
+
+#if defined(__linux__)
+  if (!m_ssl) {
+    while (static_cast<std::size_t>(offset) < size) {
+      checkLimits();
+      const ssize_t sent = ::sendfile(m_socket, fd, &offset, remaining());
+      if (sent == 0) {
+        throw SpoolFailure(TransportStatus::kPermanentFailure, "The spool file was truncated");
+      }
+      if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        wait(POLLOUT, limitAfter(period), TimeoutReason::kStalled);
+      } else if (sent < 0 && errno != EINTR) {
+        throw SpoolFailure(TransportStatus::kTransientFailure, "Failed sending data to the peer");
+      }
+    }
+    return PayloadPath::kSendfile;
+  }
+#endif
+
+#if !defined(OPENSSL_NO_KTLS) && OPENSSL_VERSION_NUMBER >= 0x30000000L
+  if (m_ssl && BIO_get_ktls_send(SSL_get_wbio(m_ssl))) {
+    while (static_cast<std::size_t>(offset) < size) {
+      checkLimits();
+      ERR_clear_error();
+      const ossl_ssize_t sent = SSL_sendfile(m_ssl, fd, offset, remaining(), 0);
+      if (sent > 0) {
+        offset += static_cast<off_t>(sent);
+      } else {
+        retrySsl(static_cast<int>(sent), limitAfter(period), TimeoutReason::kStalled,
+                 "SSL_sendfile()");
+      }
+    }
+    return PayloadPath::kKernelTls;
+  }
+#endif
+
+  std::vector<char> buffer(kCopyBufferSize);
+  while (static_cast<std::size_t>(offset) < size) {
+    checkLimits();
+    const ssize_t read = pread(fd, buffer.data(), std::min(buffer.size(), remaining()), offset);
+    if (read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (read <= 0) {
+      throw SpoolFailure(TransportStatus::kPermanentFailure, "Failed reading the spool file");
+    }
+    this->send({buffer.data(), static_cast<std::size_t>(read)});
+    offset += read;
+  }
+  return PayloadPath::kCopied;
+}
+
+// Logs in with the first of PLAIN and LOGIN that the relay offers. The commands hold the
+// password, so they are built in a buffer that is wiped afterwards.
+static void login(Connection &connection, std::string_view user, std::string_view password,
+                  std::string_view mechanisms) {
+  std::array<std::byte, 1024> buffer;
+  std::pmr::monotonic_buffer_resource arena{buffer.data(), buffer.size()};
+  struct Wipe {
+    std::array<std::byte, 1024> &buffer;
+    ~Wipe() { secureWipe(buffer.data(), buffer.size()); }
+  } wipe{buffer};
+
+  const auto &offers = [&](std::string_view mechanism) {
+    std::size_t pos = mechanisms.find(mechanism);
+    while (pos != std::string_view::npos) {
+      const std::size_t end = pos + mechanism.size();
+      if ((pos == 0 || mechanisms[pos - 1] == ' ') &&
+          (end == mechanisms.size() || mechanisms[end] == ' ' || mechanisms[end] == '\n')) {
+        return true;
+      }
+      pos = mechanisms.find(mechanism, end);
+    }
+    return false;
+  };
+
+  const auto &secret = [&](std::string_view prefix, std::string_view value) {
+    std::pmr::string line{prefix, &arena};
+    line.append(Base64::Base64Encode(value, &arena));
+    line.append(kCRLF);
+    connection.send(line);
+    return connection.reply();
+  };
+
+  Reply reply;
+  if (offers("PLAIN")) {
+    std::pmr::string credentials{&arena};
+    credentials.push_back('\0');
+    credentials.append(user);
+    credentials.push_back('\0');
+    credentials.append(password);
+    reply = secret("AUTH PLAIN ", credentials);
+  } else if (offers("LOGIN")) {
+    reply = connection.command("AUTH LOGIN");
+    if (reply.code == 334) {
+      reply = secret({}, user);
+    }
+    if (reply.code == 334) {
+      reply = secret({}, password);
+    }
+  } else {
+    throw SpoolFailure(TransportStatus::kPermanentFailure,
+                       "The relay offers no supported login mechanism");
+  }
+
+  if (reply.code != 235) {
+    throw SpoolFailure(classify(reply), "Login denied: " + reply.text);
+  }
+}
+
+// Sends the message to one batch of recipients. Returns how it went when the relay refused it,
+// anything that goes wrong with the connection itself is thrown.
+static TransportStatus transaction(Connection &connection, const TransportParams &params,
+                                   const std::vector<std::string_view> &recipients,
+                                   bool declare_size, int fd, const SpoolInfo &spool,
+                                   TransportResult &result) {
+  const auto &path = [](std::string_view address) {
+    return address.front() == '<' ? std::string(address) : "<" + std::string(address) + ">";
+  };
+  const auto &refused = [&](const Reply &reply) {
+    result.error = reply.text;
+    connection.command("RSET");
+    return classify(reply);
+  };
+
+  std::string mail = "MAIL FROM:" + path(params.from.empty() ? "<>" : params.from);
+  if (declare_size) {
+    mail += " SIZE=" + std::to_string(spool.message_size);
+  }
+  const Reply &mail_reply = connection.command(mail);
+  if (!mail_reply.positive()) {
+    return refused(mail_reply);
+  }
+
+  // A recipient that is refused does not stop the rest of them, just like sendMessage()
+  std::size_t accepted = 0;
+  Reply last_refusal;
+  for (const std::string_view recipient : recipients) {
+    const Reply &reply = connection.command("RCPT TO:" + path(recipient));
+    if (reply.positive()) {
+      accepted++;
+    } else {
+      last_refusal = reply;
+    }
+  }
+  if (accepted == 0) {
+    return refused(last_refusal);
+  }
+
+  const Reply &data_reply = connection.command("DATA");
+  if (data_reply.code != 354) {
+    return refused(data_reply);
+  }
+  result.payload = connection.sendFile(fd, spool.file_size);
+
+  const Reply &reply = connection.reply();
+  if (!reply.positive()) {
+    result.error = reply.text;
+    return classify(reply);
+  }
+  return TransportStatus::kSent;
+}
+
+TransportResult sendSpool(const TransportParams &params, int fd, const SpoolInfo &spool,
+                          const SpoolOptions &options) {
+  TransportResult result;
+
+  std::optional<Clock::time_point> deadline = params.deadline;
+  if (!deadline && params.limits.timeout.count() > 0) {
+    deadline = Clock::now() + params.limits.timeout;
+  }
+
+  std::vector<std::string_view> addresses;
+  addresses.reserve(params.recipients.size());
+  for (const auto &recipient : params.recipients) {
+    if (!recipient.empty()) {
+      addresses.push_back(recipient);
+    }
+  }
+
+  const SigpipeGuard sigpipe_guard;
+  Connection connection{params, deadline};
+  try {
+    struct stat file {};
+    if (fstat(fd, &file) != 0 || static_cast<std::size_t>(file.st_size) < spool.file_size) {
+      throw SpoolFailure(TransportStatus::kPermanentFailure, "The spool file cannot be read");
+    }
+    if (addresses.empty()) {
+      throw SpoolFailure(TransportStatus::kPermanentFailure, "No recipients");
+    }
+
+    const RelayAddress &relay = parseRelay(params.hostname);
+    connection.connect(relay);
+    if (relay.tls) {
+      connection.handshake(relay, options.kernel_tls);
+    }
+
+    const Reply &greeting = connection.reply();
+    if (greeting.code != 220) {
+      throw SpoolFailure(classify(greeting), "The relay refused the connection: " + greeting.text);
+    }
+
+    std::array<char, 256> local_name{};
+    if (gethostname(local_name.data(), local_name.size() - 1) != 0 || local_name[0] == '\0') {
+      std::snprintf(local_name.data(), local_name.size(), "localhost");
+    }
+    const Reply &ehlo = connection.command("EHLO " + std::string(local_name.data()));
+    if (ehlo.code != 250) {
+      throw SpoolFailure(classify(ehlo), "EHLO was refused: " + ehlo.text);
+    }
+
+    // Capabilities are listed one per line after the first, e.g "250-AUTH PLAIN LOGIN"
+    bool declare_size = false;
+    std::string_view mechanisms;
+    std::string_view lines = ehlo.text;
+    while (!lines.empty()) {
+      const std::size_t end = std::min(lines.find('\n'), lines.size());
+      const std::string_view line = lines.substr(0, end);
+      const std::string_view capability = line.size() > 4 ? line.substr(4) : std::string_view{};
+      declare_size |= capability == "SIZE" || capability.rfind("SIZE ", 0) == 0;
+      if (capability.rfind("AUTH ", 0) == 0) {
+        mechanisms = capability.substr(5);
+      }
+      lines.remove_prefix(std::min(end + 1, lines.size()));
+    }
+    if (!params.user.empty()) {
+      login(connection, params.user, params.password, mechanisms);
+    }
+
+    const std::size_t batch_size =
+        params.max_recipients > 0 ? params.max_recipients : addresses.size();
+    std::size_t start = 0;
+    do {
+      const std::size_t end = std::min(addresses.size(), start + batch_size);
+      const std::vector<std::string_view> batch{addresses.begin() + start,
+                                                addresses.begin() + end};
+      const TransportStatus status =
+          transaction(connection, params, batch, declare_size, fd, spool, result);
+
+      // A batch that can be retried ends the send, just like it does for sendMessage()
+      if (status != TransportStatus::kSent) {
+        result.status = status;
+        if (status != TransportStatus::kPermanentFailure) {
+          break;
+        }
+      }
+      result.recipients_done = end;
+      start = end;
+    } while (start < addresses.size());
+    result.response_code = connection.lastCode();
+
+    // The messages have been accepted by now, so a relay that is slow to say goodbye is ignored
+    try {
+      connection.quit();
+    } catch (const SpoolFailure &) {
+    }
+  } catch (const SpoolFailure &failure) {
+    fprintf(stderr, "sendSpool() failed: %s\n", failure.what());
+    result.status = failure.status();
+    result.timeout = failure.timeout();
+    result.error = failure.what();
+    result.response_code = connection.lastCode();
+  }
+
+  if (result.status != TransportStatus::kSent && result.error.empty()) {
+    result.error = "The relay refused the message";
+  }
+  return result;
+}
+
+} // namespace smtp
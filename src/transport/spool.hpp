@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+
+#include "mime/message_view.hpp"
+#include "transport/transport.hpp"
+
+namespace smtp {
+
+struct SpoolInfo {
+  // Bytes written to the file, with the dot-stuffing and the line that ends the data
+  std::size_t file_size = 0;
+  // Size of the message before it was dot-stuffed, which is what is declared with SIZE=, RFC 1870
+  // section 3
+  std::size_t message_size = 0;
+};
+
+// Writes a rendered message to fd exactly as it goes over the wire after DATA: lines that start
+// with a period are dot-stuffed, RFC 5321 section 4.5.2, and the line that ends the data is added.
+// Throws std::system_error if the write fails.
+SpoolInfo writeSpool(const MessageView &message, int fd);
+
+struct SpoolOptions {
+  // Hands the TLS session to the kernel after the handshake, when both the kernel and OpenSSL
+  // support it for the negotiated cipher. The payload is then sent with sendfile().
+  bool kernel_tls = true;
+};
+
+// Sends a message that was written by writeSpool() to the relay of params.hostname, an smtps:// or
+// smtp:// URL, spool is what writeSpool() returned for it. The SMTP conversation is held directly
+// over OpenSSL rather than through libcurl, so that on Linux the payload can go from the page cache
+// to the socket without being copied into user space. Where kernel TLS is not available the file is
+// read in chunks and written through OpenSSL instead, TransportResult::payload reports which of
+// them was used.
+//
+// Authentication, batches of recipients, limits and the stop token behave just like they do for
+// sendMessage(). The file is read with pread(), so the same descriptor can be sent from several
+// threads at once.
+TransportResult sendSpool(const TransportParams &params, int fd, const SpoolInfo &spool,
+                          const SpoolOptions &options = {});
+
+} // namespace smtp
@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include "transport/curl_handles.hpp"
+#include "transport/transport.hpp"
+#include "utils/secure_strings.hpp"
+
+#include "curl/curl.h"
+
+namespace smtp {
+
+using Clock = std::chrono::steady_clock;
+
+// Everything the callbacks need while a batch is being sent
+struct UploadContext {
+  MessageReader reader;
+  const StopToken *stop;
+  std::optional<Clock::time_point> deadline;
+
+  bool stopped() const { return stop && stop->stopRequested(); }
+  bool expired(Clock::time_point now) const { return deadline && now >= *deadline; }
+};
+
+static size_t payloadCallback(void *ptr, size_t size, size_t nmemb, void *userp);
+static int progressCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                            curl_off_t ulnow);
+
+// Whether sending again could help depends on how far the conversation with the server got
+static TransportStatus classify(CURLcode code, long response_code) {
+  if (code == CURLE_OK) {
+    return TransportStatus::kSent;
+  }
+  if (response_code >= 500) {
+    return TransportStatus::kPermanentFailure;
+  }
+  if (response_code >= 400) {
+    return TransportStatus::kTransientFailure;
+  }
+
+  switch (code) {
+  case CURLE_COULDNT_RESOLVE_HOST:
+  case CURLE_COULDNT_CONNECT:
+  case CURLE_SSL_CONNECT_ERROR:
+  case CURLE_GOT_NOTHING:
+  case CURLE_SEND_ERROR:
+  case CURLE_RECV_ERROR:
+    return response_code == 0 ? TransportStatus::kConnectFailed
+                              : TransportStatus::kTransientFailure;
+  default:
+    return TransportStatus::kPermanentFailure;
+  }
+}
+
+TransportResult sendMessage(const TransportParams &params, const MessageView &message) {
+  CURL *curl = nullptr;
+  TransportResult result;
+
+  std::optional<Clock::time_point> deadline = params.deadline;
+  if (!deadline && params.limits.timeout.count() > 0) {
+    deadline = Clock::now() + params.limits.timeout;
+  }
+
+  // curl needs null terminated strings
+  const smtp::secure_string user{params.user};
+  const smtp::secure_string password{params.password};
+  const std::string hostname{params.hostname};
+  const std::string from{params.from};
+
+  // Once the library is initialized the handle may come with an open connection to the relay
+  curl = acquireHandle(params.hostname, params.user);
+
+  if (curl) {
+    curl_easy_setopt(curl, CURLOPT_USERNAME, user.c_str());
+    curl_easy_setopt(curl, CURLOPT_PASSWORD, password.c_str());
+
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER,
+                     0); // allows emails to be sent
+    curl_easy_setopt(curl, CURLOPT_URL, hostname.c_str());
+
+    /* If you want to connect to a site who isn't using a certificate that is
+     * signed by one of the certs in the CA bundle you have, you can skip the
+     * verification of the server's certificate. This makes the connection
+     * A LOT LESS SECURE.
+     *
+     * If you have a CA cert for the server stored someplace else than in the
+     * default bundle, then the CURLOPT_CAPATH option might come handy for
+     * you. */
+#ifdef SKIP_PEER_VERIFICATION
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+#endif
+
+    /* If the site you're connecting to uses a different host name that what
+     * they have mentioned in their server certificate's commonName (or
+     * subjectAltName) fields, libcurl will refuse to connect. You can skip
+     * this check, but this will make the connection less secure. */
+#ifdef SKIP_HOSTNAME_VERIFICATION
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+#endif
+
+    /* Note that this option isn't strictly required, omitting it will result
+     * in libcurl sending the MAIL FROM command with empty sender data. All
+     * autoresponses should have an empty reverse-path, and should be directed
+     * to the address in the reverse-path which triggered them. Otherwise,
+     * they could cause an endless loop. See RFC 5321 Section 4.5.5 for more
+     * details.
+     */
+    curl_easy_setopt(curl, CURLOPT_MAIL_FROM, from.c_str());
+
+    /* Declaring the size of the upload makes libcurl add the SIZE parameter to MAIL FROM when
+     * the server supports the SIZE extension (RFC 1870), so a server can refuse a message that
+     * is too large before any of it has been transferred. */
+    curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, static_cast<curl_off_t>(message.size()));
+
+    /* We're using a callback function to specify the payload (the headers and
+     * body of the message). You could just use the CURLOPT_READDATA option to
+     * specify a FILE pointer to read from. */
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, payloadCallback);
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+
+    /* A recipient that is refused should not stop the message from being delivered to the rest
+     * of a long list, the transaction only fails if every recipient is refused. */
+#if LIBCURL_VERSION_NUM >= 0x080200
+    curl_easy_setopt(curl, CURLOPT_MAIL_RCPT_ALLOWFAILS, 1L);
+#elif LIBCURL_VERSION_NUM >= 0x074500
+    curl_easy_setopt(curl, CURLOPT_MAIL_RCPT_ALLLOWFAILS, 1L);
+#endif
+
+    /* Bound how long the send can take. The overall deadline is applied to each batch below as
+     * the time that is left of it. The low speed limit only applies while the message is being
+     * uploaded, so waiting on a reply is bounded by the response timeout instead. */
+    const SendLimits &limits = params.limits;
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS,
+                     static_cast<long>(limits.connect_timeout.count()));
+    curl_easy_setopt(curl, CURLOPT_SERVER_RESPONSE_TIMEOUT,
+                     static_cast<long>(limits.response_timeout.count()));
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT,
+                     static_cast<long>(limits.min_bytes_per_second));
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME,
+                     static_cast<long>(limits.min_speed_period.count()));
+
+    /* Sends run on several threads at once. Without this libcurl changes the process wide
+     * SIGPIPE handler while it works and may time out DNS lookups with SIGALRM, neither of
+     * which is thread safe. */
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+    /* The progress callback lets a stop request from another thread end a transfer that is
+     * waiting on the relay, rather than only one that is uploading. */
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progressCallback);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+
+    /* Since the traffic will be encrypted, it is very useful to turn on debug
+     * information within libcurl to see what is happening during the
+     * transfer */
+    curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+
+    /* Add the recipients, usually these correspond to the To: and Cc:
+     * addressees in the header, but they could be any kind of recipient. */
+    std::vector<std::string_view> addresses;
+    addresses.reserve(params.recipients.size());
+    for (const auto &recipient : params.recipients) {
+      if (!recipient.empty()) {
+        addresses.push_back(recipient);
+      }
+    }
+
+    /* The message is uploaded once per batch of recipients. The handle is reused, so libcurl
+     * keeps the connection open and every batch after the first is just another transaction. */
+    const std::size_t batch_size =
+        params.max_recipients > 0 ? params.max_recipients : addresses.size();
+    std::size_t start = 0;
+    do {
+      struct curl_slist *recipients = nullptr;
+      const std::size_t end = std::min(addresses.size(), start + batch_size);
+      for (std::size_t i = start; i < end; i++) {
+        recipients = curl_slist_append(recipients, std::string(addresses[i]).c_str());
+      }
+      curl_easy_setopt(curl, CURLOPT_MAIL_RCPT, recipients);
+
+      UploadContext upload_ctx{MessageReader{message}, params.stop, deadline};
+      curl_easy_setopt(curl, CURLOPT_READDATA, &upload_ctx);
+      curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &upload_ctx);
+
+      /* The batch only gets whatever is left of the deadline, rounded up so that libcurl does
+       * not give up before the deadline has actually passed */
+      long timeout_ms = 0;
+      if (deadline) {
+        const auto &remaining =
+            std::chrono::ceil<std::chrono::milliseconds>(*deadline - Clock::now());
+        timeout_ms = std::max<long>(static_cast<long>(remaining.count()), 1);
+      }
+      curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+
+      /* Send the message, unless the send was stopped or ran out of time between batches */
+      const bool stopped_before = upload_ctx.stopped() || upload_ctx.expired(Clock::now());
+      const CURLcode res = stopped_before ? CURLE_ABORTED_BY_CALLBACK : curl_easy_perform(curl);
+      long response_code = 0;
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+
+      /* Free the list of recipients */
+      curl_slist_free_all(recipients);
+
+      /* Check for errors. A timeout before the relay said anything was spent connecting, any
+       * other one either used up the deadline or was the relay stalling. */
+      TransportStatus status = classify(res, response_code);
+      if (res == CURLE_ABORTED_BY_CALLBACK && upload_ctx.stopped()) {
+        status = TransportStatus::kCancelled;
+      } else if (res == CURLE_OPERATION_TIMEDOUT || res == CURLE_ABORTED_BY_CALLBACK) {
+        status = TransportStatus::kTimedOut;
+        result.timeout = upload_ctx.expired(Clock::now()) ? TimeoutReason::kDeadline
+                         : response_code == 0             ? TimeoutReason::kConnect
+                                                          : TimeoutReason::kStalled;
+      }
+
+      /* A batch that can be retried ends the send, so that the caller can carry on from it
+       * later or through another relay. */
+      result.response_code = response_code;
+      if (status != TransportStatus::kSent) {
+        fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+        result.status = status;
+        result.error = curl_easy_strerror(res);
+        if (status != TransportStatus::kPermanentFailure) {
+          break;
+        }
+      }
+
+      result.recipients_done = end;
+      start = end;
+    } while (start < addresses.size());
+
+    /* Keep the connection for the next send, unless the relay may have left it in an unknown
+     * state part way through a transaction */
+    releaseHandle(params.hostname, params.user, curl,
+                  result.status == TransportStatus::kSent ||
+                      result.status == TransportStatus::kPermanentFailure);
+  }
+
+  if (!curl) {
+    result.status = TransportStatus::kPermanentFailure;
+    result.error = "curl_easy_init() failed";
+  }
+  return result;
+}
+
+static size_t payloadCallback(void *ptr, size_t size, size_t nmemb, void *userp) {
+  auto *upload_ctx = static_cast<UploadContext *>(userp);
+
+  // No more data to send
+  if ((size == 0) || (nmemb == 0) || ((size * nmemb) < 1)) {
+    return 0;
+  }
+
+  if (upload_ctx->stopped()) {
+    return CURL_READFUNC_ABORT;
+  }
+
+  return upload_ctx->reader.read(static_cast<char *>(ptr), size * nmemb);
+}
+
+static int progressCallback(void *clientp, curl_off_t /*dltotal*/, curl_off_t /*dlnow*/,
+                            curl_off_t /*ultotal*/, curl_off_t /*ulnow*/) {
+  const auto *upload_ctx = static_cast<const UploadContext *>(clientp);
+
+  // Returning non zero aborts the transfer
+  return upload_ctx->stopped() || upload_ctx->expired(Clock::now()) ? 1 : 0;
+}
+
+} // namespace smtp
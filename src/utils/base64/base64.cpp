@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <array>
 #include <cstdint>
 #include <iostream>
 #include <string>
@@ -13,23 +14,43 @@ static const std::string b64Table =
 static const std::string b64UrlTable =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
 
-static std::string base64Encode(const std::string &table, const std::vector<smtp::byte> &data);
-static std::string base64EncodeBlock(const std::string &table,
-                                     const std::vector<smtp::byte> &data_block, int padding = 0);
+static void base64Encode(const std::string &table, const smtp::byte *data, std::size_t size,
+                         char *out);
+static void base64EncodeBlock(const std::string &table, const smtp::byte *data_block,
+                              std::size_t block_size, char *out);
 
 static std::vector<smtp::byte> base64Decode(const std::string &table, const std::string &data);
-static std::vector<smtp::byte> base64DecodeBlock(const std::string &table,
-                                                 const std::string &data_block, int padding = 0);
+static void base64DecodeBlock(const std::string &table, const std::string &data_block,
+                              int padding, std::vector<smtp::byte> &out);
 
 static smtp::byte getByteValue(const std::string &table, char value);
 
 std::string smtp::Base64::Base64Encode(const std::string &data) {
-  const std::vector<smtp::byte> data_bytes(data.begin(), data.end());
-  return Base64Encode(data_bytes);
+  std::string result(EncodedSize(data.size()), '\0');
+  base64Encode(b64Table, reinterpret_cast<const smtp::byte *>(data.data()), data.size(),
+               result.data());
+  return result;
 }
 
 std::string smtp::Base64::Base64Encode(const std::vector<smtp::byte> &data) {
-  return base64Encode(b64Table, data);
+  std::string result(EncodedSize(data.size()), '\0');
+  base64Encode(b64Table, data.data(), data.size(), result.data());
+  return result;
+}
+
+std::pmr::string smtp::Base64::Base64Encode(const std::vector<smtp::byte> &data,
+                                            std::pmr::memory_resource *resource) {
+  std::pmr::string result(EncodedSize(data.size()), '\0', resource);
+  base64Encode(b64Table, data.data(), data.size(), result.data());
+  return result;
+}
+
+std::pmr::string smtp::Base64::Base64Encode(std::string_view data,
+                                            std::pmr::memory_resource *resource) {
+  std::pmr::string result(EncodedSize(data.size()), '\0', resource);
+  base64Encode(b64Table, reinterpret_cast<const smtp::byte *>(data.data()), data.size(),
+               result.data());
+  return result;
 }
 
 std::vector<smtp::byte> Base64::Base64Decode(const std::string &data) {
@@ -37,7 +58,8 @@ std::vector<smtp::byte> Base64::Base64Decode(const std::string &data) {
 }
 
 std::string Base64::Base64UrlEncode(const std::vector<smtp::byte> &data, bool keep_padding) {
-  std::string result = base64Encode(b64UrlTable, data);
+  std::string result(EncodedSize(data.size()), '\0');
+  base64Encode(b64UrlTable, data.data(), data.size(), result.data());
   if (!keep_padding) {
     result.erase(std::remove(result.begin(), result.end(), '='), result.end());
   }
@@ -48,45 +70,44 @@ std::vector<smtp::byte> Base64::Base64UrlDecode(const std::string &data) {
   return base64Decode(b64UrlTable, data);
 }
 
-static std::string base64Encode(const std::string &table, const std::vector<smtp::byte> &data) {
-  std::string result;
+std::size_t Base64::EncodedSize(std::size_t size) { return ((size + 2) / 3) * 4; }
 
-  int i = 0;
-  int n = static_cast<int>(data.size());
-
-  std::vector<smtp::byte> arr(3, 0x0);
-
-  for (smtp::byte b : data) {
-    arr[i++ % 3] = b;
-
-    if (i % 3 == 0 || i == n) {
-      result += base64EncodeBlock(table, arr, i % 3);
-      std::fill(arr.begin(), arr.end(), 0x0);
-    }
+// Encodes size bytes of data into out, which must have room for EncodedSize(size) characters.
+// The output is written in place so no temporary blocks are allocated.
+static void base64Encode(const std::string &table, const smtp::byte *data, std::size_t size,
+                         char *out) {
+  std::size_t i = 0;
+  for (; i + 3 <= size; i += 3, out += 4) {
+    base64EncodeBlock(table, data + i, 3, out);
   }
 
-  return result;
+  if (i < size) {
+    base64EncodeBlock(table, data + i, size - i, out);
+  }
 }
 
 // Base64 encodes a block of plaintext.
 // It is assumed that data_block contains a maximum of 3 smtp::bytes in size.
-static std::string base64EncodeBlock(const std::string &table,
-                                     const std::vector<smtp::byte> &data_block, int padding) {
-  int i1 = (data_block[0] & 0xfc) >> 2;
-  int i2 = ((data_block[0] & 0x3) << 4) | ((data_block[1] & 0xf0) >> 4);
-  int i3 = ((data_block[1] & 0xf) << 2) | ((data_block[2] & 0xc0) >> 6);
-  int i4 = (data_block[2] & 0x3f);
-
-  std::string s(4, 0x00);
-  s[0] = table[i1];
-  s[1] = table[i2];
-  s[2] = (padding == 1) ? '=' : table[i3];
-  s[3] = (padding >= 1) ? '=' : table[i4];
-  return s;
+static void base64EncodeBlock(const std::string &table, const smtp::byte *data_block,
+                              std::size_t block_size, char *out) {
+  const smtp::byte b0 = data_block[0];
+  const smtp::byte b1 = block_size > 1 ? data_block[1] : 0x0;
+  const smtp::byte b2 = block_size > 2 ? data_block[2] : 0x0;
+
+  int i1 = (b0 & 0xfc) >> 2;
+  int i2 = ((b0 & 0x3) << 4) | ((b1 & 0xf0) >> 4);
+  int i3 = ((b1 & 0xf) << 2) | ((b2 & 0xc0) >> 6);
+  int i4 = (b2 & 0x3f);
+
+  out[0] = table[i1];
+  out[1] = table[i2];
+  out[2] = (block_size == 1) ? '=' : table[i3];
+  out[3] = (block_size <= 2) ? '=' : table[i4];
 }
 
 static std::vector<smtp::byte> base64Decode(const std::string &table, const std::string &data) {
   std::vector<smtp::byte> result;
+  result.reserve(data.size() / 4 * 3 + 3);
 
   int i = 0;
   int n = static_cast<int>(data.length());
@@ -96,8 +117,7 @@ static std::vector<smtp::byte> base64Decode(const std::string &table, const std:
     arr[i++ % 4] = b;
 
     if (i % 4 == 0 || i == n) {
-      const std::vector<smtp::byte> decoded = base64DecodeBlock(table, arr, i % 4);
-      result.insert(result.end(), decoded.begin(), decoded.end());
+      base64DecodeBlock(table, arr, i % 4, result);
     }
   }
 
@@ -108,11 +128,12 @@ static smtp::byte getByteValue(const std::string &table, char value) {
   return value != '=' ? table.find(value) : 0;
 }
 
-// This function base64 decodes a block of 4 base64 encoded characters.
+// This function base64 decodes a block of 4 base64 encoded characters and appends the bytes to
+// out, so decoding does not allocate once for every block.
 // It is assumed that data_block is 4 smtp::bytes in size.
-static std::vector<smtp::byte> base64DecodeBlock(const std::string &table,
-                                                 const std::string &data_block, int padding) {
-  std::vector<smtp::byte> result(3);
+static void base64DecodeBlock(const std::string &table, const std::string &data_block,
+                              int padding, std::vector<smtp::byte> &out) {
+  std::array<smtp::byte, 3> result;
 
   smtp::byte i1 = getByteValue(table, data_block[0]);
   smtp::byte i2 = getByteValue(table, data_block[1]);
@@ -127,12 +148,13 @@ static std::vector<smtp::byte> base64DecodeBlock(const std::string &table,
   int n_chars = (padding_pos == std::string::npos) ? padding : static_cast<int>(padding_pos);
 
   // Padding will either be 2 or 3, since it is not possible to have 1 smtp::byte
+  std::size_t size = result.size();
   if (n_chars > 0) {
     int num_remove = 4 - n_chars;
-    result.resize(3 - num_remove);
+    size = static_cast<std::size_t>(std::max(3 - num_remove, 0));
   }
 
-  return result;
+  out.insert(out.end(), result.begin(), result.begin() + size);
 }
 
 } // namespace smtp
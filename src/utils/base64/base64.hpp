@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace smtp {
@@ -12,10 +15,18 @@ class Base64 {
 public:
   static std::string Base64Encode(const std::string &data);
   static std::string Base64Encode(const std::vector<uint8_t> &data);
+  // Same as above but the result is allocated from resource e.g an arena for a single message
+  static std::pmr::string Base64Encode(const std::vector<uint8_t> &data,
+                                       std::pmr::memory_resource *resource);
+  static std::pmr::string Base64Encode(std::string_view data,
+                                       std::pmr::memory_resource *resource);
   static std::vector<uint8_t> Base64Decode(const std::string &data);
 
   static std::string Base64UrlEncode(const std::vector<uint8_t> &data, bool keep_padding = false);
   static std::vector<uint8_t> Base64UrlDecode(const std::string &data);
+
+  // Number of characters needed to encode size bytes, including padding
+  static std::size_t EncodedSize(std::size_t size);
 };
 
 } // namespace smtp
@@ -0,0 +1,45 @@
+#include "utils/memory/counting_resource.hpp"
+
+namespace smtp {
+
+CountingResource::CountingResource(std::pmr::memory_resource *upstream)
+    : m_upstream{upstream} {}
+
+AllocationStats CountingResource::stats() const {
+  return {m_allocations.load(std::memory_order_relaxed), m_bytes.load(std::memory_order_relaxed),
+          m_peak.load(std::memory_order_relaxed)};
+}
+
+AllocationStats CountingResource::startWindow() {
+  m_peak.store(m_in_use.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  return stats();
+}
+
+AllocationStats CountingResource::windowStats(const AllocationStats &start) const {
+  const AllocationStats &end = stats();
+  return {end.allocations - start.allocations, end.bytes - start.bytes, end.peak_bytes};
+}
+
+void *CountingResource::do_allocate(std::size_t bytes, std::size_t alignment) {
+  void *ptr = m_upstream->allocate(bytes, alignment);
+  m_allocations.fetch_add(1, std::memory_order_relaxed);
+  m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+  const std::size_t in_use = m_in_use.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  std::size_t peak = m_peak.load(std::memory_order_relaxed);
+  while (in_use > peak &&
+         !m_peak.compare_exchange_weak(peak, in_use, std::memory_order_relaxed)) {
+  }
+  return ptr;
+}
+
+void CountingResource::do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) {
+  m_in_use.fetch_sub(bytes, std::memory_order_relaxed);
+  m_upstream->deallocate(ptr, bytes, alignment);
+}
+
+bool CountingResource::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+  return this == &other;
+}
+
+} // namespace smtp
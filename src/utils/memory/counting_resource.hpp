@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+
+namespace smtp {
+
+struct AllocationStats {
+  std::size_t allocations = 0;
+  // Total of every allocation, memory that was freed and allocated again counts twice
+  std::size_t bytes = 0;
+  // Most memory that was allocated and not yet freed at any one time
+  std::size_t peak_bytes = 0;
+};
+
+// Passes allocations through to another resource, counting them and keeping track of the most
+// memory that was in use at once. The counts are atomic, so one resource can be shared by
+// several threads, but the peak of a window is then shared by all of them.
+class CountingResource : public std::pmr::memory_resource {
+public:
+  explicit CountingResource(
+      std::pmr::memory_resource *upstream = std::pmr::get_default_resource());
+
+  std::pmr::memory_resource *upstream() const { return m_upstream; }
+
+  // Totals since the resource was created, the peak is since the last call to startWindow()
+  AllocationStats stats() const;
+  // Bytes that are allocated and not yet freed
+  std::size_t inUse() const { return m_in_use.load(std::memory_order_relaxed); }
+
+  // Starts measuring the peak again from the memory that is in use now. Returns the totals at
+  // this point, which windowStats() takes away from the totals at its end.
+  AllocationStats startWindow();
+  AllocationStats windowStats(const AllocationStats &start) const;
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+  void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override;
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+  std::pmr::memory_resource *m_upstream;
+  std::atomic<std::size_t> m_allocations{0};
+  std::atomic<std::size_t> m_bytes{0};
+  std::atomic<std::size_t> m_in_use{0};
+  std::atomic<std::size_t> m_peak{0};
+};
+
+} // namespace smtp
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <string>
+
+#include "utils/memory/memory_budget.hpp"
+
+namespace smtp {
+
+// How often a waiting caller checks whether it has been asked to stop
+static constexpr std::chrono::milliseconds kStopCheckInterval{100};
+
+MemoryReservation::MemoryReservation(MemoryReservation &&other) noexcept
+    : m_budget{other.m_budget}, m_bytes{other.m_bytes} {
+  other.m_budget = nullptr;
+  other.m_bytes = 0;
+}
+
+MemoryReservation &MemoryReservation::operator=(MemoryReservation &&other) noexcept {
+  if (this != &other) {
+    release();
+    m_budget = other.m_budget;
+    m_bytes = other.m_bytes;
+    other.m_budget = nullptr;
+    other.m_bytes = 0;
+  }
+  return *this;
+}
+
+void MemoryReservation::release() {
+  if (m_budget) {
+    m_budget->release(m_bytes);
+    m_budget = nullptr;
+    m_bytes = 0;
+  }
+}
+
+MemoryBudget::MemoryBudget(std::size_t capacity) : m_capacity{capacity} {
+  if (capacity == 0) {
+    throw MemoryBudgetException("[!] A memory budget needs a capacity of at least 1 byte");
+  }
+}
+
+MemoryReservation MemoryBudget::reserve(std::size_t bytes) {
+  m_in_use += bytes;
+  m_peak = std::max(m_peak, m_in_use);
+  m_admitted++;
+
+  MemoryReservation reservation;
+  reservation.m_budget = this;
+  reservation.m_bytes = bytes;
+  return reservation;
+}
+
+std::optional<MemoryReservation> MemoryBudget::acquire(std::size_t bytes,
+                                                       std::chrono::milliseconds max_wait,
+                                                       const std::function<bool()> &stop) {
+  std::unique_lock<std::mutex> lock{m_mutex};
+  if (bytes > m_capacity) {
+    m_rejected++;
+    throw MemoryBudgetException("[!] " + std::to_string(bytes) +
+                                " bytes is more than the whole memory budget of " +
+                                std::to_string(m_capacity) + " bytes");
+  }
+  if (m_waiting.empty() && m_in_use + bytes <= m_capacity) {
+    return reserve(bytes);
+  }
+
+  using Clock = std::chrono::steady_clock;
+  const Clock::time_point deadline = Clock::now() + max_wait;
+  const auto &self = m_waiting.insert(m_waiting.end(), bytes);
+  for (;;) {
+    if (self == m_waiting.begin() && m_in_use + bytes <= m_capacity) {
+      m_waiting.erase(self);
+      // Whoever is next may fit in what is left
+      m_released.notify_all();
+      return reserve(bytes);
+    }
+
+    const bool timed_out = max_wait.count() > 0 && Clock::now() >= deadline;
+    if (timed_out || (stop && stop())) {
+      const bool first = self == m_waiting.begin();
+      m_waiting.erase(self);
+      m_rejected++;
+      if (first) {
+        m_released.notify_all();
+      }
+      return std::nullopt;
+    }
+
+    Clock::time_point wake = Clock::now() + kStopCheckInterval;
+    if (max_wait.count() > 0) {
+      wake = std::min(wake, deadline);
+    }
+    if (stop) {
+      m_released.wait_until(lock, wake);
+    } else if (max_wait.count() > 0) {
+      m_released.wait_until(lock, deadline);
+    } else {
+      m_released.wait(lock);
+    }
+  }
+}
+
+std::optional<MemoryReservation> MemoryBudget::tryAcquire(std::size_t bytes) {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  if (!m_waiting.empty() || m_in_use + bytes > m_capacity) {
+    m_rejected++;
+    return std::nullopt;
+  }
+  return reserve(bytes);
+}
+
+void MemoryBudget::release(std::size_t bytes) noexcept {
+  {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_in_use -= bytes;
+  }
+  m_released.notify_all();
+}
+
+MemoryBudgetStats MemoryBudget::stats() const {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  return {m_capacity, m_in_use, m_peak, m_waiting.size(), m_admitted, m_rejected};
+}
+
+} // namespace smtp
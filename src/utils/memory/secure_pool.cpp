@@ -0,0 +1,128 @@
+#if defined(__APPLE__)
+#define __STDC_WANT_LIB_EXT1__ 1
+#endif
+
+#include <cstring>
+#include <functional>
+#include <new>
+
+#include <sys/mman.h>
+
+#include "utils/memory/secure_pool.hpp"
+
+namespace smtp {
+
+void secureWipe(void *ptr, std::size_t bytes) noexcept {
+  if (!ptr || bytes == 0) {
+    return;
+  }
+#if defined(__APPLE__)
+  memset_s(ptr, bytes, 0, bytes);
+#else
+  explicit_bzero(ptr, bytes);
+#endif
+}
+
+// Index of the smallest size class that holds bytes, the classes are powers of two
+static std::size_t sizeClass(std::size_t bytes) {
+  std::size_t index = 0;
+  for (std::size_t size = SecurePool::kMinBlockSize; size < bytes; size *= 2) {
+    index++;
+  }
+  return index;
+}
+
+static std::size_t classSize(std::size_t index) { return SecurePool::kMinBlockSize << index; }
+
+SecurePool::SecurePool(std::size_t capacity) {
+  static_assert(kMinBlockSize << (kSizeClasses - 1) == kMaxBlockSize);
+  if (capacity == 0) {
+    return;
+  }
+
+  void *region =
+      mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED) {
+    // Every allocation falls back to the heap, it is still wiped when it is freed
+    return;
+  }
+  m_region = static_cast<std::byte *>(region);
+  m_capacity = capacity;
+  m_locked = mlock(region, capacity) == 0;
+#if defined(MADV_DONTDUMP)
+  madvise(region, capacity, MADV_DONTDUMP);
+#endif
+}
+
+SecurePool::~SecurePool() {
+  if (!m_region) {
+    return;
+  }
+  secureWipe(m_region, m_carved);
+  if (m_locked) {
+    munlock(m_region, m_capacity);
+  }
+  munmap(m_region, m_capacity);
+}
+
+SecurePool &SecurePool::instance() {
+  static SecurePool *pool = new SecurePool();
+  return *pool;
+}
+
+void *SecurePool::allocate(std::size_t bytes) {
+  if (bytes <= kMaxBlockSize) {
+    const std::size_t index = sizeClass(bytes);
+    const std::size_t size = classSize(index);
+
+    std::lock_guard<std::mutex> lock{m_mutex};
+    if (FreeBlock *block = m_free[index]) {
+      m_free[index] = block->next;
+      block->next = nullptr;
+      m_in_use += size;
+      return block;
+    }
+    if (m_capacity - m_carved >= size) {
+      void *block = m_region + m_carved;
+      m_carved += size;
+      m_in_use += size;
+      return block;
+    }
+  }
+  return ::operator new(bytes);
+}
+
+void SecurePool::deallocate(void *ptr, std::size_t bytes) noexcept {
+  if (!ptr) {
+    return;
+  }
+  if (!owns(ptr)) {
+    secureWipe(ptr, bytes);
+    ::operator delete(ptr);
+    return;
+  }
+
+  const std::size_t index = sizeClass(bytes);
+  const std::size_t size = classSize(index);
+  // The whole block is wiped, not only the bytes that were asked for
+  secureWipe(ptr, size);
+
+  FreeBlock *block = static_cast<FreeBlock *>(ptr);
+  std::lock_guard<std::mutex> lock{m_mutex};
+  block->next = m_free[index];
+  m_free[index] = block;
+  m_in_use -= size;
+}
+
+std::size_t SecurePool::inUse() const {
+  std::lock_guard<std::mutex> lock{m_mutex};
+  return m_in_use;
+}
+
+bool SecurePool::owns(const void *ptr) const {
+  const std::less_equal<const void *> less_equal;
+  const std::less<const void *> less;
+  return m_region && less_equal(m_region, ptr) && less(ptr, m_region + m_capacity);
+}
+
+} // namespace smtp
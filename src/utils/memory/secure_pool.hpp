@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <mutex>
+
+namespace smtp {
+
+// Zeroes memory in a way the compiler cannot optimise out, even when the memory is about to be
+// freed
+void secureWipe(void *ptr, std::size_t bytes) noexcept;
+
+// A small region of memory for passwords and other secrets. The region is locked into RAM so it
+// is never written to swap, and left out of core dumps. Blocks are handed out from a free list for
+// each size class, and every block is wiped as it is freed. Requests that are too large for the
+// largest class, or that do not fit once the region is used up, fall back to the heap and are
+// still wiped before they are freed.
+class SecurePool {
+public:
+  static constexpr std::size_t kDefaultCapacity = 64 * 1024;
+  static constexpr std::size_t kMinBlockSize = 16;
+  static constexpr std::size_t kMaxBlockSize = 2048;
+
+  explicit SecurePool(std::size_t capacity = kDefaultCapacity);
+  ~SecurePool();
+
+  SecurePool(const SecurePool &) = delete;
+  SecurePool &operator=(const SecurePool &) = delete;
+
+  // The pool used by SecureAllocator. It is never destroyed, so secrets held by static objects
+  // can still be freed into it while the program exits.
+  static SecurePool &instance();
+
+  void *allocate(std::size_t bytes);
+  // bytes must be the size that was passed to allocate()
+  void deallocate(void *ptr, std::size_t bytes) noexcept;
+
+  // Whether the region could be locked into RAM, locking fails when it would go over
+  // RLIMIT_MEMLOCK. The pool still works when it is not locked.
+  bool locked() const { return m_locked; }
+  std::size_t capacity() const { return m_capacity; }
+  // Bytes of the region taken by blocks that have not been freed, rounded up to their size class
+  std::size_t inUse() const;
+  // Whether ptr was allocated from the region rather than the heap
+  bool owns(const void *ptr) const;
+
+private:
+  static constexpr std::size_t kSizeClasses = 8;
+
+  // Freed blocks are linked through their own, already wiped, memory
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  std::byte *m_region = nullptr;
+  std::size_t m_capacity = 0;
+  bool m_locked = false;
+
+  mutable std::mutex m_mutex;
+  // Start of the part of the region that has never been handed out
+  std::size_t m_carved = 0;
+  std::size_t m_in_use = 0;
+  std::array<FreeBlock *, kSizeClasses> m_free{};
+};
+
+} // namespace smtp
@@ -0,0 +1,202 @@
+#include <algorithm>
+
+#include "quoted_printable.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace smtp {
+
+static constexpr std::string_view kHexDigits = "0123456789ABCDEF";
+static constexpr std::string_view kSoftBreak = "=\r\n";
+static constexpr std::string_view kHardBreak = "\r\n";
+
+// Characters on a line before the '=' of a soft line break
+static constexpr std::size_t kMaxContent = QuotedPrintable::kMaxLineLength - 1;
+
+// The encoder is written once against a writer so that computing the size of the output shares
+// all of its logic with producing it.
+struct SizeWriter {
+  std::size_t size = 0;
+  void append(std::string_view text) { size += text.size(); }
+};
+
+struct StringWriter {
+  std::pmr::string &out;
+  void append(std::string_view text) { out.append(text); }
+};
+
+// Printable ASCII other than '=' can be written as is. Spaces can too unless they end a line.
+static bool isPlain(unsigned char c) { return c >= ' ' && c <= '~' && c != '='; }
+
+static bool isLineEnd(std::string_view data, std::size_t pos, QuotedPrintable::Mode mode) {
+  if (pos == data.size()) {
+    return true;
+  }
+  if (mode == QuotedPrintable::Mode::kText) {
+    return data[pos] == '\r' || data[pos] == '\n';
+  }
+  return data[pos] == '\r' && pos + 1 < data.size() && data[pos + 1] == '\n';
+}
+
+// Returns the number of plain characters starting at pos, 16 are checked at a time on x86
+static std::size_t plainRun(std::string_view data, std::size_t pos) {
+  const std::size_t start = pos;
+
+#if defined(__SSE2__)
+  const char *bytes = data.data();
+  // Compared as signed bytes so anything >= 0x80 is negative and also below a space
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i del = _mm_set1_epi8(0x7f);
+  const __m128i equals = _mm_set1_epi8('=');
+
+  for (; pos + 16 <= data.size(); pos += 16) {
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + pos));
+    const __m128i special =
+        _mm_or_si128(_mm_cmplt_epi8(block, space),
+                     _mm_or_si128(_mm_cmpeq_epi8(block, del), _mm_cmpeq_epi8(block, equals)));
+    const int mask = _mm_movemask_epi8(special);
+    if (mask != 0) {
+      return pos + static_cast<std::size_t>(__builtin_ctz(static_cast<unsigned>(mask))) - start;
+    }
+  }
+#endif
+
+  while (pos < data.size() && isPlain(static_cast<unsigned char>(data[pos]))) {
+    pos++;
+  }
+  return pos - start;
+}
+
+template <typename Writer>
+static void encode(std::string_view data, QuotedPrintable::Mode mode, Writer &out) {
+  std::size_t column = 0;
+  std::size_t pos = 0;
+
+  while (pos < data.size()) {
+    // Copy as much plain text as possible, breaking it up into lines as it goes
+    std::size_t end = pos + plainRun(data, pos);
+    if (end > pos && data[end - 1] == ' ' && isLineEnd(data, end, mode)) {
+      end--;
+    }
+    while (pos < end) {
+      if (column == kMaxContent) {
+        out.append(kSoftBreak);
+        column = 0;
+      }
+      const std::size_t length = std::min(end - pos, kMaxContent - column);
+      out.append(data.substr(pos, length));
+      column += length;
+      pos += length;
+    }
+
+    if (pos == data.size()) {
+      break;
+    }
+
+    const auto c = static_cast<unsigned char>(data[pos]);
+    if (isLineEnd(data, pos, mode)) {
+      out.append(kHardBreak);
+      column = 0;
+      pos += (c == '\r' && pos + 1 < data.size() && data[pos + 1] == '\n') ? 2 : 1;
+      continue;
+    }
+
+    // Whitespace is only encoded at the end of a line, where it would otherwise be stripped
+    const bool literal = (c == ' ' || c == '\t') && !isLineEnd(data, pos + 1, mode);
+    const std::size_t length = literal ? 1 : 3;
+    if (column + length > kMaxContent) {
+      out.append(kSoftBreak);
+      column = 0;
+    }
+
+    if (literal) {
+      out.append(data.substr(pos, 1));
+    } else {
+      const char encoded[] = {'=', kHexDigits[c >> 4], kHexDigits[c & 0x0f]};
+      out.append({encoded, sizeof(encoded)});
+    }
+    column += length;
+    pos++;
+  }
+}
+
+std::pmr::string QuotedPrintable::Encode(std::string_view data, Mode mode,
+                                         std::pmr::memory_resource *resource) {
+  std::pmr::string result{resource};
+  result.reserve(EncodedSize(data, mode));
+  EncodeTo(data, mode, result);
+  return result;
+}
+
+void QuotedPrintable::EncodeTo(std::string_view data, Mode mode, std::pmr::string &out) {
+  StringWriter writer{out};
+  encode(data, mode, writer);
+}
+
+std::size_t QuotedPrintable::EncodedSize(std::string_view data, Mode mode) {
+  SizeWriter writer;
+  encode(data, mode, writer);
+  return writer.size;
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+void QuotedPrintable::DecodeTo(std::string_view data, std::string &out) {
+  std::size_t pos = 0;
+  while (pos < data.size()) {
+    const std::size_t line_break = data.find('\n', pos);
+    const bool has_break = line_break != std::string_view::npos;
+    std::string_view line = data.substr(pos, has_break ? line_break - pos : std::string_view::npos);
+    pos = has_break ? line_break + 1 : data.size();
+
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t')) {
+      line.remove_suffix(1);
+    }
+    const bool soft_break = !line.empty() && line.back() == '=';
+    if (soft_break) {
+      line.remove_suffix(1);
+    }
+
+    std::size_t start = 0;
+    for (std::size_t equals = line.find('='); equals != std::string_view::npos;
+         equals = line.find('=', start)) {
+      out.append(line.substr(start, equals - start));
+      const int high = equals + 2 < line.size() ? hexValue(line[equals + 1]) : -1;
+      const int low = high >= 0 ? hexValue(line[equals + 2]) : -1;
+      if (low >= 0) {
+        out.push_back(static_cast<char>((high << 4) | low));
+        start = equals + 3;
+      } else {
+        out.push_back('=');
+        start = equals + 1;
+      }
+    }
+    out.append(line.substr(start));
+
+    if (has_break && !soft_break) {
+      out.append(kHardBreak);
+    }
+  }
+}
+
+std::string QuotedPrintable::Decode(std::string_view data) {
+  std::string result;
+  result.reserve(data.size());
+  DecodeTo(data, result);
+  return result;
+}
+
+} // namespace smtp
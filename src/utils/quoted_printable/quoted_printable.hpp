@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+namespace smtp {
+
+// Quoted-printable encoding (RFC 2045 section 6.7) with lines of at most 76 characters
+class QuotedPrintable {
+public:
+  enum class Mode {
+    // Any CR, LF or CRLF is a line break and is written as a CRLF hard line break
+    kText,
+    // Only CRLF is written as a hard line break, a bare CR or LF is encoded so the data decodes
+    // to exactly the same bytes
+    kBinary,
+  };
+
+  static std::pmr::string
+  Encode(std::string_view data, Mode mode,
+         std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+  // Same as above but appends the encoded data to out
+  static void EncodeTo(std::string_view data, Mode mode, std::pmr::string &out);
+
+  // Number of characters Encode() produces for data, this does not allocate
+  static std::size_t EncodedSize(std::string_view data, Mode mode);
+
+  // Decodes data and appends the result to out. Hard line breaks are written as CRLF, soft line
+  // breaks and whitespace at the end of a line are removed. Malformed escapes are kept as they
+  // are rather than rejected, as RFC 2045 recommends. A '=' at the very end of data is a soft
+  // line break, so data can be decoded a line at a time.
+  static void DecodeTo(std::string_view data, std::string &out);
+  static std::string Decode(std::string_view data);
+
+  // Lines are at most this long including the '=' of a soft line break
+  static constexpr std::size_t kMaxLineLength = 76;
+};
+
+} // namespace smtp
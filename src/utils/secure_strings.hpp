@@ -1,16 +1,18 @@
 #pragma once
 
-#include <cstring>
-#include <iostream>
 #include <limits>
 #include <memory>
 #include <new>
+#include <string>
+
+#include "utils/memory/secure_pool.hpp"
 
 namespace smtp {
 
 // This allocator zeroes out the memory for the object that is allocated once
 // the object goes out of scope. This allocator is used to construct objects
-// such as vectors or strings that may contain passwords.
+// such as vectors or strings that may contain passwords. The memory comes from
+// SecurePool, so it is kept out of swap and core dumps.
 template <class T> class SecureAllocator {
 public:
   using value_type = T;
@@ -31,19 +33,19 @@ public:
   template <class U> explicit SecureAllocator(const SecureAllocator<U> &) {}
 
   pointer allocate(size_type num_objects) {
-    if (num_objects > (max_size() / sizeof(T)))
+    if (num_objects > max_size())
       throw std::bad_alloc();
-    return static_cast<pointer>(new value_type[num_objects]);
+    return static_cast<pointer>(SecurePool::instance().allocate(num_objects * sizeof(T)));
   }
 
   pointer allocate(size_type num_objects, const_void_pointer) { return allocate(num_objects); }
 
-  void deallocate(pointer p, size_type num_objects) {
-    std::memset(p, 0x0, num_objects);
-    delete[] p;
+  // The pool wipes the memory before it is reused
+  void deallocate(pointer p, size_type num_objects) noexcept {
+    SecurePool::instance().deallocate(p, num_objects * sizeof(T));
   }
 
-  size_type max_size() const { return std::numeric_limits<size_type>::max(); }
+  size_type max_size() const { return std::numeric_limits<size_type>::max() / sizeof(T); }
 };
 
 template <typename T, typename U>
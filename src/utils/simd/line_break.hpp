@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+namespace smtp {
+
+// Returns the index of the first '\r' or '\n' in text at or after pos, or std::string_view::npos
+// if there are none. On x86 16 characters are checked at a time.
+std::size_t findLineBreak(std::string_view text, std::size_t pos = 0);
+
+} // namespace smtp
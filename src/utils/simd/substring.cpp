@@ -0,0 +1,52 @@
+#include <cstring>
+
+#include "utils/simd/substring.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace smtp {
+
+bool containsSubstring(std::string_view haystack, std::string_view needle) {
+  if (needle.empty()) {
+    return true;
+  }
+
+  if (needle.size() > haystack.size()) {
+    return false;
+  }
+
+  std::size_t pos = 0;
+
+#if defined(__SSE2__)
+  const char *data = haystack.data();
+  const std::size_t last_offset = needle.size() - 1;
+  // Number of positions in haystack that needle could start at
+  const std::size_t num_starts = haystack.size() - last_offset;
+
+  const __m128i first = _mm_set1_epi8(needle.front());
+  const __m128i last = _mm_set1_epi8(needle.back());
+
+  for (; pos + 16 <= num_starts; pos += 16) {
+    const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+    const __m128i block_last =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos + last_offset));
+
+    auto mask = static_cast<unsigned>(_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last))));
+
+    while (mask != 0) {
+      const int bit = __builtin_ctz(mask);
+      if (std::memcmp(data + pos + bit, needle.data(), needle.size()) == 0) {
+        return true;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  return haystack.substr(pos).find(needle) != std::string_view::npos;
+}
+
+} // namespace smtp
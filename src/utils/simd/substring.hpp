@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string_view>
+
+namespace smtp {
+
+// Returns true if needle occurs anywhere inside of haystack. On x86 this compares the first and
+// last characters of needle against 16 positions of haystack at a time and only does a full
+// comparison where both match, so scanning multi-megabyte bodies is cheap.
+bool containsSubstring(std::string_view haystack, std::string_view needle);
+
+} // namespace smtp
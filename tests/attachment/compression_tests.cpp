@@ -0,0 +1,184 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "doctest/doctest.h"
+
+#include "attachment/attachment.hpp"
+#include "email/email.hpp"
+
+#include "zlib.h"
+
+// Inflates data with zlib, window_bits selects gzip (31) or a raw deflate stream (-15)
+static std::vector<uint8_t> inflateAll(const uint8_t *data, std::size_t size, int window_bits) {
+  z_stream stream{};
+  REQUIRE(inflateInit2(&stream, window_bits) == Z_OK);
+
+  std::vector<uint8_t> result;
+  std::vector<uint8_t> chunk(16 * 1024);
+  stream.next_in = const_cast<Bytef *>(data);
+  stream.avail_in = static_cast<uInt>(size);
+
+  int status = Z_OK;
+  while (status != Z_STREAM_END) {
+    stream.next_out = chunk.data();
+    stream.avail_out = static_cast<uInt>(chunk.size());
+    status = inflate(&stream, Z_NO_FLUSH);
+    REQUIRE((status == Z_OK || status == Z_STREAM_END));
+    result.insert(result.end(), chunk.data(), chunk.data() + chunk.size() - stream.avail_out);
+  }
+
+  inflateEnd(&stream);
+  return result;
+}
+
+static uint32_t readLE(const std::vector<uint8_t> &data, std::size_t offset, std::size_t size) {
+  uint32_t value = 0;
+  for (std::size_t i = 0; i < size; i++) {
+    value |= static_cast<uint32_t>(data[offset + i]) << (8 * i);
+  }
+  return value;
+}
+
+static std::vector<uint8_t> makeCsv(std::size_t num_rows) {
+  std::string csv = "id,name,price,status\r\n";
+  for (std::size_t row = 0; row < num_rows; row++) {
+    csv += std::to_string(row) + ",widget " + std::to_string(row % 17) + ",3.50,in stock\r\n";
+  }
+  return {csv.begin(), csv.end()};
+}
+
+TEST_SUITE("Compression tests") {
+  TEST_CASE("Gzip round trip test") {
+    const std::vector<uint8_t> &csv = makeCsv(20000);
+
+    smtp::Attachment attachment;
+    attachment.setContents(csv);
+    attachment.setFilePath("/exports/report.csv");
+    REQUIRE(attachment.compress({smtp::CompressionFormat::kGzip}));
+
+    REQUIRE(attachment.getFilePath() == "/exports/report.csv.gz");
+    REQUIRE(attachment.getContentType() == "application/gzip");
+    REQUIRE(attachment.getContentsSize() * 5 < csv.size());
+
+    const std::vector<uint8_t> &contents = attachment.getContents();
+    REQUIRE(inflateAll(contents.data(), contents.size(), 31) == csv);
+
+    // The original name is kept in the gzip header
+    REQUIRE((contents[3] & 0x08) != 0);
+    REQUIRE(std::strcmp(reinterpret_cast<const char *>(&contents[10]), "report.csv") == 0);
+  }
+
+  TEST_CASE("Zip round trip test") {
+    const std::vector<uint8_t> &csv = makeCsv(20000);
+
+    smtp::Attachment attachment;
+    attachment.setContents(csv);
+    attachment.setFilePath("/exports/report.csv");
+    REQUIRE(attachment.compress({smtp::CompressionFormat::kZip, 9}));
+
+    REQUIRE(attachment.getFilePath() == "/exports/report.csv.zip");
+    REQUIRE(attachment.getContentType() == "application/zip");
+
+    const std::vector<uint8_t> &zip = attachment.getContents();
+    const std::string name = "report.csv";
+
+    // Local file header followed by the compressed entry
+    REQUIRE(readLE(zip, 0, 4) == 0x04034b50);
+    REQUIRE(readLE(zip, 8, 2) == 8);
+    const uint32_t crc = readLE(zip, 14, 4);
+    const uint32_t compressed_size = readLE(zip, 18, 4);
+    REQUIRE(readLE(zip, 22, 4) == csv.size());
+    REQUIRE(readLE(zip, 26, 2) == name.size());
+    REQUIRE(std::string(zip.begin() + 30, zip.begin() + 30 + name.size()) == name);
+
+    const std::size_t data_offset = 30 + name.size();
+    REQUIRE(inflateAll(zip.data() + data_offset, compressed_size, -15) == csv);
+    REQUIRE(crc == crc32(0, csv.data(), static_cast<uInt>(csv.size())));
+
+    // The end of central directory record points back at a central directory with one entry
+    const std::size_t end_offset = zip.size() - 22;
+    REQUIRE(readLE(zip, end_offset, 4) == 0x06054b50);
+    REQUIRE(readLE(zip, end_offset + 10, 2) == 1);
+    const uint32_t central_offset = readLE(zip, end_offset + 16, 4);
+    REQUIRE(central_offset == data_offset + compressed_size);
+    REQUIRE(readLE(zip, central_offset, 4) == 0x02014b50);
+    REQUIRE(readLE(zip, central_offset + 16, 4) == crc);
+  }
+
+  TEST_CASE("Thresholds are respected test") {
+    smtp::Attachment small;
+    small.setContents(makeCsv(10));
+    small.setFilePath("/path/small.csv");
+    REQUIRE_FALSE(small.compress({smtp::CompressionFormat::kGzip}));
+    REQUIRE(small.getFilePath() == "/path/small.csv");
+
+    smtp::CompressionOptions options{smtp::CompressionFormat::kGzip};
+    options.min_size = 0;
+    REQUIRE(small.compress(options));
+
+    // Random data does not compress so the original is kept
+    std::mt19937 generator{42};
+    std::vector<uint8_t> noise(100000);
+    for (auto &byte : noise) {
+      byte = static_cast<uint8_t>(generator());
+    }
+    smtp::Attachment random;
+    random.setContents(noise);
+    random.setFilePath("/path/noise.bin");
+    REQUIRE_FALSE(random.compress({smtp::CompressionFormat::kZip}));
+    REQUIRE(random.getContents() == noise);
+    REQUIRE(random.getContentType() == "application/octet-stream");
+  }
+
+  TEST_CASE("File is compressed as it is read test") {
+    const std::vector<uint8_t> &csv = makeCsv(50000);
+    char path[] = "/tmp/smtp_compression_XXXXXX";
+    const int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    REQUIRE(write(fd, csv.data(), csv.size()) == static_cast<ssize_t>(csv.size()));
+    close(fd);
+
+    const smtp::Attachment attachment{path, {smtp::CompressionFormat::kGzip, 1}};
+    std::remove(path);
+
+    REQUIRE(attachment.getFilePath() == std::string(path) + ".gz");
+    const std::vector<uint8_t> &contents = attachment.getContents();
+    REQUIRE(inflateAll(contents.data(), contents.size(), 31) == csv);
+  }
+
+  TEST_CASE("Compressed attachment in an email test") {
+    smtp::EmailParams params{
+        "user",              // smtp username
+        "password",          // smtp password
+        "hostname",          // smtp server
+        "bigboss@gmail.com", // to
+        "tully@gmail.com",   // from
+        "",                  // cc
+        "Report",            // subject
+        "Attached.",         // body
+    };
+    smtp::Email email(params);
+
+    smtp::Attachment attachment;
+    attachment.setContents(makeCsv(20000));
+    attachment.setFilePath("/exports/report.csv");
+    attachment.compress({smtp::CompressionFormat::kGzip});
+    email.addAttachment(attachment);
+
+    std::stringstream ss;
+    ss << email;
+    const std::string &actual = ss.str();
+    REQUIRE(actual.find("Content-Type: application/gzip\r\n"
+                        "Content-Transfer-Encoding: base64\r\n"
+                        "Content-Disposition: attachment;\r\n"
+                        " filename=report.csv.gz\r\n") != std::string::npos);
+    REQUIRE(email.serializedSize() == actual.size());
+  }
+}
@@ -0,0 +1,102 @@
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "doctest/doctest.h"
+
+#include "email/address.hpp"
+
+static std::string normalized(std::string_view entry, smtp::AddressError expected_error) {
+  std::string buffer(entry.size(), '\0');
+  const smtp::NormalizedAddress &result = smtp::normalizeAddress(entry, buffer.data());
+  REQUIRE(result.error == expected_error);
+  return std::string{result.address};
+}
+
+TEST_SUITE("Address tests") {
+  TEST_CASE("Valid addresses test") {
+    const std::vector<std::string_view> addresses{
+        "user@example.com",
+        "first.last+tag@sub.example.co.uk",
+        "!#$%&'*+-/=?^_`{|}~@example.com",
+        "\"quoted local\"@example.com",
+        "\"escaped \\\" quote\"@example.com",
+        "\"a@b\"@example.com",
+        "user@[192.0.2.1]",
+        "user@[IPv6:2001:db8::1]",
+        "user@localhost",
+        "user@xn--bcher-kva.example",
+        // Long enough for the SIMD path to see several blocks of each part
+        "a.very.long.local.part.with.dots@a-very-long-domain-name.example-domain.com"};
+
+    std::vector<smtp::AddressError> errors;
+    REQUIRE(smtp::validateAddresses(addresses, errors) == addresses.size());
+    for (std::size_t i = 0; i < addresses.size(); i++) {
+      REQUIRE(errors[i] == smtp::AddressError::kNone);
+    }
+  }
+
+  TEST_CASE("Invalid addresses test") {
+    using smtp::AddressError;
+    const std::string long_local(65, 'a');
+    const std::string long_label(64, 'b');
+    const std::string long_address = "user@" + std::string(250, 'c') + ".com";
+    const std::vector<std::pair<std::string, AddressError>> cases{
+        {"", AddressError::kEmpty},
+        {"user.example.com", AddressError::kMissingAt},
+        {"\"quoted\"example.com", AddressError::kMissingAt},
+        {"@example.com", AddressError::kInvalidLocalPart},
+        {".user@example.com", AddressError::kInvalidLocalPart},
+        {"user.@example.com", AddressError::kInvalidLocalPart},
+        {"us..er@example.com", AddressError::kInvalidLocalPart},
+        {"us er@example.com", AddressError::kInvalidLocalPart},
+        {"all the bosses at pwc@example.com", AddressError::kInvalidLocalPart},
+        {"user(comment)@example.com", AddressError::kInvalidLocalPart},
+        {"a@b@example.com", AddressError::kInvalidLocalPart},
+        {"\"unterminated@example.com", AddressError::kInvalidLocalPart},
+        {"caf\xc3\xa9@example.com", AddressError::kInvalidLocalPart},
+        // A bad character after the first 16 is found by the SIMD path
+        {"abcdefghijklmnopqrstuvwxyz,@example.com", AddressError::kInvalidLocalPart},
+        {long_local + "@example.com", AddressError::kLocalPartTooLong},
+        {"user@", AddressError::kInvalidDomain},
+        {"user@example..com", AddressError::kInvalidDomain},
+        {"user@.example.com", AddressError::kInvalidDomain},
+        {"user@example.com.", AddressError::kInvalidDomain},
+        {"user@-example.com", AddressError::kInvalidDomain},
+        {"user@example-.com", AddressError::kInvalidDomain},
+        {"user@exa_mple.com", AddressError::kInvalidDomain},
+        {"user@abcdefghijklmnopqrstuvwxyz.example_com", AddressError::kInvalidDomain},
+        {"user@[192.0.2.1", AddressError::kInvalidDomain},
+        {"user@[]", AddressError::kInvalidDomain},
+        {"user@" + long_label + ".com", AddressError::kLabelTooLong},
+        {long_address, AddressError::kTooLong},
+    };
+
+    for (const auto &[address, error] : cases) {
+      REQUIRE(smtp::validateAddress(address) == error);
+      REQUIRE_FALSE(smtp::describeAddressError(error).empty());
+    }
+  }
+
+  TEST_CASE("Addresses are normalized test") {
+    using smtp::AddressError;
+    REQUIRE(normalized("  User@Example.COM\t", AddressError::kNone) == "User@example.com");
+    REQUIRE(normalized("Jane Doe <Jane@EXAMPLE.com>", AddressError::kNone) ==
+            "Jane@example.com");
+    REQUIRE(normalized("\"Doe, <Jane>\" < jane@Example.com >", AddressError::kNone) ==
+            "jane@example.com");
+    REQUIRE(normalized("<user@ABCDEFGHIJKLMNOPQRSTUVWXYZ.COM>", AddressError::kNone) ==
+            "user@abcdefghijklmnopqrstuvwxyz.com");
+    REQUIRE(normalized("\"Quoted\"@EXAMPLE.com", AddressError::kNone) == "\"Quoted\"@example.com");
+
+    // Entries that are not valid are still normalized as far as they can be
+    REQUIRE(normalized("Jane <>", AddressError::kEmpty).empty());
+    REQUIRE(normalized("   ", AddressError::kEmpty).empty());
+    REQUIRE(normalized("Jane jane@example.com>", AddressError::kUnbalancedBrackets) ==
+            "Jane jane@example.com>");
+    REQUIRE(normalized("Jane <JANE@EXAMPLE", AddressError::kInvalidLocalPart) ==
+            "Jane <JANE@example");
+    REQUIRE(normalized("All the bosses at PWC", AddressError::kMissingAt) ==
+            "All the bosses at PWC");
+  }
+}
@@ -0,0 +1,165 @@
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "doctest/doctest.h"
+
+#include "email/batch_renderer.hpp"
+#include "test_helpers.hpp"
+
+// Refuses any allocation larger than limit, so building an email with a larger attachment throws
+class LimitedResource : public std::pmr::memory_resource {
+public:
+  explicit LimitedResource(std::size_t limit) : m_limit{limit} {}
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+    if (bytes > m_limit) {
+      throw std::bad_alloc();
+    }
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override {
+    std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+  }
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+
+  std::size_t m_limit;
+};
+
+static smtp::EmailParams batchParams(std::string_view to) {
+  smtp::EmailParams params{
+      "user",                     // smtp username
+      "password",                 // smtp password
+      "hostname",                 // smtp server
+      to,                         // to
+      "tully@gmail.com",          // from
+      "",                         // cc
+      "Quarterly report",         // subject
+      "Please find it attached.", // body
+      &test::kFixedDateTime       // optional datetime
+  };
+  return params;
+}
+
+static void addAttachments(smtp::Email &email, std::size_t count, std::size_t size) {
+  for (std::size_t i = 0; i < count; i++) {
+    smtp::Attachment attachment;
+    attachment.setContents(std::vector<uint8_t>(size, static_cast<uint8_t>('a' + i)));
+    attachment.setFilePath("/path/report" + std::to_string(i) + ".bin");
+    email.addAttachment(attachment);
+  }
+}
+
+// The same email rendered on its own, with the boundary of the email it is compared against
+static std::string renderedAlone(const smtp::Email &email, std::string_view to,
+                                 std::size_t attachments, std::size_t size) {
+  smtp::Email alone{batchParams(to)};
+  addAttachments(alone, attachments, size);
+  std::stringstream ss;
+  ss << alone;
+
+  std::string text = ss.str();
+  const std::string &from = alone.boundary();
+  const std::string &boundary = email.boundary();
+  for (std::size_t pos = text.find(from); pos != std::string::npos;
+       pos = text.find(from, pos + boundary.size())) {
+    text.replace(pos, from.size(), boundary);
+  }
+  return text;
+}
+
+TEST_SUITE("Batch renderer tests") {
+  TEST_CASE("Emails are rendered in the order they are given test") {
+    std::vector<std::string> recipients;
+    for (std::size_t i = 0; i < 50; i++) {
+      recipients.push_back("user" + std::to_string(i) + "@example.com");
+    }
+    std::vector<std::unique_ptr<smtp::Email>> emails;
+    std::vector<const smtp::Email *> batch;
+    for (std::size_t i = 0; i < recipients.size(); i++) {
+      emails.push_back(std::make_unique<smtp::Email>(batchParams(recipients[i])));
+      addAttachments(*emails.back(), i % 3, 1000 + i);
+      batch.push_back(emails.back().get());
+    }
+
+    smtp::BatchRenderOptions options;
+    options.threads = 4;
+    smtp::BatchRenderer renderer{options};
+    REQUIRE(renderer.threads() == 4);
+
+    std::vector<smtp::RenderedEmail> rendered;
+    renderer.render(batch, rendered);
+    REQUIRE(rendered.size() == emails.size());
+    for (std::size_t i = 0; i < emails.size(); i++) {
+      REQUIRE(test::join(rendered[i].view()) ==
+              renderedAlone(*emails[i], recipients[i], i % 3, 1000 + i));
+    }
+  }
+
+  TEST_CASE("Attachments of one email are encoded in parallel test") {
+    smtp::Email email{batchParams("bigboss@gmail.com")};
+    addAttachments(email, 6, 200000);
+
+    smtp::BatchRenderOptions options;
+    options.threads = 3;
+    smtp::BatchRenderer renderer{options};
+    std::vector<smtp::RenderedEmail> rendered;
+    renderer.render({&email}, rendered);
+    REQUIRE(rendered.size() == 1);
+    const std::string &expected = renderedAlone(email, "bigboss@gmail.com", 6, 200000);
+    REQUIRE(test::join(rendered[0].view()) == expected);
+
+    // The parts stay cached, so the email renders the same on its own afterwards
+    std::stringstream ss;
+    ss << email;
+    REQUIRE(ss.str() == expected);
+  }
+
+  TEST_CASE("Rendered emails are reused and a single thread renders everything test") {
+    smtp::Email first{batchParams("first@example.com")};
+    smtp::Email second{batchParams("second@example.com")};
+    addAttachments(second, 2, 5000);
+
+    smtp::BatchRenderOptions options;
+    options.threads = 1;
+    smtp::BatchRenderer renderer{options};
+
+    std::vector<smtp::RenderedEmail> rendered;
+    renderer.render({&first, &second}, rendered);
+    REQUIRE(rendered.size() == 2);
+    REQUIRE(test::join(rendered[1].view()) == renderedAlone(second, "second@example.com", 2, 5000));
+
+    renderer.render({&second}, rendered);
+    REQUIRE(rendered.size() == 1);
+    REQUIRE(test::join(rendered[0].view()) == renderedAlone(second, "second@example.com", 2, 5000));
+
+    renderer.render({}, rendered);
+    REQUIRE(rendered.empty());
+  }
+
+  TEST_CASE("An email that fails to render fails the batch test") {
+    LimitedResource limited{100000};
+    smtp::Email good{batchParams("good@example.com")};
+    smtp::Email bad{batchParams("bad@example.com"), &limited};
+    addAttachments(good, 2, 1000);
+    addAttachments(bad, 3, 200000);
+
+    smtp::BatchRenderOptions options;
+    options.threads = 4;
+    smtp::BatchRenderer renderer{options};
+    std::vector<smtp::RenderedEmail> rendered;
+    REQUIRE_THROWS_AS(renderer.render({&good, &bad, &good}, rendered), std::bad_alloc);
+
+    // The renderer is still usable afterwards
+    renderer.render({&good}, rendered);
+    REQUIRE(test::join(rendered[0].view()) == renderedAlone(good, "good@example.com", 2, 1000));
+  }
+}
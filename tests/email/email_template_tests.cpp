@@ -0,0 +1,184 @@
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "doctest/doctest.h"
+
+#include "email/email.hpp"
+#include "email/email_template.hpp"
+#include "mock_smtp_server.hpp"
+#include "test_helpers.hpp"
+
+static std::string replaceAll(std::string text, std::string_view from, std::string_view to) {
+  for (std::size_t pos = text.find(from); pos != std::string::npos;
+       pos = text.find(from, pos + to.size())) {
+    text.replace(pos, from.size(), to);
+  }
+  return text;
+}
+
+static smtp::Attachment makeAttachment() {
+  smtp::Attachment attachment;
+  attachment.setContents(std::vector<uint8_t>(3000, 0x7f));
+  attachment.setFilePath("/path/report.bin");
+  return attachment;
+}
+
+TEST_SUITE("Email template tests") {
+  TEST_CASE("Rendered template matches an equivalent email test") {
+    smtp::EmailParams params{
+        "user",                                         // smtp username
+        "password",                                     // smtp password
+        "hostname",                                     // smtp server
+        "{{to}}",                                       // to
+        "news@company.com",                             // from
+        "",                                             // cc
+        "Hello {{name}}",                               // subject
+        "Hi {{name}},\r\nUnsubscribe: {{unsubscribe}}", // body
+        &test::kFixedDateTime                           // optional datetime
+    };
+    const smtp::EmailTemplate email_template{params, {makeAttachment()}};
+
+    REQUIRE(email_template.slots().size() == 3);
+    const std::size_t to_slot = email_template.slotIndex("to");
+    const std::size_t name_slot = email_template.slotIndex("name");
+    const std::size_t unsubscribe_slot = email_template.slotIndex("unsubscribe");
+
+    smtp::MergedEmail merged;
+    const char *attachment_data = nullptr;
+    for (const std::string_view name : {"Tully", "Boss"}) {
+      const std::string &to = std::string(name) + "@gmail.com";
+      const std::string &unsubscribe = "https://company.com/u/" + std::string(name);
+
+      std::vector<std::string_view> values(3);
+      values[to_slot] = to;
+      values[name_slot] = name;
+      values[unsubscribe_slot] = unsubscribe;
+      email_template.render(values, merged);
+
+      const std::string &subject = "Hello " + std::string(name);
+      const std::string &body = "Hi " + std::string(name) + ",\r\nUnsubscribe: " + unsubscribe;
+      smtp::EmailParams expected_params{
+          "user", "password", "hostname", to, "news@company.com", "", subject, body,
+          &test::kFixedDateTime};
+      smtp::Email expected_email{expected_params};
+      expected_email.addAttachment(makeAttachment());
+
+      std::stringstream ss;
+      ss << expected_email;
+      const std::string &expected =
+          replaceAll(ss.str(), expected_email.boundary(), email_template.boundary());
+      REQUIRE(test::join(merged.view()) == expected);
+      REQUIRE(merged.size() == expected.size());
+      REQUIRE(merged.to() == to);
+      REQUIRE(merged.from() == "news@company.com");
+
+      // The encoded attachment is shared between recipients rather than encoded again
+      const auto &segment = merged.view().segment(merged.view().count() - 1);
+      if (attachment_data) {
+        REQUIRE(attachment_data == segment.data());
+      }
+      attachment_data = segment.data();
+    }
+  }
+
+  TEST_CASE("Values that are not 7bit are encoded test") {
+    for (const std::string_view body : {"Hi {{name}}", "Caf\xc3\xa9 for {{name}}"}) {
+      smtp::EmailParams params{
+          "user",               // smtp username
+          "password",           // smtp password
+          "hostname",           // smtp server
+          "to@gmail.com",       // to
+          "from@gmail.com",     // from
+          "",                   // cc
+          "Hello",              // subject
+          body,                 // body
+          &test::kFixedDateTime // optional datetime
+      };
+      const smtp::EmailTemplate email_template{params};
+
+      // A value that is 7bit on its own can still make the line it is filled into too long
+      const std::string long_name(996, 'a');
+      smtp::MergedEmail merged;
+      for (const std::string_view name : {"Zoe", "Zo\xc3\xab", "line\nbreak", long_name.c_str()}) {
+        email_template.render({name}, merged);
+
+        std::string expected_body{body};
+        expected_body.replace(expected_body.find("{{name}}"), 8, name);
+        params.body = expected_body;
+        const smtp::Email expected_email{params};
+
+        std::stringstream ss;
+        ss << expected_email;
+        REQUIRE(test::join(merged.view()) ==
+                replaceAll(ss.str(), expected_email.boundary(), email_template.boundary()));
+      }
+    }
+  }
+
+  TEST_CASE("Merged recipients are sent like the recipients of an email test") {
+    bench::MockServerOptions options;
+    options.user = "user";
+    options.password = "password";
+    const bench::MockSmtpServer server{options};
+
+    smtp::EmailParams params{
+        "user",                           // smtp username
+        "password",                       // smtp password
+        server.url(),                     // smtp server
+        "Jane <{{to}}>, bob@example.com", // to
+        "news@company.com",               // from
+        "",                               // cc
+        "Hello",                          // subject
+        "Body",                           // body
+        &test::kFixedDateTime             // optional datetime
+    };
+    params.max_recipients_per_message = 1;
+    const smtp::EmailTemplate email_template{params};
+
+    // Each address is a recipient of its own, and every batch of one is its own transaction
+    smtp::MergedEmail merged;
+    email_template.render({"jane@example.com"}, merged);
+    REQUIRE(email_template.send(merged).sent());
+    REQUIRE(server.stats().recipients == 2);
+    REQUIRE(server.stats().messages == 2);
+
+    email_template.render({"not an address"}, merged);
+    REQUIRE_THROWS_AS(email_template.send(merged), smtp::EmailException);
+    REQUIRE(server.stats().messages == 2);
+  }
+
+  TEST_CASE("Invalid template usage test") {
+    smtp::EmailParams params{
+        "user",               // smtp username
+        "password",           // smtp password
+        "hostname",           // smtp server
+        "to@gmail.com",       // to
+        "from@gmail.com",     // from
+        "",                   // cc
+        "Hello {{name}}",     // subject
+        "Body",               // body
+        &test::kFixedDateTime // optional datetime
+    };
+    const smtp::EmailTemplate email_template{params};
+    smtp::MergedEmail merged;
+
+    REQUIRE_THROWS_AS(email_template.slotIndex("missing"), smtp::EmailTemplateException);
+    REQUIRE_THROWS_AS(email_template.render({}, merged), smtp::EmailTemplateException);
+
+    // The boundary is fixed once the template is compiled so a value containing it is rejected
+    const std::string &value = "--" + email_template.boundary();
+    REQUIRE_THROWS_AS(email_template.render({value}, merged), smtp::EmailTemplateException);
+
+    // A line break in a header would start a header of its own
+    const std::string &injected = "Eve\r\nBcc: victim@evil.example";
+    REQUIRE_THROWS_AS(email_template.render({injected}, merged), smtp::EmailTemplateException);
+    REQUIRE_THROWS_AS(email_template.render({"Eve\nBcc: victim@evil.example"}, merged),
+                      smtp::EmailTemplateException);
+
+    params.body = "Hi {{name";
+    REQUIRE_THROWS_AS(smtp::EmailTemplate{params}, smtp::EmailTemplateException);
+  }
+}
@@ -1,20 +1,35 @@
 #include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <memory>
+#include <memory_resource>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "doctest/doctest.h"
 
 #include "date_time/date_time_now.hpp"
 #include "email/email.hpp"
+#include "test_helpers.hpp"
+#include "utils/memory/counting_resource.hpp"
 
-class DateTimeStatic : public smtp::DateTime {
-public:
-  std::string getTimestamp() const override { return "25/07/2023 07:21:05 +1100"; }
-};
+// The expected emails below are written with this boundary, it is swapped for the random boundary
+// of the email under test before comparing.
+static const std::string kExpectedBoundary = "----------030203080101020302070708";
 
-const auto dateTimeStatic = std::make_unique<DateTimeStatic>();
+static std::string replaceAll(std::string text, std::string_view from, std::string_view to) {
+  for (std::size_t pos = text.find(from); pos != std::string::npos;
+       pos = text.find(from, pos + to.size())) {
+    text.replace(pos, from.size(), to);
+  }
+  return text;
+}
+
+static std::string withBoundary(const std::string &expected, const smtp::Email &email) {
+  return replaceAll(expected, kExpectedBoundary, email.boundary());
+}
 
 TEST_SUITE("Email tests") {
   TEST_CASE("Basic email test") {
@@ -28,7 +43,7 @@ TEST_SUITE("Email tests") {
         "PWC pay rise",          // subject
         "Hey mate, I have been working here for 5 years now, I think "
         "its time for a pay rise.", // body
-        dateTimeStatic.get()        // optional datetime
+        &test::kFixedDateTime       // optional datetime
     };
 
     smtp::Email email(params);
@@ -57,7 +72,7 @@ TEST_SUITE("Email tests") {
     std::stringstream ss;
     ss << email;
     const std::string &actual = ss.str();
-    REQUIRE(expected == actual);
+    REQUIRE(withBoundary(expected, email) == actual);
   }
 
   TEST_CASE("Add attachment test") {
@@ -71,7 +86,7 @@ TEST_SUITE("Email tests") {
         "PWC pay rise",          // subject
         "Hey mate, I have been working here for 5 years now, I think "
         "its time for a pay rise.", // body
-        dateTimeStatic.get()        // optional datetime
+        &test::kFixedDateTime       // optional datetime
     };
     smtp::Email email(params);
 
@@ -100,12 +115,11 @@ TEST_SUITE("Email tests") {
         "Hey mate, I have been working here for 5 years now, I think its time for a pay rise.\r\n"
         "------------030203080101020302070708\r\n"
         "Content-Type: application/octet-stream\r\n"
-        "Content-Transfer-Encoding: base64\r\n"
+        "Content-Transfer-Encoding: quoted-printable\r\n"
         "Content-Disposition: attachment;\r\n"
         " filename=test.txt\r\n"
         "\r\n"
-        "TWltZU1vY2tBdHRhY2htZW50\r\n"
-        "\r\n"
+        "MimeMockAttachment\r\n"
         "------------030203080101020302070708\r\n"
         "------------030203080101020302070708--\r\n"
         ".\r\n";
@@ -114,7 +128,7 @@ TEST_SUITE("Email tests") {
     ss << email;
     const std::string &actual = ss.str();
 
-    REQUIRE(expected == actual);
+    REQUIRE(withBoundary(expected, email) == actual);
   }
 
   TEST_CASE("Remove attachment test") {
@@ -128,7 +142,7 @@ TEST_SUITE("Email tests") {
         "PWC pay rise",          // subject
         "Hey mate, I have been working here for 5 years now, I think "
         "its time for a pay rise.", // body
-        dateTimeStatic.get()        // optional datetime
+        &test::kFixedDateTime       // optional datetime
     };
     smtp::Email email(params);
 
@@ -165,12 +179,11 @@ TEST_SUITE("Email tests") {
         "Hey mate, I have been working here for 5 years now, I think its time for a pay rise.\r\n"
         "------------030203080101020302070708\r\n"
         "Content-Type: application/octet-stream\r\n"
-        "Content-Transfer-Encoding: base64\r\n"
+        "Content-Transfer-Encoding: quoted-printable\r\n"
         "Content-Disposition: attachment;\r\n"
         " filename=test2.txt\r\n"
         "\r\n"
-        "TWltZU1vY2tBdHRhY2htZW50Mg==\r\n"
-        "\r\n"
+        "MimeMockAttachment2\r\n"
         "------------030203080101020302070708\r\n"
         "------------030203080101020302070708--\r\n"
         ".\r\n";
@@ -179,7 +192,7 @@ TEST_SUITE("Email tests") {
     ss << email;
     const std::string &actual = ss.str();
 
-    REQUIRE(expected == actual);
+    REQUIRE(withBoundary(expected, email) == actual);
   }
 
   TEST_CASE("Clear test") {
@@ -193,7 +206,7 @@ TEST_SUITE("Email tests") {
         "PWC pay rise",          // subject
         "Hey mate, I have been working here for 5 years now, I think "
         "its time for a pay rise.", // body
-        dateTimeStatic.get()        // optional datetime
+        &test::kFixedDateTime       // optional datetime
     };
     smtp::Email email(params);
 
@@ -227,6 +240,514 @@ TEST_SUITE("Email tests") {
     ss << email;
     const std::string &actual = ss.str();
 
-    REQUIRE(expected == actual);
+    REQUIRE(withBoundary(expected, email) == actual);
+  }
+
+  TEST_CASE("Serialized size matches rendered email test") {
+    smtp::EmailParams params{
+        "user",                  // smtp username
+        "password",              // smtp password
+        "hostname",              // smtp server
+        "bigboss@gmail.com",     // to
+        "tully@gmail.com",       // from
+        "All the bosses at PWC", // cc
+        "PWC pay rise",          // subject
+        "Hey mate, I have been working here for 5 years now, I think "
+        "its time for a pay rise.", // body
+        &test::kFixedDateTime       // optional datetime
+    };
+    smtp::Email email(params);
+
+    // Cover every base64 padding case and attachments that span several 512 byte lines
+    for (std::size_t attachment_size : {0, 1, 2, 3, 383, 384, 385, 5000}) {
+      smtp::Attachment attachment;
+      attachment.setContents(std::vector<uint8_t>(attachment_size, 0xab));
+      attachment.setFilePath("/path/to/file" + std::to_string(attachment_size) + ".bin");
+      email.addAttachment(attachment);
+
+      std::stringstream ss;
+      ss << email;
+      REQUIRE(email.serializedSize() == ss.str().size());
+    }
+  }
+
+  TEST_CASE("Recipient lists are rendered once and Bcc is left out test") {
+    smtp::EmailParams params{
+        "user",                                              // smtp username
+        "password",                                          // smtp password
+        "hostname",                                          // smtp server
+        "Boss <bigboss@gmail.com>, bigboss@GMAIL.com",       // to
+        "tully@gmail.com",                                   // from
+        "hr@gmail.com, \"Payroll, PWC\" <payroll@gmail.com>", // cc
+        "PWC pay rise",                                      // subject
+        "Pay rise please",                                   // body
+        &test::kFixedDateTime                                // optional datetime
+    };
+    params.bcc = "secret@gmail.com, hr@gmail.com";
+    smtp::Email email(params);
+    REQUIRE(email.recipientCount() == 4);
+
+    std::stringstream ss;
+    ss << email;
+    std::string actual = ss.str();
+    REQUIRE(actual.find("To: Boss <bigboss@gmail.com>\r\n") == 0);
+    REQUIRE(actual.find("Cc: hr@gmail.com, \"Payroll, PWC\" <payroll@gmail.com>\r\n") !=
+            std::string::npos);
+    REQUIRE(actual.find("secret@gmail.com") == std::string::npos);
+    REQUIRE(email.serializedSize() == actual.size());
+
+    // Enough recipients to fold the header
+    for (std::size_t i = 0; i < 50; i++) {
+      REQUIRE(email.addRecipients(smtp::RecipientType::kCc,
+                                  "staff" + std::to_string(i) + "@gmail.com") == 1);
+    }
+    REQUIRE(email.addRecipients(smtp::RecipientType::kTo, "staff0@gmail.com") == 0);
+    REQUIRE(email.recipientCount() == 54);
+
+    ss.str("");
+    ss << email;
+    actual = ss.str();
+    REQUIRE(actual.find("staff49@gmail.com") != std::string::npos);
+    REQUIRE(actual.find(",\r\n staff") != std::string::npos);
+    REQUIRE(email.serializedSize() == actual.size());
+  }
+
+  TEST_CASE("Invalid recipients are rejected before sending test") {
+    smtp::EmailParams params{
+        "user",                  // smtp username
+        "password",              // smtp password
+        "hostname",              // smtp server
+        "bigboss@gmail.com",     // to
+        "tully@gmail.com",       // from
+        "All the bosses at PWC", // cc
+        "PWC pay rise",          // subject
+        "Pay rise please",       // body
+        &test::kFixedDateTime    // optional datetime
+    };
+    params.bcc = "hr@gmail..com";
+    smtp::Email email(params);
+
+    const std::vector<std::string> invalid{"All the bosses at PWC", "hr@gmail..com"};
+    REQUIRE(email.invalidRecipients() == invalid);
+    REQUIRE_THROWS_AS(email.send(), smtp::EmailException);
+
+    email.setCc("");
+    email.setBcc("hr@gmail.com");
+    REQUIRE(email.invalidRecipients().empty());
+  }
+
+  TEST_CASE("Message larger than the size limit is rejected test") {
+    smtp::EmailParams params{
+        "user",                         // smtp username
+        "password",                     // smtp password
+        "hostname",                     // smtp server
+        "bigboss@gmail.com",            // to
+        "tully@gmail.com",              // from
+        "",                             // cc
+        "PWC pay rise",                 // subject
+        "Hey mate, I want a pay rise.", // body
+        &test::kFixedDateTime,          // optional datetime
+        128                             // max message size
+    };
+    smtp::Email email(params);
+
+    REQUIRE(email.serializedSize() > 128);
+    REQUIRE_THROWS_AS(email.send(), smtp::EmailException);
+  }
+
+  TEST_CASE("Changes after rendering are reflected in the next render test") {
+    smtp::EmailParams params{
+        "user",                         // smtp username
+        "password",                     // smtp password
+        "hostname",                     // smtp server
+        "bigboss@gmail.com",            // to
+        "tully@gmail.com",              // from
+        "",                             // cc
+        "PWC pay rise",                 // subject
+        "Hey mate, I want a pay rise.", // body
+        &test::kFixedDateTime           // optional datetime
+    };
+    smtp::Email email(params);
+
+    smtp::Attachment attachment;
+    const std::string &contents = "MimeMockAttachment";
+    attachment.setContents(std::vector<uint8_t>(contents.begin(), contents.end()));
+    attachment.setFilePath("/path/test.txt");
+    email.addAttachment(attachment);
+
+    std::stringstream first;
+    first << email;
+
+    email.setSubject("PWC pay cut");
+    email.setBody("Never mind.");
+    email.removeAttachment("/path/test.txt");
+    attachment.setFilePath("/path/test2.txt");
+    email.addAttachment(attachment);
+
+    const std::string &expected = "To: bigboss@gmail.com\r\n"
+                                  "From: tully@gmail.com\r\n"
+                                  "Cc: \r\n"
+                                  "Subject: PWC pay cut\r\n"
+                                  "25/07/2023 07:21:05 +1100\r\n"
+                                  "User-Agent: Very-Simple-SMTPS\r\n"
+                                  "MIME-Version: 1.0\r\n"
+                                  "Content-Type: multipart/mixed;\r\n"
+                                  " boundary=\"----------030203080101020302070708\"\r\n"
+                                  "\r\n"
+                                  "This is a multi-part message in MIME format.\r\n"
+                                  "------------030203080101020302070708\r\n"
+                                  "Content-Type: text/plain; charset=utf-8; format=flowed\r\n"
+                                  "Content-Transfer-Encoding: 7bit\r\n"
+                                  "\r\n"
+                                  "Never mind.\r\n"
+                                  "------------030203080101020302070708\r\n"
+                                  "Content-Type: application/octet-stream\r\n"
+                                  "Content-Transfer-Encoding: quoted-printable\r\n"
+                                  "Content-Disposition: attachment;\r\n"
+                                  " filename=test2.txt\r\n"
+                                  "\r\n"
+                                  "MimeMockAttachment\r\n"
+                                  "------------030203080101020302070708\r\n"
+                                  "------------030203080101020302070708--\r\n"
+                                  ".\r\n";
+
+    std::stringstream second;
+    second << email;
+    REQUIRE(withBoundary(expected, email) == second.str());
+  }
+
+  TEST_CASE("Rendering the same email from several threads test") {
+    smtp::EmailParams params{
+        "user",                         // smtp username
+        "password",                     // smtp password
+        "hostname",                     // smtp server
+        "bigboss@gmail.com",            // to
+        "tully@gmail.com",              // from
+        "",                             // cc
+        "PWC pay rise",                 // subject
+        "Hey mate, I want a pay rise.", // body
+        &test::kFixedDateTime           // optional datetime
+    };
+    smtp::Email email(params);
+
+    smtp::Attachment attachment;
+    attachment.setContents(std::vector<uint8_t>(100000, 0x42));
+    attachment.setFilePath("/path/large.bin");
+    email.addAttachment(attachment);
+
+    std::vector<std::string> results(8);
+    std::vector<std::thread> threads;
+    for (auto &result : results) {
+      threads.emplace_back([&email, &result]() {
+        std::stringstream ss;
+        ss << email;
+        result = ss.str();
+      });
+    }
+
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    std::stringstream ss;
+    ss << email;
+    for (const auto &result : results) {
+      REQUIRE(result == ss.str());
+    }
+  }
+
+  TEST_CASE("Email built inside an arena test") {
+    smtp::EmailParams params{
+        "user",                         // smtp username
+        "password",                     // smtp password
+        "hostname",                     // smtp server
+        "bigboss@gmail.com",            // to
+        "tully@gmail.com",              // from
+        "",                             // cc
+        "PWC pay rise",                 // subject
+        "Hey mate, I want a pay rise.", // body
+        &test::kFixedDateTime           // optional datetime
+    };
+
+    smtp::Attachment attachment;
+    attachment.setContents(std::vector<uint8_t>(5000, 0x42));
+    attachment.setFilePath("/path/large.bin");
+
+    smtp::Email heap_email(params);
+    heap_email.addAttachment(attachment);
+
+    // The null upstream makes any allocation that does not fit inside the buffer throw
+    std::vector<std::byte> buffer(64 * 1024);
+    std::pmr::monotonic_buffer_resource arena{buffer.data(), buffer.size(),
+                                              std::pmr::null_memory_resource()};
+    smtp::Email arena_email(params, &arena);
+    arena_email.addAttachment(attachment);
+
+    std::stringstream heap_ss;
+    heap_ss << heap_email;
+    std::stringstream arena_ss;
+    arena_ss << arena_email;
+
+    REQUIRE(heap_ss.str() ==
+            replaceAll(arena_ss.str(), arena_email.boundary(), heap_email.boundary()));
+  }
+
+  TEST_CASE("Write a rendered email to a file test") {
+    smtp::EmailParams params{
+        "user",                         // smtp username
+        "password",                     // smtp password
+        "hostname",                     // smtp server
+        "bigboss@gmail.com",            // to
+        "tully@gmail.com",              // from
+        "",                             // cc
+        "PWC pay rise",                 // subject
+        "Hey mate, I want a pay rise.", // body
+        &test::kFixedDateTime           // optional datetime
+    };
+    smtp::Email email(params);
+
+    smtp::Attachment attachment;
+    attachment.setContents(std::vector<uint8_t>(100000, 0x42));
+    attachment.setFilePath("/path/large.bin");
+    email.addAttachment(attachment);
+
+    smtp::RenderedEmail rendered;
+    email.render(rendered);
+
+    std::FILE *file = std::tmpfile();
+    REQUIRE(file != nullptr);
+    REQUIRE(rendered.view().writeTo(fileno(file)) == email.serializedSize());
+
+    std::string contents(email.serializedSize(), '\0');
+    std::rewind(file);
+    REQUIRE(std::fread(contents.data(), 1, contents.size(), file) == contents.size());
+    std::fclose(file);
+
+    std::stringstream ss;
+    ss << email;
+    REQUIRE(contents == ss.str());
+  }
+
+  TEST_CASE("Body containing the boundary test") {
+    smtp::EmailParams params{
+        "user",               // smtp username
+        "password",           // smtp password
+        "hostname",           // smtp server
+        "bigboss@gmail.com",  // to
+        "tully@gmail.com",    // from
+        "",                   // cc
+        "Fwd: pay rise",      // subject
+        "",                   // body
+        &test::kFixedDateTime // optional datetime
+    };
+    smtp::Email email(params);
+    smtp::Email other(params);
+    REQUIRE(email.boundary() != other.boundary());
+
+    std::stringstream first;
+    first << email;
+
+    // Forwarding a message with the same boundary must not split the body into another part
+    const std::string old_boundary = email.boundary();
+    const std::string &body = "--" + old_boundary + "\r\nForwarded message";
+    email.setBody(body);
+
+    std::stringstream second;
+    second << email;
+    const std::string &actual = second.str();
+    REQUIRE(email.boundary() != old_boundary);
+    REQUIRE(replaceAll(actual, body, "").find(old_boundary) == std::string::npos);
+    REQUIRE(actual.find("--" + email.boundary() + "--\r\n") != std::string::npos);
+    REQUIRE(email.serializedSize() == actual.size());
+
+    // Attaching the message is sent as quoted-printable, which keeps the boundary as it is
+    const std::string attached_boundary = email.boundary();
+    const std::string &message = "--" + attached_boundary + "\nForwarded message\n";
+    smtp::Attachment forwarded;
+    forwarded.setContents(std::vector<uint8_t>(message.begin(), message.end()));
+    forwarded.setFilePath("/path/forwarded.eml");
+    email.addAttachment(forwarded);
+
+    std::stringstream third;
+    third << email;
+    const std::string &encoded = "--" + attached_boundary + "=0AForwarded message=0A";
+    REQUIRE(third.str().find(encoded) != std::string::npos);
+    REQUIRE(email.boundary() != attached_boundary);
+    REQUIRE(replaceAll(third.str(), encoded, "").find(attached_boundary) == std::string::npos);
+    REQUIRE(email.serializedSize() == third.str().size());
+  }
+
+  TEST_CASE("Body line breaks are normalized test") {
+    smtp::EmailParams params{
+        "user",                         // smtp username
+        "password",                     // smtp password
+        "hostname",                     // smtp server
+        "bigboss@gmail.com",            // to
+        "tully@gmail.com",              // from
+        "",                             // cc
+        "PWC pay rise",                 // subject
+        "Hey mate,\nI want a raise.\n", // body
+        &test::kFixedDateTime           // optional datetime
+    };
+    smtp::Email email(params);
+
+    std::stringstream ss;
+    ss << email;
+    const std::string &actual = ss.str();
+    REQUIRE(actual.find("Hey mate,\r\nI want a raise.\r\n\r\n") != std::string::npos);
+    REQUIRE(email.serializedSize() == actual.size());
+
+  }
+
+  TEST_CASE("Transfer encoding is chosen from the content test") {
+    smtp::EmailParams params{
+        "user",               // smtp username
+        "password",           // smtp password
+        "hostname",           // smtp server
+        "bigboss@gmail.com",  // to
+        "tully@gmail.com",    // from
+        "",                   // cc
+        "Report",             // subject
+        "",                   // body
+        &test::kFixedDateTime // optional datetime
+    };
+    smtp::Email email(params);
+
+    const auto &render = [&email]() {
+      std::stringstream ss;
+      ss << email;
+      REQUIRE(email.serializedSize() == ss.str().size());
+      return ss.str();
+    };
+
+    // Lines over the limit of 998 octets can not be sent as they are
+    email.setBody(std::string(1000, 'a'));
+    REQUIRE(render().find("Content-Transfer-Encoding: quoted-printable\r\n\r\n" +
+                          std::string(75, 'a') + "=\r\n") != std::string::npos);
+
+    // Mostly ASCII text with a few accents is quoted-printable, non-latin text is base64
+    email.setBody("Caf\xc3\xa9 au lait");
+    REQUIRE(render().find("\r\n\r\nCaf=C3=A9 au lait\r\n") != std::string::npos);
+    email.setBody("\xd0\x9f\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82");
+    REQUIRE(render().find("\r\n\r\n0J/RgNC40LLQtdGC\r\n") != std::string::npos);
+
+    // A CSV export is much smaller as quoted-printable while binary data stays base64
+    std::string csv;
+    for (int row = 0; row < 200; row++) {
+      csv += std::to_string(row) + ",widget,3.50,\"in stock\"\n";
+    }
+    smtp::Attachment report;
+    report.setContents(std::vector<uint8_t>(csv.begin(), csv.end()));
+    report.setFilePath("/path/report.csv");
+    email.addAttachment(report);
+
+    smtp::Attachment binary;
+    binary.setContents({0x00, 0x01, 0x02, 0xff});
+    binary.setFilePath("/path/data.bin");
+    email.addAttachment(binary);
+
+    const std::string &actual = render();
+    REQUIRE(actual.find("Content-Transfer-Encoding: quoted-printable\r\n"
+                        "Content-Disposition: attachment;\r\n"
+                        " filename=report.csv\r\n\r\n0,widget,3.50,\"in stock\"=0A1,") !=
+            std::string::npos);
+    REQUIRE(actual.find("Content-Transfer-Encoding: base64\r\n"
+                        "Content-Disposition: attachment;\r\n"
+                        " filename=data.bin\r\n\r\nAAEC/w==\r\n") != std::string::npos);
+  }
+
+  // Upper bounds for fixed shapes of email, so that a change that makes a build allocate more
+  // often or hold onto more copies of an attachment fails here
+  TEST_CASE("Allocations of a build stay within bounds test") {
+    const smtp::EmailParams params{
+        "user", "password", "smtps://localhost:465", "to@example.com", "from@example.com", "",
+        "Report", "Please find the report attached.", &test::kFixedDateTime};
+
+    // Bytes that are not all the same, so the attachment is sent as base64
+    std::vector<uint8_t> contents(1024 * 1024);
+    uint32_t state = 1;
+    for (uint8_t &byte : contents) {
+      state = state * 1664525 + 1013904223;
+      byte = static_cast<uint8_t>(state >> 24);
+    }
+    smtp::Attachment attachment;
+    attachment.setContents(contents);
+    attachment.setFilePath("/path/report.bin");
+
+    smtp::CountingResource counter;
+    smtp::Email email{params, &counter};
+    const auto &build = [&email, &counter]() {
+      const smtp::AllocationStats &start = counter.startWindow();
+      smtp::RenderedEmail rendered;
+      email.render(rendered);
+      return counter.windowStats(start);
+    };
+
+    const smtp::AllocationStats &text_only = build();
+    REQUIRE(text_only.allocations <= 16);
+    REQUIRE(text_only.peak_bytes <= 2 * 1024);
+
+    // The encoded contents only live until the part has been rendered, so at most two copies of
+    // the attachment are ever held by the email
+    email.addAttachment(attachment);
+    const smtp::AllocationStats &cold = build();
+    const double amplification =
+        static_cast<double>(cold.peak_bytes) / static_cast<double>(email.serializedSize());
+    REQUIRE(cold.allocations <= 8);
+    REQUIRE(amplification < 2.1);
+    REQUIRE(counter.inUse() < email.serializedSize() * 11 / 10);
+
+    // Everything but the date comes out of the cache
+    const smtp::AllocationStats &cached = build();
+    REQUIRE(cached.allocations <= 2);
+    REQUIRE(cached.bytes <= 256);
+  }
+
+  TEST_CASE("Allocations of a send are reported test") {
+    smtp::EmailParams params{
+        "user", "password", "smtp://127.0.0.1:1", "to@example.com", "from@example.com", "",
+        "Report", "Please find the report attached.", &test::kFixedDateTime};
+    smtp::Attachment attachment;
+    attachment.setContents(std::vector<uint8_t>(64 * 1024, 0x00));
+    attachment.setFilePath("/path/report.bin");
+
+    smtp::Email untracked{params};
+    untracked.addAttachment(attachment);
+    const smtp::TransportResult &plain = untracked.send();
+    REQUIRE(plain.allocations.allocations == 0);
+
+    params.track_allocations = true;
+    smtp::Email email{params};
+    email.addAttachment(attachment);
+
+    // Nothing listens on the port, the message is still rendered before connecting
+    const smtp::TransportResult &first = email.send();
+    REQUIRE(first.status == smtp::TransportStatus::kConnectFailed);
+    REQUIRE(first.allocations.allocations > 0);
+    REQUIRE(first.allocations.bytes > 64 * 1024);
+    REQUIRE(first.allocations.peak_bytes >= first.allocations.bytes / 2);
+
+    const smtp::TransportResult &second = email.send();
+    REQUIRE(second.allocations.allocations <= 2);
+    REQUIRE(second.allocations.bytes < 1024);
+  }
+
+  TEST_CASE("Credentials are shared by emails test") {
+    const std::shared_ptr<const smtp::Credentials> &credentials =
+        smtp::Credentials::make("user", "password", "smtp://127.0.0.1:1");
+    smtp::EmailParams params{"",      "",     "", "to@example.com", "from@example.com", "",
+                             "Report", "Hello", &test::kFixedDateTime};
+    params.credentials = credentials;
+
+    smtp::Email first{params};
+    smtp::Email second{params};
+    // One reference is held by params
+    REQUIRE(credentials.use_count() == 4);
+
+    // The relay from the credentials is used, nothing listens on it
+    REQUIRE(first.send().status == smtp::TransportStatus::kConnectFailed);
+
+    first.clear();
+    REQUIRE(credentials.use_count() == 3);
   }
 }
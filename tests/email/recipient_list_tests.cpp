@@ -0,0 +1,108 @@
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "doctest/doctest.h"
+
+#include "email/recipient_list.hpp"
+
+static std::string headerOf(const smtp::RecipientList &list, smtp::RecipientType type,
+                            std::size_t prefix_size) {
+  std::pmr::string header;
+  list.appendHeader(type, prefix_size, header);
+  REQUIRE(list.headerSize(type, prefix_size) == header.size());
+  return std::string{header};
+}
+
+TEST_SUITE("Recipient list tests") {
+  TEST_CASE("Addresses are normalized and deduplicated test") {
+    smtp::RecipientList list;
+    REQUIRE(list.add(smtp::RecipientType::kTo, " jane@Example.COM ") == 1);
+    REQUIRE(list.add(smtp::RecipientType::kTo, "Jane Doe <jane@example.com>") == 0);
+    REQUIRE(list.add(smtp::RecipientType::kCc, "jane@EXAMPLE.com, bob@example.com") == 1);
+    // Only the domain is case insensitive
+    REQUIRE(list.add(smtp::RecipientType::kBcc, "Bob@example.com") == 1);
+    REQUIRE(list.add(smtp::RecipientType::kBcc, ",  , <>") == 0);
+
+    REQUIRE(list.size() == 3);
+    REQUIRE(list.contains("jane@example.com"));
+    REQUIRE(list.contains("bob@EXAMPLE.com"));
+    REQUIRE_FALSE(list.contains("alice@example.com"));
+
+    const std::vector<std::string_view> envelope{"jane@example.com", "bob@example.com",
+                                                 "Bob@example.com"};
+    REQUIRE(list.envelope() == envelope);
+    REQUIRE(headerOf(list, smtp::RecipientType::kTo, 4) == "jane@Example.COM");
+    REQUIRE(headerOf(list, smtp::RecipientType::kCc, 4) == "bob@example.com");
+    REQUIRE(headerOf(list, smtp::RecipientType::kBcc, 5) == "Bob@example.com");
+  }
+
+  TEST_CASE("Display names may contain commas test") {
+    smtp::RecipientList list;
+    REQUIRE(list.add(smtp::RecipientType::kTo,
+                     "\"Doe, Jane\" <jane@example.com>, Bob <bob@example.com>") == 2);
+
+    const std::vector<std::string_view> envelope{"jane@example.com", "bob@example.com"};
+    REQUIRE(list.envelope() == envelope);
+    REQUIRE(headerOf(list, smtp::RecipientType::kTo, 4) ==
+            "\"Doe, Jane\" <jane@example.com>, Bob <bob@example.com>");
+  }
+
+  TEST_CASE("Long headers are folded test") {
+    smtp::RecipientList list;
+    std::vector<std::string> expected;
+    for (std::size_t i = 0; i < 500; i++) {
+      const std::string address = "user" + std::to_string(i) + "@example.com";
+      REQUIRE(list.add(smtp::RecipientType::kTo, address) == 1);
+      REQUIRE(list.add(smtp::RecipientType::kCc, address) == 0);
+      expected.push_back(address);
+    }
+    REQUIRE(list.size() == 500);
+
+    const std::string header = "To: " + headerOf(list, smtp::RecipientType::kTo, 4);
+    std::size_t line_start = 0;
+    std::size_t lines = 0;
+    for (std::size_t end = header.find("\r\n"); line_start != std::string::npos;
+         end = header.find("\r\n", line_start)) {
+      const std::size_t length = (end == std::string::npos ? header.size() : end) - line_start;
+      REQUIRE(length <= 78);
+      line_start = end == std::string::npos ? end : end + 2;
+      lines++;
+    }
+    REQUIRE(lines > 1);
+
+    // Unfolding gives back the plain list
+    std::string unfolded = header;
+    for (std::size_t pos = unfolded.find("\r\n"); pos != std::string::npos;
+         pos = unfolded.find("\r\n", pos)) {
+      unfolded.erase(pos, 2);
+    }
+    std::string joined = "To: ";
+    for (std::size_t i = 0; i < expected.size(); i++) {
+      joined += (i == 0 ? "" : ", ") + expected[i];
+    }
+    REQUIRE(unfolded == joined);
+  }
+
+  TEST_CASE("Clearing one kind of recipient test") {
+    smtp::RecipientList list;
+    list.add(smtp::RecipientType::kTo, "a@example.com, b@example.com");
+    list.add(smtp::RecipientType::kCc, "c@example.com");
+    list.add(smtp::RecipientType::kBcc, "d@example.com");
+
+    list.clear(smtp::RecipientType::kTo);
+    REQUIRE(list.size() == 2);
+    REQUIRE_FALSE(list.contains("a@example.com"));
+    REQUIRE(headerOf(list, smtp::RecipientType::kTo, 4).empty());
+
+    // A cleared address can be added again
+    REQUIRE(list.add(smtp::RecipientType::kCc, "a@example.com") == 1);
+    const std::vector<std::string_view> envelope{"c@example.com", "d@example.com",
+                                                 "a@example.com"};
+    REQUIRE(list.envelope() == envelope);
+
+    list.clear();
+    REQUIRE(list.size() == 0);
+    REQUIRE(list.envelope().empty());
+  }
+}
@@ -0,0 +1,118 @@
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "doctest/doctest.h"
+
+#include "email/send_queue.hpp"
+
+using namespace std::chrono_literals;
+
+// Stands in for a send to a relay that takes duration
+static smtp::SendQueue::Send fakeSend(std::chrono::milliseconds duration) {
+  return [duration]() {
+    std::this_thread::sleep_for(duration);
+    return smtp::TransportResult{};
+  };
+}
+
+TEST_SUITE("Send queue tests") {
+  TEST_CASE("Interactive mail goes first and the other lanes are weighted test") {
+    smtp::SendQueueOptions options;
+    options.workers = 1;
+    options.reserved_interactive = 0;
+    options.normal_weight = 3;
+    options.bulk_weight = 1;
+    smtp::SendQueue queue{options};
+
+    // Hold the only worker until every lane has been filled
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    queue.submit([released]() {
+      released.wait();
+      return smtp::TransportResult{};
+    });
+    while (queue.stats(smtp::Priority::kNormal).in_flight == 0) {
+      std::this_thread::yield();
+    }
+
+    std::mutex mutex;
+    std::string order;
+    const auto &record = [&](char lane) {
+      return [&, lane]() {
+        std::lock_guard<std::mutex> lock{mutex};
+        order += lane;
+        return smtp::TransportResult{};
+      };
+    };
+    for (int i = 0; i < 4; i++) {
+      queue.submit(record('b'), smtp::Priority::kBulk);
+    }
+    for (int i = 0; i < 6; i++) {
+      queue.submit(record('n'), smtp::Priority::kNormal);
+    }
+    queue.submit(record('i'), smtp::Priority::kInteractive);
+    REQUIRE(queue.stats(smtp::Priority::kBulk).queued == 4);
+
+    release.set_value();
+    queue.drain();
+    REQUIRE(order == "innnbnnnbbb");
+    REQUIRE(queue.stats(smtp::Priority::kNormal).sent == 7);
+    REQUIRE(queue.stats(smtp::Priority::kBulk).sent == 4);
+    REQUIRE(queue.stats(smtp::Priority::kInteractive).sent == 1);
+  }
+
+  TEST_CASE("Interactive mail does not wait behind a bulk blast test") {
+    smtp::SendQueueOptions options;
+    options.workers = 3;
+    options.reserved_interactive = 1;
+    smtp::SendQueue queue{options};
+
+    // Enough bulk mail to keep the shared workers busy for a couple of seconds
+    std::vector<std::future<smtp::TransportResult>> bulk;
+    for (int i = 0; i < 400; i++) {
+      bulk.push_back(queue.submit(fakeSend(10ms), smtp::Priority::kBulk));
+    }
+
+    for (int i = 0; i < 5; i++) {
+      const auto start = std::chrono::steady_clock::now();
+      std::future<smtp::TransportResult> urgent =
+          queue.submit(fakeSend(10ms), smtp::Priority::kInteractive);
+      REQUIRE(urgent.get().sent());
+      REQUIRE(std::chrono::steady_clock::now() - start < 500ms);
+    }
+    REQUIRE(queue.stats(smtp::Priority::kBulk).queued > 0);
+    REQUIRE(queue.stats(smtp::Priority::kInteractive).longest_wait < 100ms);
+
+    queue.drain();
+    REQUIRE(queue.stats(smtp::Priority::kBulk).sent == 400);
+  }
+
+  TEST_CASE("Failures and exceptions reach the caller test") {
+    smtp::SendQueue queue{{2, 1, 4, 1}};
+
+    std::future<smtp::TransportResult> refused = queue.submit([]() {
+      smtp::TransportResult result;
+      result.status = smtp::TransportStatus::kPermanentFailure;
+      return result;
+    });
+    std::future<smtp::TransportResult> thrown = queue.submit(
+        []() -> smtp::TransportResult { throw smtp::EmailException("[!] Too large"); },
+        smtp::Priority::kBulk);
+
+    REQUIRE(refused.get().status == smtp::TransportStatus::kPermanentFailure);
+    REQUIRE_THROWS_AS(thrown.get(), smtp::EmailException);
+    queue.drain();
+    REQUIRE(queue.stats(smtp::Priority::kNormal).failed == 1);
+    REQUIRE(queue.stats(smtp::Priority::kBulk).failed == 1);
+  }
+
+  TEST_CASE("Invalid queues test") {
+    REQUIRE_THROWS_AS(smtp::SendQueue({1, 1, 4, 1}), smtp::SendQueueException);
+    REQUIRE_THROWS_AS(smtp::SendQueue({0, 0, 4, 1}), smtp::SendQueueException);
+    REQUIRE_THROWS_AS(smtp::SendQueue({2, 1, 0, 1}), smtp::SendQueueException);
+  }
+}
@@ -0,0 +1,84 @@
+#include "doctest/doctest.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "mime/message_view.hpp"
+#include "mime/mime.hpp"
+
+static std::string readFile(std::FILE *file) {
+  std::string contents;
+  std::rewind(file);
+  for (int c = std::fgetc(file); c != EOF; c = std::fgetc(file)) {
+    contents.push_back(static_cast<char>(c));
+  }
+  return contents;
+}
+
+TEST_SUITE("Message view tests") {
+  TEST_CASE("Empty segments are skipped test") {
+    smtp::MessageView view;
+    view.append("Hello ");
+    view.append("");
+    view.append("world");
+
+    REQUIRE(view.count() == 2);
+    REQUIRE(view.size() == 11);
+    REQUIRE(view.segment(1) == "world");
+  }
+
+  TEST_CASE("Segments reference the original buffers test") {
+    smtp::Mime m("test_user_agent");
+    m.addMessage("This is a test message placed inside the body.");
+
+    const smtp::MessageView &view = m.view();
+    REQUIRE(view.count() == m.document().size());
+    for (std::size_t i = 0; i < view.count(); i++) {
+      REQUIRE(view.segment(i).data() == m.document()[i].data());
+    }
+    REQUIRE(view.size() == m.serializedSize());
+  }
+
+  TEST_CASE("Reading into small buffers test") {
+    const std::vector<std::string> segments{"To: someone\r\n", "a", "longer segment\r\n", "."};
+    std::string expected;
+    smtp::MessageView view;
+    for (const auto &segment : segments) {
+      view.append(segment);
+      expected += segment;
+    }
+
+    smtp::MessageReader reader{view};
+    std::string actual;
+    char buffer[3];
+    for (std::size_t n = reader.read(buffer, sizeof(buffer)); n > 0;
+         n = reader.read(buffer, sizeof(buffer))) {
+      actual.append(buffer, n);
+    }
+
+    REQUIRE(expected == actual);
+  }
+
+  TEST_CASE("Write more segments than writev accepts at once test") {
+    std::vector<std::string> segments;
+    for (int i = 0; i < 3000; i++) {
+      segments.push_back("line " + std::to_string(i) + "\r\n");
+    }
+
+    std::string expected;
+    smtp::MessageView view;
+    for (const auto &segment : segments) {
+      view.append(segment);
+      expected += segment;
+    }
+
+    std::FILE *file = std::tmpfile();
+    REQUIRE(file != nullptr);
+    REQUIRE(view.writeTo(fileno(file)) == expected.size());
+    REQUIRE(readFile(file) == expected);
+    std::fclose(file);
+  }
+}
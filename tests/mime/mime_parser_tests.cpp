@@ -0,0 +1,255 @@
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "doctest/doctest.h"
+
+#include "email/email.hpp"
+#include "mime/delivery_status.hpp"
+#include "mime/mime_parser.hpp"
+#include "test_helpers.hpp"
+
+// Records everything the parser reports, body pieces are joined up per entity
+class RecordingHandler : public smtp::MimeHandler {
+public:
+  std::vector<std::string> events;
+  std::vector<std::string> bodies;
+  std::vector<std::pair<std::string, std::string>> headers;
+  const char *input_begin = nullptr;
+  const char *input_end = nullptr;
+  std::size_t copied_pieces = 0;
+
+  void onEntityBegin(std::size_t depth) override {
+    events.push_back("begin " + std::to_string(depth));
+  }
+  void onHeader(std::string_view name, std::string_view value) override {
+    headers.emplace_back(name, value);
+  }
+  bool onHeadersEnd(const smtp::MimeEntity &entity) override {
+    events.push_back(std::string(entity.content_type) + " " + std::to_string(entity.depth));
+    if (!entity.isMultipart()) {
+      bodies.emplace_back();
+    }
+    return true;
+  }
+  void onBody(std::string_view data) override {
+    bodies.back().append(data);
+    const bool line_break = data == "\r\n";
+    if (input_begin && !line_break &&
+        (data.data() < input_begin || data.data() + data.size() > input_end)) {
+      copied_pieces++;
+    }
+  }
+  void onEntityEnd(std::size_t depth) override {
+    events.push_back("end " + std::to_string(depth));
+  }
+};
+
+static void parseInChunks(std::string_view message, std::size_t chunk_size,
+                          smtp::MimeHandler &handler) {
+  smtp::MimeParser parser{handler};
+  for (std::size_t pos = 0; pos < message.size(); pos += chunk_size) {
+    parser.feed(message.substr(pos, chunk_size));
+  }
+  parser.finish();
+}
+
+static const std::string kBounce =
+    "From: MAILER-DAEMON@mx.example.com\r\n"
+    "To: sender@company.com\r\n"
+    "Subject: Undelivered Mail Returned to Sender\r\n"
+    "MIME-Version: 1.0\r\n"
+    "Content-Type: multipart/report; report-type=delivery-status;\r\n"
+    "\tboundary=\"outer\"\r\n"
+    "\r\n"
+    "This is a MIME-encapsulated message.\r\n"
+    "\r\n"
+    "--outer\r\n"
+    "Content-Type: text/plain; charset=us-ascii\r\n"
+    "\r\n"
+    "Your message could not be delivered.\r\n"
+    "--outer\r\n"
+    "Content-Type: message/delivery-status\r\n"
+    "\r\n"
+    "Reporting-MTA: dns; mx.example.com\r\n"
+    "Arrival-Date: Tue, 25 Jul 2023 07:21:05 +1100\r\n"
+    "\r\n"
+    "Final-Recipient: rfc822; gone@example.com\r\n"
+    "Original-Recipient: rfc822;Gone@Example.com\r\n"
+    "Action: Failed\r\n"
+    "Status: 5.1.1\r\n"
+    "Remote-MTA: dns; inbound.example.com\r\n"
+    "Diagnostic-Code: smtp; 550 5.1.1 <gone@example.com>:\r\n"
+    "    Recipient address rejected: User unknown\r\n"
+    "\r\n"
+    "Final-Recipient: rfc822; busy@example.com\r\n"
+    "Action: delayed\r\n"
+    "Status: 4.2.2 (mailbox full)\r\n"
+    "\r\n"
+    "--outer\r\n"
+    "Content-Type: message/rfc822\r\n"
+    "\r\n"
+    "From: sender@company.com\r\n"
+    "To: gone@example.com\r\n"
+    "Content-Type: multipart/mixed; boundary=\"inner\"\r\n"
+    "\r\n"
+    "--inner\r\n"
+    "Content-Type: text/plain\r\n"
+    "\r\n"
+    "Hello\r\n"
+    "--inner--\r\n"
+    "--outer--\r\n"
+    "Epilogue\r\n";
+
+TEST_SUITE("MIME parser tests") {
+  TEST_CASE("Parses a rendered email test") {
+    smtp::EmailParams params{
+        "user",                                    // smtp username
+        "password",                                // smtp password
+        "hostname",                                // smtp server
+        "to@gmail.com",                            // to
+        "from@gmail.com",                          // from
+        "",                                        // cc
+        "Report",                                  // subject
+        "Caf\xc3\xa9 report\r\n\r\nSee below\r\n", // body
+        &test::kFixedDateTime                      // optional datetime
+    };
+    smtp::Email email{params};
+
+    std::vector<uint8_t> binary(10000);
+    for (std::size_t i = 0; i < binary.size(); i++) {
+      binary[i] = static_cast<uint8_t>(i * 7);
+    }
+    smtp::Attachment base64_attachment;
+    base64_attachment.setContents(binary);
+    base64_attachment.setFilePath("/path/data.bin");
+    email.addAttachment(base64_attachment);
+
+    const std::string text(3000, 'x');
+    smtp::Attachment qp_attachment;
+    qp_attachment.setContents({text.begin(), text.end()});
+    qp_attachment.setFilePath("/path/log.txt");
+    email.addAttachment(qp_attachment);
+
+    std::stringstream ss;
+    ss << email;
+    const std::string &message = ss.str();
+
+    RecordingHandler expected;
+    parseInChunks(message, message.size(), expected);
+    // Every part ends with a delimiter, so the closing delimiter follows an empty last part
+    const std::vector<std::string> events{
+        "begin 0", "multipart/mixed 0", "begin 1", "text/plain 1", "end 1",
+        "begin 1", "application/octet-stream 1", "end 1",
+        "begin 1", "application/octet-stream 1", "end 1",
+        "begin 1", "text/plain 1", "end 1", "end 0"};
+    REQUIRE(expected.events == events);
+    REQUIRE(expected.bodies.size() == 4);
+    REQUIRE(expected.bodies[0] == std::string(params.body));
+    REQUIRE(expected.bodies[1] == std::string(binary.begin(), binary.end()));
+    REQUIRE(expected.bodies[2] == text);
+    REQUIRE(expected.bodies[3].empty());
+
+    // Splitting the message anywhere makes no difference to what is parsed
+    for (const std::size_t chunk_size : {1, 2, 3, 7, 64, 1000}) {
+      RecordingHandler handler;
+      parseInChunks(message, chunk_size, handler);
+      REQUIRE(handler.events == expected.events);
+      REQUIRE(handler.bodies == expected.bodies);
+      REQUIRE(handler.headers == expected.headers);
+    }
+  }
+
+  TEST_CASE("Headers are unfolded and nested multiparts are followed test") {
+    RecordingHandler handler;
+    handler.input_begin = kBounce.data();
+    handler.input_end = kBounce.data() + kBounce.size();
+    parseInChunks(kBounce, kBounce.size(), handler);
+
+    const std::vector<std::string> events{
+        "begin 0", "multipart/report 0", "begin 1", "text/plain 1", "end 1",
+        "begin 1", "message/delivery-status 1", "end 1",
+        "begin 1", "message/rfc822 1", "end 1", "end 0"};
+    REQUIRE(handler.events == events);
+    REQUIRE(handler.headers[4].first == "Content-Type");
+    REQUIRE(handler.headers[4].second ==
+            "multipart/report; report-type=delivery-status;\tboundary=\"outer\"");
+    REQUIRE(handler.bodies[0] == "Your message could not be delivered.");
+
+    // Bodies that are not encoded are passed on without being copied, apart from the line breaks
+    // between lines that are handled separately
+    REQUIRE(handler.copied_pieces == 0);
+  }
+
+  TEST_CASE("Delivery status is extracted from a bounce test") {
+    for (const std::size_t chunk_size : {std::size_t{1}, std::size_t{5}, kBounce.size()}) {
+      smtp::DeliveryStatusHandler handler;
+      parseInChunks(kBounce, chunk_size, handler);
+      REQUIRE(handler.found());
+
+      const smtp::DeliveryStatus &status = handler.status();
+      REQUIRE(status.reporting_mta == "mx.example.com");
+      REQUIRE(status.recipients.size() == 2);
+
+      const smtp::RecipientStatus &gone = status.recipients[0];
+      REQUIRE(gone.final_recipient == "gone@example.com");
+      REQUIRE(gone.original_recipient == "Gone@Example.com");
+      REQUIRE(gone.action == "failed");
+      REQUIRE(gone.status == "5.1.1");
+      REQUIRE(gone.remote_mta == "inbound.example.com");
+      REQUIRE(gone.diagnostic_code ==
+              "smtp; 550 5.1.1 <gone@example.com>:    Recipient address rejected: User unknown");
+      REQUIRE(gone.isPermanentFailure());
+
+      const smtp::RecipientStatus &busy = status.recipients[1];
+      REQUIRE(busy.final_recipient == "busy@example.com");
+      REQUIRE(busy.status == "4.2.2");
+      REQUIRE_FALSE(busy.isPermanentFailure());
+    }
+
+    smtp::DeliveryStatus status;
+    REQUIRE(smtp::parseDeliveryStatus(kBounce, status));
+    REQUIRE_FALSE(smtp::parseDeliveryStatus("Subject: hi\r\n\r\nNot a bounce\r\n", status));
+  }
+
+  TEST_CASE("Encoded and oddly formatted bodies test") {
+    const std::string message = "Content-Type: multipart/mixed; boundary=b\n"
+                                "\n"
+                                "--b\n"
+                                "Content-Transfer-Encoding: quoted-printable\n"
+                                "\n"
+                                "caf=C3=A9 =\n"
+                                "soft  \n"
+                                "--not-a-delimiter\n"
+                                "--b   \n"
+                                "Content-Transfer-Encoding: BASE64\n"
+                                "\n"
+                                "aGVs\n"
+                                "bG8=\n"
+                                "--b--";
+
+    for (const std::size_t chunk_size : {std::size_t{1}, std::size_t{4}, message.size()}) {
+      RecordingHandler handler;
+      parseInChunks(message, chunk_size, handler);
+      REQUIRE(handler.bodies.size() == 2);
+      REQUIRE(handler.bodies[0] == "caf\xc3\xa9 soft\r\n--not-a-delimiter");
+      REQUIRE(handler.bodies[1] == "hello");
+    }
+  }
+
+  TEST_CASE("Invalid messages test") {
+    std::string nested;
+    for (std::size_t i = 0; i <= smtp::MimeParser::kMaxDepth; i++) {
+      nested += "Content-Type: multipart/mixed; boundary=b" + std::to_string(i) + "\r\n\r\n--b" +
+                std::to_string(i) + "\r\n";
+    }
+    RecordingHandler handler;
+    smtp::MimeParser parser{handler};
+    REQUIRE_THROWS_AS(parser.feed(nested), smtp::MimeParserException);
+
+    smtp::MimeParser finished{handler};
+    finished.finish();
+    REQUIRE_THROWS_AS(finished.feed("Subject: late\r\n"), smtp::MimeParserException);
+  }
+}
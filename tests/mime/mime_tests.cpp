@@ -2,8 +2,10 @@
 
 #include <fstream>
 #include <iostream>
+#include <memory_resource>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "mime/mime.hpp"
 #include "utils/base64/base64.hpp"
@@ -21,6 +23,17 @@ static std::string getLargeData() {
   return Base64::Base64Encode(s);
 }
 
+// The line that separates the parts of m
+static std::string delimiter(const smtp::Mime &m) { return "--" + std::string(m.boundary()); }
+
+static std::string replaceAll(std::string text, std::string_view from, std::string_view to) {
+  for (std::size_t pos = text.find(from); pos != std::string::npos;
+       pos = text.find(from, pos + to.size())) {
+    text.replace(pos, from.size(), to);
+  }
+  return text;
+}
+
 static const std::string &kSmallData = "VGhpcyBpcyBzb21lIHRlc3QgZGF0YSBmb3IgdGhlIGZpbGUu";
 static const std::string &kBinaryData = "kBKHhUNlEBJlkDQjJWVBQkP5";
 
@@ -35,9 +48,9 @@ TEST_SUITE("Mime tests") {
                                   "MIME-Version: 1.0\r\n"
                                   "Content-Type: multipart/mixed;\r\n"
                                   " boundary=\"" +
-                                  smtp::Mime::kBoundaryDeclare + "\"" + "\r\n" +
+                                  std::string(m.boundary()) + "\"" + "\r\n" +
                                   "\r\nThis is a multi-part message in MIME format.\r\n" +
-                                  smtp::Mime::kBoundary + "\r\n";
+                                  delimiter(m) + "\r\n";
     REQUIRE(expected == actual);
   }
 
@@ -54,14 +67,14 @@ TEST_SUITE("Mime tests") {
                                   "MIME-Version: 1.0\r\n"
                                   "Content-Type: multipart/mixed;\r\n"
                                   " boundary=\"" +
-                                  smtp::Mime::kBoundaryDeclare + "\"" + "\r\n" +
+                                  std::string(m.boundary()) + "\"" + "\r\n" +
                                   "\r\nThis is a multi-part message in MIME format.\r\n" +
-                                  smtp::Mime::kBoundary +
+                                  delimiter(m) +
                                   "\r\n"
                                   "Content-Type: text/plain; charset=utf-8; format=flowed\r\n"
                                   "Content-Transfer-Encoding: 7bit\r\n"
                                   "\r\n" +
-                                  message + "\r\n" + smtp::Mime::kBoundary + "\r\n";
+                                  message + "\r\n" + delimiter(m) + "\r\n";
 
     REQUIRE(expected == actual);
   }
@@ -80,9 +93,9 @@ TEST_SUITE("Mime tests") {
                                   "MIME-Version: 1.0\r\n"
                                   "Content-Type: multipart/mixed;\r\n"
                                   " boundary=\"" +
-                                  smtp::Mime::kBoundaryDeclare + "\"" + "\r\n" +
+                                  std::string(m.boundary()) + "\"" + "\r\n" +
                                   "\r\nThis is a multi-part message in MIME format.\r\n" +
-                                  smtp::Mime::kBoundary +
+                                  delimiter(m) +
                                   "\r\n"
                                   "Content-Type: application/octet-stream\r\n"
                                   "Content-Transfer-Encoding: base64\r\n"
@@ -92,7 +105,7 @@ TEST_SUITE("Mime tests") {
                                   "\r\n"
                                   "VGhpcyBpcyBzb21lIHRlc3QgZGF0YSBmb3IgdGhlIGZpbGUu"
                                   "\r\n\r\n" +
-                                  smtp::Mime::kBoundary + "\r\n";
+                                  delimiter(m) + "\r\n";
 
     REQUIRE(expected == actual);
   }
@@ -111,9 +124,9 @@ TEST_SUITE("Mime tests") {
                                   "MIME-Version: 1.0\r\n"
                                   "Content-Type: multipart/mixed;\r\n"
                                   " boundary=\"" +
-                                  smtp::Mime::kBoundaryDeclare + "\"" + "\r\n" +
+                                  std::string(m.boundary()) + "\"" + "\r\n" +
                                   "\r\nThis is a multi-part message in MIME format.\r\n" +
-                                  smtp::Mime::kBoundary +
+                                  delimiter(m) +
                                   "\r\n"
                                   "Content-Type: application/octet-stream\r\n"
                                   "Content-Transfer-Encoding: base64\r\n"
@@ -123,7 +136,7 @@ TEST_SUITE("Mime tests") {
                                   "\r\n"
                                   "kBKHhUNlEBJlkDQjJWVBQkP5\r\n"
                                   "\r\n" +
-                                  smtp::Mime::kBoundary + "\r\n";
+                                  delimiter(m) + "\r\n";
 
     REQUIRE(expected == actual);
   }
@@ -144,9 +157,9 @@ TEST_SUITE("Mime tests") {
                                   "MIME-Version: 1.0\r\n"
                                   "Content-Type: multipart/mixed;\r\n"
                                   " boundary=\"" +
-                                  smtp::Mime::kBoundaryDeclare + "\"" + "\r\n" +
+                                  std::string(m.boundary()) + "\"" + "\r\n" +
                                   "\r\nThis is a multi-part message in MIME format.\r\n" +
-                                  smtp::Mime::kBoundary +
+                                  delimiter(m) +
                                   "\r\n"
                                   "Content-Type: application/octet-stream\r\n"
                                   "Content-Transfer-Encoding: base64\r\n"
@@ -156,7 +169,7 @@ TEST_SUITE("Mime tests") {
                                   "\r\n"
                                   "VGhpcyBpcyBzb21lIHRlc3QgZGF0YSBmb3IgdGhlIGZpbGUu\r\n"
                                   "\r\n" +
-                                  smtp::Mime::kBoundary +
+                                  delimiter(m) +
                                   "\r\n"
                                   "Content-Type: application/octet-stream\r\n"
                                   "Content-Transfer-Encoding: base64\r\n"
@@ -166,7 +179,7 @@ TEST_SUITE("Mime tests") {
                                   "\r\n"
                                   "kBKHhUNlEBJlkDQjJWVBQkP5\r\n"
                                   "\r\n" +
-                                  smtp::Mime::kBoundary + "\r\n";
+                                  delimiter(m) + "\r\n";
 
     REQUIRE(expected == actual);
   }
@@ -187,8 +200,8 @@ TEST_SUITE("Mime tests") {
         "MIME-Version: 1.0\r\n"
         "Content-Type: multipart/mixed;\r\n"
         " boundary=\"" +
-        smtp::Mime::kBoundaryDeclare + "\"" + "\r\n" +
-        "\r\nThis is a multi-part message in MIME format.\r\n" + smtp::Mime::kBoundary +
+        std::string(m.boundary()) + "\"" + "\r\n" +
+        "\r\nThis is a multi-part message in MIME format.\r\n" + delimiter(m) +
         "\r\n"
         "Content-Type: application/octet-stream\r\n"
         "Content-Transfer-Encoding: base64\r\n"
@@ -270,8 +283,89 @@ TEST_SUITE("Mime tests") {
         "Dx8vP09fb3"
         "+Pn6+/z9/v8=\r\n"
         "\r\n" +
-        smtp::Mime::kBoundary + "\r\n";
+        delimiter(m) + "\r\n";
 
     REQUIRE(expected == actual);
   }
+
+  TEST_CASE("Serialized size test") {
+    const std::string &message = "This is a test message placed inside the body.";
+    const std::string &kLargeBinaryData = getLargeData();
+
+    smtp::Mime m("test_user_agent");
+    REQUIRE(m.serializedSize() == smtp::Mime::headerSize("test_user_agent", m.boundary()));
+
+    m.addMessage(message);
+    m.addAttachment("/path/test.txt", kSmallData);
+    m.addAttachment("/path/large.bin", kLargeBinaryData);
+
+    std::stringstream ss;
+    ss << m;
+
+    // 36 and 2048 are the sizes of the attachments before they were encoded
+    const std::string_view boundary = m.boundary();
+    const std::size_t expected =
+        smtp::Mime::headerSize("test_user_agent", boundary) +
+        smtp::Mime::messageSize(smtp::chooseTextEncoding(message), boundary) +
+        smtp::Mime::attachmentSize("/path/test.txt", 36, boundary) +
+        smtp::Mime::attachmentSize("/path/large.bin", 2048, boundary);
+    REQUIRE(m.serializedSize() == ss.str().size());
+    REQUIRE(expected == ss.str().size());
+  }
+
+  TEST_CASE("Build into an arena test") {
+    const std::string &message = "This is a test message placed inside the body.";
+
+    smtp::Mime heap_mime("test_user_agent");
+    heap_mime.addMessage(message);
+    heap_mime.addAttachment("/path/test.txt", kSmallData);
+
+    // The null upstream makes any allocation that does not fit inside the buffer throw
+    std::vector<std::byte> buffer(64 * 1024);
+    std::pmr::monotonic_buffer_resource arena{buffer.data(), buffer.size(),
+                                              std::pmr::null_memory_resource()};
+    smtp::Mime arena_mime("test_user_agent", &arena);
+    arena_mime.addMessage(message);
+    arena_mime.addAttachment("/path/test.txt", kSmallData);
+
+    std::stringstream heap_ss;
+    heap_ss << heap_mime;
+    std::stringstream arena_ss;
+    arena_ss << arena_mime;
+
+    REQUIRE(heap_ss.str() ==
+            replaceAll(arena_ss.str(), arena_mime.boundary(), heap_mime.boundary()));
+    REQUIRE(arena_mime.document().get_allocator().resource() == &arena);
+  }
+
+  TEST_CASE("Random boundary test") {
+    const smtp::Mime first("test_user_agent");
+    const smtp::Mime second("test_user_agent");
+
+    REQUIRE(first.boundary().size() == smtp::Mime::kBoundaryLength);
+    REQUIRE(first.boundary().substr(0, 10) == "----------");
+    REQUIRE(first.boundary() != second.boundary());
+  }
+
+  TEST_CASE("Message containing the boundary test") {
+    smtp::Mime m("test_user_agent");
+    m.addAttachment("/path/test.txt", kSmallData);
+
+    // A forwarded message that happens to contain this document's boundary
+    const std::string old_boundary{m.boundary()};
+    const std::string &message = "Forwarded:\r\n--" + old_boundary + "\r\nHello";
+    m.addMessage(message);
+
+    REQUIRE(m.boundary() != old_boundary);
+    REQUIRE(!smtp::Mime::collidesWithBoundary(message, m.boundary()));
+
+    // Every delimiter rendered before the boundary was replaced now uses the new one
+    std::stringstream ss;
+    ss << m;
+    const std::string &actual = ss.str();
+    REQUIRE(replaceAll(actual, message, "").find(old_boundary) == std::string::npos);
+    REQUIRE(actual.find(" boundary=\"" + std::string(m.boundary()) + "\"\r\n") !=
+            std::string::npos);
+    REQUIRE(m.serializedSize() == actual.size());
+  }
 }
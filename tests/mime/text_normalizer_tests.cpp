@@ -0,0 +1,73 @@
+#include <string>
+#include <string_view>
+
+#include "doctest/doctest.h"
+
+#include "mime/text_normalizer.hpp"
+
+static std::string normalize(std::string_view text, bool dot_stuff, std::size_t chunk_size) {
+  smtp::TextNormalizer normalizer{dot_stuff};
+  std::string result;
+  for (std::size_t pos = 0; pos < text.size(); pos += chunk_size) {
+    normalizer.process(text.substr(pos, chunk_size),
+                       [&result](std::string_view piece) { result.append(piece); });
+  }
+  REQUIRE(normalizer.stats().size == result.size());
+  return result;
+}
+
+TEST_SUITE("Text normalizer tests") {
+  TEST_CASE("Line breaks are converted to CRLF test") {
+    const std::string &text = "unix\nmac\rwindows\r\nmixed\n\r\n\r\rend";
+    const std::string &expected = "unix\r\nmac\r\nwindows\r\nmixed\r\n\r\n\r\n\r\nend";
+
+    // Splitting the text into chunks must not change the output, in particular when a CRLF is
+    // split between two chunks.
+    for (std::size_t chunk_size = 1; chunk_size <= text.size(); chunk_size++) {
+      REQUIRE(normalize(text, false, chunk_size) == expected);
+    }
+  }
+
+  TEST_CASE("Leading periods are dot-stuffed test") {
+    const std::string &text = ".first\r\nmiddle.\n.\r\n..two\r\n";
+    REQUIRE(normalize(text, true, text.size()) == "..first\r\nmiddle.\r\n..\r\n...two\r\n");
+    REQUIRE(normalize(text, true, 1) == "..first\r\nmiddle.\r\n..\r\n...two\r\n");
+    REQUIRE(normalize(text, false, text.size()) == ".first\r\nmiddle.\r\n.\r\n..two\r\n");
+  }
+
+  TEST_CASE("Text that needs no changes is passed through test") {
+    const std::string &text = "A line that is already fine\r\nand another\r\n";
+    smtp::TextNormalizer normalizer;
+
+    std::size_t num_pieces = 0;
+    normalizer.process(text, [&text, &num_pieces](std::string_view piece) {
+      // Runs of text are views of the input rather than copies
+      if (piece != "\r\n") {
+        REQUIRE(piece.data() >= text.data());
+        REQUIRE(piece.data() < text.data() + text.size());
+      }
+      num_pieces++;
+    });
+    REQUIRE(num_pieces == 4);
+    REQUIRE(normalizer.stats().size == text.size());
+  }
+
+  TEST_CASE("Long lines are counted test") {
+    const std::string &limit = std::string(smtp::TextNormalizer::kMaxLineLength, 'a');
+    REQUIRE(smtp::TextNormalizer::measure(limit + "\r\n" + limit).long_lines == 0);
+
+    const std::string &text = limit + "a\r\nshort\n" + limit + limit + "\r\n";
+    REQUIRE(smtp::TextNormalizer::measure(text).long_lines == 2);
+
+    // The dot added by dot-stuffing also counts towards the length of the line
+    REQUIRE(smtp::TextNormalizer::measure("." + limit.substr(1), false).long_lines == 0);
+    REQUIRE(smtp::TextNormalizer::measure("." + limit, true).long_lines == 1);
+
+    // The count is the same when a long line arrives in pieces
+    smtp::TextNormalizer normalizer;
+    for (std::size_t i = 0; i < text.size(); i += 100) {
+      normalizer.process(std::string_view{text}.substr(i, 100), [](std::string_view) {});
+    }
+    REQUIRE(normalizer.stats().long_lines == 2);
+  }
+}
@@ -0,0 +1,67 @@
+#include <string>
+
+#include "doctest/doctest.h"
+
+#include "mime/transfer_encoding.hpp"
+#include "utils/base64/base64.hpp"
+#include "utils/quoted_printable/quoted_printable.hpp"
+
+TEST_SUITE("Transfer encoding tests") {
+  TEST_CASE("Content is classified in a single scan test") {
+    const smtp::ContentStats &stats = smtp::scanContent("a=b\nline two\r\n\xc3\xa9\r");
+    REQUIRE(stats.size == 17);
+    REQUIRE(stats.eight_bit == 2);
+    REQUIRE(stats.equals == 1);
+    REQUIRE(stats.controls == 0);
+    REQUIRE(stats.bare_line_breaks == 2);
+    REQUIRE(stats.longest_line == 8);
+
+    REQUIRE(smtp::classifyContent(smtp::scanContent("plain text\r\n")) ==
+            smtp::ContentClass::kSevenBit);
+    REQUIRE(smtp::classifyContent(smtp::scanContent(std::string(999, 'a'))) ==
+            smtp::ContentClass::kMostlyAscii);
+    REQUIRE(smtp::classifyContent(smtp::scanContent("Caf\xc3\xa9 au lait, merci")) ==
+            smtp::ContentClass::kMostlyAscii);
+    REQUIRE(smtp::classifyContent(smtp::scanContent("\xd0\x9f\xd1\x80\xd0\xb8")) ==
+            smtp::ContentClass::kEightBit);
+    REQUIRE(smtp::classifyContent(smtp::scanContent(std::string{"a\0b", 3})) ==
+            smtp::ContentClass::kBinary);
+  }
+
+  TEST_CASE("Scanning gives the same result for every alignment test") {
+    // Long enough that the vectorised loop is used, with the interesting bytes moving across the
+    // edges of the blocks
+    for (std::size_t offset = 0; offset < 40; offset++) {
+      std::string text(offset, 'x');
+      text += "\r\n=\xff\r";
+      text += std::string(40, 'y');
+
+      const smtp::ContentStats &stats = smtp::scanContent(text);
+      REQUIRE(stats.eight_bit == 1);
+      REQUIRE(stats.equals == 1);
+      REQUIRE(stats.bare_line_breaks == 1);
+      REQUIRE(stats.longest_line == std::max<std::size_t>(offset, 40));
+    }
+  }
+
+  TEST_CASE("The smallest encoding is chosen test") {
+    REQUIRE(smtp::chooseTextEncoding("hello\nworld").encoding == smtp::TransferEncoding::k7Bit);
+    REQUIRE(smtp::chooseTextEncoding("hello\nworld").size == 12);
+
+    std::string csv;
+    for (int row = 0; row < 1000; row++) {
+      // RFC 4180 rows end with a CRLF
+      csv += std::to_string(row) + ",widget,3.50,\"in stock\"\r\n";
+    }
+    const smtp::EncodingChoice &choice = smtp::chooseAttachmentEncoding(csv);
+    REQUIRE(choice.encoding == smtp::TransferEncoding::kQuotedPrintable);
+    REQUIRE(choice.size ==
+            smtp::QuotedPrintable::EncodedSize(csv, smtp::QuotedPrintable::Mode::kBinary));
+    // Base64 would be at least a quarter larger
+    REQUIRE(choice.size * 5 < smtp::Base64::EncodedSize(csv.size()) * 4);
+
+    const std::string binary = {'\x00', '\x01', '\x02', '\xff'};
+    REQUIRE(smtp::chooseAttachmentEncoding(binary).encoding == smtp::TransferEncoding::kBase64);
+    REQUIRE(smtp::chooseAttachmentEncoding(binary).size == 8);
+  }
+}
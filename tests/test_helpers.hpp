@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "date_time/date_time.hpp"
+#include "mime/message_view.hpp"
+
+// Helpers shared by the tests of several modules
+namespace test {
+
+// Always the same date, so that rendered emails can be compared byte for byte
+class FixedDateTime : public smtp::DateTime {
+public:
+  std::string getTimestamp() const override { return "25/07/2023 07:21:05 +1100"; }
+};
+
+inline const FixedDateTime kFixedDateTime;
+
+// The segments of a rendered message joined into one string
+inline std::string join(const smtp::MessageView &view) {
+  std::string result;
+  for (std::size_t i = 0; i < view.count(); i++) {
+    result.append(view.segment(i));
+  }
+  return result;
+}
+
+} // namespace test
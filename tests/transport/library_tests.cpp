@@ -0,0 +1,146 @@
+#include <chrono>
+#include <string>
+
+#include "doctest/doctest.h"
+
+#include "email/email.hpp"
+#include "email/send_queue.hpp"
+#include "mock_smtp_server.hpp"
+#include "transport/library.hpp"
+
+using namespace std::chrono_literals;
+
+static bench::MockServerOptions loginOptions() {
+  bench::MockServerOptions options;
+  options.tls = true;
+  options.user = "user";
+  options.password = "password";
+  return options;
+}
+
+static smtp::EmailParams paramsFor(const bench::MockSmtpServer &server) {
+  return {"user",        "password", server.url(), "bigboss@example.com", "tully@example.com", "",
+          "Prewarmed", "Hello"};
+}
+
+TEST_SUITE("Library tests") {
+  TEST_CASE("Sends reuse the connections of an initialized library test") {
+    const bench::MockSmtpServer server{loginOptions()};
+    const smtp::Email email{paramsFor(server)};
+
+    // Without the library every send connects and logs in again
+    REQUIRE_FALSE(smtp::initialized());
+    REQUIRE(email.send().sent());
+    REQUIRE(email.send().sent());
+    REQUIRE(server.stats().connections == 2);
+
+    const smtp::LibraryGuard library;
+    REQUIRE(smtp::initialized());
+    for (int i = 0; i < 3; i++) {
+      REQUIRE(email.send().sent());
+    }
+    REQUIRE(server.stats().connections == 3);
+    REQUIRE(server.stats().logins == 3);
+    REQUIRE(server.stats().messages == 5);
+  }
+
+  TEST_CASE("Prewarmed connections are used by the first sends test") {
+    const bench::MockSmtpServer server{loginOptions()};
+    smtp::LibraryOptions options;
+    options.max_idle_connections = 3;
+    const smtp::LibraryGuard library{options};
+
+    const smtp::Credentials credentials{"user", "password", server.url()};
+    REQUIRE(smtp::prewarm(credentials, 5) == 3);
+    REQUIRE(server.stats().connections == 3);
+    REQUIRE(server.stats().logins == 3);
+
+    const smtp::Email email{paramsFor(server)};
+    for (int i = 0; i < 3; i++) {
+      REQUIRE(email.send().sent());
+    }
+    REQUIRE(server.stats().connections == 3);
+    REQUIRE(server.stats().messages == 3);
+
+    // Connections that cannot be opened are not counted
+    const smtp::Credentials wrong{"user", "wrong", server.url()};
+    REQUIRE(smtp::prewarm(wrong, 1) == 0);
+  }
+
+  TEST_CASE("Idle connections expire test") {
+    const bench::MockSmtpServer server{loginOptions()};
+    smtp::LibraryOptions options;
+    options.max_idle_time = 0s;
+    const smtp::LibraryGuard library{options};
+
+    const smtp::Email email{paramsFor(server)};
+    REQUIRE(email.send().sent());
+    REQUIRE(email.send().sent());
+    REQUIRE(server.stats().connections == 2);
+  }
+
+  TEST_CASE("Initialization nests test") {
+    REQUIRE_THROWS_AS(smtp::prewarm({"user", "password", "smtps://127.0.0.1:1"}, 1),
+                      smtp::LibraryException);
+
+    smtp::initialize();
+    smtp::initialize();
+    smtp::shutdown();
+    REQUIRE(smtp::initialized());
+    smtp::shutdown();
+    REQUIRE_FALSE(smtp::initialized());
+  }
+
+  TEST_CASE("Queued and in flight sends hold a share of the memory budget test") {
+    bench::MockServerOptions server_options = loginOptions();
+    server_options.reply_delay = 50ms;
+    const bench::MockSmtpServer server{server_options};
+    const smtp::Email email{paramsFor(server)};
+
+    smtp::LibraryOptions options;
+    options.memory_budget = 2 * email.serializedSize();
+    options.reject_over_budget = true;
+    const smtp::LibraryGuard library{options};
+    const smtp::MemoryBudget *budget = smtp::memoryBudget();
+    REQUIRE(budget != nullptr);
+
+    {
+      smtp::SendQueueOptions queue_options;
+      queue_options.workers = 3;
+      smtp::SendQueue queue{queue_options};
+      std::future<smtp::TransportResult> first = queue.submit(email);
+      std::future<smtp::TransportResult> second = queue.submit(email, smtp::Priority::kBulk);
+      REQUIRE(budget->stats().in_use == 2 * email.serializedSize());
+      REQUIRE_THROWS_AS(queue.submit(email), smtp::MemoryBudgetException);
+
+      // Interactive mail goes out even though the budget is used up
+      std::future<smtp::TransportResult> urgent =
+          queue.submit(email, smtp::Priority::kInteractive);
+      REQUIRE(first.get().sent());
+      REQUIRE(second.get().sent());
+      REQUIRE(urgent.get().sent());
+    }
+
+    const smtp::MemoryBudgetStats &stats = budget->stats();
+    REQUIRE(stats.in_use == 0);
+    REQUIRE(stats.peak == 2 * email.serializedSize());
+    REQUIRE(stats.admitted == 2);
+    REQUIRE(stats.rejected == 2);
+
+    // A send on its own takes its share until it returns
+    REQUIRE(email.send().sent());
+    REQUIRE(budget->stats().admitted == 3);
+    REQUIRE(budget->stats().in_use == 0);
+  }
+
+  TEST_CASE("A message larger than the whole memory budget is refused test") {
+    const bench::MockSmtpServer server{loginOptions()};
+    const smtp::Email email{paramsFor(server)};
+
+    smtp::LibraryOptions options;
+    options.memory_budget = email.serializedSize() - 1;
+    const smtp::LibraryGuard library{options};
+    REQUIRE_THROWS_AS(email.send(), smtp::MemoryBudgetException);
+    REQUIRE(server.stats().connections == 0);
+  }
+}
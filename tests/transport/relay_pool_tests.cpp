@@ -0,0 +1,127 @@
+#include <chrono>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "doctest/doctest.h"
+
+#include "transport/relay_pool.hpp"
+
+using namespace std::chrono_literals;
+
+static const std::vector<std::string_view> kRelays{"smtps://a.example.com:465",
+                                                   "smtps://b.example.com:465",
+                                                   "smtps://c.example.com:465"};
+
+TEST_SUITE("Relay pool tests") {
+  TEST_CASE("The fastest relay is preferred test") {
+    smtp::RelayPool pool{kRelays};
+    const smtp::RelayPool::Clock::time_point now{};
+
+    // Every relay is tried once before any has a latency
+    for (const std::size_t expected : {0, 1, 2}) {
+      const std::optional<std::size_t> &relay = pool.acquire(0, now);
+      REQUIRE(relay == expected);
+    }
+    pool.release(0, smtp::TransportStatus::kSent, 30ms, now);
+    pool.release(1, smtp::TransportStatus::kSent, 10ms, now);
+    pool.release(2, smtp::TransportStatus::kSent, 20ms, now);
+
+    REQUIRE(pool.acquire(0, now) == 1);
+    // With a send in flight the second fastest relay scores better
+    REQUIRE(pool.acquire(0, now) == 2);
+    pool.release(1, smtp::TransportStatus::kSent, 10ms, now);
+    pool.release(2, smtp::TransportStatus::kSent, 20ms, now);
+
+    // Relays that were already tried are skipped
+    REQUIRE(pool.acquire(uint64_t{1} << 1, now) == 2);
+    pool.release(2, smtp::TransportStatus::kSent, 20ms, now);
+    REQUIRE_FALSE(pool.acquire(0b111, now).has_value());
+
+    // A relay that slows down loses its place once the average catches up
+    for (int i = 0; i < 5; i++) {
+      REQUIRE(pool.acquire(0b101, now) == 1);
+      pool.release(1, smtp::TransportStatus::kSent, 100ms, now);
+    }
+    REQUIRE(pool.acquire(0, now) == 2);
+    pool.release(2, smtp::TransportStatus::kSent, 20ms, now);
+
+    const std::vector<smtp::RelayStats> &stats = pool.stats();
+    REQUIRE(stats.size() == 3);
+    REQUIRE(stats[0].url == kRelays[0]);
+    REQUIRE(stats[0].latency == 30ms);
+    REQUIRE(stats[1].sent == 7);
+    REQUIRE(stats[1].latency > 50ms);
+    REQUIRE(stats[2].in_flight == 0);
+  }
+
+  TEST_CASE("A failing relay has its circuit opened test") {
+    smtp::RelayOptions options;
+    options.failure_threshold = 2;
+    options.open_duration = 10s;
+    const std::vector<std::string_view> relays{kRelays[0], kRelays[1]};
+    smtp::RelayPool pool{relays, options};
+    const smtp::RelayPool::Clock::time_point now{};
+
+    REQUIRE(pool.acquire(0, now) == 0);
+    pool.release(0, smtp::TransportStatus::kSent, 1ms, now);
+    REQUIRE(pool.acquire(0, now) == 1);
+    pool.release(1, smtp::TransportStatus::kSent, 5ms, now);
+
+    // A refused message is not held against the relay
+    REQUIRE(pool.acquire(0, now) == 0);
+    pool.release(0, smtp::TransportStatus::kPermanentFailure, 1ms, now);
+    for (int i = 0; i < 2; i++) {
+      REQUIRE(pool.acquire(0, now) == 0);
+      pool.release(0, smtp::TransportStatus::kTransientFailure, 1ms, now);
+    }
+    REQUIRE(pool.stats()[0].state == smtp::CircuitState::kOpen);
+    REQUIRE(pool.stats()[0].failures == 2);
+    REQUIRE(pool.acquire(0, now + 9s) == 1);
+    pool.release(1, smtp::TransportStatus::kSent, 5ms, now);
+
+    // Once the open period is over a single trial send is let through
+    REQUIRE(pool.acquire(0, now + 10s) == 0);
+    REQUIRE(pool.stats()[0].state == smtp::CircuitState::kHalfOpen);
+    REQUIRE(pool.acquire(0, now + 10s) == 1);
+    pool.release(1, smtp::TransportStatus::kSent, 5ms, now + 10s);
+
+    // Failing the trial opens the circuit again straight away
+    pool.release(0, smtp::TransportStatus::kConnectFailed, 1ms, now + 10s);
+    REQUIRE(pool.stats()[0].state == smtp::CircuitState::kOpen);
+    REQUIRE(pool.acquire(0, now + 15s) == 1);
+    pool.release(1, smtp::TransportStatus::kSent, 5ms, now + 15s);
+
+    REQUIRE(pool.acquire(0, now + 20s) == 0);
+    pool.release(0, smtp::TransportStatus::kSent, 1ms, now + 20s);
+    REQUIRE(pool.stats()[0].state == smtp::CircuitState::kClosed);
+    REQUIRE(pool.stats()[0].consecutive_failures == 0);
+  }
+
+  TEST_CASE("Sends fail over to every relay test") {
+    // Nothing listens on these ports, so each relay refuses the connection straight away
+    const std::vector<std::string_view> relays{"smtp://127.0.0.1:1", "smtp://127.0.0.1:2"};
+    smtp::RelayPool pool{relays};
+
+    smtp::MessageView message;
+    message.append("Subject: hi\r\n\r\nHello\r\n");
+    smtp::TransportParams params;
+    params.from = "from@example.com";
+    params.recipients = {"to@example.com", ""};
+
+    const smtp::TransportResult &result = pool.send(params, message);
+    REQUIRE(result.status == smtp::TransportStatus::kConnectFailed);
+    REQUIRE(result.recipients_done == 0);
+    for (const smtp::RelayStats &stats : pool.stats()) {
+      REQUIRE(stats.failures == 1);
+      REQUIRE(stats.in_flight == 0);
+    }
+  }
+
+  TEST_CASE("Invalid pools test") {
+    REQUIRE_THROWS_AS(smtp::RelayPool{{}}, smtp::RelayPoolException);
+    smtp::RelayOptions options;
+    options.latency_weight = 0.0;
+    REQUIRE_THROWS_AS(smtp::RelayPool(kRelays, options), smtp::RelayPoolException);
+  }
+}
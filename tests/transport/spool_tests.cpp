@@ -0,0 +1,208 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "doctest/doctest.h"
+
+#include "attachment/attachment.hpp"
+#include "email/email.hpp"
+#include "mock_smtp_server.hpp"
+#include "test_helpers.hpp"
+#include "transport/spool.hpp"
+
+// A spool file that is removed as soon as it is closed
+class SpoolFile {
+public:
+  SpoolFile() : m_file{std::tmpfile()} { REQUIRE(m_file != nullptr); }
+  ~SpoolFile() { std::fclose(m_file); }
+
+  int fd() const { return fileno(m_file); }
+
+  std::string contents() const {
+    std::string contents(static_cast<std::size_t>(lseek(fd(), 0, SEEK_END)), '\0');
+    REQUIRE(pread(fd(), contents.data(), contents.size(), 0) ==
+            static_cast<ssize_t>(contents.size()));
+    return contents;
+  }
+
+private:
+  std::FILE *m_file;
+};
+
+static smtp::TransportParams paramsFor(const bench::MockSmtpServer &server,
+                                       const std::vector<std::string_view> &recipients) {
+  return {"user", "password", server.url(), "tully@example.com", recipients};
+}
+
+TEST_SUITE("Spool tests") {
+  TEST_CASE("A spool file is dot-stuffed and terminated test") {
+    smtp::MessageView message;
+    message.append("Hello\r\n.hidden");
+    message.append("\r\n");
+    message.append(".");
+    message.append("start\r\nend");
+
+    SpoolFile spool;
+    const std::string &expected = "Hello\r\n..hidden\r\n..start\r\nend\r\n.\r\n";
+    const smtp::SpoolInfo &info = smtp::writeSpool(message, spool.fd());
+    REQUIRE(info.file_size == expected.size());
+    REQUIRE(info.message_size == message.size() + 2);
+    REQUIRE(spool.contents() == expected);
+  }
+
+  TEST_CASE("A spooled email arrives just like one sent through libcurl test") {
+    for (const bool tls : {false, true}) {
+      bench::MockServerOptions options;
+      options.tls = tls;
+      options.user = "user";
+      options.password = "password";
+      options.record = true;
+      const bench::MockSmtpServer server{options};
+
+      const smtp::EmailParams params{"user",
+                                     "password",
+                                     server.url(),
+                                     "bigboss@example.com",
+                                     "tully@example.com",
+                                     "",
+                                     "Report",
+                                     "Line one\r\n.Leading dot\r\n..Two dots\r\n",
+                                     &test::kFixedDateTime};
+      smtp::Email email{params};
+      smtp::Attachment attachment;
+      attachment.setContents(std::vector<uint8_t>(256 * 1024, 'a'));
+      attachment.setFilePath("/path/report.bin");
+      email.addAttachment(attachment);
+      REQUIRE(email.send().sent());
+
+      smtp::RenderedEmail rendered;
+      email.render(rendered);
+      SpoolFile spool;
+      const smtp::SpoolInfo &info = smtp::writeSpool(rendered.view(), spool.fd());
+
+      const smtp::TransportResult &result =
+          smtp::sendSpool(paramsFor(server, {"bigboss@example.com"}), spool.fd(), info);
+      REQUIRE(result.sent());
+      REQUIRE(result.response_code == 250);
+      if (tls) {
+        REQUIRE(result.payload != smtp::PayloadPath::kSendfile);
+      } else {
+        REQUIRE(result.payload == smtp::PayloadPath::kSendfile);
+      }
+
+      // Without kernel TLS the payload is copied through OpenSSL
+      const smtp::TransportResult &copied = smtp::sendSpool(
+          paramsFor(server, {"bigboss@example.com"}), spool.fd(), info, {/*kernel_tls=*/false});
+      REQUIRE(copied.sent());
+
+      const std::vector<std::string> &messages = server.messages();
+      REQUIRE(messages.size() == 3);
+      REQUIRE(messages[1] == messages[0]);
+      REQUIRE(messages[2] == messages[0]);
+      REQUIRE(server.stats().logins == 3);
+    }
+  }
+
+  TEST_CASE("Recipients are sent in batches over one connection test") {
+    bench::MockServerOptions options;
+    options.tls = true;
+    options.user = "user";
+    options.password = "password";
+    const bench::MockSmtpServer server{options};
+
+    SpoolFile spool;
+    smtp::MessageView message;
+    message.append("Subject: Batches\r\n\r\nHello\r\n");
+    const smtp::SpoolInfo &info = smtp::writeSpool(message, spool.fd());
+
+    smtp::TransportParams params =
+        paramsFor(server, {"a@example.com", "b@example.com", "c@example.com", "d@example.com",
+                           "e@example.com"});
+    params.max_recipients = 2;
+    const smtp::TransportResult &result = smtp::sendSpool(params, spool.fd(), info);
+    REQUIRE(result.sent());
+    REQUIRE(result.recipients_done == 5);
+
+    const bench::MockServerStats &stats = server.stats();
+    REQUIRE(stats.connections == 1);
+    REQUIRE(stats.messages == 3);
+    REQUIRE(stats.recipients == 5);
+  }
+
+  TEST_CASE("The size declared to the relay does not count the dot-stuffing test") {
+    SpoolFile spool;
+    smtp::MessageView message;
+    message.append("Subject: Dots\r\n\r\n.one\r\n.two\r\n.three\r\n");
+    const smtp::SpoolInfo &info = smtp::writeSpool(message, spool.fd());
+    REQUIRE(info.message_size == message.size());
+
+    // A message right at the limit of the relay is accepted, however many dots were added
+    bench::MockServerOptions options;
+    options.user = "user";
+    options.password = "password";
+    options.max_message_size = info.message_size;
+    const bench::MockSmtpServer server{options};
+    REQUIRE(smtp::sendSpool(paramsFor(server, {"a@example.com"}), spool.fd(), info).sent());
+  }
+
+  TEST_CASE("A relay that is slow to answer QUIT does not hold up the send test") {
+    bench::MockServerOptions options;
+    options.user = "user";
+    options.password = "password";
+    options.quit_delay = std::chrono::seconds{2};
+    const bench::MockSmtpServer server{options};
+
+    SpoolFile spool;
+    smtp::MessageView message;
+    message.append("Subject: Goodbye\r\n\r\nHello\r\n");
+    const smtp::SpoolInfo &info = smtp::writeSpool(message, spool.fd());
+
+    const auto &start = std::chrono::steady_clock::now();
+    const smtp::TransportResult &result =
+        smtp::sendSpool(paramsFor(server, {"a@example.com"}), spool.fd(), info);
+    REQUIRE(std::chrono::steady_clock::now() - start < options.quit_delay);
+    REQUIRE(result.sent());
+    REQUIRE(result.response_code == 250);
+  }
+
+  TEST_CASE("Failures are classified like sendMessage() test") {
+    bench::MockServerOptions options;
+    options.user = "user";
+    options.password = "password";
+    options.fault_stage = bench::FaultStage::kData;
+    options.fault_rate = 1.0;
+    const bench::MockSmtpServer server{options};
+
+    SpoolFile spool;
+    smtp::MessageView message;
+    message.append("Subject: Failures\r\n\r\nHello\r\n");
+    const smtp::SpoolInfo &info = smtp::writeSpool(message, spool.fd());
+
+    const smtp::TransportResult &refused =
+        smtp::sendSpool(paramsFor(server, {"a@example.com"}), spool.fd(), info);
+    REQUIRE(refused.status == smtp::TransportStatus::kTransientFailure);
+    REQUIRE(refused.response_code == 451);
+    REQUIRE(refused.retryable());
+
+    smtp::TransportParams wrong_password = paramsFor(server, {"a@example.com"});
+    wrong_password.password = "wrong";
+    const smtp::TransportResult &denied = smtp::sendSpool(wrong_password, spool.fd(), info);
+    REQUIRE(denied.status == smtp::TransportStatus::kPermanentFailure);
+    REQUIRE(denied.response_code == 535);
+
+    smtp::TransportParams unreachable = paramsFor(server, {"a@example.com"});
+    unreachable.hostname = "smtp://127.0.0.1:1";
+    REQUIRE(smtp::sendSpool(unreachable, spool.fd(), info).status ==
+            smtp::TransportStatus::kConnectFailed);
+
+    smtp::StopToken stop;
+    stop.requestStop();
+    smtp::TransportParams stopped = paramsFor(server, {"a@example.com"});
+    stopped.stop = &stop;
+    REQUIRE(smtp::sendSpool(stopped, spool.fd(), info).status ==
+            smtp::TransportStatus::kCancelled);
+  }
+}
@@ -0,0 +1,146 @@
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "doctest/doctest.h"
+
+#include "transport/transport.hpp"
+
+using namespace std::chrono_literals;
+
+// A server on a loopback port that accepts connections but never says anything, or that only
+// greets and answers EHLO, so that every send against it stalls
+class StalledServer {
+public:
+  explicit StalledServer(bool greet) {
+    m_socket = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    REQUIRE(bind(m_socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0);
+    REQUIRE(listen(m_socket, 4) == 0);
+    socklen_t size = sizeof(address);
+    getsockname(m_socket, reinterpret_cast<sockaddr *>(&address), &size);
+    m_url = "smtp://127.0.0.1:" + std::to_string(ntohs(address.sin_port));
+
+    if (greet) {
+      m_thread = std::thread{[this]() {
+        const int client = accept(m_socket, nullptr, nullptr);
+        if (client >= 0) {
+          m_client = client;
+          const std::string greeting = "220 stalled.example.com ESMTP\r\n";
+          const std::string ehlo = "250 stalled.example.com\r\n";
+          char buffer[512];
+          if (write(client, greeting.data(), greeting.size()) > 0 &&
+              read(client, buffer, sizeof(buffer)) > 0) {
+            (void)write(client, ehlo.data(), ehlo.size());
+          }
+        }
+      }};
+    }
+  }
+
+  ~StalledServer() {
+    shutdown(m_socket, SHUT_RDWR);
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+    if (m_client >= 0) {
+      close(m_client);
+    }
+    close(m_socket);
+  }
+
+  const std::string &url() const { return m_url; }
+
+private:
+  int m_socket = -1;
+  int m_client = -1;
+  std::string m_url;
+  std::thread m_thread;
+};
+
+static smtp::TransportParams stalledParams(const StalledServer &server) {
+  smtp::TransportParams params;
+  params.hostname = server.url();
+  params.from = "from@example.com";
+  params.recipients = {"to@example.com"};
+  return params;
+}
+
+static const smtp::MessageView &testMessage() {
+  static const smtp::MessageView message = []() {
+    smtp::MessageView view;
+    view.append("Subject: hi\r\n\r\nHello\r\n");
+    return view;
+  }();
+  return message;
+}
+
+TEST_SUITE("Transport tests") {
+  TEST_CASE("A relay that never greets times out while connecting test") {
+    const StalledServer server{false};
+    smtp::TransportParams params = stalledParams(server);
+    params.limits.connect_timeout = 200ms;
+
+    const auto start = std::chrono::steady_clock::now();
+    const smtp::TransportResult &result = smtp::sendMessage(params, testMessage());
+    REQUIRE(std::chrono::steady_clock::now() - start < 5s);
+    REQUIRE(result.status == smtp::TransportStatus::kTimedOut);
+    REQUIRE(result.timeout == smtp::TimeoutReason::kConnect);
+    REQUIRE(result.retryable());
+  }
+
+  TEST_CASE("The deadline bounds the whole send test") {
+    const StalledServer server{false};
+    smtp::TransportParams params = stalledParams(server);
+    params.limits.timeout = 200ms;
+
+    const auto start = std::chrono::steady_clock::now();
+    const smtp::TransportResult &result = smtp::sendMessage(params, testMessage());
+    REQUIRE(std::chrono::steady_clock::now() - start < 5s);
+    REQUIRE(result.status == smtp::TransportStatus::kTimedOut);
+    REQUIRE(result.timeout == smtp::TimeoutReason::kDeadline);
+    REQUIRE_FALSE(result.retryable());
+
+    // A deadline that has already passed does not even connect
+    params.deadline = std::chrono::steady_clock::now();
+    const smtp::TransportResult &expired = smtp::sendMessage(params, testMessage());
+    REQUIRE(expired.status == smtp::TransportStatus::kTimedOut);
+    REQUIRE(expired.timeout == smtp::TimeoutReason::kDeadline);
+  }
+
+  TEST_CASE("A relay that stops replying has stalled test") {
+    const StalledServer server{true};
+    smtp::TransportParams params = stalledParams(server);
+    params.limits.response_timeout = 1s;
+
+    const smtp::TransportResult &result = smtp::sendMessage(params, testMessage());
+    REQUIRE(result.status == smtp::TransportStatus::kTimedOut);
+    REQUIRE(result.timeout == smtp::TimeoutReason::kStalled);
+    REQUIRE(result.response_code == 250);
+  }
+
+  TEST_CASE("A send is cancelled from another thread test") {
+    const StalledServer server{false};
+    smtp::TransportParams params = stalledParams(server);
+    smtp::StopToken stop;
+    params.stop = &stop;
+
+    std::thread canceller{[&stop]() {
+      std::this_thread::sleep_for(100ms);
+      stop.requestStop();
+    }};
+    const auto start = std::chrono::steady_clock::now();
+    const smtp::TransportResult &result = smtp::sendMessage(params, testMessage());
+    canceller.join();
+    REQUIRE(std::chrono::steady_clock::now() - start < 5s);
+    REQUIRE(result.status == smtp::TransportStatus::kCancelled);
+    REQUIRE_FALSE(result.retryable());
+  }
+}
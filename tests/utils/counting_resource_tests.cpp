@@ -0,0 +1,76 @@
+#include <memory_resource>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "doctest/doctest.h"
+
+#include "utils/memory/counting_resource.hpp"
+
+TEST_SUITE("Counting resource tests") {
+  TEST_CASE("Allocations and bytes are counted test") {
+    smtp::CountingResource counter;
+    {
+      std::pmr::vector<char> first{&counter};
+      first.resize(1000);
+      std::pmr::vector<char> second{&counter};
+      second.resize(500);
+      REQUIRE(counter.inUse() == 1500);
+    }
+
+    const smtp::AllocationStats &stats = counter.stats();
+    REQUIRE(stats.allocations == 2);
+    REQUIRE(stats.bytes == 1500);
+    REQUIRE(stats.peak_bytes == 1500);
+    REQUIRE(counter.inUse() == 0);
+  }
+
+  TEST_CASE("A window only measures what happens inside of it test") {
+    smtp::CountingResource counter;
+    std::pmr::vector<char> kept{&counter};
+    kept.resize(4000);
+
+    const smtp::AllocationStats &start = counter.startWindow();
+    for (int i = 0; i < 3; i++) {
+      std::pmr::vector<char> temporary{&counter};
+      temporary.resize(100);
+    }
+
+    // The peak starts from what was already in use and the temporaries never overlapped
+    const smtp::AllocationStats &window = counter.windowStats(start);
+    REQUIRE(window.allocations == 3);
+    REQUIRE(window.bytes == 300);
+    REQUIRE(window.peak_bytes == 4100);
+  }
+
+  TEST_CASE("Allocations go to the upstream resource test") {
+    std::pmr::monotonic_buffer_resource arena;
+    smtp::CountingResource counter{&arena};
+    REQUIRE(counter.upstream() == &arena);
+
+    std::pmr::string text{"a string that is too long for the small string buffer", &counter};
+    REQUIRE(counter.stats().allocations == 1);
+    REQUIRE(counter.is_equal(counter));
+    REQUIRE_FALSE(counter.is_equal(arena));
+  }
+
+  TEST_CASE("Counts are kept across threads test") {
+    smtp::CountingResource counter;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+      threads.emplace_back([&counter]() {
+        for (int i = 0; i < 1000; i++) {
+          counter.deallocate(counter.allocate(16), 16);
+        }
+      });
+    }
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+
+    REQUIRE(counter.stats().allocations == 4000);
+    REQUIRE(counter.stats().bytes == 64000);
+    REQUIRE(counter.stats().peak_bytes <= 64);
+    REQUIRE(counter.inUse() == 0);
+  }
+}
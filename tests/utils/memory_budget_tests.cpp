@@ -0,0 +1,106 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "doctest/doctest.h"
+
+#include "utils/memory/memory_budget.hpp"
+
+using namespace std::chrono_literals;
+
+// Spins until the budget has the given number of callers waiting on it
+static void waitForWaiting(const smtp::MemoryBudget &budget, std::size_t waiting) {
+  while (budget.stats().waiting != waiting) {
+    std::this_thread::yield();
+  }
+}
+
+TEST_SUITE("Memory budget tests") {
+  TEST_CASE("Reservations are given back when they are released test") {
+    smtp::MemoryBudget budget{1000};
+    REQUIRE(budget.capacity() == 1000);
+
+    std::optional<smtp::MemoryReservation> first = budget.acquire(600);
+    REQUIRE(first.has_value());
+    REQUIRE(first->bytes() == 600);
+    REQUIRE(budget.stats().in_use == 600);
+    REQUIRE_FALSE(budget.tryAcquire(500).has_value());
+
+    {
+      std::optional<smtp::MemoryReservation> second = budget.tryAcquire(400);
+      REQUIRE(second.has_value());
+      REQUIRE(budget.stats().in_use == 1000);
+
+      // Moving a reservation does not give anything back
+      smtp::MemoryReservation moved = std::move(*second);
+      REQUIRE(budget.stats().in_use == 1000);
+      REQUIRE(moved.bytes() == 400);
+    }
+    REQUIRE(budget.stats().in_use == 600);
+
+    first->release();
+    first->release();
+    const smtp::MemoryBudgetStats &stats = budget.stats();
+    REQUIRE(stats.in_use == 0);
+    REQUIRE(stats.peak == 1000);
+    REQUIRE(stats.admitted == 2);
+    REQUIRE(stats.rejected == 1);
+
+    REQUIRE_THROWS_AS(budget.acquire(1001), smtp::MemoryBudgetException);
+    REQUIRE_THROWS_AS(smtp::MemoryBudget{0}, smtp::MemoryBudgetException);
+  }
+
+  TEST_CASE("Waiting callers are admitted in order as memory is released test") {
+    smtp::MemoryBudget budget{100};
+    std::optional<smtp::MemoryReservation> held = budget.acquire(50);
+
+    std::mutex mutex;
+    std::vector<smtp::MemoryReservation> admitted;
+    const auto &waiter = [&](std::size_t bytes) {
+      std::optional<smtp::MemoryReservation> reservation = budget.acquire(bytes);
+      std::lock_guard<std::mutex> lock{mutex};
+      admitted.push_back(std::move(*reservation));
+    };
+
+    // The small reservation would fit, but it may not overtake the large one in front of it
+    std::thread large{waiter, 80};
+    waitForWaiting(budget, 1);
+    std::thread small{waiter, 10};
+    waitForWaiting(budget, 2);
+    REQUIRE(budget.stats().in_use == 50);
+    REQUIRE_FALSE(budget.tryAcquire(1).has_value());
+
+    held->release();
+    large.join();
+    small.join();
+    REQUIRE(admitted.size() == 2);
+    REQUIRE(budget.stats().in_use == 90);
+    REQUIRE(budget.stats().waiting == 0);
+  }
+
+  TEST_CASE("Waiting gives up when it times out or is stopped test") {
+    smtp::MemoryBudget budget{100};
+    std::optional<smtp::MemoryReservation> held = budget.acquire(100);
+
+    const auto &start = std::chrono::steady_clock::now();
+    REQUIRE_FALSE(budget.acquire(50, 50ms).has_value());
+    REQUIRE(std::chrono::steady_clock::now() - start >= 50ms);
+
+    std::atomic<bool> stop{false};
+    std::thread stopper{[&]() {
+      waitForWaiting(budget, 1);
+      stop = true;
+    }};
+    REQUIRE_FALSE(budget.acquire(50, 0ms, [&stop]() { return stop.load(); }).has_value());
+    stopper.join();
+
+    const smtp::MemoryBudgetStats &stats = budget.stats();
+    REQUIRE(stats.rejected == 2);
+    REQUIRE(stats.waiting == 0);
+    REQUIRE(stats.in_use == 100);
+  }
+}
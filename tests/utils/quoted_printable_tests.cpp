@@ -0,0 +1,80 @@
+#include <string>
+#include <string_view>
+
+#include "doctest/doctest.h"
+
+#include "utils/quoted_printable/quoted_printable.hpp"
+
+using QuotedPrintable = smtp::QuotedPrintable;
+using Mode = smtp::QuotedPrintable::Mode;
+using namespace std::string_view_literals;
+
+static std::string encode(std::string_view data, Mode mode) {
+  const std::pmr::string &encoded = QuotedPrintable::Encode(data, mode);
+  REQUIRE(QuotedPrintable::EncodedSize(data, mode) == encoded.size());
+  return std::string{encoded};
+}
+
+TEST_SUITE("Quoted printable tests") {
+  TEST_CASE("Plain text is unchanged test") {
+    REQUIRE(encode("", Mode::kText) == "");
+    REQUIRE(encode("Hello, world!", Mode::kText) == "Hello, world!");
+    REQUIRE(encode("line one\r\nline two", Mode::kText) == "line one\r\nline two");
+  }
+
+  TEST_CASE("Special characters are escaped test") {
+    REQUIRE(encode("a=b", Mode::kText) == "a=3Db");
+    REQUIRE(encode("Caf\xc3\xa9", Mode::kText) == "Caf=C3=A9");
+    REQUIRE(encode(std::string{"nul\0byte", 8}, Mode::kText) == "nul=00byte");
+    REQUIRE(encode("\x7f", Mode::kText) == "=7F");
+  }
+
+  TEST_CASE("Whitespace at the end of a line is escaped test") {
+    REQUIRE(encode("trailing \r\nspace ", Mode::kText) == "trailing=20\r\nspace=20");
+    REQUIRE(encode("tab\t\nin\tthe middle", Mode::kText) == "tab=09\r\nin\tthe middle");
+    REQUIRE(encode("two  \n", Mode::kText) == "two =20\r\n");
+  }
+
+  TEST_CASE("Line breaks in text and binary mode test") {
+    REQUIRE(encode("a\nb\rc\r\nd", Mode::kText) == "a\r\nb\r\nc\r\nd");
+    REQUIRE(encode("a\nb\rc\r\nd", Mode::kBinary) == "a=0Ab=0Dc\r\nd");
+  }
+
+  TEST_CASE("Long lines are broken at 76 characters test") {
+    const std::string &line = std::string(200, 'x');
+    const std::string &encoded = encode(line, Mode::kText);
+    REQUIRE(encoded == std::string(75, 'x') + "=\r\n" + std::string(75, 'x') + "=\r\n" +
+                           std::string(50, 'x'));
+
+    // An escape sequence is never split over two lines
+    const std::string &escapes = std::string(74, 'x') + "==";
+    REQUIRE(encode(escapes, Mode::kText) == std::string(74, 'x') + "=\r\n=3D=3D");
+
+    // Every line of a long mixed input stays within the limit
+    std::string mixed;
+    for (int i = 0; i < 1000; i++) {
+      mixed += static_cast<char>(i % 256);
+    }
+    const std::string &mixed_encoded = encode(mixed, Mode::kBinary);
+    std::size_t line_start = 0;
+    for (std::size_t pos = mixed_encoded.find("\r\n"); pos != std::string::npos;
+         pos = mixed_encoded.find("\r\n", line_start)) {
+      REQUIRE(pos - line_start <= QuotedPrintable::kMaxLineLength);
+      line_start = pos + 2;
+    }
+  }
+
+  TEST_CASE("Decoding reverses encoding test") {
+    const std::string text = "Caf\xc3\xa9 a=b\ttrailing \r\n" + std::string(200, 'x') + "\r\nend";
+    REQUIRE(QuotedPrintable::Decode(encode(text, Mode::kText)) == text);
+
+    const std::string binary{"nul\0\nbare\rbreaks\r\n"sv};
+    REQUIRE(QuotedPrintable::Decode(encode(binary, Mode::kBinary)) == binary);
+  }
+
+  TEST_CASE("Decoding is lenient test") {
+    REQUIRE(QuotedPrintable::Decode("a=3db=\r\nc") == "a=bc");
+    REQUIRE(QuotedPrintable::Decode("trailing  \nspace\t=") == "trailing\r\nspace\t");
+    REQUIRE(QuotedPrintable::Decode("bad =ZZ and =4") == "bad =ZZ and =4");
+  }
+}
@@ -0,0 +1,87 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "doctest/doctest.h"
+
+#include "transport/credentials.hpp"
+#include "utils/memory/secure_pool.hpp"
+#include "utils/secure_strings.hpp"
+
+static bool isWiped(const void *ptr, std::size_t bytes) {
+  const unsigned char *mem = static_cast<const unsigned char *>(ptr);
+  for (std::size_t i = 0; i < bytes; i++) {
+    if (mem[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TEST_SUITE("Secure pool tests") {
+  TEST_CASE("Freed blocks are wiped and reused by their size class test") {
+    smtp::SecurePool pool{4096};
+    REQUIRE(pool.capacity() == 4096);
+
+    void *first = pool.allocate(20);
+    REQUIRE(pool.owns(first));
+    REQUIRE(pool.inUse() == 32);
+    std::memset(first, 'x', 20);
+
+    pool.deallocate(first, 20);
+    REQUIRE(pool.inUse() == 0);
+    REQUIRE(isWiped(first, 32));
+
+    // Any size in the same class gets the block back, a different class does not
+    void *second = pool.allocate(17);
+    REQUIRE(second == first);
+    void *third = pool.allocate(100);
+    REQUIRE(third != first);
+    REQUIRE(pool.owns(third));
+    REQUIRE(pool.inUse() == 32 + 128);
+
+    pool.deallocate(second, 17);
+    pool.deallocate(third, 100);
+    REQUIRE(pool.inUse() == 0);
+  }
+
+  TEST_CASE("Large and overflowing allocations fall back to the heap test") {
+    smtp::SecurePool pool{64};
+
+    void *large = pool.allocate(smtp::SecurePool::kMaxBlockSize + 1);
+    REQUIRE(large != nullptr);
+    REQUIRE_FALSE(pool.owns(large));
+    pool.deallocate(large, smtp::SecurePool::kMaxBlockSize + 1);
+
+    void *first = pool.allocate(64);
+    void *overflow = pool.allocate(64);
+    REQUIRE(pool.owns(first));
+    REQUIRE_FALSE(pool.owns(overflow));
+    pool.deallocate(overflow, 64);
+    pool.deallocate(first, 64);
+  }
+
+  TEST_CASE("The whole allocation of a wide type is wiped test") {
+    using SecureWords = std::vector<std::uint32_t, smtp::SecureAllocator<std::uint32_t>>;
+    SecureWords *words = new SecureWords(100, 0xdeadbeef);
+    const void *ptr = words->data();
+    REQUIRE(smtp::SecurePool::instance().owns(ptr));
+
+    delete words;
+
+    // The memory stays in the pool, so it can be read after it is freed
+    REQUIRE(isWiped(ptr, 100 * sizeof(std::uint32_t)));
+  }
+
+  TEST_CASE("Short secrets are kept in the pool too test") {
+    const std::shared_ptr<const smtp::Credentials> &credentials =
+        smtp::Credentials::make("user", "hunter2", "smtps://smtp.example.com:465");
+    REQUIRE(credentials->user() == "user");
+    REQUIRE(credentials->password() == "hunter2");
+    REQUIRE(credentials->hostname() == "smtps://smtp.example.com:465");
+
+    // The password is short enough to be stored inside of the string object
+    REQUIRE(smtp::SecurePool::instance().owns(credentials->password().data()));
+  }
+}
@@ -0,0 +1,33 @@
+#include <string>
+
+#include "doctest/doctest.h"
+
+#include "utils/simd/substring.hpp"
+
+TEST_SUITE("Substring tests") {
+  TEST_CASE("Finds a needle at every offset test") {
+    const std::string &needle = "--boundary";
+
+    // Covers matches inside of the vectorised blocks, across block edges and in the scalar tail
+    for (std::size_t offset = 0; offset < 70; offset++) {
+      std::string haystack(80, '-');
+      haystack.replace(offset, needle.size(), needle);
+      haystack.resize(std::max(haystack.size(), offset + needle.size()));
+      REQUIRE(smtp::containsSubstring(haystack, needle));
+    }
+  }
+
+  TEST_CASE("Near misses are not matches test") {
+    // The first and last characters match everywhere but the middle never does
+    const std::string haystack(4096, 'a');
+    REQUIRE_FALSE(smtp::containsSubstring(haystack, "abba"));
+    REQUIRE(smtp::containsSubstring(haystack + "abba", "abba"));
+  }
+
+  TEST_CASE("Edge cases test") {
+    REQUIRE(smtp::containsSubstring("anything", ""));
+    REQUIRE_FALSE(smtp::containsSubstring("", "a"));
+    REQUIRE_FALSE(smtp::containsSubstring("short", "much longer needle"));
+    REQUIRE(smtp::containsSubstring("x", "x"));
+  }
+}